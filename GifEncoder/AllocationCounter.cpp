@@ -0,0 +1,49 @@
+#include "pch.h"
+#include "AllocationCounter.h"
+
+#ifdef GIFENCODER_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> g_allocationCount{ 0 };
+}
+
+// The array and nothrow forms call these, so only the plain ones need
+// replacing. Aligned allocations aren't counted.
+void* operator new(size_t size)
+{
+    g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto data = std::malloc(size > 0 ? size : 1))
+    {
+        return data;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* data) noexcept
+{
+    std::free(data);
+}
+
+void operator delete(void* data, size_t) noexcept
+{
+    std::free(data);
+}
+
+uint64_t GetAllocationCount()
+{
+    return g_allocationCount.load(std::memory_order_relaxed);
+}
+
+#else
+
+uint64_t GetAllocationCount()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+// Debug builds replace the global operator new so that every heap
+// allocation, from any thread, is counted. Used to check that the frame
+// loop stops allocating once it has warmed up. Define
+// GIFENCODER_COUNT_ALLOCATIONS to count in other builds too.
+#if defined(_DEBUG) && !defined(GIFENCODER_COUNT_ALLOCATIONS)
+#define GIFENCODER_COUNT_ALLOCATIONS
+#endif
+
+constexpr bool IsAllocationCountingEnabled()
+{
+#ifdef GIFENCODER_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Always zero when counting is disabled
+uint64_t GetAllocationCount();
@@ -0,0 +1,203 @@
+#include "pch.h"
+#include "AlphaBlend.h"
+
+namespace
+{
+    // x / 255, rounded, for x up to 255 * 255
+    inline uint32_t DivideBy255(uint32_t value)
+    {
+        value += 128;
+        return (value + (value >> 8)) >> 8;
+    }
+
+    inline uint32_t BlendPixel(uint32_t destination, uint32_t source, uint32_t weight)
+    {
+        auto sourceAlpha = ((source >> 24) * weight + 128) >> 8;
+        auto inverseAlpha = 255 - sourceAlpha;
+        uint32_t result = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8)
+        {
+            auto sourceChannel = (((source >> shift) & 0xFF) * weight + 128) >> 8;
+            auto destinationChannel = DivideBy255(((destination >> shift) & 0xFF) * inverseAlpha);
+            result |= (sourceChannel + destinationChannel) << shift;
+        }
+        return result;
+    }
+
+    void BlendRowTail(uint32_t* destination, uint32_t const* source, uint32_t start, uint32_t width, uint32_t weight)
+    {
+        for (auto x = start; x < width; x++)
+        {
+            destination[x] = BlendPixel(destination[x], source[x], weight);
+        }
+    }
+
+    void BlendRowScalar(uint32_t* destination, uint32_t const* source, uint32_t width, uint32_t weight)
+    {
+        if (weight == OpaqueBlendWeight)
+        {
+            // Most layers are mostly opaque or mostly empty
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto alpha = source[x] >> 24;
+                if (alpha == 255)
+                {
+                    destination[x] = source[x];
+                }
+                else if (alpha != 0)
+                {
+                    destination[x] = BlendPixel(destination[x], source[x], weight);
+                }
+            }
+        }
+        else
+        {
+            BlendRowTail(destination, source, 0, width, weight);
+        }
+    }
+
+#if defined(GIFENCODER_X86)
+    // Blends two pixels held as 16 bit channels
+    inline __m128i BlendPixelsSse2(__m128i destination, __m128i source, __m128i weight)
+    {
+        const auto round = _mm_set1_epi16(128);
+        const auto max = _mm_set1_epi16(255);
+        auto scaled = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(source, weight), round), 8);
+        auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(scaled, 0xFF), 0xFF);
+        auto product = _mm_add_epi16(_mm_mullo_epi16(destination, _mm_sub_epi16(max, alpha)), round);
+        product = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+        return _mm_add_epi16(scaled, product);
+    }
+
+    void BlendRowSse2(uint32_t* destination, uint32_t const* source, uint32_t width, uint32_t weight)
+    {
+        const auto zero = _mm_setzero_si128();
+        const auto weights = _mm_set1_epi16(static_cast<short>(weight));
+        const auto alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        auto opaque = weight == OpaqueBlendWeight;
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto src = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + x));
+            if (opaque)
+            {
+                // Skip the math for fully transparent and fully opaque blocks
+                auto alphaBits = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(src, alphaMask), alphaMask));
+                if (alphaBits == 0xFFFF)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), src);
+                    continue;
+                }
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(src, alphaMask), zero)) == 0xFFFF)
+                {
+                    continue;
+                }
+            }
+            auto dst = _mm_loadu_si128(reinterpret_cast<__m128i const*>(destination + x));
+            auto low = BlendPixelsSse2(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(src, zero), weights);
+            auto high = BlendPixelsSse2(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(src, zero), weights);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(low, high));
+        }
+        BlendRowTail(destination, source, x, width, weight);
+    }
+
+    GIFENCODER_TARGET_AVX2 inline __m256i BlendPixelsAvx2(__m256i destination, __m256i source, __m256i weight)
+    {
+        const auto round = _mm256_set1_epi16(128);
+        const auto max = _mm256_set1_epi16(255);
+        auto scaled = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(source, weight), round), 8);
+        auto alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(scaled, 0xFF), 0xFF);
+        auto product = _mm256_add_epi16(_mm256_mullo_epi16(destination, _mm256_sub_epi16(max, alpha)), round);
+        product = _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+        return _mm256_add_epi16(scaled, product);
+    }
+
+    GIFENCODER_TARGET_AVX2 void BlendRowAvx2(uint32_t* destination, uint32_t const* source, uint32_t width, uint32_t weight)
+    {
+        const auto zero = _mm256_setzero_si256();
+        const auto weights = _mm256_set1_epi16(static_cast<short>(weight));
+        const auto alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+        auto opaque = weight == OpaqueBlendWeight;
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto src = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + x));
+            if (opaque)
+            {
+                auto alpha = _mm256_and_si256(src, alphaMask);
+                if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(alpha, alphaMask))) == 0xFFFFFFFF)
+                {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x), src);
+                    continue;
+                }
+                if (_mm256_testz_si256(src, alphaMask))
+                {
+                    continue;
+                }
+            }
+            // Unpacking works within 128 bit lanes, and so does packing,
+            // so the pixels end up back where they started.
+            auto dst = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(destination + x));
+            auto low = BlendPixelsAvx2(_mm256_unpacklo_epi8(dst, zero), _mm256_unpacklo_epi8(src, zero), weights);
+            auto high = BlendPixelsAvx2(_mm256_unpackhi_epi8(dst, zero), _mm256_unpackhi_epi8(src, zero), weights);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x), _mm256_packus_epi16(low, high));
+        }
+        BlendRowTail(destination, source, x, width, weight);
+    }
+#endif
+
+#if defined(GIFENCODER_NEON)
+    inline uint16x8_t BlendPixelsNeon(uint16x8_t destination, uint16x8_t source, uint16x8_t weight)
+    {
+        const auto round = vdupq_n_u16(128);
+        auto scaled = vshrq_n_u16(vaddq_u16(vmulq_u16(source, weight), round), 8);
+        // Broadcast the alpha of each pixel (lanes 3 and 7)
+        auto alpha = vcombine_u16(vdup_lane_u16(vget_low_u16(scaled), 3), vdup_lane_u16(vget_high_u16(scaled), 3));
+        auto product = vaddq_u16(vmulq_u16(destination, vsubq_u16(vdupq_n_u16(255), alpha)), round);
+        product = vshrq_n_u16(vaddq_u16(product, vshrq_n_u16(product, 8)), 8);
+        return vaddq_u16(scaled, product);
+    }
+
+    void BlendRowNeon(uint32_t* destination, uint32_t const* source, uint32_t width, uint32_t weight)
+    {
+        const auto weights = vdupq_n_u16(static_cast<uint16_t>(weight));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto src = vreinterpretq_u8_u32(vld1q_u32(source + x));
+            auto dst = vreinterpretq_u8_u32(vld1q_u32(destination + x));
+            auto low = BlendPixelsNeon(vmovl_u8(vget_low_u8(dst)), vmovl_u8(vget_low_u8(src)), weights);
+            auto high = BlendPixelsNeon(vmovl_u8(vget_high_u8(dst)), vmovl_u8(vget_high_u8(src)), weights);
+            auto result = vcombine_u8(vmovn_u16(low), vmovn_u16(high));
+            vst1q_u32(destination + x, vreinterpretq_u32_u8(result));
+        }
+        BlendRowTail(destination, source, x, width, weight);
+    }
+#endif
+}
+
+BlendRowKernel GetBlendRowKernel(SimdLevel level)
+{
+    if (!IsSimdLevelSupported(level))
+    {
+        return nullptr;
+    }
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return BlendRowScalar;
+#if defined(GIFENCODER_X86)
+    case SimdLevel::Sse2:
+    case SimdLevel::Sse41:
+        return BlendRowSse2;
+    case SimdLevel::Avx2:
+        return BlendRowAvx2;
+#endif
+#if defined(GIFENCODER_NEON)
+    case SimdLevel::Neon:
+        return BlendRowNeon;
+#endif
+    default:
+        return nullptr;
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include "CpuFeatures.h"
+
+// Opacities are fixed point, 256 is fully opaque.
+const uint32_t OpaqueBlendWeight = 256;
+
+inline uint32_t OpacityToBlendWeight(float opacity)
+{
+    if (!(opacity > 0.0f))
+    {
+        return 0;
+    }
+    if (opacity >= 1.0f)
+    {
+        return OpaqueBlendWeight;
+    }
+    return static_cast<uint32_t>(opacity * OpaqueBlendWeight + 0.5f);
+}
+
+// Converts a straight alpha 0xAARRGGBB color to premultiplied alpha.
+inline uint32_t PremultiplyColor(uint32_t color)
+{
+    auto alpha = color >> 24;
+    auto premultiply = [alpha](uint32_t channel)
+    {
+        auto value = channel * alpha + 128;
+        return (value + (value >> 8)) >> 8;
+    };
+    return (alpha << 24) |
+        (premultiply((color >> 16) & 0xFF) << 16) |
+        (premultiply((color >> 8) & 0xFF) << 8) |
+        premultiply(color & 0xFF);
+}
+
+// Draws a row of premultiplied BGRA pixels over another with the given
+// weight, the same way ID2D1DeviceContext::DrawBitmap does with an
+// opacity: dst = src * weight + dst * (1 - srcAlpha * weight). Every
+// kernel produces identical results for premultiplied input.
+typedef void (*BlendRowKernel)(
+    uint32_t* destination,
+    uint32_t const* source,
+    uint32_t width,
+    uint32_t weight);
+
+// Returns nullptr if the given level isn't supported by this build.
+BlendRowKernel GetBlendRowKernel(SimdLevel level);
@@ -0,0 +1,276 @@
+#include "pch.h"
+#include "Base64.h"
+
+namespace
+{
+    const uint8_t InvalidValue = 0xFF;
+    const uint8_t WhitespaceValue = 0xFE;
+    const uint8_t PaddingValue = 0xFD;
+
+    struct DecodeTable
+    {
+        uint8_t Values[256];
+
+        DecodeTable()
+        {
+            for (auto&& value : Values)
+            {
+                value = InvalidValue;
+            }
+            const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            for (uint8_t i = 0; i < 64; i++)
+            {
+                Values[static_cast<uint8_t>(alphabet[i])] = i;
+            }
+            Values[' '] = WhitespaceValue;
+            Values['\t'] = WhitespaceValue;
+            Values['\r'] = WhitespaceValue;
+            Values['\n'] = WhitespaceValue;
+            Values['='] = PaddingValue;
+        }
+    };
+
+    const DecodeTable Table;
+
+    struct DecodeState
+    {
+        uint32_t Accumulator = 0;
+        uint32_t NumValues = 0;
+        bool ReachedPadding = false;
+    };
+
+    // Consumes characters until a group of four values has been written,
+    // the input runs out or padding is reached. SIMD kernels fall back to
+    // this for anything their blocks can't handle, then pick up again at
+    // the next group.
+    inline void DecodeGroupScalar(char const* input, size_t length, size_t& position, uint8_t*& output, DecodeState& state)
+    {
+        while (position < length)
+        {
+            auto value = Table.Values[static_cast<uint8_t>(input[position++])];
+            if (value < 64)
+            {
+                state.Accumulator = (state.Accumulator << 6) | value;
+                if (++state.NumValues == 4)
+                {
+                    output[0] = static_cast<uint8_t>(state.Accumulator >> 16);
+                    output[1] = static_cast<uint8_t>(state.Accumulator >> 8);
+                    output[2] = static_cast<uint8_t>(state.Accumulator);
+                    output += 3;
+                    state.Accumulator = 0;
+                    state.NumValues = 0;
+                    return;
+                }
+            }
+            else if (value == PaddingValue)
+            {
+                state.ReachedPadding = true;
+                return;
+            }
+            else if (value != WhitespaceValue)
+            {
+                throw std::invalid_argument("Invalid base64 character.");
+            }
+        }
+    }
+
+    // Writes out a partial group
+    inline uint8_t* FinishDecode(DecodeState const& state, uint8_t* output)
+    {
+        switch (state.NumValues)
+        {
+        case 0:
+            break;
+        case 2:
+            *output++ = static_cast<uint8_t>(state.Accumulator >> 4);
+            break;
+        case 3:
+            *output++ = static_cast<uint8_t>(state.Accumulator >> 10);
+            *output++ = static_cast<uint8_t>(state.Accumulator >> 2);
+            break;
+        default:
+            throw std::invalid_argument("Truncated base64 data.");
+        }
+        return output;
+    }
+
+    size_t DecodeBase64Scalar(char const* input, size_t length, uint8_t* output)
+    {
+        DecodeState state;
+        auto current = output;
+        size_t position = 0;
+        while (position < length && !state.ReachedPadding)
+        {
+            DecodeGroupScalar(input, length, position, current, state);
+        }
+        return static_cast<size_t>(FinishDecode(state, current) - output);
+    }
+
+#if defined(GIFENCODER_X86)
+    // The SIMD kernels are based on the nibble lookup approach described
+    // by Wojciech Muła and used in Alfred Klomp's base64 library. Each
+    // character is classified by its low and high nibble with pshufb; any
+    // character outside of the alphabet (including whitespace and padding)
+    // makes the block fall back to the scalar path. Valid characters are
+    // turned into 6 bit values by adding an offset picked by the high
+    // nibble, then packed with multiply-adds.
+
+    // Blocks store a whole register but only produce 3/4 of it, so they
+    // only run while the output is guaranteed to have room for the store.
+    GIFENCODER_TARGET_SSE41 size_t DecodeBase64Sse41(char const* input, size_t length, uint8_t* output)
+    {
+        const auto lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const auto lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const auto lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const auto mask2F = _mm_set1_epi8(0x2F);
+        const auto mergePairs = _mm_set1_epi32(0x01400140);
+        const auto mergeQuads = _mm_set1_epi32(0x00011000);
+        const auto packBytes = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        DecodeState state;
+        auto current = output;
+        size_t position = 0;
+        while (position < length && !state.ReachedPadding)
+        {
+            while (length - position >= 24)
+            {
+                auto characters = _mm_loadu_si128(reinterpret_cast<__m128i const*>(input + position));
+                auto hiNibbles = _mm_and_si128(_mm_srli_epi32(characters, 4), mask2F);
+                auto loNibbles = _mm_and_si128(characters, mask2F);
+                auto hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+                auto lo = _mm_shuffle_epi8(lutLo, loNibbles);
+                if (!_mm_testz_si128(lo, hi))
+                {
+                    break;
+                }
+                auto isSlash = _mm_cmpeq_epi8(characters, mask2F);
+                auto roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(isSlash, hiNibbles));
+                auto values = _mm_add_epi8(characters, roll);
+                auto merged = _mm_madd_epi16(_mm_maddubs_epi16(values, mergePairs), mergeQuads);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(current), _mm_shuffle_epi8(merged, packBytes));
+                position += 16;
+                current += 12;
+            }
+            DecodeGroupScalar(input, length, position, current, state);
+        }
+        return static_cast<size_t>(FinishDecode(state, current) - output);
+    }
+
+    GIFENCODER_TARGET_AVX2 size_t DecodeBase64Avx2(char const* input, size_t length, uint8_t* output)
+    {
+        const auto lutLo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const auto lutHi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const auto lutRoll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const auto mask2F = _mm256_set1_epi8(0x2F);
+        const auto mergePairs = _mm256_set1_epi32(0x01400140);
+        const auto mergeQuads = _mm256_set1_epi32(0x00011000);
+        const auto packBytes = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        // Moves the 12 bytes of the upper lane next to the lower lane's
+        const auto packLanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+        DecodeState state;
+        auto current = output;
+        size_t position = 0;
+        while (position < length && !state.ReachedPadding)
+        {
+            while (length - position >= 48)
+            {
+                auto characters = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(input + position));
+                auto hiNibbles = _mm256_and_si256(_mm256_srli_epi32(characters, 4), mask2F);
+                auto loNibbles = _mm256_and_si256(characters, mask2F);
+                auto hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+                auto lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+                if (!_mm256_testz_si256(lo, hi))
+                {
+                    break;
+                }
+                auto isSlash = _mm256_cmpeq_epi8(characters, mask2F);
+                auto roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNibbles));
+                auto values = _mm256_add_epi8(characters, roll);
+                auto merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, mergePairs), mergeQuads);
+                auto packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, packBytes), packLanes);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(current), packed);
+                position += 32;
+                current += 24;
+            }
+            DecodeGroupScalar(input, length, position, current, state);
+        }
+        return static_cast<size_t>(FinishDecode(state, current) - output);
+    }
+#endif
+}
+
+Base64DecodeKernel GetBase64DecodeKernel(SimdLevel level)
+{
+    if (!IsSimdLevelSupported(level))
+    {
+        return nullptr;
+    }
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return DecodeBase64Scalar;
+#if defined(GIFENCODER_X86)
+    case SimdLevel::Sse41:
+        return DecodeBase64Sse41;
+    case SimdLevel::Avx2:
+        return DecodeBase64Avx2;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+size_t DecodeBase64(char const* input, size_t length, uint8_t* output)
+{
+    static const Base64DecodeKernel kernel = []()
+    {
+        const SimdLevel candidates[] = { SimdLevel::Avx2, SimdLevel::Sse41 };
+        for (auto&& candidate : candidates)
+        {
+            if (auto kernel = GetBase64DecodeKernel(candidate))
+            {
+                return kernel;
+            }
+        }
+        return GetBase64DecodeKernel(SimdLevel::Scalar);
+    }();
+    return kernel(input, length, output);
+}
+
+std::string EncodeBase64(uint8_t const* data, size_t size, size_t lineLength)
+{
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve(((size + 2) / 3) * 4 * 79 / 76);
+    size_t column = 0;
+    auto push = [&](char c)
+    {
+        result.push_back(c);
+        if (lineLength > 0 && ++column == lineLength)
+        {
+            result.append("\r\n");
+            column = 0;
+        }
+    };
+    for (size_t i = 0; i < size; i += 3)
+    {
+        auto remaining = size - i;
+        uint32_t value = data[i] << 16;
+        if (remaining > 1) value |= data[i + 1] << 8;
+        if (remaining > 2) value |= data[i + 2];
+        push(alphabet[(value >> 18) & 0x3F]);
+        push(alphabet[(value >> 12) & 0x3F]);
+        push(remaining > 1 ? alphabet[(value >> 6) & 0x3F] : '=');
+        push(remaining > 2 ? alphabet[value & 0x3F] : '=');
+    }
+    return result;
+}
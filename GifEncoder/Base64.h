@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "CpuFeatures.h"
+
+// An upper bound on the number of bytes DecodeBase64 writes.
+inline size_t GetMaxDecodedBase64Size(size_t length)
+{
+    return ((length + 3) / 4) * 3;
+}
+
+// Decodes standard (RFC 4648) base64. Whitespace is skipped so text from
+// an XML element can be passed in as is, and decoding stops at the first
+// padding character. Throws std::invalid_argument on any other character
+// outside of the alphabet. The output must have room for
+// GetMaxDecodedBase64Size(length) bytes. Returns the number of bytes
+// written.
+typedef size_t (*Base64DecodeKernel)(char const* input, size_t length, uint8_t* output);
+
+// Returns nullptr if the given level isn't supported by this build.
+Base64DecodeKernel GetBase64DecodeKernel(SimdLevel level);
+
+// Uses the fastest kernel for this machine.
+size_t DecodeBase64(char const* input, size_t length, uint8_t* output);
+
+// Encodes standard (RFC 4648) base64 with padding. When lineLength isn't
+// zero, lines are wrapped the same way .NET's Convert.ToBase64String does
+// with InsertLineBreaks when lineLength is 76.
+std::string EncodeBase64(uint8_t const* data, size_t size, size_t lineLength = 0);
@@ -0,0 +1,1209 @@
+#include "pch.h"
+#include "Benchmarks.h"
+#include "GifWriter.h"
+#include "LzwDecoder.h"
+#include "ParallelGifWriter.h"
+#include "CpuTransparencyFixer.h"
+#include "TransparencyFixer.h"
+#include "PaletteQuantizer.h"
+#include "PaletteMapper.h"
+#include "Color.h"
+#include "Base64.h"
+#include "BufferPool.h"
+#include "AlphaBlend.h"
+#include "EncodeStats.h"
+#include "RaniFormat.h"
+#include "RaniCompositor.h"
+#include "SyntheticAnimation.h"
+#include "RowBandPool.h"
+#include "ParallelPalettizer.h"
+#include "Dither.h"
+#include "FrameEncoder.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+    using namespace robmikh::common::desktop;
+}
+
+namespace
+{
+    enum class IndexPattern
+    {
+        // Every pixel is random, the worst case for LZW
+        Noise,
+        // Long horizontal runs that change slowly from row to row
+        Gradient,
+        // A delta frame that is mostly the transparent index
+        SparseDelta,
+        // A delta frame where a few blocks changed and the rest is the
+        // transparent index
+        BlockDelta,
+    };
+
+    std::vector<uint8_t> GenerateIndices(IndexPattern pattern, uint32_t width, uint32_t height, uint32_t numColors)
+    {
+        // Use a fixed seed and raw engine output so results are
+        // reproducible across standard library implementations.
+        std::mt19937 random(1234);
+        std::vector<uint8_t> indices(static_cast<size_t>(width) * height, 0);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = indices.data() + (static_cast<size_t>(y) * width);
+            for (uint32_t x = 0; x < width; x++)
+            {
+                uint32_t value = 0;
+                switch (pattern)
+                {
+                case IndexPattern::Noise:
+                    value = random() % numColors;
+                    break;
+                case IndexPattern::Gradient:
+                    value = ((x / 64) + (y / 8)) % numColors;
+                    break;
+                case IndexPattern::SparseDelta:
+                    value = (random() % 64) == 0 ? random() % numColors : 0;
+                    break;
+                case IndexPattern::BlockDelta:
+                    value = ((x / 96) % 7 == 3 && (y / 96) % 5 == 2) ? random() % numColors : 0;
+                    break;
+                }
+                row[x] = static_cast<uint8_t>(value);
+            }
+        }
+        return indices;
+    }
+
+    // Generates a BGRA frame made of large flat blocks of color, with a
+    // rectangle of noise in the middle that changes with the seed.
+    std::vector<uint32_t> GenerateBgraFrame(uint32_t width, uint32_t height, uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint32_t> pixels(static_cast<size_t>(width) * height, 0);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                uint32_t color = 0xFF000000 | (((x / 128) * 0x203040) + ((y / 128) * 0x102030));
+                if (x >= width / 4 && x < (width * 3) / 4 && y >= height / 3 && y < (height * 2) / 3)
+                {
+                    color = 0xFF000000 | (random() & 0x00FFFFFF);
+                }
+                pixels[(static_cast<size_t>(y) * width) + x] = color;
+            }
+        }
+        return pixels;
+    }
+
+    template <typename Func>
+    double MeasureAverageMilliseconds(uint32_t iterations, Func const& func)
+    {
+        // Warm up
+        func();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            func();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto total = std::chrono::duration<double, std::milli>(end - start).count();
+        return total / iterations;
+    }
+
+    void PrintThroughput(std::wstring const& name, double milliseconds, size_t inputBytes, size_t outputBytes)
+    {
+        auto megabytes = static_cast<double>(inputBytes) / (1024.0 * 1024.0);
+        auto megabytesPerSecond = megabytes / (milliseconds / 1000.0);
+        wprintf(L"  %-40ls %10.3f ms %10.2f MB/s %12zu bytes\n", name.c_str(), milliseconds, megabytesPerSecond, outputBytes);
+    }
+
+    void PrintFrameThroughput(std::wstring const& name, double milliseconds, size_t inputBytes, uint32_t numFrames)
+    {
+        auto megabytes = static_cast<double>(inputBytes) / (1024.0 * 1024.0);
+        auto megabytesPerSecond = megabytes / (milliseconds / 1000.0);
+        auto framesPerSecond = numFrames / (milliseconds / 1000.0);
+        wprintf(L"  %-40ls %10.3f ms %10.2f MB/s %10.2f frames/s\n", name.c_str(), milliseconds, megabytesPerSecond, framesPerSecond);
+    }
+
+    void PrintEncodeResult(std::wstring const& name, double milliseconds, size_t inputBytes, uint32_t numFrames, uint64_t outputBytes)
+    {
+        auto megabytes = static_cast<double>(inputBytes) / (1024.0 * 1024.0);
+        auto megabytesPerSecond = megabytes / (milliseconds / 1000.0);
+        auto framesPerSecond = numFrames / (milliseconds / 1000.0);
+        wprintf(L"  %-40ls %10.3f ms %10.2f MB/s %10.2f frames/s %12llu bytes\n",
+            name.c_str(), milliseconds, megabytesPerSecond, framesPerSecond, static_cast<unsigned long long>(outputBytes));
+    }
+
+    // Discards everything written to it
+    class NullStreamBuffer : public std::streambuf
+    {
+    protected:
+        std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+        int_type overflow(int_type value) override { return traits_type::not_eof(value); }
+    };
+
+    void BenchmarkLzwEncoder()
+    {
+        struct Size { uint32_t Width; uint32_t Height; const wchar_t* Name; };
+        const Size sizes[] = { { 1920, 1080, L"1080p" }, { 3840, 2160, L"4k" } };
+        struct Pattern { IndexPattern Pattern; const wchar_t* Name; };
+        const Pattern patterns[] = {
+            { IndexPattern::Noise, L"noise" },
+            { IndexPattern::Gradient, L"gradient" },
+            { IndexPattern::SparseDelta, L"sparse-delta" },
+            { IndexPattern::BlockDelta, L"block-delta" },
+        };
+        const LzwClearMode clearModes[] = { LzwClearMode::WhenFull, LzwClearMode::Adaptive };
+
+        LzwEncoder encoder;
+        std::vector<uint8_t> output;
+        for (auto&& size : sizes)
+        {
+            for (auto&& pattern : patterns)
+            {
+                auto indices = GenerateIndices(pattern.Pattern, size.Width, size.Height, 256);
+                for (auto&& clearMode : clearModes)
+                {
+                    auto milliseconds = MeasureAverageMilliseconds(10, [&]()
+                    {
+                        output.clear();
+                        CompressGifImageData(encoder, indices.data(), indices.size(), 256, output, clearMode);
+                    });
+                    auto name = std::wstring(size.Name) + L" " + pattern.Name + L" " + LzwClearModeToString(clearMode);
+                    PrintThroughput(name, milliseconds, indices.size(), output.size());
+                }
+            }
+        }
+    }
+
+    void BenchmarkLzwDecoder()
+    {
+        struct Pattern { IndexPattern Pattern; const wchar_t* Name; };
+        const Pattern patterns[] = {
+            { IndexPattern::Noise, L"noise" },
+            { IndexPattern::Gradient, L"gradient" },
+            { IndexPattern::SparseDelta, L"sparse-delta" },
+        };
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+
+        LzwEncoder encoder;
+        LzwDecoder decoder;
+        for (auto&& pattern : patterns)
+        {
+            auto indices = GenerateIndices(pattern.Pattern, width, height, 256);
+            std::vector<uint8_t> imageData;
+            CompressGifImageData(encoder, indices.data(), indices.size(), 256, imageData);
+
+            // Skip the minimum code size byte
+            std::vector<uint8_t> output(indices.size(), 0);
+            auto milliseconds = MeasureAverageMilliseconds(10, [&]()
+            {
+                decoder.Decode(imageData.data() + 1, imageData.size() - 1, imageData[0], output.data(), output.size());
+            });
+            if (output != indices)
+            {
+                throw std::runtime_error("LZW round trip failed.");
+            }
+            auto name = std::wstring(L"1080p ") + pattern.Name;
+            PrintThroughput(name, milliseconds, indices.size(), imageData.size());
+        }
+    }
+
+    void BenchmarkParallelLzwEncoder()
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const uint32_t numFrames = 64;
+        auto indices = GenerateIndices(IndexPattern::Gradient, width, height, 256);
+        std::vector<uint32_t> palette(256, 0xFF000000);
+        GifFrameDesc desc = {};
+        desc.Width = static_cast<uint16_t>(width);
+        desc.Height = static_cast<uint16_t>(height);
+
+        std::vector<uint32_t> threadCounts = { 1, GetDefaultThreadCount() };
+        for (auto&& threadCount : threadCounts)
+        {
+            NullStreamBuffer nullBuffer;
+            std::ostream nullStream(&nullBuffer);
+            auto milliseconds = MeasureAverageMilliseconds(1, [&]()
+            {
+                GifWriter writer(nullStream, desc.Width, desc.Height);
+                ParallelGifWriter parallelWriter(writer, threadCount);
+                for (uint32_t i = 0; i < numFrames; i++)
+                {
+                    auto frameIndices = indices;
+                    parallelWriter.SubmitFrame(desc, palette, std::move(frameIndices));
+                }
+                parallelWriter.Finish();
+            });
+            auto name = std::to_wstring(numFrames) + L" frames, " + std::to_wstring(threadCount) + L" threads";
+            PrintFrameThroughput(name, milliseconds, indices.size() * numFrames, numFrames);
+        }
+    }
+
+    winrt::com_ptr<ID3D11Texture2D> CreateBenchmarkTexture(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        uint32_t width,
+        uint32_t height,
+        std::vector<uint32_t> const& pixels)
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = pixels.data();
+        initData.SysMemPitch = width * 4;
+        winrt::com_ptr<ID3D11Texture2D> texture;
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, &initData, texture.put()));
+        return texture;
+    }
+
+    void BenchmarkDiff()
+    {
+        struct Size { uint32_t Width; uint32_t Height; const wchar_t* Name; };
+        const Size sizes[] = { { 1920, 1080, L"1080p" }, { 3840, 2160, L"4k" } };
+        const int transparentIndex = 0;
+        const uint32_t iterations = 20;
+
+        for (auto&& size : sizes)
+        {
+            auto first = GenerateBgraFrame(size.Width, size.Height, 1);
+            auto second = GenerateBgraFrame(size.Width, size.Height, 2);
+            auto frameBytes = first.size() * sizeof(uint32_t);
+            std::vector<uint8_t> indices(first.size(), 1);
+
+            // Each iteration diffs two frames, one against the other and back
+            const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+            for (auto&& level : levels)
+            {
+                if (!IsSimdLevelSupported(level))
+                {
+                    continue;
+                }
+                CpuTransparencyFixer fixer(size.Width, size.Height, level);
+                fixer.InitPrevious(reinterpret_cast<uint8_t const*>(first.data()));
+                auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+                {
+                    fixer.ProcessInput(reinterpret_cast<uint8_t const*>(second.data()), transparentIndex, indices);
+                    fixer.ProcessInput(reinterpret_cast<uint8_t const*>(first.data()), transparentIndex, indices);
+                });
+                auto name = std::wstring(size.Name) + L" cpu " + SimdLevelToString(level);
+                PrintThroughput(name, milliseconds / 2.0, frameBytes, 0);
+            }
+
+            // Compare against the compute shader, including the copies to and from the GPU
+            auto d3dDevice = util::CreateD3DDevice(D3D11_CREATE_DEVICE_BGRA_SUPPORT);
+            winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+            d3dDevice->GetImmediateContext(d3dContext.put());
+            auto firstTexture = CreateBenchmarkTexture(d3dDevice, size.Width, size.Height, first);
+            auto secondTexture = CreateBenchmarkTexture(d3dDevice, size.Width, size.Height, second);
+            auto fixer = TransparencyFixer(d3dDevice, d3dContext, size.Width, size.Height);
+            fixer.InitPrevious(firstTexture);
+            auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                fixer.ProcessInput(secondTexture, transparentIndex, indices);
+                fixer.ProcessInput(firstTexture, transparentIndex, indices);
+            });
+            auto name = std::wstring(size.Name) + L" gpu";
+            PrintThroughput(name, milliseconds / 2.0, frameBytes, 0);
+        }
+    }
+
+    // Generates a BGRA frame with smooth gradients, which needs more
+    // colors than a GIF palette can hold.
+    std::vector<uint32_t> GenerateGradientFrame(uint32_t width, uint32_t height)
+    {
+        std::vector<uint32_t> pixels(static_cast<size_t>(width) * height, 0);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto red = (x * 255) / width;
+                auto green = (y * 255) / height;
+                auto blue = ((x + y) * 127) / (width + height) + ((x / 32) % 2) * 64;
+                pixels[(static_cast<size_t>(y) * width) + x] = MakeColor(255, red, green, blue);
+            }
+        }
+        return pixels;
+    }
+
+    double ComputePsnr(std::vector<uint32_t> const& pixels, std::vector<uint8_t> const& indices, std::vector<uint32_t> const& palette)
+    {
+        double error = 0;
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            error += ColorDistanceSquared(pixels[i], palette[indices[i]]);
+        }
+        auto meanSquaredError = error / (pixels.size() * 3.0);
+        if (meanSquaredError == 0)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        return 10.0 * std::log10((255.0 * 255.0) / meanSquaredError);
+    }
+
+    void PrintQuality(std::wstring const& name, double milliseconds, double psnr)
+    {
+        wprintf(L"  %-40ls %10.3f ms/frame %8.2f dB PSNR\n", name.c_str(), milliseconds, psnr);
+    }
+
+    void BenchmarkQuantizer()
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const uint32_t iterations = 5;
+        struct Frame { std::vector<uint32_t> Pixels; const wchar_t* Name; };
+        const Frame frames[] = {
+            { GenerateGradientFrame(width, height), L"gradient" },
+            { GenerateBgraFrame(width, height, 1), L"blocks+noise" },
+        };
+
+        for (auto&& frame : frames)
+        {
+            std::vector<uint8_t> indices(frame.Pixels.size(), 0);
+
+            const QuantizerAlgorithm algorithms[] = { QuantizerAlgorithm::Octree, QuantizerAlgorithm::MedianCut, QuantizerAlgorithm::KMeans };
+            for (auto&& algorithm : algorithms)
+            {
+                QuantizerOptions options = {};
+                options.Algorithm = algorithm;
+                ColorHistogram histogram;
+                std::vector<uint32_t> palette;
+                auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+                {
+                    histogram.Clear();
+                    histogram.AddPixels(frame.Pixels.data(), frame.Pixels.size());
+                    palette = BuildPalette(histogram, options);
+                    InverseColorMap colorMap(palette);
+                    colorMap.MapPixels(frame.Pixels.data(), frame.Pixels.size(), indices.data());
+                });
+                auto name = std::wstring(frame.Name) + L" " + QuantizerAlgorithmToString(algorithm);
+                PrintQuality(name, milliseconds, ComputePsnr(frame.Pixels, indices, palette));
+            }
+
+            // The WIC palette and format converter that MainAsync uses by default
+            auto wicFactory = winrt::create_instance<IWICImagingFactory2>(CLSID_WICImagingFactory2, CLSCTX_INPROC_SERVER);
+            std::vector<uint32_t> wicColors;
+            auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                winrt::com_ptr<IWICBitmap> wicBitmap;
+                winrt::check_hresult(wicFactory->CreateBitmapFromMemory(
+                    width,
+                    height,
+                    GUID_WICPixelFormat32bppBGRA,
+                    width * 4,
+                    static_cast<uint32_t>(frame.Pixels.size() * 4),
+                    reinterpret_cast<BYTE*>(const_cast<uint32_t*>(frame.Pixels.data())),
+                    wicBitmap.put()));
+                winrt::com_ptr<IWICPalette> wicPalette;
+                winrt::check_hresult(wicFactory->CreatePalette(wicPalette.put()));
+                winrt::check_hresult(wicPalette->InitializeFromBitmap(wicBitmap.get(), 256, true));
+                uint32_t numColors = 0;
+                winrt::check_hresult(wicPalette->GetColorCount(&numColors));
+                wicColors.resize(numColors);
+                winrt::check_hresult(wicPalette->GetColors(numColors, wicColors.data(), &numColors));
+
+                winrt::com_ptr<IWICFormatConverter> wicConverter;
+                winrt::check_hresult(wicFactory->CreateFormatConverter(wicConverter.put()));
+                winrt::check_hresult(wicConverter->Initialize(
+                    wicBitmap.get(),
+                    GUID_WICPixelFormat8bppIndexed,
+                    WICBitmapDitherTypeNone,
+                    wicPalette.get(),
+                    0.0,
+                    WICBitmapPaletteTypeFixedWebPalette));
+                winrt::check_hresult(wicConverter->CopyPixels(nullptr, width, static_cast<uint32_t>(indices.size()), indices.data()));
+            });
+            auto name = std::wstring(frame.Name) + L" wic";
+            PrintQuality(name, milliseconds, ComputePsnr(frame.Pixels, indices, wicColors));
+        }
+    }
+
+    void BenchmarkPaletteMapping()
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const uint32_t iterations = 5;
+        auto pixels = GenerateGradientFrame(width, height);
+        auto frameBytes = pixels.size() * sizeof(uint32_t);
+        std::vector<uint8_t> indices(pixels.size(), 0);
+
+        ColorHistogram histogram;
+        histogram.AddPixels(pixels.data(), pixels.size());
+        auto palette = BuildPalette(histogram, QuantizerOptions{});
+
+        auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+        {
+            MapPixelsToIndices(pixels.data(), pixels.size(), palette, indices.data());
+        });
+        PrintThroughput(L"nearest color search", milliseconds, frameBytes, 0);
+        PrintQuality(L"nearest color search", milliseconds, ComputePsnr(pixels, indices, palette));
+
+        // A new palette every frame has to fill the table as it goes
+        milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+        {
+            InverseColorMap colorMap(palette);
+            colorMap.MapPixels(pixels.data(), pixels.size(), indices.data());
+        });
+        PrintThroughput(L"inverse color map (cold)", milliseconds, frameBytes, 0);
+
+        // Frames that reuse a palette reuse the filled in table
+        InverseColorMap colorMap(palette);
+        milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+        {
+            colorMap.MapPixels(pixels.data(), pixels.size(), indices.data());
+        });
+        PrintThroughput(L"inverse color map (warm)", milliseconds, frameBytes, 0);
+        PrintQuality(L"inverse color map (warm)", milliseconds, ComputePsnr(pixels, indices, palette));
+    }
+
+    void PrintSpeedup(double milliseconds, double singleThreadMilliseconds)
+    {
+        wprintf(L"    %-38ls %9.2fx\n", L"vs 1 thread", singleThreadMilliseconds / milliseconds);
+    }
+
+    bool AreHistogramsEqual(ColorHistogram const& first, ColorHistogram const& second)
+    {
+        auto firstEntries = first.GetEntries();
+        auto secondEntries = second.GetEntries();
+        return first.NumPixels() == second.NumPixels() &&
+            first.NumTransparentPixels() == second.NumTransparentPixels() &&
+            std::equal(firstEntries.begin(), firstEntries.end(), secondEntries.begin(), secondEntries.end(), [](auto&& a, auto&& b)
+            {
+                return a.Red == b.Red && a.Green == b.Green && a.Blue == b.Blue && a.Count == b.Count;
+            });
+    }
+
+    // Splits the histogram, palette mapping and diff of one 4k frame into
+    // row bands on more and more threads. Every thread count has to give
+    // the same results as one thread.
+    void BenchmarkRowBands()
+    {
+        const uint32_t width = 3840;
+        const uint32_t height = 2160;
+        const uint32_t iterations = 10;
+        const int transparentIndex = 0;
+        auto pixels = GenerateGradientFrame(width, height);
+        auto first = GenerateBgraFrame(width, height, 1);
+        auto second = GenerateBgraFrame(width, height, 2);
+        auto frameBytes = pixels.size() * sizeof(uint32_t);
+
+        // What a single thread produces
+        ColorHistogram expectedHistogram;
+        expectedHistogram.AddPixels(pixels.data(), pixels.size());
+        auto palette = BuildPalette(expectedHistogram, QuantizerOptions{});
+        std::vector<uint8_t> expectedIndices(pixels.size(), 0);
+        InverseColorMap(palette).MapPixels(pixels.data(), pixels.size(), expectedIndices.data());
+        std::vector<uint8_t> expectedDiffIndices(pixels.size(), 1);
+        CpuTransparencyFixer expectedFixer(width, height);
+        expectedFixer.InitPrevious(reinterpret_cast<uint8_t const*>(first.data()));
+        auto expectedDiffInfo = expectedFixer.ProcessInput(reinterpret_cast<uint8_t const*>(second.data()), transparentIndex, expectedDiffIndices);
+
+        double singleThreadMilliseconds[3] = {};
+        const uint32_t threadCounts[] = { 1, 2, 4, 8, 16 };
+        for (auto&& threadCount : threadCounts)
+        {
+            if (threadCount > 1 && threadCount > GetDefaultThreadCount())
+            {
+                break;
+            }
+            RowBandPool pool(threadCount);
+            ParallelPalettizer palettizer(pool, width, height);
+            auto threads = std::to_wstring(threadCount) + (threadCount == 1 ? L" thread" : L" threads");
+
+            ColorHistogram histogram;
+            auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                palettizer.BuildHistogram(pixels.data(), histogram);
+            });
+            if (!AreHistogramsEqual(histogram, expectedHistogram))
+            {
+                throw std::runtime_error("Row bands changed the histogram.");
+            }
+            PrintThroughput(L"4k histogram, " + threads, milliseconds, frameBytes, 0);
+            if (threadCount == 1)
+            {
+                singleThreadMilliseconds[0] = milliseconds;
+            }
+            else
+            {
+                PrintSpeedup(milliseconds, singleThreadMilliseconds[0]);
+            }
+
+            // A new palette every frame, so threads fill the table together
+            std::vector<uint8_t> indices(pixels.size(), 0);
+            milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                InverseColorMap colorMap(palette);
+                palettizer.MapPixels(colorMap, pixels.data(), indices.data());
+            });
+            if (indices != expectedIndices)
+            {
+                throw std::runtime_error("Row bands changed the palette indices.");
+            }
+            PrintThroughput(L"4k map (cold), " + threads, milliseconds, frameBytes, 0);
+            if (threadCount == 1)
+            {
+                singleThreadMilliseconds[1] = milliseconds;
+            }
+            else
+            {
+                PrintSpeedup(milliseconds, singleThreadMilliseconds[1]);
+            }
+
+            // Each iteration diffs two frames, one against the other and back
+            CpuTransparencyFixer fixer(width, height);
+            fixer.SetRowBandPool(&pool);
+            fixer.InitPrevious(reinterpret_cast<uint8_t const*>(first.data()));
+            std::vector<uint8_t> diffIndices(pixels.size(), 1);
+            auto diffInfo = fixer.ProcessInput(reinterpret_cast<uint8_t const*>(second.data()), transparentIndex, diffIndices);
+            if (memcmp(&diffInfo, &expectedDiffInfo, sizeof(DiffInfo)) != 0 || diffIndices != expectedDiffIndices)
+            {
+                throw std::runtime_error("Row bands changed the diff.");
+            }
+            milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                fixer.ProcessInput(reinterpret_cast<uint8_t const*>(first.data()), transparentIndex, diffIndices);
+                fixer.ProcessInput(reinterpret_cast<uint8_t const*>(second.data()), transparentIndex, diffIndices);
+            });
+            PrintThroughput(L"4k diff, " + threads, milliseconds / 2.0, frameBytes, 0);
+            if (threadCount == 1)
+            {
+                singleThreadMilliseconds[2] = milliseconds;
+            }
+            else
+            {
+                PrintSpeedup(milliseconds, singleThreadMilliseconds[2]);
+            }
+        }
+    }
+
+    void BenchmarkBase64()
+    {
+        const uint32_t iterations = 10;
+        std::vector<uint8_t> data(8 * 1024 * 1024);
+        std::mt19937 random(1);
+        for (auto&& value : data)
+        {
+            value = static_cast<uint8_t>(random());
+        }
+        struct Payload { std::string Text; const wchar_t* Name; };
+        const Payload payloads[] = {
+            { EncodeBase64(data.data(), data.size(), 0), L"8MB" },
+            { EncodeBase64(data.data(), data.size(), 76), L"8MB wrapped" },
+        };
+
+        BufferPool pool;
+        const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2, SimdLevel::Neon };
+        for (auto&& payload : payloads)
+        {
+            for (auto&& level : levels)
+            {
+                auto kernel = GetBase64DecodeKernel(level);
+                if (kernel == nullptr)
+                {
+                    continue;
+                }
+                size_t outputSize = 0;
+                auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+                {
+                    PooledBuffer buffer(pool);
+                    buffer.Get().resize(GetMaxDecodedBase64Size(payload.Text.size()));
+                    outputSize = kernel(payload.Text.data(), payload.Text.size(), buffer.Get().data());
+                });
+                {
+                    PooledBuffer buffer(pool);
+                    buffer.Get().resize(GetMaxDecodedBase64Size(payload.Text.size()));
+                    outputSize = kernel(payload.Text.data(), payload.Text.size(), buffer.Get().data());
+                    if (outputSize != data.size() || memcmp(buffer.Get().data(), data.data(), data.size()) != 0)
+                    {
+                        wprintf(L"  %ls produced the wrong output!\n", SimdLevelToString(level));
+                    }
+                }
+                auto name = std::wstring(payload.Name) + L" " + SimdLevelToString(level);
+                PrintThroughput(name, milliseconds, payload.Text.size(), outputSize);
+            }
+
+            // Without the pool every decode pays for a fresh allocation
+            size_t outputSize = 0;
+            auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+            {
+                std::vector<uint8_t> buffer(GetMaxDecodedBase64Size(payload.Text.size()));
+                outputSize = DecodeBase64(payload.Text.data(), payload.Text.size(), buffer.data());
+            });
+            PrintThroughput(std::wstring(payload.Name) + L" best, unpooled", milliseconds, payload.Text.size(), outputSize);
+        }
+        wprintf(L"  buffer pool: %llu reuses, %llu allocations\n",
+            static_cast<unsigned long long>(pool.Reuses()),
+            static_cast<unsigned long long>(pool.Allocations()));
+    }
+
+    void BenchmarkAlphaBlend()
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const uint32_t iterations = 10;
+        // A layer with a translucent edge around an opaque middle, the
+        // rest is empty
+        std::vector<uint32_t> layer(static_cast<size_t>(width) * height, 0);
+        for (uint32_t y = height / 4; y < height * 3 / 4; y++)
+        {
+            for (uint32_t x = width / 4; x < width * 3 / 4; x++)
+            {
+                auto edge = x < width / 4 + 16 || y < height / 4 + 16;
+                auto alpha = edge ? 128u : 255u;
+                layer[static_cast<size_t>(y) * width + x] = PremultiplyColor(MakeColor(alpha, x & 0xFF, y & 0xFF, 0x80));
+            }
+        }
+        auto background = GenerateBgraFrame(width, height, 1);
+        for (auto&& pixel : background)
+        {
+            pixel |= 0xFF000000;
+        }
+        std::vector<uint32_t> target(background.size());
+        auto frameBytes = layer.size() * sizeof(uint32_t);
+
+        struct Opacity { float Value; const wchar_t* Name; };
+        const Opacity opacities[] = { { 1.0f, L"opaque" }, { 0.5f, L"50%" } };
+        const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+        for (auto&& opacity : opacities)
+        {
+            auto weight = OpacityToBlendWeight(opacity.Value);
+            for (auto&& level : levels)
+            {
+                auto kernel = GetBlendRowKernel(level);
+                if (kernel == nullptr)
+                {
+                    continue;
+                }
+                auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+                {
+                    target = background;
+                    for (uint32_t y = 0; y < height; y++)
+                    {
+                        auto offset = static_cast<size_t>(y) * width;
+                        kernel(target.data() + offset, layer.data() + offset, width, weight);
+                    }
+                });
+                auto name = std::wstring(L"1080p ") + opacity.Name + L" " + SimdLevelToString(level);
+                PrintThroughput(name, milliseconds, frameBytes, 0);
+            }
+        }
+    }
+
+    // Runs the encode pipeline that main uses with '-diff cpu -palette
+    // reuse' over the frames nextFrame hands out, through the same
+    // FrameEncoder: duplicate frames dropped, a palette that is kept while
+    // it fits, mapping and diffing in row bands on every core, the
+    // changes split into up to maxImagesPerFrame images (like '-images')
+    // and compression on every core. The diff uses the given tolerance,
+    // like '-tolerance', and mapping the given dither mode, like
+    // '-dither'. The output is thrown away. Returns the size of the GIF.
+    template <typename NextFrameFunc>
+    uint64_t EncodeFramesOnCpu(
+        uint32_t width,
+        uint32_t height,
+        NextFrameFunc const& nextFrame,
+        EncodeStats& stats,
+        uint32_t maxImagesPerFrame = 1,
+        DiffTolerance const& tolerance = {},
+        DitherMode dither = DitherMode::None)
+    {
+        NullStreamBuffer nullBuffer;
+        std::ostream nullStream(&nullBuffer);
+        GifWriter gifWriter(nullStream, static_cast<uint16_t>(width), static_cast<uint16_t>(height));
+        ParallelGifWriter frameWriter(gifWriter, GetDefaultThreadCount());
+        frameWriter.SetFrameWrittenCallback([&stats](WrittenFrameInfo const& info)
+        {
+            stats.FrameWritten(info.FrameNumber, info.CompressedBytes, info.CompressNanoseconds, info.WriteNanoseconds);
+        });
+        FrameEncoderOptions options = {};
+        options.Palette = PaletteMode::Reuse;
+        options.Dither = dither;
+        options.Tolerance = tolerance;
+        options.MaxImagesPerFrame = maxImagesPerFrame;
+        options.NumBandThreads = GetDefaultThreadCount();
+        FrameEncoder frameEncoder(gifWriter, frameWriter, stats, width, height, options);
+
+        const auto frameDelay = std::chrono::milliseconds(50);
+        uint32_t const* pixels = nullptr;
+        FrameRect dirtyRect = {};
+        while (true)
+        {
+            auto composeStart = std::chrono::steady_clock::now();
+            if (!nextFrame(pixels, dirtyRect))
+            {
+                break;
+            }
+            auto& frameStats = stats.BeginFrame();
+            stats.AddTime(EncodeStage::Compose, NanosecondsSince(composeStart));
+
+            InputFrame frame = {};
+            frame.Pixels = pixels;
+            frame.Delay = frameDelay;
+            frame.DirtyRect = dirtyRect;
+            frameEncoder.EncodeFrame(frame, frameStats);
+        }
+        {
+            ScopedStageTimer timer(stats, EncodeStage::Finish);
+            frameWriter.Finish();
+        }
+        stats.SetOutputBytes(gifWriter.BytesWritten());
+        return gifWriter.BytesWritten();
+    }
+
+    // Prints the time each stage took per frame. Compress is spread over
+    // the workers, so it can add up to more than the total.
+    void PrintStageTimes(EncodeStats const& stats, uint32_t numFrames, size_t frameBytes)
+    {
+        const EncodeStage stages[] =
+        {
+            EncodeStage::Compose,
+            EncodeStage::Dedup,
+            EncodeStage::Palette,
+            EncodeStage::Convert,
+            EncodeStage::Diff,
+            EncodeStage::Crop,
+            EncodeStage::Compress,
+            EncodeStage::Write,
+        };
+        for (auto&& stage : stages)
+        {
+            auto milliseconds = stats.StageNanoseconds(stage) / 1000000.0 / std::max(numFrames, 1u);
+            auto megabytesPerSecond = (frameBytes / (1024.0 * 1024.0)) / (milliseconds / 1000.0);
+            wprintf(L"    %-38hs %10.3f ms/frame %10.2f MB/s\n", EncodeStageToString(stage), milliseconds, megabytesPerSecond);
+        }
+    }
+
+    void BenchmarkSyntheticScenes()
+    {
+        const uint32_t width = 1280;
+        const uint32_t height = 720;
+        const uint32_t numFrames = 60;
+        const SyntheticScene scenes[] = { SyntheticScene::MovingSprite, SyntheticScene::Noise, SyntheticScene::ScrollingText, SyntheticScene::ScatteredWidgets };
+        auto frameBytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+        for (auto&& scene : scenes)
+        {
+            SyntheticAnimation animation(scene, width, height, numFrames);
+            EncodeStats stats(width, height, numFrames);
+            auto start = std::chrono::high_resolution_clock::now();
+            auto outputBytes = EncodeFramesOnCpu(width, height, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+            {
+                if (!animation.TryGetNextFrame(dirtyRect))
+                {
+                    return false;
+                }
+                pixels = animation.Pixels().data();
+                return true;
+            }, stats);
+            auto end = std::chrono::high_resolution_clock::now();
+            auto milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+            auto name = std::wstring(L"720p ") + SyntheticSceneToString(scene) + L" encode";
+            PrintEncodeResult(name, milliseconds, frameBytes * numFrames, numFrames, outputBytes);
+            PrintStageTimes(stats, numFrames, frameBytes);
+        }
+    }
+
+    // Compares writing each frame's changes as one image against splitting
+    // them into several
+    void BenchmarkImagesPerFrame()
+    {
+        const uint32_t width = 1280;
+        const uint32_t height = 720;
+        const uint32_t numFrames = 60;
+        const SyntheticScene scenes[] = { SyntheticScene::MovingSprite, SyntheticScene::ScatteredWidgets };
+        const uint32_t imageCounts[] = { 1, 4, 16 };
+        auto frameBytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+        for (auto&& scene : scenes)
+        {
+            for (auto&& maxImages : imageCounts)
+            {
+                SyntheticAnimation animation(scene, width, height, numFrames);
+                EncodeStats stats(width, height, numFrames);
+                auto start = std::chrono::high_resolution_clock::now();
+                auto outputBytes = EncodeFramesOnCpu(width, height, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+                {
+                    if (!animation.TryGetNextFrame(dirtyRect))
+                    {
+                        return false;
+                    }
+                    pixels = animation.Pixels().data();
+                    return true;
+                }, stats, maxImages);
+                auto end = std::chrono::high_resolution_clock::now();
+                auto milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+                uint32_t numImages = 0;
+                for (auto&& frame : stats.Frames())
+                {
+                    numImages += frame.ImageBlocks;
+                }
+                auto name = std::wstring(L"720p ") + SyntheticSceneToString(scene) + L" up to " + std::to_wstring(maxImages) + L" images";
+                PrintEncodeResult(name, milliseconds, frameBytes * numFrames, numFrames, outputBytes);
+                wprintf(L"    %-38ls %10.2f per frame\n", L"images", static_cast<double>(numImages) / numFrames);
+            }
+        }
+    }
+
+    // Encodes a noisy capture with an exact diff and with each tolerance,
+    // and shows how much smaller and faster the lossy diffs are
+    void BenchmarkDiffTolerance()
+    {
+        const uint32_t width = 1280;
+        const uint32_t height = 720;
+        const uint32_t numFrames = 60;
+        const uint32_t threshold = 4;
+        const DiffToleranceMode modes[] = { DiffToleranceMode::Exact, DiffToleranceMode::Channel, DiffToleranceMode::YCbCr };
+        auto frameBytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+        double exactMilliseconds = 0.0;
+        uint64_t exactBytes = 0;
+        for (auto&& mode : modes)
+        {
+            SyntheticAnimation animation(SyntheticScene::NoisySprite, width, height, numFrames);
+            EncodeStats stats(width, height, numFrames);
+            auto tolerance = DiffTolerance{ mode, mode == DiffToleranceMode::Exact ? 0 : threshold };
+            auto start = std::chrono::high_resolution_clock::now();
+            auto outputBytes = EncodeFramesOnCpu(width, height, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+            {
+                if (!animation.TryGetNextFrame(dirtyRect))
+                {
+                    return false;
+                }
+                pixels = animation.Pixels().data();
+                return true;
+            }, stats, 1, tolerance);
+            auto end = std::chrono::high_resolution_clock::now();
+            auto milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+            auto name = std::wstring(L"720p noisy-sprite ") + DiffToleranceModeToString(mode);
+            PrintEncodeResult(name, milliseconds, frameBytes * numFrames, numFrames, outputBytes);
+            if (mode == DiffToleranceMode::Exact)
+            {
+                exactMilliseconds = milliseconds;
+                exactBytes = outputBytes;
+            }
+            else
+            {
+                auto bytesSaved = 100.0 * (1.0 - static_cast<double>(outputBytes) / static_cast<double>(exactBytes));
+                auto timeSaved = 100.0 * (1.0 - milliseconds / exactMilliseconds);
+                wprintf(L"    %-38ls %9.1f%% smaller %9.1f%% faster\n", L"vs exact", bytesSaved, timeSaved);
+            }
+        }
+    }
+
+    // Maps a 1080p gradient with every dither mode, then a block moving
+    // over the gradient with one palette. The diff compares colors, so it
+    // finds the same pixels whatever the mode and writes the transparent
+    // index over the rest. What the mode changes is how many indices move
+    // between frames (including pixels whose color didn't change) and how
+    // well the delta images compress. Last, a moving sprite is encoded
+    // end to end with each mode.
+    void BenchmarkDithering()
+    {
+        const uint32_t width = 1920;
+        const uint32_t height = 1080;
+        const uint32_t iterations = 5;
+        const uint32_t numFrames = 16;
+        const uint32_t blockSize = 240;
+        const DitherMode modes[] = { DitherMode::None, DitherMode::Bayer, DitherMode::FloydSteinberg, DitherMode::SierraLite };
+        auto pixels = GenerateGradientFrame(width, height);
+        auto frameBytes = pixels.size() * sizeof(uint32_t);
+        std::vector<uint8_t> indices(pixels.size(), 0);
+
+        ColorHistogram histogram;
+        histogram.AddPixels(pixels.data(), pixels.size());
+        auto palette = BuildPalette(histogram, QuantizerOptions{});
+        auto transparentIndex = FindTransparentColorIndex(palette);
+
+        std::vector<uint32_t> threadCounts = { 1 };
+        if (GetDefaultThreadCount() > 1)
+        {
+            threadCounts.push_back(GetDefaultThreadCount());
+        }
+        for (auto&& threadCount : threadCounts)
+        {
+            RowBandPool pool(threadCount);
+            auto threads = std::to_wstring(threadCount) + (threadCount == 1 ? L" thread" : L" threads");
+            for (auto&& mode : modes)
+            {
+                ParallelPalettizer palettizer(pool, width, height, mode);
+                InverseColorMap colorMap(palette);
+                auto milliseconds = MeasureAverageMilliseconds(iterations, [&]()
+                {
+                    palettizer.MapPixels(colorMap, pixels.data(), indices.data());
+                });
+                PrintThroughput(std::wstring(L"1080p ") + DitherModeToString(mode) + L", " + threads, milliseconds, frameBytes, 0);
+            }
+        }
+
+        // A flat block that isn't in the palette, so every mode but none
+        // dithers it
+        auto generateFrame = [&](uint32_t frameIndex, std::vector<uint32_t>& frame)
+        {
+            frame = pixels;
+            auto left = (frameIndex * 61) % (width - blockSize);
+            auto top = (frameIndex * 29) % (height - blockSize);
+            for (auto y = top; y < top + blockSize; y++)
+            {
+                std::fill_n(frame.data() + (static_cast<size_t>(y) * width) + left, blockSize, MakeColor(255, 200, 90, 150));
+            }
+        };
+
+        RowBandPool pool(GetDefaultThreadCount());
+        std::vector<uint32_t> frame;
+        std::vector<uint32_t> previousFrame;
+        std::vector<uint8_t> previousIndices(pixels.size(), 0);
+        std::vector<uint8_t> cropped;
+        std::vector<uint8_t> imageData;
+        LzwEncoder encoder;
+        for (auto&& mode : modes)
+        {
+            ParallelPalettizer palettizer(pool, width, height, mode);
+            InverseColorMap colorMap(palette);
+            CpuTransparencyFixer fixer(width, height);
+            double milliseconds = 0.0;
+            uint64_t numDifferingPixels = 0;
+            uint64_t numChangedIndices = 0;
+            uint64_t numUnstablePixels = 0;
+            uint64_t numImageBytes = 0;
+            for (uint32_t frameIndex = 0; frameIndex < numFrames; frameIndex++)
+            {
+                generateFrame(frameIndex, frame);
+                auto start = std::chrono::high_resolution_clock::now();
+                palettizer.MapPixels(colorMap, frame.data(), indices.data());
+                auto end = std::chrono::high_resolution_clock::now();
+                milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+
+                auto bytes = reinterpret_cast<uint8_t const*>(frame.data());
+                if (frameIndex == 0)
+                {
+                    fixer.InitPrevious(bytes);
+                }
+                else
+                {
+                    for (size_t i = 0; i < indices.size(); i++)
+                    {
+                        if (indices[i] != previousIndices[i])
+                        {
+                            numChangedIndices++;
+                            numUnstablePixels += frame[i] == previousFrame[i] ? 1 : 0;
+                        }
+                    }
+                }
+                previousIndices = indices;
+                previousFrame = frame;
+                if (frameIndex == 0)
+                {
+                    continue;
+                }
+
+                // Write the changed area like the encoder would
+                auto diffInfo = fixer.ProcessInput(bytes, transparentIndex, indices);
+                numDifferingPixels += diffInfo.NumDifferingPixels;
+                auto imageWidth = diffInfo.right - diffInfo.left;
+                cropped.resize(static_cast<size_t>(imageWidth) * (diffInfo.bottom - diffInfo.top));
+                for (auto y = diffInfo.top; y < diffInfo.bottom; y++)
+                {
+                    auto row = indices.data() + (static_cast<size_t>(y) * width) + diffInfo.left;
+                    std::copy_n(row, imageWidth, cropped.data() + (static_cast<size_t>(y - diffInfo.top) * imageWidth));
+                }
+                CompressGifImageData(encoder, cropped.data(), cropped.size(), palette.size(), imageData);
+                numImageBytes += imageData.size();
+            }
+
+            auto numDeltaFrames = numFrames - 1;
+            PrintThroughput(std::wstring(L"1080p moving block ") + DitherModeToString(mode), milliseconds / numFrames, frameBytes, numImageBytes / numDeltaFrames);
+            wprintf(L"    %-38ls %10llu per frame\n", L"differing pixels", static_cast<unsigned long long>(numDifferingPixels / numDeltaFrames));
+            wprintf(L"    %-38ls %10llu per frame\n", L"changed indices", static_cast<unsigned long long>(numChangedIndices / numDeltaFrames));
+            wprintf(L"    %-38ls %10llu per frame\n", L"changed indices, same color", static_cast<unsigned long long>(numUnstablePixels / numDeltaFrames));
+        }
+
+        // The whole pipeline, as main runs it with '-dither'
+        const uint32_t sceneWidth = 1280;
+        const uint32_t sceneHeight = 720;
+        const uint32_t numSceneFrames = 60;
+        auto sceneFrameBytes = static_cast<size_t>(sceneWidth) * sceneHeight * sizeof(uint32_t);
+        for (auto&& mode : modes)
+        {
+            SyntheticAnimation animation(SyntheticScene::MovingSprite, sceneWidth, sceneHeight, numSceneFrames);
+            EncodeStats stats(sceneWidth, sceneHeight, numSceneFrames);
+            auto start = std::chrono::high_resolution_clock::now();
+            auto outputBytes = EncodeFramesOnCpu(sceneWidth, sceneHeight, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+            {
+                if (!animation.TryGetNextFrame(dirtyRect))
+                {
+                    return false;
+                }
+                pixels = animation.Pixels().data();
+                return true;
+            }, stats, 1, DiffTolerance{}, mode);
+            auto end = std::chrono::high_resolution_clock::now();
+            auto milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+            auto name = std::wstring(L"720p moving-sprite encode ") + DitherModeToString(mode);
+            PrintEncodeResult(name, milliseconds, sceneFrameBytes * numSceneFrames, numSceneFrames, outputBytes);
+        }
+    }
+
+    // Encodes an idle recording, where the screen only changes every few
+    // frames and the reader can't tell which parts changed, so every frame
+    // comes with a full frame dirty rect
+    void BenchmarkDuplicateFrames()
+    {
+        const uint32_t width = 1280;
+        const uint32_t height = 720;
+        const uint32_t numFrames = 120;
+        const uint32_t repeatCount = 4;
+        auto frameBytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+        SyntheticAnimation animation(SyntheticScene::ScatteredWidgets, width, height, numFrames / repeatCount);
+        EncodeStats stats(width, height, numFrames);
+        uint32_t frameIndex = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        auto outputBytes = EncodeFramesOnCpu(width, height, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+        {
+            FrameRect animationRect = {};
+            if (frameIndex % repeatCount == 0 && !animation.TryGetNextFrame(animationRect))
+            {
+                return false;
+            }
+            frameIndex++;
+            pixels = animation.Pixels().data();
+            dirtyRect = { 0, 0, width, height };
+            return true;
+        }, stats);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+        uint32_t numDuplicates = 0;
+        for (auto&& frame : stats.Frames())
+        {
+            numDuplicates += frame.Duplicate ? 1 : 0;
+        }
+        PrintEncodeResult(L"720p idle widgets encode", milliseconds, frameBytes * numFrames, numFrames, outputBytes);
+        wprintf(L"    %-38ls %10u of %u\n", L"duplicates", numDuplicates, numFrames);
+        PrintStageTimes(stats, numFrames, frameBytes);
+    }
+
+    void BenchmarkRaniLayers()
+    {
+        const uint32_t width = 1280;
+        const uint32_t height = 720;
+        const uint32_t numFrames = 32;
+        const uint32_t numLayers = 16;
+        auto frameBytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+        // Cropped sprite images, and the full canvas ones the editor saves
+        for (auto fullCanvasLayers : { false, true })
+        {
+            auto name = std::to_wstring(numLayers) + (fullCanvasLayers ? L" full canvas layers" : L" layers");
+            auto file = GenerateSyntheticRaniProject(width, height, numFrames, numLayers, fullCanvasLayers);
+
+            std::unique_ptr<RaniProject> project;
+            auto milliseconds = MeasureAverageMilliseconds(5, [&]()
+            {
+                project = ParseRaniProject(file.data(), file.size());
+            });
+            PrintThroughput(name + L" parse", milliseconds, file.size(), 0);
+
+            // Every pass starts with a cold cache, so decoding is included
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                LayerBitmapCache cache;
+                RaniCpuCompositor compositor(*project, file.data(), file.size(), DecodeSyntheticLayerImage, cache);
+                std::vector<uint32_t> pixels;
+                for (auto&& frame : project->Frames)
+                {
+                    compositor.ComposeFrame(frame, pixels);
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+                PrintFrameThroughput(name + L" compose", milliseconds, frameBytes * numFrames, numFrames);
+            }
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                LayerBitmapCache cache;
+                RaniCpuCompositor compositor(*project, file.data(), file.size(), DecodeSyntheticLayerImage, cache);
+                IncrementalRaniCompositor incremental(compositor, *project);
+                FrameRect dirtyRect = {};
+                uint64_t numDirtyPixels = 0;
+                while (incremental.TryGetNextFrame(dirtyRect))
+                {
+                    numDirtyPixels += static_cast<uint64_t>(dirtyRect.Width()) * dirtyRect.Height();
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+                PrintFrameThroughput(name + L" incremental compose", milliseconds, frameBytes * numFrames, numFrames);
+                wprintf(L"    %-38ls %10llu per frame\n", L"dirty pixels", static_cast<unsigned long long>(numDirtyPixels / numFrames));
+            }
+            {
+                LayerBitmapCache cache;
+                RaniCpuCompositor compositor(*project, file.data(), file.size(), DecodeSyntheticLayerImage, cache);
+                IncrementalRaniCompositor incremental(compositor, *project);
+                EncodeStats stats(width, height, numFrames);
+                auto start = std::chrono::high_resolution_clock::now();
+                auto outputBytes = EncodeFramesOnCpu(width, height, [&](uint32_t const*& pixels, FrameRect& dirtyRect)
+                {
+                    if (!incremental.TryGetNextFrame(dirtyRect))
+                    {
+                        return false;
+                    }
+                    pixels = incremental.Pixels().data();
+                    return true;
+                }, stats);
+                auto end = std::chrono::high_resolution_clock::now();
+                milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+                PrintEncodeResult(name + L" encode", milliseconds, frameBytes * numFrames, numFrames, outputBytes);
+                PrintStageTimes(stats, numFrames, frameBytes);
+            }
+        }
+    }
+
+    struct BenchmarkEntry
+    {
+        const wchar_t* Name;
+        void (*Run)();
+    };
+
+    const BenchmarkEntry Benchmarks[] =
+    {
+        { L"lzw", BenchmarkLzwEncoder },
+        { L"lzw-decode", BenchmarkLzwDecoder },
+        { L"parallel-lzw", BenchmarkParallelLzwEncoder },
+        { L"diff", BenchmarkDiff },
+        { L"quantize", BenchmarkQuantizer },
+        { L"map", BenchmarkPaletteMapping },
+        { L"bands", BenchmarkRowBands },
+        { L"dither", BenchmarkDithering },
+        { L"base64", BenchmarkBase64 },
+        { L"blend", BenchmarkAlphaBlend },
+        { L"scenes", BenchmarkSyntheticScenes },
+        { L"images", BenchmarkImagesPerFrame },
+        { L"dedup", BenchmarkDuplicateFrames },
+        { L"tolerance", BenchmarkDiffTolerance },
+        { L"rani-layers", BenchmarkRaniLayers },
+    };
+}
+
+void RunBenchmarks(std::wstring const& filter)
+{
+    for (auto&& benchmark : Benchmarks)
+    {
+        if (filter.empty() || filter == benchmark.Name)
+        {
+            wprintf(L"%ls\n", benchmark.Name);
+            benchmark.Run();
+        }
+    }
+}
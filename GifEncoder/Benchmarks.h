@@ -0,0 +1,6 @@
+#pragma once
+
+// Runs the built-in benchmarks and prints the results to stdout. An empty
+// filter runs every benchmark, otherwise only the benchmark with a
+// matching name is run.
+void RunBenchmarks(std::wstring const& filter);
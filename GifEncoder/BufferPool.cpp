@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "BufferPool.h"
+
+namespace
+{
+    // The largest class whose size fits in the capacity
+    size_t SizeClassOf(size_t capacity)
+    {
+        size_t sizeClass = 0;
+        while ((capacity >> 1) >= (static_cast<size_t>(1) << sizeClass))
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    // The smallest class whose size holds the given number of bytes
+    size_t SizeClassFor(size_t minCapacity)
+    {
+        size_t sizeClass = 0;
+        while (sizeClass + 1 < sizeof(size_t) * 8 && (static_cast<size_t>(1) << sizeClass) < minCapacity)
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+}
+
+BufferPool::BufferPool(size_t maxPooledBuffers)
+{
+    m_maxPooledBuffers = maxPooledBuffers;
+}
+
+std::vector<uint8_t> BufferPool::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto sizeClass = NumSizeClasses; sizeClass-- > 0;)
+    {
+        auto&& buffers = m_buffers[sizeClass];
+        if (!buffers.empty())
+        {
+            // The most recently released buffer is the most likely to be warm
+            auto buffer = std::move(buffers.back());
+            buffers.pop_back();
+            m_reuses++;
+            return buffer;
+        }
+    }
+    m_allocations++;
+    return {};
+}
+
+std::vector<uint8_t> BufferPool::Acquire(size_t minCapacity)
+{
+    auto sizeClass = SizeClassFor(minCapacity);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto&& buffers = m_buffers[sizeClass];
+        if (!buffers.empty())
+        {
+            auto buffer = std::move(buffers.back());
+            buffers.pop_back();
+            m_reuses++;
+            return buffer;
+        }
+        m_allocations++;
+    }
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(std::max(static_cast<size_t>(1) << sizeClass, minCapacity));
+    return buffer;
+}
+
+void BufferPool::Release(std::vector<uint8_t>&& buffer)
+{
+    if (buffer.capacity() == 0)
+    {
+        return;
+    }
+    buffer.clear();
+    auto sizeClass = SizeClassOf(buffer.capacity());
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto&& buffers = m_buffers[sizeClass];
+    if (buffers.size() < m_maxPooledBuffers)
+    {
+        // Reserve the whole class up front so releasing doesn't allocate
+        if (buffers.capacity() == 0)
+        {
+            buffers.reserve(m_maxPooledBuffers);
+        }
+        buffers.push_back(std::move(buffer));
+    }
+}
+
+uint64_t BufferPool::Reuses() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_reuses;
+}
+
+uint64_t BufferPool::Allocations() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_allocations;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Hands out byte buffers that keep their capacity between uses, so
+// decoding into them doesn't allocate once the pool has warmed up.
+// Buffers are sorted into power of two size classes by capacity, and the
+// limit on pooled buffers applies to each class. Buffers can be acquired
+// and released from any thread.
+class BufferPool
+{
+public:
+    static const size_t DefaultMaxPooledBuffers = 8;
+
+    explicit BufferPool(size_t maxPooledBuffers = DefaultMaxPooledBuffers);
+
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    // The buffer is empty, but may already have capacity. Use this when
+    // the size isn't known up front; it hands out the largest buffer.
+    std::vector<uint8_t> Acquire();
+    // The buffer is empty and has a capacity of at least minCapacity.
+    // New buffers are rounded up to the size class.
+    std::vector<uint8_t> Acquire(size_t minCapacity);
+    // Buffers past the pool's limit are freed.
+    void Release(std::vector<uint8_t>&& buffer);
+
+    uint64_t Reuses() const;
+    uint64_t Allocations() const;
+
+private:
+    static const size_t NumSizeClasses = sizeof(size_t) * 8;
+
+    size_t m_maxPooledBuffers = 0;
+    mutable std::mutex m_lock;
+    // Class n holds buffers with a capacity of at least 2^n bytes
+    std::array<std::vector<std::vector<uint8_t>>, NumSizeClasses> m_buffers;
+    uint64_t m_reuses = 0;
+    uint64_t m_allocations = 0;
+};
+
+// Returns its buffer to the pool when it goes out of scope.
+class PooledBuffer
+{
+public:
+    explicit PooledBuffer(BufferPool& pool) : m_pool(&pool), m_buffer(pool.Acquire()) {}
+    ~PooledBuffer()
+    {
+        if (m_pool != nullptr)
+        {
+            m_pool->Release(std::move(m_buffer));
+        }
+    }
+
+    PooledBuffer(PooledBuffer&& other) noexcept : m_pool(other.m_pool), m_buffer(std::move(other.m_buffer))
+    {
+        other.m_pool = nullptr;
+    }
+    PooledBuffer(PooledBuffer const&) = delete;
+    PooledBuffer& operator=(PooledBuffer const&) = delete;
+
+    std::vector<uint8_t>& Get() { return m_buffer; }
+
+private:
+    BufferPool* m_pool = nullptr;
+    std::vector<uint8_t> m_buffer;
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+// BGRA8 pixels read as 0xAARRGGBB when loaded as a little endian uint32_t,
+// which is the same layout WICColor uses.
+
+// Pixels with an alpha at or below this value are treated as fully
+// transparent. This matches the 0.1 threshold in FixTransparency.hlsl.
+const uint32_t TransparentAlphaThreshold = 25;
+
+inline uint32_t GetAlpha(uint32_t color) { return color >> 24; }
+inline uint32_t GetRed(uint32_t color) { return (color >> 16) & 0xFF; }
+inline uint32_t GetGreen(uint32_t color) { return (color >> 8) & 0xFF; }
+inline uint32_t GetBlue(uint32_t color) { return color & 0xFF; }
+
+inline uint32_t MakeColor(uint32_t alpha, uint32_t red, uint32_t green, uint32_t blue)
+{
+    return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+inline bool IsTransparentPixel(uint32_t color)
+{
+    return GetAlpha(color) <= TransparentAlphaThreshold;
+}
+
+inline uint32_t ColorDistanceSquared(uint32_t first, uint32_t second)
+{
+    auto red = static_cast<int>(GetRed(first)) - static_cast<int>(GetRed(second));
+    auto green = static_cast<int>(GetGreen(first)) - static_cast<int>(GetGreen(second));
+    auto blue = static_cast<int>(GetBlue(first)) - static_cast<int>(GetBlue(second));
+    return static_cast<uint32_t>((red * red) + (green * green) + (blue * blue));
+}
@@ -16,7 +16,8 @@ namespace winrt
 }
 
 std::future<std::unique_ptr<IComposedFrameProvider>> LoadComposedFrameProviderFromFileAsync(
-    winrt::Windows::Storage::StorageFile const& file)
+    winrt::Windows::Storage::StorageFile const& file,
+    ComposeOptions const& options)
 {
     auto extension = std::wstring(file.FileType());
     std::transform(extension.begin(), extension.end(), extension.begin(),
@@ -25,20 +26,15 @@ std::future<std::unique_ptr<IComposedFrameProvider>> LoadComposedFrameProviderFr
     std::unique_ptr<IComposedFrameProvider> result;
     if (extension == L".rani")
     {
-        auto document = co_await winrt::XmlDocument::LoadFromFileAsync(file);
-        auto project = LoadRaniProjectFromXmlDocument(document);
-        result = std::make_unique<RaniComposedFrameProvider>(std::move(project));
+        auto mappedFile = std::make_unique<MappedFile>(std::filesystem::path(std::wstring(file.Path())));
+        auto project = ParseRaniProject(mappedFile->Data(), mappedFile->Size());
+        result = std::make_unique<RaniComposedFrameProvider>(std::move(mappedFile), std::move(project), options);
     }
     else if (extension == L".gif")
     {
-        auto inMemoryStream = winrt::InMemoryRandomAccessStream();
-        {
-            auto stream = co_await file.OpenAsync(winrt::FileAccessMode::Read);
-            winrt::RandomAccessStream::CopyAsync(stream, inMemoryStream);
-        }
-
-        auto wicFactory = winrt::create_instance<IWICImagingFactory2>(CLSID_WICImagingFactory2, CLSCTX_INPROC_SERVER);
-        result = std::make_unique<GifComposedFrameProvider>(inMemoryStream, wicFactory);
+        auto mappedFile = std::make_unique<MappedFile>(std::filesystem::path(std::wstring(file.Path())));
+        auto gif = ParseGifFile(mappedFile->Data(), mappedFile->Size());
+        result = std::make_unique<GifComposedFrameProvider>(std::move(mappedFile), std::move(gif), options);
     }
     else
     {
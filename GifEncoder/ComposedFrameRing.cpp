@@ -0,0 +1,129 @@
+#include "pch.h"
+#include "ComposedFrameRing.h"
+#include "FrameCopyCounter.h"
+
+ComposedFrameRing::ComposedFrameRing(
+	winrt::com_ptr<ID3D11Device> const& d3dDevice,
+	uint32_t width,
+	uint32_t height,
+	uint32_t size)
+{
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = width;
+	desc.Height = height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+	desc.SampleDesc.Count = 1;
+
+	m_textures.resize(std::max(size, 1u));
+	for (auto&& texture : m_textures)
+	{
+		winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+	}
+}
+
+winrt::com_ptr<ID3D11Texture2D> const& ComposedFrameRing::Next()
+{
+	auto&& texture = m_textures[m_nextIndex];
+	m_nextIndex = (m_nextIndex + 1) % m_textures.size();
+	return texture;
+}
+
+FrameUploader::FrameUploader(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint32_t width, uint32_t height) : m_ring(d3dDevice, width, height)
+{
+	m_width = width;
+	m_height = height;
+	d3dDevice->GetImmediateContext(m_d3dContext.put());
+}
+
+void FrameUploader::SetFrame(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect)
+{
+	if (m_pendingPixels == nullptr)
+	{
+		m_pendingDirtyRect = dirtyRect;
+	}
+	else if (m_pendingDirtyRect.has_value() && dirtyRect.has_value())
+	{
+		m_pendingDirtyRect = UnionRects(m_pendingDirtyRect.value(), dirtyRect.value());
+	}
+	else
+	{
+		m_pendingDirtyRect = std::nullopt;
+	}
+	m_pendingPixels = pixels;
+}
+
+winrt::com_ptr<ID3D11Texture2D> const& FrameUploader::GetTexture()
+{
+	if (m_pendingPixels != nullptr)
+	{
+		Upload(m_pendingPixels, m_pendingDirtyRect);
+		m_pendingPixels = nullptr;
+		m_pendingDirtyRect = std::nullopt;
+	}
+	return m_previousTexture;
+}
+
+void FrameUploader::Upload(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect)
+{
+	// Ring textures hold older frames, so start from a copy of the
+	// previous one
+	auto&& texture = m_ring.Next();
+	auto stride = m_width * 4;
+	if (m_previousTexture == nullptr || !dirtyRect.has_value())
+	{
+		m_d3dContext->UpdateSubresource(texture.get(), 0, nullptr, pixels, stride, 0);
+		AddFrameBytesCopied(static_cast<size_t>(stride) * m_height);
+	}
+	else
+	{
+		m_d3dContext->CopyResource(texture.get(), m_previousTexture.get());
+		auto&& rect = dirtyRect.value();
+		if (!rect.IsEmpty())
+		{
+			D3D11_BOX box = { rect.Left, rect.Top, 0, rect.Right, rect.Bottom, 1 };
+			auto source = pixels + static_cast<size_t>(rect.Top) * m_width + rect.Left;
+			m_d3dContext->UpdateSubresource(texture.get(), 0, &box, source, stride, 0);
+			AddFrameBytesCopied(static_cast<size_t>(rect.Width()) * rect.Height() * 4);
+		}
+	}
+	m_previousTexture = texture;
+}
+
+FrameDownloader::FrameDownloader(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint32_t width, uint32_t height)
+{
+	m_width = width;
+	m_height = height;
+	d3dDevice->GetImmediateContext(m_d3dContext.put());
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = width;
+	desc.Height = height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.SampleDesc.Count = 1;
+	winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_stagingTexture.put()));
+}
+
+void FrameDownloader::Download(winrt::com_ptr<ID3D11Texture2D> const& texture, std::vector<uint32_t>& pixels)
+{
+	m_d3dContext->CopyResource(m_stagingTexture.get(), texture.get());
+	pixels.resize(static_cast<size_t>(m_width) * m_height);
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	winrt::check_hresult(m_d3dContext->Map(m_stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+	auto source = reinterpret_cast<uint8_t const*>(mapped.pData);
+	auto stride = static_cast<size_t>(m_width) * 4;
+	for (uint32_t y = 0; y < m_height; y++)
+	{
+		memcpy(pixels.data() + static_cast<size_t>(y) * m_width, source + static_cast<size_t>(y) * mapped.RowPitch, stride);
+	}
+	m_d3dContext->Unmap(m_stagingTexture.get(), 0);
+	AddFrameBytesCopied(stride * m_height);
+}
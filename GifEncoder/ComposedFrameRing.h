@@ -0,0 +1,70 @@
+#pragma once
+#include "FrameRect.h"
+
+// A fixed set of frame textures that are handed out round robin. Peak
+// memory stays the same no matter how many frames are composed.
+class ComposedFrameRing
+{
+public:
+	// Enough for the frame being encoded and the one being composed
+	static const uint32_t DefaultSize = 3;
+
+	ComposedFrameRing(
+		winrt::com_ptr<ID3D11Device> const& d3dDevice,
+		uint32_t width,
+		uint32_t height,
+		uint32_t size = DefaultSize);
+
+	// The texture can be used as both a render target and a shader resource.
+	winrt::com_ptr<ID3D11Texture2D> const& Next();
+
+private:
+	std::vector<winrt::com_ptr<ID3D11Texture2D>> m_textures;
+	size_t m_nextIndex = 0;
+};
+
+// Uploads frames composed on the CPU into ring textures, but only once
+// their texture is asked for, so frames that are dropped cost no GPU work.
+// When the caller knows what changed, the previous frame's texture is
+// copied and only the dirty rect is uploaded.
+class FrameUploader
+{
+public:
+	FrameUploader(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint32_t width, uint32_t height);
+
+	// The pixels must be tightly packed BGRA, and stay valid until the
+	// next frame is set. The dirty rects of frames that were never
+	// uploaded add up.
+	void SetFrame(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect);
+	// Uploads the last frame that was set, if it hasn't been already
+	winrt::com_ptr<ID3D11Texture2D> const& GetTexture();
+
+private:
+	void Upload(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect);
+
+	winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+	ComposedFrameRing m_ring;
+	winrt::com_ptr<ID3D11Texture2D> m_previousTexture;
+	uint32_t const* m_pendingPixels = nullptr;
+	// Covers everything that changed since the last upload
+	std::optional<FrameRect> m_pendingDirtyRect;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+};
+
+// Reads frame textures back to the CPU through a staging texture that is
+// reused for every frame.
+class FrameDownloader
+{
+public:
+	FrameDownloader(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint32_t width, uint32_t height);
+
+	// The pixels are resized to fit the frame and are tightly packed.
+	void Download(winrt::com_ptr<ID3D11Texture2D> const& texture, std::vector<uint32_t>& pixels);
+
+private:
+	winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+	winrt::com_ptr<ID3D11Texture2D> m_stagingTexture;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct ContentCacheStats
+{
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    uint64_t Evictions = 0;
+    size_t NumEntries = 0;
+    size_t BytesUsed = 0;
+};
+
+// Maps a content hash (e.g. XxHash64 of the encoded data) to the decoded
+// value, so identical content is only decoded once and then shared. Once
+// the values in the cache take up more than the memory budget, the least
+// recently used ones are dropped; anyone still holding them keeps them
+// alive. The size of a value comes from a GetCacheEntrySize(T const&)
+// overload. Safe to use from several threads. If two threads ask for the
+// same missing key, one decodes it and the other waits.
+template <typename T>
+class ContentCache
+{
+public:
+    static const size_t DefaultMemoryBudget = 512 * 1024 * 1024;
+
+    explicit ContentCache(size_t memoryBudget = DefaultMemoryBudget) : m_memoryBudget(memoryBudget) {}
+
+    ContentCache(ContentCache const&) = delete;
+    ContentCache& operator=(ContentCache const&) = delete;
+
+    // The create function returns a std::shared_ptr<T const>.
+    template <typename Create>
+    std::shared_ptr<T const> GetOrCreate(uint64_t key, Create&& create)
+    {
+        std::promise<std::shared_ptr<T const>> promise;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            auto it = m_entries.find(key);
+            if (it != m_entries.end())
+            {
+                m_stats.Hits++;
+                auto&& entry = it->second;
+                m_order.splice(m_order.begin(), m_order, entry.Position);
+                auto value = entry.Value;
+                lock.unlock();
+                return value.get();
+            }
+
+            m_stats.Misses++;
+            m_order.push_front(key);
+            m_entries.emplace(key, Entry{ promise.get_future().share(), 0, m_order.begin() });
+        }
+
+        std::shared_ptr<T const> value;
+        try
+        {
+            value = create();
+        }
+        catch (...)
+        {
+            // Let waiters see the error, but don't keep it around
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(m_lock);
+            auto it = m_entries.find(key);
+            m_order.erase(it->second.Position);
+            m_entries.erase(it);
+            throw;
+        }
+        promise.set_value(value);
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end())
+        {
+            it->second.Bytes = GetCacheEntrySize(*value);
+            m_stats.BytesUsed += it->second.Bytes;
+            Evict();
+        }
+        return value;
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        // Entries that are still being created are removed by their creator
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (IsReady(it->second))
+            {
+                m_stats.BytesUsed -= it->second.Bytes;
+                m_order.erase(it->second.Position);
+                it = m_entries.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+
+    ContentCacheStats Statistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto stats = m_stats;
+        stats.NumEntries = m_entries.size();
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_future<std::shared_ptr<T const>> Value;
+        // Zero until the value has been created
+        size_t Bytes;
+        typename std::list<uint64_t>::iterator Position;
+    };
+
+    static bool IsReady(Entry const& entry)
+    {
+        return entry.Value.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Must be called with the lock held
+    void Evict()
+    {
+        auto it = m_order.end();
+        while (m_stats.BytesUsed > m_memoryBudget && it != m_order.begin())
+        {
+            it--;
+            auto entry = m_entries.find(*it);
+            // Always keep the most recently used entry, even if it's over budget
+            if (it == m_order.begin() || !IsReady(entry->second))
+            {
+                continue;
+            }
+            m_stats.BytesUsed -= entry->second.Bytes;
+            m_stats.Evictions++;
+            m_entries.erase(entry);
+            it = m_order.erase(it);
+        }
+    }
+
+    size_t m_memoryBudget = 0;
+    mutable std::mutex m_lock;
+    // Most recently used first
+    std::list<uint64_t> m_order;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    ContentCacheStats m_stats;
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define GIFENCODER_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define GIFENCODER_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC lets us use any intrinsic regardless of the target architecture,
+// but GCC and Clang need functions that use newer instructions to be
+// marked as such.
+#if defined(GIFENCODER_X86) && !defined(_MSC_VER)
+#define GIFENCODER_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define GIFENCODER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define GIFENCODER_TARGET_SSE41
+#define GIFENCODER_TARGET_AVX2
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    Sse2,
+    // Includes SSSE3
+    Sse41,
+    Avx2,
+    Neon,
+};
+
+inline const wchar_t* SimdLevelToString(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Sse2:
+        return L"sse2";
+    case SimdLevel::Sse41:
+        return L"sse4.1";
+    case SimdLevel::Avx2:
+        return L"avx2";
+    case SimdLevel::Neon:
+        return L"neon";
+    default:
+        return L"scalar";
+    }
+}
+
+inline bool IsSimdLevelSupported(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return true;
+#if defined(GIFENCODER_X86)
+    // SSE2 is part of the x64 baseline, and every x86 CPU we'd run on has it
+    case SimdLevel::Sse2:
+        return true;
+    case SimdLevel::Sse41:
+    {
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 1);
+        auto ssse3 = (info[2] & (1 << 9)) != 0;
+        auto sse41 = (info[2] & (1 << 19)) != 0;
+        return ssse3 && sse41;
+#else
+        return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+#endif
+    }
+    case SimdLevel::Avx2:
+    {
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuid(info, 1);
+        // The OS needs to save the YMM registers (OSXSAVE + AVX)
+        auto osxsave = (info[2] & (1 << 27)) != 0;
+        auto avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+#if defined(GIFENCODER_NEON)
+    case SimdLevel::Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+inline SimdLevel GetBestSimdLevel()
+{
+    static const SimdLevel level = []()
+    {
+        const SimdLevel candidates[] = { SimdLevel::Avx2, SimdLevel::Neon, SimdLevel::Sse41, SimdLevel::Sse2 };
+        for (auto&& candidate : candidates)
+        {
+            if (IsSimdLevelSupported(candidate))
+            {
+                return candidate;
+            }
+        }
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+inline uint32_t PopCount32(uint32_t value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    value = (value + (value >> 4)) & 0x0F0F0F0F;
+    return (value * 0x01010101) >> 24;
+}
+
+// The value must not be zero
+inline uint32_t CountTrailingZeros32(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanForward(&index, value);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+}
+
+// The value must not be zero
+inline uint32_t HighestSetBit32(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanReverse(&index, value);
+    return static_cast<uint32_t>(index);
+#else
+    return 31 - static_cast<uint32_t>(__builtin_clz(value));
+#endif
+}
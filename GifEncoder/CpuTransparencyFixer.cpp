@@ -0,0 +1,116 @@
+#include "pch.h"
+#include "CpuTransparencyFixer.h"
+
+CpuTransparencyFixer::CpuTransparencyFixer(uint32_t width, uint32_t height, SimdLevel simdLevel, DiffTolerance const& tolerance)
+{
+	m_width = width;
+	m_height = height;
+	m_previousPixels.resize(static_cast<size_t>(width) * height, 0);
+
+	m_kernel = GetDiffRowKernel(simdLevel);
+	if (m_kernel == nullptr)
+	{
+		m_kernel = GetDiffRowKernel(SimdLevel::Scalar);
+	}
+	if (tolerance.Mode != DiffToleranceMode::Exact)
+	{
+		if (tolerance.Threshold > 255)
+		{
+			throw std::invalid_argument("The diff threshold must be between 0 and 255.");
+		}
+		m_threshold = tolerance.Threshold;
+		m_toleranceKernel = GetToleranceDiffRowKernel(tolerance.Mode, simdLevel);
+		if (m_toleranceKernel == nullptr)
+		{
+			m_toleranceKernel = GetToleranceDiffRowKernel(tolerance.Mode, SimdLevel::Scalar);
+		}
+	}
+}
+
+void CpuTransparencyFixer::InitPrevious(uint8_t const* previousPixels)
+{
+	memcpy(m_previousPixels.data(), previousPixels, m_previousPixels.size() * sizeof(uint32_t));
+}
+
+DiffInfo CpuTransparencyFixer::ProcessInput(
+	uint8_t const* pixels,
+	int transparentColorIndex,
+	std::vector<uint8_t>& indexPixels,
+	std::optional<FrameRect> const& dirtyRect)
+{
+	if (indexPixels.size() != m_previousPixels.size())
+	{
+		throw std::invalid_argument("Unexpected index buffer size.");
+	}
+
+	auto scanRect = FrameRect{ 0, 0, m_width, m_height };
+	if (dirtyRect.has_value())
+	{
+		scanRect.Left = std::min(dirtyRect->Left, m_width);
+		scanRect.Top = std::min(dirtyRect->Top, m_height);
+		scanRect.Right = std::min(dirtyRect->Right, m_width);
+		scanRect.Bottom = std::min(dirtyRect->Bottom, m_height);
+	}
+
+	auto transparentIndex = static_cast<uint8_t>(transparentColorIndex);
+	auto current = reinterpret_cast<uint32_t const*>(pixels);
+	if (m_pool == nullptr || scanRect.IsEmpty())
+	{
+		return ProcessRows(current, transparentIndex, indexPixels, scanRect, scanRect.Top, scanRect.Bottom);
+	}
+
+	// Every band writes its own rows and its own partial result
+	m_bandDiffInfos.resize(m_pool->GetBandCount(scanRect.Top, scanRect.Bottom));
+	m_pool->ForEachBand(scanRect.Top, scanRect.Bottom, [&](uint32_t top, uint32_t bottom, uint32_t band, uint32_t)
+	{
+		m_bandDiffInfos[band] = ProcessRows(current, transparentIndex, indexPixels, scanRect, top, bottom);
+	});
+	auto diffInfo = CreateInitialDiffInfo(m_width, m_height);
+	for (auto&& bandDiffInfo : m_bandDiffInfos)
+	{
+		MergeDiffInfo(diffInfo, bandDiffInfo);
+	}
+	return diffInfo;
+}
+
+DiffInfo CpuTransparencyFixer::ProcessRows(
+	uint32_t const* current,
+	uint8_t transparentIndex,
+	std::vector<uint8_t>& indexPixels,
+	FrameRect const& scanRect,
+	uint32_t top,
+	uint32_t bottom)
+{
+	// Same initial values as the shader uses
+	auto diffInfo = CreateInitialDiffInfo(m_width, m_height);
+	for (uint32_t y = top; y < bottom && !scanRect.IsEmpty(); y++)
+	{
+		auto offset = static_cast<size_t>(y) * m_width + scanRect.Left;
+		auto result = m_toleranceKernel
+			? m_toleranceKernel(
+				current + offset,
+				m_previousPixels.data() + offset,
+				indexPixels.data() + offset,
+				scanRect.Width(),
+				transparentIndex,
+				m_threshold)
+			: m_kernel(
+				current + offset,
+				m_previousPixels.data() + offset,
+				indexPixels.data() + offset,
+				scanRect.Width(),
+				transparentIndex);
+
+		diffInfo.NumToleratedPixels += result.NumToleratedPixels;
+		if (result.NumDifferingPixels > 0)
+		{
+			diffInfo.NumDifferingPixels += result.NumDifferingPixels;
+			diffInfo.left = std::min(diffInfo.left, scanRect.Left + result.First);
+			diffInfo.right = std::max(diffInfo.right, scanRect.Left + result.End);
+			diffInfo.top = std::min(diffInfo.top, y);
+			diffInfo.bottom = std::max(diffInfo.bottom, y + 1);
+		}
+	}
+
+	return diffInfo;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <optional>
+#include <vector>
+#include "DiffInfo.h"
+#include "DiffKernels.h"
+#include "FrameRect.h"
+#include "RowBandPool.h"
+
+// A CPU implementation of TransparencyFixer. It follows the same DiffInfo
+// contract as FixTransparency.hlsl, but works on BGRA pixels in memory
+// and doesn't need a D3D device.
+class CpuTransparencyFixer
+{
+public:
+	// With a tolerance other than exact, pixels that stay within it of the
+	// last color written for them count as unchanged, and the previous
+	// frame only follows the pixels that changed.
+	CpuTransparencyFixer(uint32_t width, uint32_t height, SimdLevel simdLevel = GetBestSimdLevel(), DiffTolerance const& tolerance = {});
+
+	// With a pool, ProcessInput diffs the frame in row bands. The result
+	// is the same either way. The pool must outlive the fixer.
+	void SetRowBandPool(RowBandPool* pool) { m_pool = pool; }
+
+	// Both methods expect tightly packed BGRA pixels (width * 4 bytes per row).
+	void InitPrevious(uint8_t const* previousPixels);
+	// When a dirty rect is given, pixels outside of it are assumed to match
+	// the previous frame and are skipped. Their indices are left as they are.
+	DiffInfo ProcessInput(
+		uint8_t const* pixels,
+		int transparentColorIndex,
+		std::vector<uint8_t>& indexPixels,
+		std::optional<FrameRect> const& dirtyRect = std::nullopt);
+
+private:
+	DiffInfo ProcessRows(
+		uint32_t const* current,
+		uint8_t transparentIndex,
+		std::vector<uint8_t>& indexPixels,
+		FrameRect const& scanRect,
+		uint32_t top,
+		uint32_t bottom);
+
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	DiffRowKernel m_kernel = nullptr;
+	ToleranceDiffRowKernel m_toleranceKernel = nullptr;
+	uint32_t m_threshold = 0;
+	std::vector<uint32_t> m_previousPixels;
+	RowBandPool* m_pool = nullptr;
+	// Merged in band order once every band is done
+	std::vector<DiffInfo> m_bandDiffInfos;
+};
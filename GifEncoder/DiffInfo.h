@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include "FrameRect.h"
+
+// Matches the layout of the DiffInfo struct in FixTransparency.hlsl. The
+// bounds are half-open like FrameRect: right and bottom are one past the
+// last pixel that changed. With no changes they stay at their initial
+// values, which form an empty rect.
+struct DiffInfo
+{
+	uint32_t NumDifferingPixels;
+	uint32_t left;
+	uint32_t top;
+	uint32_t right;
+	uint32_t bottom;
+	// Pixels that differ from the previous frame but stay within the
+	// diff tolerance. Always 0 for an exact diff.
+	uint32_t NumToleratedPixels;
+};
+
+// Structured buffer strides must be a multiple of 4
+static_assert(sizeof(DiffInfo) % 4 == 0, "DiffInfo must match the shader's layout.");
+
+// The values the diff starts from, before any pixel has been compared
+inline DiffInfo CreateInitialDiffInfo(uint32_t width, uint32_t height)
+{
+	DiffInfo diffInfo = {};
+	diffInfo.NumDifferingPixels = 0;
+	diffInfo.left = width;
+	diffInfo.top = height;
+	diffInfo.right = 0;
+	diffInfo.bottom = 0;
+	diffInfo.NumToleratedPixels = 0;
+	return diffInfo;
+}
+
+// Adds the changes found in another part of the same frame. Counts are
+// sums and bounds are mins and maxes, so parts can be merged in any order.
+inline void MergeDiffInfo(DiffInfo& diffInfo, DiffInfo const& part)
+{
+	diffInfo.NumDifferingPixels += part.NumDifferingPixels;
+	diffInfo.NumToleratedPixels += part.NumToleratedPixels;
+	if (part.NumDifferingPixels > 0)
+	{
+		diffInfo.left = std::min(diffInfo.left, part.left);
+		diffInfo.top = std::min(diffInfo.top, part.top);
+		diffInfo.right = std::max(diffInfo.right, part.right);
+		diffInfo.bottom = std::max(diffInfo.bottom, part.bottom);
+	}
+}
+
+// The exact area that changed. Empty when no pixel changed.
+inline FrameRect GetDiffRect(DiffInfo const& diffInfo)
+{
+	if (diffInfo.NumDifferingPixels == 0)
+	{
+		return FrameRect{};
+	}
+	return FrameRect{ diffInfo.left, diffInfo.top, diffInfo.right, diffInfo.bottom };
+}
@@ -0,0 +1,513 @@
+#include "pch.h"
+#include "DiffKernels.h"
+
+namespace
+{
+    inline void AccumulateMask(RowDiffResult& result, uint32_t changedMask, uint32_t x)
+    {
+        if (changedMask != 0)
+        {
+            if (result.NumDifferingPixels == 0)
+            {
+                result.First = x + CountTrailingZeros32(changedMask);
+            }
+            result.End = x + HighestSetBit32(changedMask) + 1;
+            result.NumDifferingPixels += PopCount32(changedMask);
+        }
+    }
+
+    void DiffRowTail(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t start,
+        uint32_t width,
+        uint8_t transparentIndex,
+        RowDiffResult& result)
+    {
+        for (uint32_t x = start; x < width; x++)
+        {
+            auto currentPixel = current[x];
+            auto changed = currentPixel != previous[x];
+            if (changed)
+            {
+                if (result.NumDifferingPixels == 0)
+                {
+                    result.First = x;
+                }
+                result.End = x + 1;
+                result.NumDifferingPixels++;
+            }
+            if (!changed || (currentPixel >> 24) <= TransparentAlphaThreshold)
+            {
+                indices[x] = transparentIndex;
+            }
+            previous[x] = currentPixel;
+        }
+    }
+
+    RowDiffResult DiffRowScalar(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex)
+    {
+        RowDiffResult result = {};
+        DiffRowTail(current, previous, indices, 0, width, transparentIndex, result);
+        return result;
+    }
+
+    template <bool (*IsWithin)(uint32_t, uint32_t, uint32_t)>
+    void DiffRowToleranceTail(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t start,
+        uint32_t width,
+        uint8_t transparentIndex,
+        uint32_t threshold,
+        RowDiffResult& result)
+    {
+        for (uint32_t x = start; x < width; x++)
+        {
+            auto currentPixel = current[x];
+            auto changed = currentPixel != previous[x];
+            if (changed && IsWithin(currentPixel, previous[x], threshold))
+            {
+                result.NumToleratedPixels++;
+                changed = false;
+            }
+            if (changed)
+            {
+                if (result.NumDifferingPixels == 0)
+                {
+                    result.First = x;
+                }
+                result.End = x + 1;
+                result.NumDifferingPixels++;
+                previous[x] = currentPixel;
+            }
+            if (!changed || (currentPixel >> 24) <= TransparentAlphaThreshold)
+            {
+                indices[x] = transparentIndex;
+            }
+        }
+    }
+
+    template <bool (*IsWithin)(uint32_t, uint32_t, uint32_t)>
+    RowDiffResult DiffRowToleranceScalar(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex,
+        uint32_t threshold)
+    {
+        RowDiffResult result = {};
+        DiffRowToleranceTail<IsWithin>(current, previous, indices, 0, width, transparentIndex, threshold, result);
+        return result;
+    }
+
+#if defined(GIFENCODER_X86)
+    // Produces an all-ones lane for every pixel that changed, and one for
+    // every pixel that should keep its index.
+    inline void ComparePixelsSse2(
+        __m128i currentPixels,
+        __m128i previousPixels,
+        __m128i& changed,
+        __m128i& keep)
+    {
+        const auto threshold = _mm_set1_epi32(static_cast<int>(TransparentAlphaThreshold));
+        changed = _mm_xor_si128(_mm_cmpeq_epi32(currentPixels, previousPixels), _mm_set1_epi32(-1));
+        auto visible = _mm_cmpgt_epi32(_mm_srli_epi32(currentPixels, 24), threshold);
+        keep = _mm_and_si128(changed, visible);
+    }
+
+    RowDiffResult DiffRowSse2(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex)
+    {
+        RowDiffResult result = {};
+        const auto transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+
+        // 16 pixels at a time so the masks pack down to a full vector of indices
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i changed[4];
+            __m128i keep[4];
+            for (auto i = 0; i < 4; i++)
+            {
+                auto currentPixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(current + x + (i * 4)));
+                auto previousPixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previous + x + (i * 4)));
+                ComparePixelsSse2(currentPixels, previousPixels, changed[i], keep[i]);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(previous + x + (i * 4)), currentPixels);
+            }
+
+            auto changedBytes = _mm_packs_epi16(_mm_packs_epi32(changed[0], changed[1]), _mm_packs_epi32(changed[2], changed[3]));
+            auto changedMask = static_cast<uint32_t>(_mm_movemask_epi8(changedBytes));
+            AccumulateMask(result, changedMask, x);
+
+            auto keepBytes = _mm_packs_epi16(_mm_packs_epi32(keep[0], keep[1]), _mm_packs_epi32(keep[2], keep[3]));
+            auto indexBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(indices + x));
+            indexBytes = _mm_or_si128(_mm_and_si128(keepBytes, indexBytes), _mm_andnot_si128(keepBytes, transparent));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + x), indexBytes);
+        }
+
+        DiffRowTail(current, previous, indices, x, width, transparentIndex, result);
+        return result;
+    }
+
+    // Like ComparePixelsSse2, but a pixel only counts as changed when one
+    // of its channels moved further than the threshold. Pixels that
+    // differ but stay within it are flagged in tolerated.
+    inline void ComparePixelsWithThresholdSse2(
+        __m128i currentPixels,
+        __m128i previousPixels,
+        __m128i threshold,
+        __m128i& changed,
+        __m128i& tolerated,
+        __m128i& keep)
+    {
+        const auto alphaThreshold = _mm_set1_epi32(static_cast<int>(TransparentAlphaThreshold));
+        const auto zero = _mm_setzero_si128();
+        auto delta = _mm_or_si128(_mm_subs_epu8(currentPixels, previousPixels), _mm_subs_epu8(previousPixels, currentPixels));
+        auto withinThreshold = _mm_cmpeq_epi32(_mm_subs_epu8(delta, threshold), zero);
+        auto equal = _mm_cmpeq_epi32(currentPixels, previousPixels);
+        changed = _mm_xor_si128(withinThreshold, _mm_set1_epi32(-1));
+        tolerated = _mm_andnot_si128(equal, withinThreshold);
+        auto visible = _mm_cmpgt_epi32(_mm_srli_epi32(currentPixels, 24), alphaThreshold);
+        keep = _mm_and_si128(changed, visible);
+    }
+
+    RowDiffResult DiffRowChannelToleranceSse2(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex,
+        uint32_t threshold)
+    {
+        RowDiffResult result = {};
+        const auto transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+        const auto thresholdBytes = _mm_set1_epi8(static_cast<char>(threshold));
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i changed[4];
+            __m128i tolerated[4];
+            __m128i keep[4];
+            for (auto i = 0; i < 4; i++)
+            {
+                auto currentPixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(current + x + (i * 4)));
+                auto previousPixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previous + x + (i * 4)));
+                ComparePixelsWithThresholdSse2(currentPixels, previousPixels, thresholdBytes, changed[i], tolerated[i], keep[i]);
+                auto reference = _mm_or_si128(_mm_and_si128(changed[i], currentPixels), _mm_andnot_si128(changed[i], previousPixels));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(previous + x + (i * 4)), reference);
+            }
+
+            auto changedBytes = _mm_packs_epi16(_mm_packs_epi32(changed[0], changed[1]), _mm_packs_epi32(changed[2], changed[3]));
+            AccumulateMask(result, static_cast<uint32_t>(_mm_movemask_epi8(changedBytes)), x);
+            auto toleratedBytes = _mm_packs_epi16(_mm_packs_epi32(tolerated[0], tolerated[1]), _mm_packs_epi32(tolerated[2], tolerated[3]));
+            result.NumToleratedPixels += PopCount32(static_cast<uint32_t>(_mm_movemask_epi8(toleratedBytes)));
+
+            auto keepBytes = _mm_packs_epi16(_mm_packs_epi32(keep[0], keep[1]), _mm_packs_epi32(keep[2], keep[3]));
+            auto indexBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(indices + x));
+            indexBytes = _mm_or_si128(_mm_and_si128(keepBytes, indexBytes), _mm_andnot_si128(keepBytes, transparent));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + x), indexBytes);
+        }
+
+        DiffRowToleranceTail<IsWithinChannelTolerance>(current, previous, indices, x, width, transparentIndex, threshold, result);
+        return result;
+    }
+
+    // Packs two vectors of 8 32-bit masks into 16 byte masks in pixel order.
+    GIFENCODER_TARGET_AVX2
+    inline __m128i PackMasksAvx2(__m256i first, __m256i second)
+    {
+        // packs works within each 128-bit lane, so put the 64-bit
+        // quarters back in order before narrowing again.
+        auto words = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xD8);
+        return _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    }
+
+    GIFENCODER_TARGET_AVX2
+    RowDiffResult DiffRowAvx2(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex)
+    {
+        RowDiffResult result = {};
+        const auto transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+        const auto threshold = _mm256_set1_epi32(static_cast<int>(TransparentAlphaThreshold));
+        const auto allOnes = _mm256_set1_epi32(-1);
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m256i changed[2];
+            __m256i keep[2];
+            for (auto i = 0; i < 2; i++)
+            {
+                auto currentPixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(current + x + (i * 8)));
+                auto previousPixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(previous + x + (i * 8)));
+                changed[i] = _mm256_xor_si256(_mm256_cmpeq_epi32(currentPixels, previousPixels), allOnes);
+                auto visible = _mm256_cmpgt_epi32(_mm256_srli_epi32(currentPixels, 24), threshold);
+                keep[i] = _mm256_and_si256(changed[i], visible);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(previous + x + (i * 8)), currentPixels);
+            }
+
+            auto changedMask = static_cast<uint32_t>(_mm_movemask_epi8(PackMasksAvx2(changed[0], changed[1])));
+            AccumulateMask(result, changedMask, x);
+
+            auto keepBytes = PackMasksAvx2(keep[0], keep[1]);
+            auto indexBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(indices + x));
+            indexBytes = _mm_blendv_epi8(transparent, indexBytes, keepBytes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + x), indexBytes);
+        }
+
+        DiffRowTail(current, previous, indices, x, width, transparentIndex, result);
+        return result;
+    }
+
+    GIFENCODER_TARGET_AVX2
+    RowDiffResult DiffRowChannelToleranceAvx2(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex,
+        uint32_t threshold)
+    {
+        RowDiffResult result = {};
+        const auto transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+        const auto thresholdBytes = _mm256_set1_epi8(static_cast<char>(threshold));
+        const auto alphaThreshold = _mm256_set1_epi32(static_cast<int>(TransparentAlphaThreshold));
+        const auto zero = _mm256_setzero_si256();
+        const auto allOnes = _mm256_set1_epi32(-1);
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m256i changed[2];
+            __m256i tolerated[2];
+            __m256i keep[2];
+            for (auto i = 0; i < 2; i++)
+            {
+                auto currentPixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(current + x + (i * 8)));
+                auto previousPixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(previous + x + (i * 8)));
+                auto delta = _mm256_or_si256(_mm256_subs_epu8(currentPixels, previousPixels), _mm256_subs_epu8(previousPixels, currentPixels));
+                auto withinThreshold = _mm256_cmpeq_epi32(_mm256_subs_epu8(delta, thresholdBytes), zero);
+                auto equal = _mm256_cmpeq_epi32(currentPixels, previousPixels);
+                changed[i] = _mm256_xor_si256(withinThreshold, allOnes);
+                tolerated[i] = _mm256_andnot_si256(equal, withinThreshold);
+                auto visible = _mm256_cmpgt_epi32(_mm256_srli_epi32(currentPixels, 24), alphaThreshold);
+                keep[i] = _mm256_and_si256(changed[i], visible);
+                auto reference = _mm256_blendv_epi8(previousPixels, currentPixels, changed[i]);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(previous + x + (i * 8)), reference);
+            }
+
+            AccumulateMask(result, static_cast<uint32_t>(_mm_movemask_epi8(PackMasksAvx2(changed[0], changed[1]))), x);
+            result.NumToleratedPixels += PopCount32(static_cast<uint32_t>(_mm_movemask_epi8(PackMasksAvx2(tolerated[0], tolerated[1]))));
+
+            auto keepBytes = PackMasksAvx2(keep[0], keep[1]);
+            auto indexBytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(indices + x));
+            indexBytes = _mm_blendv_epi8(transparent, indexBytes, keepBytes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + x), indexBytes);
+        }
+
+        DiffRowToleranceTail<IsWithinChannelTolerance>(current, previous, indices, x, width, transparentIndex, threshold, result);
+        return result;
+    }
+#endif
+
+#if defined(GIFENCODER_NEON)
+    inline uint8x16_t NarrowMasksNeon(uint32x4_t a, uint32x4_t b, uint32x4_t c, uint32x4_t d)
+    {
+        auto low = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+        auto high = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+        return vcombine_u8(vmovn_u16(low), vmovn_u16(high));
+    }
+
+    RowDiffResult DiffRowNeon(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex)
+    {
+        RowDiffResult result = {};
+        const auto transparent = vdupq_n_u8(transparentIndex);
+        const auto threshold = vdupq_n_u32(TransparentAlphaThreshold);
+        // Used to build a 16-bit mask out of the changed bytes
+        const uint8_t bitValues[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        const auto bits = vld1q_u8(bitValues);
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            uint32x4_t changed[4];
+            uint32x4_t keep[4];
+            for (auto i = 0; i < 4; i++)
+            {
+                auto currentPixels = vld1q_u32(current + x + (i * 4));
+                auto previousPixels = vld1q_u32(previous + x + (i * 4));
+                changed[i] = vmvnq_u32(vceqq_u32(currentPixels, previousPixels));
+                auto visible = vcgtq_u32(vshrq_n_u32(currentPixels, 24), threshold);
+                keep[i] = vandq_u32(changed[i], visible);
+                vst1q_u32(previous + x + (i * 4), currentPixels);
+            }
+
+            auto changedBytes = NarrowMasksNeon(changed[0], changed[1], changed[2], changed[3]);
+            auto maskBits = vandq_u8(changedBytes, bits);
+            auto changedMask = static_cast<uint32_t>(vaddv_u8(vget_low_u8(maskBits))) |
+                (static_cast<uint32_t>(vaddv_u8(vget_high_u8(maskBits))) << 8);
+            AccumulateMask(result, changedMask, x);
+
+            auto keepBytes = NarrowMasksNeon(keep[0], keep[1], keep[2], keep[3]);
+            auto indexBytes = vld1q_u8(indices + x);
+            vst1q_u8(indices + x, vbslq_u8(keepBytes, indexBytes, transparent));
+        }
+
+        DiffRowTail(current, previous, indices, x, width, transparentIndex, result);
+        return result;
+    }
+
+    inline uint32_t MaskBitsNeon(uint8x16_t bytes, uint8x16_t bits)
+    {
+        auto maskBits = vandq_u8(bytes, bits);
+        return static_cast<uint32_t>(vaddv_u8(vget_low_u8(maskBits))) |
+            (static_cast<uint32_t>(vaddv_u8(vget_high_u8(maskBits))) << 8);
+    }
+
+    RowDiffResult DiffRowChannelToleranceNeon(
+        uint32_t const* current,
+        uint32_t* previous,
+        uint8_t* indices,
+        uint32_t width,
+        uint8_t transparentIndex,
+        uint32_t threshold)
+    {
+        RowDiffResult result = {};
+        const auto transparent = vdupq_n_u8(transparentIndex);
+        const auto thresholdBytes = vdupq_n_u8(static_cast<uint8_t>(threshold));
+        const auto alphaThreshold = vdupq_n_u32(TransparentAlphaThreshold);
+        const uint8_t bitValues[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        const auto bits = vld1q_u8(bitValues);
+
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            uint32x4_t changed[4];
+            uint32x4_t tolerated[4];
+            uint32x4_t keep[4];
+            for (auto i = 0; i < 4; i++)
+            {
+                auto currentPixels = vld1q_u32(current + x + (i * 4));
+                auto previousPixels = vld1q_u32(previous + x + (i * 4));
+                auto delta = vabdq_u8(vreinterpretq_u8_u32(currentPixels), vreinterpretq_u8_u32(previousPixels));
+                auto overThreshold = vreinterpretq_u32_u8(vcgtq_u8(delta, thresholdBytes));
+                changed[i] = vtstq_u32(overThreshold, overThreshold);
+                tolerated[i] = vbicq_u32(vmvnq_u32(vceqq_u32(currentPixels, previousPixels)), changed[i]);
+                auto visible = vcgtq_u32(vshrq_n_u32(currentPixels, 24), alphaThreshold);
+                keep[i] = vandq_u32(changed[i], visible);
+                vst1q_u32(previous + x + (i * 4), vbslq_u32(changed[i], currentPixels, previousPixels));
+            }
+
+            AccumulateMask(result, MaskBitsNeon(NarrowMasksNeon(changed[0], changed[1], changed[2], changed[3]), bits), x);
+            result.NumToleratedPixels += PopCount32(MaskBitsNeon(NarrowMasksNeon(tolerated[0], tolerated[1], tolerated[2], tolerated[3]), bits));
+
+            auto keepBytes = NarrowMasksNeon(keep[0], keep[1], keep[2], keep[3]);
+            auto indexBytes = vld1q_u8(indices + x);
+            vst1q_u8(indices + x, vbslq_u8(keepBytes, indexBytes, transparent));
+        }
+
+        DiffRowToleranceTail<IsWithinChannelTolerance>(current, previous, indices, x, width, transparentIndex, threshold, result);
+        return result;
+    }
+#endif
+}
+
+wchar_t const* DiffToleranceModeToString(DiffToleranceMode mode)
+{
+    switch (mode)
+    {
+    case DiffToleranceMode::Exact:
+        return L"exact";
+    case DiffToleranceMode::Channel:
+        return L"channel";
+    case DiffToleranceMode::YCbCr:
+        return L"ycbcr";
+    default:
+        throw std::runtime_error("Unknown DiffToleranceMode value!");
+    }
+}
+
+DiffRowKernel GetDiffRowKernel(SimdLevel level)
+{
+    if (!IsSimdLevelSupported(level))
+    {
+        return nullptr;
+    }
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return DiffRowScalar;
+#if defined(GIFENCODER_X86)
+    case SimdLevel::Sse2:
+    // Nothing in SSE4.1 helps here
+    case SimdLevel::Sse41:
+        return DiffRowSse2;
+    case SimdLevel::Avx2:
+        return DiffRowAvx2;
+#endif
+#if defined(GIFENCODER_NEON)
+    case SimdLevel::Neon:
+        return DiffRowNeon;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+ToleranceDiffRowKernel GetToleranceDiffRowKernel(DiffToleranceMode mode, SimdLevel level)
+{
+    if (!IsSimdLevelSupported(level))
+    {
+        return nullptr;
+    }
+    // Only the per-channel test is vectorized so far
+    if (mode == DiffToleranceMode::YCbCr)
+    {
+        return DiffRowToleranceScalar<IsWithinYCbCrTolerance>;
+    }
+    if (mode != DiffToleranceMode::Channel)
+    {
+        return nullptr;
+    }
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return DiffRowToleranceScalar<IsWithinChannelTolerance>;
+#if defined(GIFENCODER_X86)
+    case SimdLevel::Sse2:
+    case SimdLevel::Sse41:
+        return DiffRowChannelToleranceSse2;
+    case SimdLevel::Avx2:
+        return DiffRowChannelToleranceAvx2;
+#endif
+#if defined(GIFENCODER_NEON)
+    case SimdLevel::Neon:
+        return DiffRowChannelToleranceNeon;
+#endif
+    default:
+        return nullptr;
+    }
+}
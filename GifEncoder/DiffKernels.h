@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include "CpuFeatures.h"
+#include "Color.h"
+
+// How far a pixel may drift from the last color written for it before it
+// counts as changed. Anything but Exact is lossy: noise from a camera or a
+// video codec no longer marks every pixel as changed. The values are the
+// ones FixTransparency.hlsl expects.
+enum class DiffToleranceMode
+{
+    // Any difference at all
+    Exact,
+    // Every channel, alpha included, within the threshold
+    Channel,
+    // Alpha within the threshold and the YCbCr distance within it, with
+    // chroma counting half as much as luma
+    YCbCr,
+};
+
+wchar_t const* DiffToleranceModeToString(DiffToleranceMode mode);
+
+struct DiffTolerance
+{
+    DiffToleranceMode Mode = DiffToleranceMode::Exact;
+    // 0 to 255, in 8-bit channel steps
+    uint32_t Threshold = 0;
+};
+
+inline bool IsWithinChannelTolerance(uint32_t current, uint32_t reference, uint32_t threshold)
+{
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+    {
+        auto delta = static_cast<int32_t>((current >> shift) & 0xFF) - static_cast<int32_t>((reference >> shift) & 0xFF);
+        if (static_cast<uint32_t>(std::abs(delta)) > threshold)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// BT.601 weights in 8-bit fixed point. FixTransparency.hlsl does the same
+// integer math, so both diffs agree on every pixel.
+inline bool IsWithinYCbCrTolerance(uint32_t current, uint32_t reference, uint32_t threshold)
+{
+    auto alpha = static_cast<int32_t>(GetAlpha(current)) - static_cast<int32_t>(GetAlpha(reference));
+    auto red = static_cast<int32_t>(GetRed(current)) - static_cast<int32_t>(GetRed(reference));
+    auto green = static_cast<int32_t>(GetGreen(current)) - static_cast<int32_t>(GetGreen(reference));
+    auto blue = static_cast<int32_t>(GetBlue(current)) - static_cast<int32_t>(GetBlue(reference));
+    auto luma = ((77 * red) + (150 * green) + (29 * blue)) >> 8;
+    auto blueChroma = ((-43 * red) - (85 * green) + (128 * blue)) >> 8;
+    auto redChroma = ((128 * red) - (107 * green) - (21 * blue)) >> 8;
+    auto limit = static_cast<int32_t>(threshold);
+    return std::abs(alpha) <= limit &&
+        (4 * luma * luma) + (blueChroma * blueChroma) + (redChroma * redChroma) <= 4 * limit * limit;
+}
+
+inline bool IsWithinTolerance(uint32_t current, uint32_t reference, DiffTolerance const& tolerance)
+{
+    switch (tolerance.Mode)
+    {
+    case DiffToleranceMode::Channel:
+        return IsWithinChannelTolerance(current, reference, tolerance.Threshold);
+    case DiffToleranceMode::YCbCr:
+        return IsWithinYCbCrTolerance(current, reference, tolerance.Threshold);
+    default:
+        return current == reference;
+    }
+}
+
+struct RowDiffResult
+{
+    uint32_t NumDifferingPixels;
+    // The changed pixels lie in [First, End). Only valid if
+    // NumDifferingPixels is greater than 0.
+    uint32_t First;
+    uint32_t End;
+    // Pixels that differ from the reference but stay within the tolerance
+    uint32_t NumToleratedPixels;
+};
+
+// Compares a row of BGRA pixels against the previous frame. Indices of
+// pixels that didn't change, or that are nearly transparent, are replaced
+// with the transparent index. The previous row is updated with the
+// current pixels as it is consumed.
+typedef RowDiffResult (*DiffRowKernel)(
+    uint32_t const* current,
+    uint32_t* previous,
+    uint8_t* indices,
+    uint32_t width,
+    uint8_t transparentIndex);
+
+// Returns nullptr if the given level isn't supported by this build.
+DiffRowKernel GetDiffRowKernel(SimdLevel level);
+
+// Like DiffRowKernel, but pixels within the threshold of the previous row
+// count as unchanged, and only the pixels that changed are copied to it.
+// The previous row then holds what a viewer shows, so small changes can't
+// add up over several frames.
+typedef RowDiffResult (*ToleranceDiffRowKernel)(
+    uint32_t const* current,
+    uint32_t* previous,
+    uint8_t* indices,
+    uint32_t width,
+    uint8_t transparentIndex,
+    uint32_t threshold);
+
+// Returns nullptr for DiffToleranceMode::Exact, which uses the plain
+// kernels, or if the given level isn't supported by this build.
+ToleranceDiffRowKernel GetToleranceDiffRowKernel(DiffToleranceMode mode, SimdLevel level);
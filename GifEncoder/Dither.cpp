@@ -0,0 +1,152 @@
+#include "pch.h"
+#include "Dither.h"
+#include "Color.h"
+
+wchar_t const* DitherModeToString(DitherMode mode)
+{
+    switch (mode)
+    {
+    case DitherMode::None:
+        return L"none";
+    case DitherMode::Bayer:
+        return L"bayer";
+    case DitherMode::FloydSteinberg:
+        return L"floyd-steinberg";
+    case DitherMode::SierraLite:
+        return L"sierra-lite";
+    default:
+        throw std::runtime_error("Unknown DitherMode value!");
+    }
+}
+
+ErrorDiffusionDitherer::ErrorDiffusionDitherer(uint32_t width, uint32_t height, DitherMode mode)
+{
+    m_width = width;
+    m_height = height;
+    switch (mode)
+    {
+    case DitherMode::FloydSteinberg:
+        m_kernel = { 7, 3, 5, 1, 4 };
+        break;
+    case DitherMode::SierraLite:
+        m_kernel = { 2, 1, 1, 0, 2 };
+        break;
+    default:
+        throw std::invalid_argument("Not an error diffusion dither mode.");
+    }
+    m_rowProgress = std::make_unique<std::atomic<uint32_t>[]>(height);
+}
+
+void ErrorDiffusionDitherer::MapPixels(RowBandPool* pool, InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices)
+{
+    auto numThreads = pool != nullptr ? pool->NumThreads() : 1;
+    auto stride = (static_cast<size_t>(m_width) + 2) * 3;
+
+    // Row y clears the ring row it pushes errors to once row y - 1 has
+    // started. By then row y - numThreads - 1, the last one to read that
+    // ring row, is done: it ran on the same thread as row y - 1.
+    auto numErrorRows = numThreads + 2;
+    if (numErrorRows != m_numErrorRows)
+    {
+        m_numErrorRows = numErrorRows;
+        m_errorRows.resize(stride * numErrorRows);
+    }
+    std::fill(m_errorRows.begin(), m_errorRows.begin() + stride, 0);
+    for (uint32_t y = 0; y < m_height; y++)
+    {
+        m_rowProgress[y].store(0, std::memory_order_relaxed);
+    }
+
+    auto mapRows = [&](uint32_t task, uint32_t)
+    {
+        for (auto y = task; y < m_height; y += numThreads)
+        {
+            MapRow(colorMap, pixels, indices, y);
+        }
+    };
+    if (pool != nullptr)
+    {
+        pool->ForEachTask(numThreads, mapRows);
+    }
+    else
+    {
+        mapRows(0, 0);
+    }
+}
+
+void ErrorDiffusionDitherer::MapRow(InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices, uint32_t y)
+{
+    // Rows report their progress every this many pixels
+    const uint32_t chunkSize = 64;
+    auto stride = (static_cast<size_t>(m_width) + 2) * 3;
+    auto current = m_errorRows.data() + ((y % m_numErrorRows) * stride);
+    auto next = m_errorRows.data() + (((y + 1) % m_numErrorRows) * stride);
+    auto row = pixels + (static_cast<size_t>(y) * m_width);
+    auto rowIndices = indices + (static_cast<size_t>(y) * m_width);
+    auto palette = colorMap.Palette().data();
+    auto transparentColorIndex = colorMap.TransparentColorIndex();
+    auto kernel = m_kernel;
+    auto rounding = 1 << (kernel.Shift - 1);
+
+    int32_t carry[3] = {};
+    for (uint32_t start = 0; start < m_width; start += chunkSize)
+    {
+        auto end = std::min(start + chunkSize, m_width);
+        if (y > 0)
+        {
+            // Pixel x gets errors from x - 1, x and x + 1 of the row above
+            WaitForRow(y - 1, std::min(end + 1, m_width));
+        }
+        if (start == 0)
+        {
+            std::fill(next, next + stride, 0);
+        }
+
+        for (auto x = start; x < end; x++)
+        {
+            auto pixel = row[x];
+            if (transparentColorIndex >= 0 && IsTransparentPixel(pixel))
+            {
+                // Transparent pixels don't take or pass on any error
+                rowIndices[x] = static_cast<uint8_t>(transparentColorIndex);
+                carry[0] = carry[1] = carry[2] = 0;
+                continue;
+            }
+
+            // Errors are kept in 1 << Shift units. The shift rounds
+            // negative errors down, the same way on every thread.
+            auto error = current + ((static_cast<size_t>(x) + 1) * 3);
+            int32_t channels[3] = { static_cast<int32_t>(GetRed(pixel)), static_cast<int32_t>(GetGreen(pixel)), static_cast<int32_t>(GetBlue(pixel)) };
+            for (int c = 0; c < 3; c++)
+            {
+                auto value = channels[c] + ((carry[c] + error[c] + rounding) >> kernel.Shift);
+                channels[c] = std::min(std::max(value, 0), 255);
+            }
+            auto index = colorMap.MapColor(MakeColor(GetAlpha(pixel), channels[0], channels[1], channels[2]));
+            rowIndices[x] = index;
+
+            auto mapped = palette[index];
+            int32_t mappedChannels[3] = { static_cast<int32_t>(GetRed(mapped)), static_cast<int32_t>(GetGreen(mapped)), static_cast<int32_t>(GetBlue(mapped)) };
+            auto below = next + ((static_cast<size_t>(x) + 1) * 3);
+            for (int c = 0; c < 3; c++)
+            {
+                auto difference = channels[c] - mappedChannels[c];
+                carry[c] = difference * kernel.Right;
+                below[c - 3] += difference * kernel.BelowLeft;
+                below[c] += difference * kernel.Below;
+                below[c + 3] += difference * kernel.BelowRight;
+            }
+        }
+        m_rowProgress[y].store(end, std::memory_order_release);
+    }
+}
+
+void ErrorDiffusionDitherer::WaitForRow(uint32_t y, uint32_t progress) const
+{
+    // Rows only wait on the row above, which is always running on another
+    // thread, so this is a short wait
+    while (m_rowProgress[y].load(std::memory_order_acquire) < progress)
+    {
+        std::this_thread::yield();
+    }
+}
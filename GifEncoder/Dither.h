@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "PaletteMapper.h"
+#include "RowBandPool.h"
+
+enum class DitherMode
+{
+    None,
+    // An 8x8 Bayer matrix. The offset a pixel gets only depends on where
+    // it is, so pixels that don't change keep their index.
+    Bayer,
+    // Error diffusion. The error of every pixel spreads to the ones right
+    // and below it, so a change anywhere can change the indices of pixels
+    // after it that didn't change themselves.
+    FloydSteinberg,
+    // A lighter error diffusion kernel that spreads to three pixels
+    // instead of four
+    SierraLite,
+};
+
+wchar_t const* DitherModeToString(DitherMode mode);
+
+inline bool IsErrorDiffusion(DitherMode mode)
+{
+    return mode == DitherMode::FloydSteinberg || mode == DitherMode::SierraLite;
+}
+
+// Maps frames to palette indices with error diffusion. Each row pushes the
+// error of its pixels to the row below, so rows run as a pipeline: every
+// thread of the pool takes every Nth row, and a row only moves on once
+// the row above is far enough ahead. Errors are kept as integers, so the
+// indices don't depend on the number of threads.
+class ErrorDiffusionDitherer
+{
+public:
+    ErrorDiffusionDitherer(uint32_t width, uint32_t height, DitherMode mode);
+
+    // Same contract as InverseColorMap::MapPixels for a whole frame.
+    // Without a pool, the rows run on the calling thread.
+    void MapPixels(RowBandPool* pool, InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices);
+
+private:
+    struct Kernel
+    {
+        int32_t Right;
+        int32_t BelowLeft;
+        int32_t Below;
+        int32_t BelowRight;
+        // The weights add up to 1 << Shift
+        int32_t Shift;
+    };
+
+    void MapRow(InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices, uint32_t y);
+    void WaitForRow(uint32_t y, uint32_t progress) const;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    Kernel m_kernel = {};
+    // The errors pushed to the rows in flight, three channels per pixel
+    // plus a pixel of padding on both sides. Row y uses ring row y % size.
+    uint32_t m_numErrorRows = 0;
+    std::vector<int32_t> m_errorRows;
+    // How many pixels of each row are done
+    std::unique_ptr<std::atomic<uint32_t>[]> m_rowProgress;
+};
@@ -0,0 +1,197 @@
+#include "pch.h"
+#include "EncodeStats.h"
+
+namespace
+{
+    double ToMilliseconds(uint64_t nanoseconds)
+    {
+        return nanoseconds / 1000000.0;
+    }
+
+    double ToMicroseconds(uint64_t nanoseconds)
+    {
+        return nanoseconds / 1000.0;
+    }
+
+    // Restores the stream's number formatting when done
+    class FixedPrecision
+    {
+    public:
+        FixedPrecision(std::ostream& stream, std::streamsize precision) :
+            m_stream(stream),
+            m_flags(stream.flags()),
+            m_precision(stream.precision(precision))
+        {
+            m_stream.setf(std::ios::fixed, std::ios::floatfield);
+        }
+
+        ~FixedPrecision()
+        {
+            m_stream.flags(m_flags);
+            m_stream.precision(m_precision);
+        }
+
+    private:
+        std::ostream& m_stream;
+        std::ios::fmtflags m_flags;
+        std::streamsize m_precision;
+    };
+}
+
+char const* EncodeStageToString(EncodeStage stage)
+{
+    switch (stage)
+    {
+    case EncodeStage::Load:
+        return "load";
+    case EncodeStage::Compose:
+        return "compose";
+    case EncodeStage::Dedup:
+        return "dedup";
+    case EncodeStage::Palette:
+        return "palette";
+    case EncodeStage::Convert:
+        return "convert";
+    case EncodeStage::Diff:
+        return "diff";
+    case EncodeStage::Crop:
+        return "crop";
+    case EncodeStage::Submit:
+        return "submit";
+    case EncodeStage::Write:
+        return "write";
+    case EncodeStage::Compress:
+        return "compress";
+    case EncodeStage::Finish:
+        return "finish";
+    default:
+        throw std::runtime_error("Unknown EncodeStage value!");
+    }
+}
+
+EncodeStats::EncodeStats(uint32_t width, uint32_t height, uint32_t expectedFrames)
+{
+    m_width = width;
+    m_height = height;
+    m_frames.reserve(expectedFrames);
+    m_outputFrames.reserve(expectedFrames);
+}
+
+FrameStats& EncodeStats::BeginFrame()
+{
+    FrameStats frame;
+    frame.InputIndex = static_cast<uint32_t>(m_frames.size());
+    m_frames.push_back(frame);
+    return m_frames.back();
+}
+
+void EncodeStats::FrameSubmitted()
+{
+    auto&& frame = m_frames.back();
+    if (frame.OutputIndex < 0)
+    {
+        frame.OutputIndex = static_cast<int32_t>(m_outputFrames.size());
+    }
+    frame.ImageBlocks++;
+    m_outputFrames.push_back(frame.InputIndex);
+}
+
+void EncodeStats::FrameWritten(size_t outputIndex, size_t compressedBytes, uint64_t compressNanoseconds, uint64_t writeNanoseconds)
+{
+    m_stageNanoseconds[static_cast<size_t>(EncodeStage::Compress)] += compressNanoseconds;
+    m_stageNanoseconds[static_cast<size_t>(EncodeStage::Write)] += writeNanoseconds;
+    if (outputIndex < m_outputFrames.size())
+    {
+        auto&& frame = m_frames[m_outputFrames[outputIndex]];
+        frame.CompressedBytes += compressedBytes;
+        frame.StageNanoseconds[static_cast<size_t>(EncodeStage::Compress)] += compressNanoseconds;
+        frame.StageNanoseconds[static_cast<size_t>(EncodeStage::Write)] += writeNanoseconds;
+    }
+}
+
+void EncodeStats::AddTime(EncodeStage stage, uint64_t nanoseconds)
+{
+    auto index = static_cast<size_t>(stage);
+    m_stageNanoseconds[index] += nanoseconds;
+    if (!m_frames.empty() && stage != EncodeStage::Load && stage != EncodeStage::Finish)
+    {
+        m_frames.back().StageNanoseconds[index] += nanoseconds;
+    }
+}
+
+void EncodeStats::WriteJson(std::ostream& stream) const
+{
+    FixedPrecision precision(stream, 3);
+    stream << "{\n";
+    stream << "  \"width\": " << m_width << ",\n";
+    stream << "  \"height\": " << m_height << ",\n";
+    stream << "  \"inputFrames\": " << m_frames.size() << ",\n";
+    stream << "  \"outputFrames\": " << m_outputFrames.size() << ",\n";
+    stream << "  \"outputBytes\": " << m_outputBytes << ",\n";
+    stream << "  \"stagesMs\": {";
+    for (size_t i = 0; i < NumEncodeStages; i++)
+    {
+        stream << (i > 0 ? ", " : " ") << "\"" << EncodeStageToString(static_cast<EncodeStage>(i)) << "\": " << ToMilliseconds(m_stageNanoseconds[i]);
+    }
+    stream << " },\n";
+    stream << "  \"frames\": [\n";
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+        auto&& frame = m_frames[i];
+        stream << "    { \"input\": " << frame.InputIndex
+            << ", \"output\": " << frame.OutputIndex
+            << ", \"blocks\": " << frame.ImageBlocks
+            << ", \"delayMs\": " << frame.DelayMilliseconds
+            << ", \"duplicate\": " << (frame.Duplicate ? "true" : "false")
+            << ", \"differingPixels\": " << frame.DifferingPixels
+            << ", \"toleratedPixels\": " << frame.ToleratedPixels
+            << ", \"left\": " << frame.Left
+            << ", \"top\": " << frame.Top
+            << ", \"width\": " << frame.Width
+            << ", \"height\": " << frame.Height
+            << ", \"paletteSize\": " << frame.PaletteSize
+            << ", \"newPalette\": " << (frame.NewPalette ? "true" : "false")
+            << ", \"compressedBytes\": " << frame.CompressedBytes
+            << ", \"stagesUs\": {";
+        for (size_t stage = 0; stage < NumEncodeStages; stage++)
+        {
+            stream << (stage > 0 ? ", " : " ") << "\"" << EncodeStageToString(static_cast<EncodeStage>(stage)) << "\": " << ToMicroseconds(frame.StageNanoseconds[stage]);
+        }
+        stream << " } }" << (i + 1 < m_frames.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n";
+    stream << "}\n";
+}
+
+void EncodeStats::WriteCsv(std::ostream& stream) const
+{
+    FixedPrecision precision(stream, 3);
+    stream << "input,output,blocks,delayMs,duplicate,differingPixels,toleratedPixels,left,top,width,height,paletteSize,newPalette,compressedBytes";
+    for (size_t stage = 0; stage < NumEncodeStages; stage++)
+    {
+        stream << "," << EncodeStageToString(static_cast<EncodeStage>(stage)) << "Us";
+    }
+    stream << "\n";
+    for (auto&& frame : m_frames)
+    {
+        stream << frame.InputIndex
+            << "," << frame.OutputIndex
+            << "," << frame.ImageBlocks
+            << "," << frame.DelayMilliseconds
+            << "," << (frame.Duplicate ? 1 : 0)
+            << "," << frame.DifferingPixels
+            << "," << frame.ToleratedPixels
+            << "," << frame.Left
+            << "," << frame.Top
+            << "," << frame.Width
+            << "," << frame.Height
+            << "," << frame.PaletteSize
+            << "," << (frame.NewPalette ? 1 : 0)
+            << "," << frame.CompressedBytes;
+        for (size_t stage = 0; stage < NumEncodeStages; stage++)
+        {
+            stream << "," << ToMicroseconds(frame.StageNanoseconds[stage]);
+        }
+        stream << "\n";
+    }
+}
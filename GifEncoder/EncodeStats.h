@@ -0,0 +1,135 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// The parts of the encode pipeline that are timed. Every stage except
+// Compress is wall time on the thread running the frame loop. Submit and
+// Finish include waiting for the writer and the Write time of any frames
+// they write. Compress is summed over the worker threads.
+enum class EncodeStage : uint32_t
+{
+    Load,
+    Compose,
+    Dedup,
+    Palette,
+    Convert,
+    Diff,
+    Crop,
+    Submit,
+    Write,
+    Compress,
+    Finish,
+};
+
+const size_t NumEncodeStages = static_cast<size_t>(EncodeStage::Finish) + 1;
+
+char const* EncodeStageToString(EncodeStage stage);
+
+struct FrameStats
+{
+    uint32_t InputIndex = 0;
+    // The output index of the frame's first image, -1 when the frame was
+    // merged into the previous one
+    int32_t OutputIndex = -1;
+    // How many images the frame was written as
+    uint32_t ImageBlocks = 0;
+    uint32_t DelayMilliseconds = 0;
+    // Set when the frame was identical to the previous one and dropped
+    // before any palette or diff work
+    bool Duplicate = false;
+    uint32_t DifferingPixels = 0;
+    // Pixels that differed but stayed within the diff tolerance, so they
+    // were left out like unchanged ones
+    uint32_t ToleratedPixels = 0;
+    // The area written to the output, in output pixels. When the frame is
+    // written as several images, this is the box around all of them.
+    uint32_t Left = 0;
+    uint32_t Top = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t PaletteSize = 0;
+    bool NewPalette = false;
+    uint64_t CompressedBytes = 0;
+    std::array<uint64_t, NumEncodeStages> StageNanoseconds = {};
+};
+
+// Collects stage timings and per-frame counters for one encode and writes
+// them out as JSON or CSV. Recording a value is a couple of additions, and
+// frame records are reserved up front, so this stays on for every encode.
+// Not thread safe; only the frame loop records into it.
+class EncodeStats
+{
+public:
+    EncodeStats(uint32_t width, uint32_t height, uint32_t expectedFrames);
+
+    // Starts the record for the next input frame. Times are added to it
+    // until the next call.
+    FrameStats& BeginFrame();
+    // Gives the next output index to one of the current frame's images
+    void FrameSubmitted();
+    void FrameWritten(size_t outputIndex, size_t compressedBytes, uint64_t compressNanoseconds, uint64_t writeNanoseconds);
+
+    void AddTime(EncodeStage stage, uint64_t nanoseconds);
+    void SetOutputBytes(uint64_t bytes) { m_outputBytes = bytes; }
+
+    uint64_t StageNanoseconds(EncodeStage stage) const { return m_stageNanoseconds[static_cast<size_t>(stage)]; }
+    std::vector<FrameStats> const& Frames() const { return m_frames; }
+
+    void WriteJson(std::ostream& stream) const;
+    // One row per input frame
+    void WriteCsv(std::ostream& stream) const;
+
+private:
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint64_t m_outputBytes = 0;
+    std::array<uint64_t, NumEncodeStages> m_stageNanoseconds = {};
+    std::vector<FrameStats> m_frames;
+    // Index into m_frames for each output frame
+    std::vector<uint32_t> m_outputFrames;
+};
+
+inline uint64_t NanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+// Adds the time between construction and destruction to a stage
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(EncodeStats& stats, EncodeStage stage) :
+        m_stats(stats),
+        m_stage(stage),
+        m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedStageTimer()
+    {
+        Stop();
+    }
+
+    // Ends the timer early. Later calls do nothing.
+    void Stop()
+    {
+        if (!m_stopped)
+        {
+            m_stats.AddTime(m_stage, NanosecondsSince(m_start));
+            m_stopped = true;
+        }
+    }
+
+    ScopedStageTimer(ScopedStageTimer const&) = delete;
+    ScopedStageTimer& operator=(ScopedStageTimer const&) = delete;
+
+private:
+    EncodeStats& m_stats;
+    EncodeStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_stopped = false;
+};
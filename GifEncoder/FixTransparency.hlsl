@@ -3,6 +3,9 @@ cbuffer FrameInfo : register(b0)
     uint Width;
     uint Height;
     int TransparentColorIndex;
+    // 0 is exact, 1 per channel and 2 YCbCr, like DiffToleranceMode
+    uint ToleranceMode;
+    uint Threshold;
 }; 
 
 struct DiffInfo
@@ -12,12 +15,33 @@ struct DiffInfo
     uint top;
     uint right;
     uint bottom;
+    uint NumToleratedPixels;
 };
 
 Texture2D<unorm float4> currentTexture : register(t0);
 Texture2D<unorm float4> previousTexture : register(t1);
 RWTexture2D<uint> outputTexture : register(u0);
 RWStructuredBuffer<DiffInfo> diffBuffer : register(u1);
+// Only bound with a tolerance. Receives the colors a viewer will show,
+// which the next frame is compared against.
+RWTexture2D<unorm float4> referenceTexture : register(u2);
+
+// The same integer math as IsWithinChannelTolerance and
+// IsWithinYCbCrTolerance in DiffKernels.h
+bool IsWithinTolerance(float4 currentPixel, float4 previousPixel)
+{
+    int4 delta = (int4)round(currentPixel * 255.0f) - (int4)round(previousPixel * 255.0f);
+    int limit = (int)Threshold;
+    if (ToleranceMode == 1)
+    {
+        return all(abs(delta) <= limit);
+    }
+    int luma = ((77 * delta.r) + (150 * delta.g) + (29 * delta.b)) >> 8;
+    int blueChroma = ((-43 * delta.r) - (85 * delta.g) + (128 * delta.b)) >> 8;
+    int redChroma = ((128 * delta.r) - (107 * delta.g) - (21 * delta.b)) >> 8;
+    return abs(delta.a) <= limit &&
+        (4 * luma * luma) + (blueChroma * blueChroma) + (redChroma * redChroma) <= 4 * limit * limit;
+}
 
 [numthreads(8, 8, 1)]
 void main( uint3 DTid : SV_DispatchThreadID )
@@ -30,10 +54,19 @@ void main( uint3 DTid : SV_DispatchThreadID )
         float4 previousPixel = previousTexture[position];
 
         uint index = outputTexture[position];
-        if ((currentPixel.x != previousPixel.x) || 
-            (currentPixel.y != previousPixel.y) || 
-            (currentPixel.z != previousPixel.z) ||
-            (currentPixel.w != previousPixel.w))
+        bool changed = any(currentPixel != previousPixel);
+        if (ToleranceMode != 0)
+        {
+            if (changed && IsWithinTolerance(currentPixel, previousPixel))
+            {
+                uint toleratedValue = 0;
+                InterlockedAdd(diffBuffer[0].NumToleratedPixels, 1, toleratedValue);
+                changed = false;
+            }
+            referenceTexture[position] = changed ? currentPixel : previousPixel;
+        }
+
+        if (changed)
         {
             uint value = 0;
             InterlockedAdd(diffBuffer[0].NumDifferingPixels, 1, value);
@@ -41,8 +74,9 @@ void main( uint3 DTid : SV_DispatchThreadID )
             value = 0;
             InterlockedMin(diffBuffer[0].left, position.x, value);
             InterlockedMin(diffBuffer[0].top, position.y, value);
-            InterlockedMax(diffBuffer[0].right, position.x, value);
-            InterlockedMax(diffBuffer[0].bottom, position.y, value);
+            // right and bottom are exclusive
+            InterlockedMax(diffBuffer[0].right, position.x + 1, value);
+            InterlockedMax(diffBuffer[0].bottom, position.y + 1, value);
         }
         else
         {
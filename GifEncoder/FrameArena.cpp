@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "FrameArena.h"
+
+FrameArena::FrameArena(size_t blockSize)
+{
+    m_blocks.reserve(8);
+    AddBlock(blockSize);
+}
+
+void* FrameArena::AllocateBytes(size_t size, size_t alignment)
+{
+    auto offset = (m_offset + alignment - 1) & ~(alignment - 1);
+    if (offset + size > m_blocks.back().Size)
+    {
+        AddBlock(size);
+        offset = 0;
+    }
+    auto data = reinterpret_cast<uint8_t*>(m_blocks.back().Data.get()) + offset;
+    m_offset = offset + size;
+    m_bytesUsed += size;
+    return data;
+}
+
+void FrameArena::AddBlock(size_t minSize)
+{
+    // Grow geometrically so a frame needs few blocks
+    auto size = m_blocks.empty() ? minSize : std::max(minSize, m_blocks.back().Size * 2);
+    auto numElements = std::max<size_t>((size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t), 1);
+    Block block;
+    block.Data = std::make_unique<std::max_align_t[]>(numElements);
+    block.Size = numElements * sizeof(std::max_align_t);
+    m_blocks.push_back(std::move(block));
+    m_offset = 0;
+}
+
+void FrameArena::Reset()
+{
+    if (m_blocks.size() > 1)
+    {
+        auto capacity = Capacity();
+        m_blocks.clear();
+        AddBlock(capacity);
+    }
+    m_offset = 0;
+    m_bytesUsed = 0;
+}
+
+size_t FrameArena::Capacity() const
+{
+    size_t capacity = 0;
+    for (auto&& block : m_blocks)
+    {
+        capacity += block.Size;
+    }
+    return capacity;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for scratch memory that only lives while one frame is
+// encoded. Nothing is freed until Reset, which drops everything at once.
+// When a frame needed more than the first block, Reset replaces the
+// blocks with a single one big enough for all of it, so later frames of
+// the same size don't touch the heap.
+class FrameArena
+{
+public:
+    static const size_t DefaultBlockSize = 256 * 1024;
+
+    explicit FrameArena(size_t blockSize = DefaultBlockSize);
+
+    FrameArena(FrameArena const&) = delete;
+    FrameArena& operator=(FrameArena const&) = delete;
+
+    // The memory is uninitialized. Only for types that don't need their
+    // destructor run.
+    template <typename T>
+    T* Allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destroyed");
+        static_assert(alignof(T) <= MaxAlignment, "Type is over-aligned for the arena");
+        return static_cast<T*>(AllocateBytes(count * sizeof(T), alignof(T)));
+    }
+
+    void Reset();
+
+    size_t BytesUsed() const { return m_bytesUsed; }
+    size_t Capacity() const;
+
+private:
+    static const size_t MaxAlignment = alignof(std::max_align_t);
+
+    struct Block
+    {
+        std::unique_ptr<std::max_align_t[]> Data;
+        size_t Size = 0;
+    };
+
+    void* AllocateBytes(size_t size, size_t alignment);
+    void AddBlock(size_t minSize);
+
+    std::vector<Block> m_blocks;
+    size_t m_offset = 0;
+    size_t m_bytesUsed = 0;
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Counts bytes of frame data moved from one buffer to another, whether
+// on the CPU or between the CPU and the GPU. Copies that stay on the GPU
+// aren't counted.
+inline std::atomic<uint64_t>& FrameBytesCopiedCounter()
+{
+    static std::atomic<uint64_t> counter{ 0 };
+    return counter;
+}
+
+inline void AddFrameBytesCopied(size_t bytes)
+{
+    FrameBytesCopiedCounter().fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline uint64_t GetFrameBytesCopied()
+{
+    return FrameBytesCopiedCounter().load(std::memory_order_relaxed);
+}
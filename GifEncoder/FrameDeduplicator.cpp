@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "FrameDeduplicator.h"
+#include "XxHash.h"
+
+FrameDeduplicator::FrameDeduplicator(uint32_t width, uint32_t height)
+{
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + TileSize - 1) / TileSize;
+    m_tilesY = (height + TileSize - 1) / TileSize;
+    m_tileHashes.resize(static_cast<size_t>(m_tilesX) * m_tilesY, 0);
+}
+
+FrameRect FrameDeduplicator::Update(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect)
+{
+    // Tiles outside of the reader's dirty rect can't have changed
+    uint32_t firstTileX = 0;
+    uint32_t firstTileY = 0;
+    uint32_t endTileX = m_tilesX;
+    uint32_t endTileY = m_tilesY;
+    if (m_hasPrevious && dirtyRect.has_value())
+    {
+        auto right = std::min(dirtyRect->Right, m_width);
+        auto bottom = std::min(dirtyRect->Bottom, m_height);
+        if (dirtyRect->Left >= right || dirtyRect->Top >= bottom)
+        {
+            return FrameRect{};
+        }
+        firstTileX = dirtyRect->Left / TileSize;
+        firstTileY = dirtyRect->Top / TileSize;
+        endTileX = (right + TileSize - 1) / TileSize;
+        endTileY = (bottom + TileSize - 1) / TileSize;
+    }
+
+    FrameRect changedRect = {};
+    for (auto tileY = firstTileY; tileY < endTileY; tileY++)
+    {
+        for (auto tileX = firstTileX; tileX < endTileX; tileX++)
+        {
+            auto hash = HashTile(pixels, tileX, tileY);
+            auto&& previousHash = m_tileHashes[(static_cast<size_t>(tileY) * m_tilesX) + tileX];
+            if (!m_hasPrevious || hash != previousHash)
+            {
+                previousHash = hash;
+                auto tileRect = FrameRect
+                {
+                    tileX * TileSize,
+                    tileY * TileSize,
+                    std::min((tileX + 1) * TileSize, m_width),
+                    std::min((tileY + 1) * TileSize, m_height),
+                };
+                changedRect = UnionRects(changedRect, tileRect);
+            }
+        }
+    }
+    m_hasPrevious = true;
+    return changedRect;
+}
+
+uint64_t FrameDeduplicator::HashTile(uint32_t const* pixels, uint32_t tileX, uint32_t tileY) const
+{
+    // Chain the rows through the seed, so the tile hashes as one stream
+    auto left = tileX * TileSize;
+    auto top = tileY * TileSize;
+    auto rowBytes = (std::min(left + TileSize, m_width) - left) * sizeof(uint32_t);
+    auto bottom = std::min(top + TileSize, m_height);
+    uint64_t hash = 0;
+    for (auto y = top; y < bottom; y++)
+    {
+        hash = XxHash64(pixels + (static_cast<size_t>(y) * m_width) + left, rowBytes, hash);
+    }
+    return hash;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "FrameRect.h"
+
+// Hashes composed frames in 64x64 tiles and compares them with the
+// previous frame, so that exact duplicates can be dropped before any
+// palette, diff or GPU work. The tiles that did change also give a dirty
+// rect for readers that can't provide one. Tiles are compared by their
+// 64-bit hashes, so a collision could hide a change; with XXH64 that is
+// far less likely than a bit flip in memory.
+class FrameDeduplicator
+{
+public:
+    static const uint32_t TileSize = 64;
+
+    FrameDeduplicator(uint32_t width, uint32_t height);
+
+    // Hashes the frame's tiles and returns the rect that covers the tiles
+    // that differ from the previous frame. The rect is empty for an exact
+    // duplicate and covers the whole frame for the first one. When the
+    // reader gave a dirty rect, only the tiles it touches are hashed.
+    FrameRect Update(uint32_t const* pixels, std::optional<FrameRect> const& dirtyRect = std::nullopt);
+
+    // Forgets the previous frame, so the next one counts as all changed
+    void Reset() { m_hasPrevious = false; }
+
+private:
+    uint64_t HashTile(uint32_t const* pixels, uint32_t tileX, uint32_t tileY) const;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_tilesX = 0;
+    uint32_t m_tilesY = 0;
+    bool m_hasPrevious = false;
+    std::vector<uint64_t> m_tileHashes;
+};
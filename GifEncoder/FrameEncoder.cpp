@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "FrameEncoder.h"
+#include "FrameCopyCounter.h"
+
+FrameEncoder::FrameEncoder(
+    GifWriter& gifWriter,
+    ParallelGifWriter& frameWriter,
+    EncodeStats& stats,
+    uint32_t width,
+    uint32_t height,
+    FrameEncoderOptions const& options) :
+    m_gifWriter(gifWriter),
+    m_frameWriter(frameWriter),
+    m_stats(stats),
+    m_bandPool(options.NumBandThreads),
+    m_palettizer(m_bandPool, width, height, options.Dither),
+    m_deduplicator(width, height),
+    m_tileMap(width, height)
+{
+    m_width = width;
+    m_height = height;
+    m_options = options;
+    m_colors.reserve(256);
+    m_indices.resize(static_cast<size_t>(width) * height, 0);
+    m_imageRects.reserve(std::max(options.MaxImagesPerFrame, 1u));
+}
+
+void FrameEncoder::SetGlobalPalette(std::vector<uint32_t> const& colors)
+{
+    m_sharedColors = colors;
+    m_gifWriter.SetGlobalPalette(colors);
+}
+
+void FrameEncoder::SetDiffFunctions(InitDiffFunction initDiff, DiffFunction diff)
+{
+    m_initDiff = std::move(initDiff);
+    m_diff = std::move(diff);
+}
+
+void FrameEncoder::EncodeFrame(InputFrame const& frame, FrameStats& frameStats)
+{
+    m_frameArena.Reset();
+
+    // Drop exact duplicates before any palette or diff work. The tiles
+    // that changed also narrow the diff when the reader can't.
+    ScopedStageTimer dedupTimer(m_stats, EncodeStage::Dedup);
+    auto changedRect = m_deduplicator.Update(frame.Pixels, frame.DirtyRect);
+    if (frame.DirtyRect.has_value())
+    {
+        changedRect = IntersectRects(changedRect, frame.DirtyRect.value());
+    }
+    dedupTimer.Stop();
+    if (m_frameIndex > 0 && changedRect.IsEmpty())
+    {
+        frameStats.Duplicate = true;
+        m_numDuplicateFrames++;
+        m_unusedDelay += frame.Delay;
+        return;
+    }
+
+    // The reader already has the frame on the CPU
+    auto pixels = frame.Pixels;
+    MapToPalette(pixels, frameStats);
+
+    // We need to find which color is our transparent one
+    auto transparentColorIndex = FindTransparentColorIndex(m_colors);
+    frameStats.PaletteSize = static_cast<uint32_t>(m_colors.size());
+
+    if (!m_diff && !m_cpuFixer)
+    {
+        m_cpuFixer = std::make_unique<CpuTransparencyFixer>(m_width, m_height, GetBestSimdLevel(), m_options.Tolerance);
+        m_cpuFixer->SetRowBandPool(&m_bandPool);
+    }
+
+    std::optional<DiffInfo> diffInfoOpt = std::nullopt;
+    ScopedStageTimer diffTimer(m_stats, EncodeStage::Diff);
+    if (transparentColorIndex >= 0 && m_frameIndex > 0)
+    {
+        auto info = m_diff
+            ? m_diff(transparentColorIndex, m_indices, changedRect)
+            : m_cpuFixer->ProcessInput(reinterpret_cast<uint8_t const*>(pixels), transparentColorIndex, m_indices, changedRect);
+        frameStats.DifferingPixels = info.NumDifferingPixels;
+        frameStats.ToleratedPixels = info.NumToleratedPixels;
+        m_numToleratedPixels += info.NumToleratedPixels;
+        if (info.NumDifferingPixels > 0)
+        {
+            diffInfoOpt = std::optional(std::move(info));
+        }
+        else
+        {
+            m_unusedDelay += frame.Delay;
+            return;
+        }
+    }
+    else if (m_initDiff)
+    {
+        m_initDiff();
+    }
+    else
+    {
+        m_cpuFixer->InitPrevious(reinterpret_cast<uint8_t const*>(pixels));
+    }
+
+    // Split the changed area into a few images when asked to, so that
+    // changes far apart don't turn into one near full frame image
+    m_imageRects.clear();
+    if (diffInfoOpt.has_value())
+    {
+        // The exact area that changed, never empty here
+        auto bounds = GetDiffRect(diffInfoOpt.value());
+        if (m_options.MaxImagesPerFrame > 1)
+        {
+            m_tileMap.Build(m_indices.data(), transparentColorIndex, bounds);
+            // A local color table is repeated in every image
+            auto extraBlockBytes = m_gifWriter.IsGlobalPalette(m_colors) ? 0 : m_colors.size() * 3;
+            m_tileMap.GetChangedRects(m_options.MaxImagesPerFrame, extraBlockBytes, m_imageRects);
+        }
+        if (m_imageRects.empty())
+        {
+            m_imageRects.push_back(bounds);
+        }
+    }
+    else
+    {
+        m_imageRects.push_back({ 0, 0, m_width, m_height });
+    }
+    diffTimer.Stop();
+
+    // TEMP DEBUG
+    //{
+    //    auto debugFileName = ImageViewerFileNameFromSize("debug_indexed", m_width, m_height);
+    //    WriteIndexedPixelBytesToFileAsBgra8(debugFileName, m_indices);
+    //}
+
+    auto delay = frame.Delay + m_unusedDelay;
+    m_unusedDelay = {};
+    SubmitImages(delay, transparentColorIndex, frameStats);
+    m_frameIndex++;
+}
+
+void FrameEncoder::MapToPalette(uint32_t const* pixels, FrameStats& frameStats)
+{
+    if (m_options.Palette == PaletteMode::Global)
+    {
+        ScopedStageTimer timer(m_stats, EncodeStage::Convert);
+        m_colors = m_sharedColors;
+        m_palettizer.MapPixels(*m_colorMapCache.GetOrCreate(m_colors), pixels, m_indices.data());
+    }
+    else if (m_paletteFunction && m_options.Palette == PaletteMode::PerFrame)
+    {
+        // The palette function times its own stages
+        frameStats.NewPalette = true;
+        m_paletteFunction(pixels, m_colors, m_indices.data());
+    }
+    else
+    {
+        ScopedStageTimer paletteTimer(m_stats, EncodeStage::Palette);
+        m_palettizer.BuildHistogram(pixels, m_histogram);
+
+        // Keep using the previous palette while it still fits the frame
+        std::shared_ptr<InverseColorMap> colorMap;
+        if (m_options.Palette == PaletteMode::Reuse && !m_sharedColors.empty())
+        {
+            colorMap = m_colorMapCache.GetOrCreate(m_sharedColors);
+            if (ComputePaletteError(m_histogram, *colorMap, m_frameArena) <= m_sharedColorsError * PaletteReuseTolerance)
+            {
+                m_colors = m_sharedColors;
+            }
+            else
+            {
+                colorMap = nullptr;
+            }
+        }
+
+        if (!colorMap)
+        {
+            // Create a pallette from the frame's histogram
+            m_colors = BuildPalette(m_histogram, m_options.Quantizer);
+            colorMap = m_colorMapCache.GetOrCreate(m_colors);
+            frameStats.NewPalette = true;
+            if (m_options.Palette == PaletteMode::Reuse)
+            {
+                // The first palette becomes the global palette, so frames
+                // that reuse it don't need a local color table.
+                if (m_frameIndex == 0)
+                {
+                    m_gifWriter.SetGlobalPalette(m_colors);
+                }
+                m_sharedColors = m_colors;
+                m_sharedColorsError = ComputePaletteError(m_histogram, *colorMap, m_frameArena);
+            }
+        }
+
+        paletteTimer.Stop();
+
+        // Convert our frame using the palette
+        ScopedStageTimer convertTimer(m_stats, EncodeStage::Convert);
+        m_palettizer.MapPixels(*colorMap, pixels, m_indices.data());
+    }
+}
+
+void FrameEncoder::SubmitImages(std::chrono::nanoseconds delay, int transparentColorIndex, FrameStats& frameStats)
+{
+    auto millisconds = std::chrono::duration_cast<std::chrono::milliseconds>(delay);
+    frameStats.DelayMilliseconds = static_cast<uint32_t>(millisconds.count());
+
+    FrameRect writtenRect = {};
+    for (size_t imageIndex = 0; imageIndex < m_imageRects.size(); imageIndex++)
+    {
+        auto&& rect = m_imageRects[imageIndex];
+        writtenRect = UnionRects(writtenRect, rect);
+
+        // Crop the fixed bytes to the area that changed. The index
+        // buffer is reused for the next frame while this one is
+        // compressed, and the writer hands the copy back to its pool
+        // once the image is out.
+        ScopedStageTimer cropTimer(m_stats, EncodeStage::Crop);
+        GifFrameDesc frameDesc = {};
+        auto framePixels = m_frameWriter.AcquireIndexBuffer(static_cast<size_t>(rect.Width()) * rect.Height());
+        CopyRectPixels(m_indices.data(), m_width, rect, framePixels.data());
+        AddFrameBytesCopied(framePixels.size());
+
+        frameDesc.Left = static_cast<uint16_t>(rect.Left);
+        frameDesc.Top = static_cast<uint16_t>(rect.Top);
+        frameDesc.Width = static_cast<uint16_t>(rect.Width());
+        frameDesc.Height = static_cast<uint16_t>(rect.Height());
+        cropTimer.Stop();
+
+        // Viewers wait for the delay after showing an image, so the
+        // frame's other images are shown right away and the last one
+        // holds the frame on screen. Use 10ms units.
+        if (imageIndex + 1 == m_imageRects.size())
+        {
+            frameDesc.Delay = static_cast<uint16_t>(millisconds.count() / 10);
+        }
+
+        // Transparency
+        if (transparentColorIndex >= 0 && m_frameIndex > 0)
+        {
+            frameDesc.TransparentColorIndex = transparentColorIndex;
+        }
+
+        if (m_frameIndex > 0)
+        {
+            frameDesc.Disposal = GifDisposal::DoNotDispose;
+        }
+
+        // Queue the image to be compressed and written out
+        m_stats.FrameSubmitted();
+        {
+            ScopedStageTimer timer(m_stats, EncodeStage::Submit);
+            m_frameWriter.SubmitFrame(frameDesc, m_colors, std::move(framePixels));
+        }
+    }
+    frameStats.Left = writtenRect.Left;
+    frameStats.Top = writtenRect.Top;
+    frameStats.Width = writtenRect.Width();
+    frameStats.Height = writtenRect.Height();
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "CpuTransparencyFixer.h"
+#include "DiffKernels.h"
+#include "Dither.h"
+#include "EncodeStats.h"
+#include "FrameArena.h"
+#include "FrameDeduplicator.h"
+#include "FrameRect.h"
+#include "GifWriter.h"
+#include "PaletteMapper.h"
+#include "PaletteQuantizer.h"
+#include "ParallelGifWriter.h"
+#include "ParallelPalettizer.h"
+#include "RowBandPool.h"
+#include "TileChangeMap.h"
+
+enum class PaletteMode
+{
+    // Every frame gets its own palette
+    PerFrame,
+    // One palette, built from a sample of the frames, is shared by every frame
+    Global,
+    // Frames keep the previous palette until it no longer fits
+    Reuse,
+};
+
+// A palette is reused until the error it produces grows past this
+// multiple of the error it had on the frame it was built for.
+const double PaletteReuseTolerance = 1.25;
+
+struct FrameEncoderOptions
+{
+    PaletteMode Palette = PaletteMode::PerFrame;
+    QuantizerOptions Quantizer;
+    DitherMode Dither = DitherMode::None;
+    DiffTolerance Tolerance;
+    // Changed areas of a frame are written as up to this many images
+    uint32_t MaxImagesPerFrame = 1;
+    // Threads that share the palette, convert and diff work of each frame
+    uint32_t NumBandThreads = 1;
+};
+
+struct InputFrame
+{
+    uint32_t const* Pixels = nullptr;
+    std::chrono::nanoseconds Delay = {};
+    // The area that changed since the previous frame, when the reader knows
+    std::optional<FrameRect> DirtyRect;
+};
+
+// The per-frame part of an encode: drops duplicate frames, picks a
+// palette and maps the frame to it, diffs it against the previous frame,
+// and crops the changes into images for the frame writer. Both main and
+// the end-to-end benchmarks encode through this, so they can't drift
+// apart. Palettes come from our quantizer and the diff runs on the CPU,
+// unless the caller plugs in its own (WIC palettes, the shader diff).
+class FrameEncoder
+{
+public:
+    // Fills in a palette for the frame and maps the frame to it. Used for
+    // per-frame palettes only.
+    typedef std::function<void(uint32_t const* pixels, std::vector<uint32_t>& colors, uint8_t* indices)> PaletteFunction;
+    // Makes the current frame the one the next diff compares against
+    typedef std::function<void()> InitDiffFunction;
+    // Diffs the current frame against the previous one, like
+    // CpuTransparencyFixer::ProcessInput
+    typedef std::function<DiffInfo(int transparentColorIndex, std::vector<uint8_t>& indices, FrameRect const& changedRect)> DiffFunction;
+
+    FrameEncoder(
+        GifWriter& gifWriter,
+        ParallelGifWriter& frameWriter,
+        EncodeStats& stats,
+        uint32_t width,
+        uint32_t height,
+        FrameEncoderOptions const& options);
+
+    FrameEncoder(FrameEncoder const&) = delete;
+    FrameEncoder& operator=(FrameEncoder const&) = delete;
+
+    RowBandPool& BandPool() { return m_bandPool; }
+
+    // Used with PaletteMode::Global. Also becomes the global color table.
+    void SetGlobalPalette(std::vector<uint32_t> const& colors);
+    void SetPaletteFunction(PaletteFunction paletteFunction) { m_paletteFunction = std::move(paletteFunction); }
+    void SetDiffFunctions(InitDiffFunction initDiff, DiffFunction diff);
+
+    // Encodes the next input frame. Its times and counters go into
+    // frameStats, which the caller got from EncodeStats::BeginFrame.
+    void EncodeFrame(InputFrame const& frame, FrameStats& frameStats);
+
+    uint32_t NumDuplicateFrames() const { return m_numDuplicateFrames; }
+    uint64_t NumToleratedPixels() const { return m_numToleratedPixels; }
+
+private:
+    void MapToPalette(uint32_t const* pixels, FrameStats& frameStats);
+    void SubmitImages(std::chrono::nanoseconds delay, int transparentColorIndex, FrameStats& frameStats);
+
+    GifWriter& m_gifWriter;
+    ParallelGifWriter& m_frameWriter;
+    EncodeStats& m_stats;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    FrameEncoderOptions m_options;
+
+    RowBandPool m_bandPool;
+    ParallelPalettizer m_palettizer;
+    PaletteFunction m_paletteFunction;
+    // Only created when no diff functions are set
+    std::unique_ptr<CpuTransparencyFixer> m_cpuFixer;
+    InitDiffFunction m_initDiff;
+    DiffFunction m_diff;
+
+    // Scratch memory that only lives for one frame. The palette keeps its
+    // capacity between frames.
+    FrameArena m_frameArena;
+    ColorHistogram m_histogram;
+    InverseColorMapCache m_colorMapCache;
+    std::vector<uint32_t> m_colors;
+    std::vector<uint32_t> m_sharedColors;
+    double m_sharedColorsError = 0.0;
+    std::vector<uint8_t> m_indices;
+    FrameDeduplicator m_deduplicator;
+    TileChangeMap m_tileMap;
+    std::vector<FrameRect> m_imageRects;
+
+    uint32_t m_frameIndex = 0;
+    // The delay of frames that were dropped, added to the next one written
+    std::chrono::nanoseconds m_unusedDelay = {};
+    uint32_t m_numDuplicateFrames = 0;
+    uint64_t m_numToleratedPixels = 0;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// A half-open rectangle of pixels: Left and Top are inside the rect,
+// Right and Bottom are one past its edges.
+struct FrameRect
+{
+    uint32_t Left = 0;
+    uint32_t Top = 0;
+    uint32_t Right = 0;
+    uint32_t Bottom = 0;
+
+    uint32_t Width() const { return Right > Left ? Right - Left : 0; }
+    uint32_t Height() const { return Bottom > Top ? Bottom - Top : 0; }
+    bool IsEmpty() const { return Right <= Left || Bottom <= Top; }
+};
+
+// The smallest rect that covers both rects. Empty rects are ignored.
+inline FrameRect UnionRects(FrameRect const& first, FrameRect const& second)
+{
+    if (first.IsEmpty())
+    {
+        return second;
+    }
+    if (second.IsEmpty())
+    {
+        return first;
+    }
+    return FrameRect
+    {
+        std::min(first.Left, second.Left),
+        std::min(first.Top, second.Top),
+        std::max(first.Right, second.Right),
+        std::max(first.Bottom, second.Bottom),
+    };
+}
+
+// The area both rects cover, which may be empty
+inline FrameRect IntersectRects(FrameRect const& first, FrameRect const& second)
+{
+    auto rect = FrameRect
+    {
+        std::max(first.Left, second.Left),
+        std::max(first.Top, second.Top),
+        std::min(first.Right, second.Right),
+        std::min(first.Bottom, second.Bottom),
+    };
+    return rect.IsEmpty() ? FrameRect{} : rect;
+}
+
+// Copies the pixels inside rect out of a frame that is frameWidth pixels
+// wide into dest, which holds rect.Width() * rect.Height() tightly packed
+// pixels. The rect must lie inside the frame.
+template <typename T>
+void CopyRectPixels(T const* frame, uint32_t frameWidth, FrameRect const& rect, T* dest)
+{
+    auto rowBytes = static_cast<size_t>(rect.Width()) * sizeof(T);
+    for (uint32_t y = rect.Top; y < rect.Bottom; y++)
+    {
+        std::memcpy(dest, frame + (static_cast<size_t>(y) * frameWidth) + rect.Left, rowBytes);
+        dest += rect.Width();
+    }
+}
@@ -1,25 +1,43 @@
 #pragma once
 #include "IComposedFrameProvider.h"
+#include "ComposedFrameRing.h"
+#include "GifDecoder.h"
+#include "MappedFile.h"
+
+struct GifComposedFrameReader : IComposedFrameReader
+{
+	GifComposedFrameReader(
+		GifFile const& gif,
+		MappedFile const& file,
+		bool uploadFrames,
+		winrt::com_ptr<ID3D11Device> const& d3dDevice);
+	~GifComposedFrameReader() {}
+
+	bool TryGetNextFrame(ComposedFrame& frame) override;
+	winrt::com_ptr<ID3D11Texture2D> GetFrameTexture() override;
+
+private:
+	GifFile const& m_gif;
+	GifFrameComposer m_composer;
+	uint32_t m_frameIndex = 0;
+	std::optional<FrameUploader> m_uploader;
+};
 
 struct GifComposedFrameProvider : IComposedFrameProvider
 {
-	GifComposedFrameProvider(
-		winrt::Windows::Storage::Streams::IRandomAccessStream const& stream, 
-		winrt::com_ptr<IWICImagingFactory2> const& wicFactory);
+	GifComposedFrameProvider(std::unique_ptr<MappedFile>&& file, std::unique_ptr<GifFile>&& gif, ComposeOptions const& options);
 	~GifComposedFrameProvider() {}
 
-	uint32_t Width() override { return m_width; }
-	uint32_t Height() override { return m_height; }
-	std::vector<ComposedFrame> GetFrames(
+	uint32_t Width() override { return m_gif->Width; }
+	uint32_t Height() override { return m_gif->Height; }
+	uint32_t FrameCount() override { return static_cast<uint32_t>(m_gif->Frames.size()); }
+	std::unique_ptr<IComposedFrameReader> CreateFrameReader(
 		winrt::com_ptr<ID3D11Device> const& d3dDevice,
 		winrt::com_ptr<ID2D1DeviceContext> const& d2dContext) override;
 
 private:
-	uint32_t m_width = 0;
-	uint32_t m_height = 0;
-	uint32_t m_frameCount = 0;
-	winrt::Windows::Storage::Streams::IRandomAccessStream m_stream{ nullptr };
-	winrt::com_ptr<IStream> m_abiStream;
-	winrt::com_ptr<IWICImagingFactory2> m_wicFactory;
-	winrt::com_ptr<IWICBitmapDecoder> m_wicDecoder;
-};
\ No newline at end of file
+	// Image data is decoded straight out of the file as frames are read
+	std::unique_ptr<MappedFile> m_file;
+	std::unique_ptr<GifFile> m_gif;
+	ComposeOptions m_options;
+};
@@ -0,0 +1,368 @@
+#include "pch.h"
+#include "GifDecoder.h"
+
+namespace
+{
+    const uint8_t ExtensionIntroducer = 0x21;
+    const uint8_t ImageSeparator = 0x2C;
+    const uint8_t Trailer = 0x3B;
+    const uint8_t GraphicControlLabel = 0xF9;
+    const uint8_t PlainTextLabel = 0x01;
+
+    // Out of range indices show up as black
+    const uint32_t MissingPaletteColor = 0xFF000000;
+
+    class ByteReader
+    {
+    public:
+        ByteReader(uint8_t const* data, size_t size)
+        {
+            m_data = data;
+            m_size = size;
+        }
+
+        size_t Position() const { return m_position; }
+        bool HasBytes(size_t count) const { return m_size - m_position >= count; }
+
+        uint8_t ReadByte()
+        {
+            return m_data[m_position++];
+        }
+
+        uint16_t ReadUInt16()
+        {
+            auto value = static_cast<uint16_t>(m_data[m_position] | (m_data[m_position + 1] << 8));
+            m_position += 2;
+            return value;
+        }
+
+        void Skip(size_t count)
+        {
+            m_position += count;
+        }
+
+        // Returns false if the data ends before the block terminator
+        bool SkipSubBlocks()
+        {
+            while (HasBytes(1))
+            {
+                auto length = ReadByte();
+                if (length == 0)
+                {
+                    return true;
+                }
+                if (!HasBytes(length))
+                {
+                    m_position = m_size;
+                    return false;
+                }
+                Skip(length);
+            }
+            return false;
+        }
+
+        bool ReadColorTable(uint8_t packed, std::vector<uint32_t>& palette)
+        {
+            auto numColors = static_cast<size_t>(2) << (packed & 0x7);
+            if (!HasBytes(numColors * 3))
+            {
+                return false;
+            }
+            palette.resize(numColors);
+            for (auto&& color : palette)
+            {
+                auto red = static_cast<uint32_t>(ReadByte());
+                auto green = static_cast<uint32_t>(ReadByte());
+                auto blue = static_cast<uint32_t>(ReadByte());
+                color = 0xFF000000 | (red << 16) | (green << 8) | blue;
+            }
+            return true;
+        }
+
+    private:
+        uint8_t const* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_position = 0;
+    };
+}
+
+std::unique_ptr<GifFile> ParseGifFile(uint8_t const* data, size_t size)
+{
+    ByteReader reader(data, size);
+    if (!reader.HasBytes(13) ||
+        (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0))
+    {
+        throw std::invalid_argument("Not a GIF file.");
+    }
+    reader.Skip(6);
+
+    auto file = std::make_unique<GifFile>();
+    file->Width = reader.ReadUInt16();
+    file->Height = reader.ReadUInt16();
+    auto packed = reader.ReadByte();
+    // Background color and pixel aspect ratio
+    reader.Skip(2);
+    if ((packed & 0x80) && !reader.ReadColorTable(packed, file->GlobalPalette))
+    {
+        throw std::runtime_error("Unexpected end of file.");
+    }
+
+    // The graphic control extension applies to the next image
+    GifImage control = {};
+    while (reader.HasBytes(1))
+    {
+        auto blockType = reader.ReadByte();
+        if (blockType == ExtensionIntroducer)
+        {
+            if (!reader.HasBytes(1))
+            {
+                break;
+            }
+            auto label = reader.ReadByte();
+            auto blockSize = reader.HasBytes(1) ? data[reader.Position()] : 0;
+            if (label == GraphicControlLabel && blockSize >= 4 && reader.HasBytes(1 + static_cast<size_t>(blockSize)))
+            {
+                reader.Skip(1);
+                auto controlPacked = reader.ReadByte();
+                control.Delay = reader.ReadUInt16();
+                auto transparentColorIndex = reader.ReadByte();
+                control.TransparentColorIndex = (controlPacked & 0x1) ? transparentColorIndex : -1;
+                // Disposal methods past 3 aren't defined and are treated as none
+                auto disposal = (controlPacked >> 2) & 0x7;
+                control.Disposal = disposal <= 3 ? static_cast<GifDisposal>(disposal) : GifDisposal::Unspecified;
+                // Anything else in the block is followed by the terminator
+                reader.Skip(blockSize - 4);
+            }
+            else if (label == PlainTextLabel)
+            {
+                // Text isn't drawn, but it is what the pending graphic
+                // control extension applied to
+                control = {};
+            }
+            if (!reader.SkipSubBlocks())
+            {
+                break;
+            }
+        }
+        else if (blockType == ImageSeparator)
+        {
+            if (!reader.HasBytes(9))
+            {
+                break;
+            }
+            auto image = std::move(control);
+            control = {};
+            image.Left = reader.ReadUInt16();
+            image.Top = reader.ReadUInt16();
+            image.Width = reader.ReadUInt16();
+            image.Height = reader.ReadUInt16();
+            auto imagePacked = reader.ReadByte();
+            image.Interlaced = (imagePacked & 0x40) != 0;
+            if ((imagePacked & 0x80) && !reader.ReadColorTable(imagePacked, image.Palette))
+            {
+                break;
+            }
+            if (!reader.HasBytes(1))
+            {
+                break;
+            }
+            image.LzwMinCodeSize = reader.ReadByte();
+            image.ImageDataOffset = reader.Position();
+            auto complete = reader.SkipSubBlocks();
+            file->Frames.push_back(std::move(image));
+            if (!complete)
+            {
+                break;
+            }
+        }
+        else
+        {
+            // The trailer, or something we can't make sense of
+            break;
+        }
+    }
+
+    if (file->Frames.empty())
+    {
+        throw std::runtime_error("The GIF file doesn't have any frames.");
+    }
+
+    // Some encoders leave the logical screen empty, so size it to fit
+    if (file->Width == 0 || file->Height == 0)
+    {
+        for (auto&& image : file->Frames)
+        {
+            file->Width = static_cast<uint16_t>(std::max<uint32_t>(file->Width, std::min<uint32_t>(image.Left + image.Width, UINT16_MAX)));
+            file->Height = static_cast<uint16_t>(std::max<uint32_t>(file->Height, std::min<uint32_t>(image.Top + image.Height, UINT16_MAX)));
+        }
+        if (file->Width == 0 || file->Height == 0)
+        {
+            throw std::runtime_error("A width or height of 0 is invalid.");
+        }
+    }
+    return file;
+}
+
+GifFrameComposer::GifFrameComposer(GifFile const& file, uint8_t const* data, size_t size) : m_file(file)
+{
+    m_data = data;
+    m_size = size;
+    m_pixels.resize(static_cast<size_t>(file.Width) * file.Height, 0);
+    m_palette.resize(256, MissingPaletteColor);
+}
+
+FrameRect GifFrameComposer::GetClippedRect(GifImage const& image) const
+{
+    FrameRect rect = {};
+    rect.Left = std::min<uint32_t>(image.Left, m_file.Width);
+    rect.Top = std::min<uint32_t>(image.Top, m_file.Height);
+    rect.Right = std::min<uint32_t>(image.Left + image.Width, m_file.Width);
+    rect.Bottom = std::min<uint32_t>(image.Top + image.Height, m_file.Height);
+    return rect;
+}
+
+void GifFrameComposer::DisposePreviousFrame()
+{
+    auto&& previous = m_file.Frames[m_nextFrame - 1];
+    auto rect = GetClippedRect(previous);
+    auto width = static_cast<size_t>(m_file.Width);
+    if (previous.Disposal == GifDisposal::RestoreToBackground)
+    {
+        // Browsers clear to transparent rather than the background color
+        for (auto y = rect.Top; y < rect.Bottom; y++)
+        {
+            std::fill_n(m_pixels.data() + y * width + rect.Left, rect.Width(), 0);
+        }
+    }
+    else if (previous.Disposal == GifDisposal::RestoreToPrevious)
+    {
+        for (auto y = rect.Top; y < rect.Bottom; y++)
+        {
+            std::copy_n(
+                m_savedPixels.data() + static_cast<size_t>(y - rect.Top) * rect.Width(),
+                rect.Width(),
+                m_pixels.data() + y * width + rect.Left);
+        }
+    }
+}
+
+void GifFrameComposer::DrawFrame(GifImage const& image, FrameRect const& rect)
+{
+    auto numIndices = static_cast<size_t>(image.Width) * image.Height;
+    m_indices.resize(numIndices);
+    // Like browsers, draw nothing for image data we can't decode rather
+    // than giving up on the whole file
+    size_t decoded = 0;
+    if (LzwDecoder::IsValidLzwMinCodeSize(image.LzwMinCodeSize))
+    {
+        decoded = m_decoder.Decode(
+            m_data + image.ImageDataOffset,
+            m_size - image.ImageDataOffset,
+            image.LzwMinCodeSize,
+            m_indices.data(),
+            numIndices);
+    }
+
+    auto&& palette = image.Palette.empty() ? m_file.GlobalPalette : image.Palette;
+    std::copy(palette.begin(), palette.end(), m_palette.begin());
+    std::fill(m_palette.begin() + palette.size(), m_palette.end(), MissingPaletteColor);
+    // A transparent index that isn't in the palette still leaves pixels alone
+    auto transparentIndex = image.TransparentColorIndex;
+
+    // Interlaced images store every 8th row, then the 4th, 2nd and 1st
+    // rows in between
+    const uint32_t passStarts[] = { 0, 4, 2, 1 };
+    const uint32_t passSteps[] = { 8, 8, 4, 2 };
+    auto numPasses = image.Interlaced ? 4 : 1;
+    auto visibleWidth = rect.Width();
+    auto canvasWidth = static_cast<size_t>(m_file.Width);
+    size_t row = 0;
+    for (auto pass = 0; pass < numPasses; pass++)
+    {
+        auto start = image.Interlaced ? passStarts[pass] : 0;
+        auto step = image.Interlaced ? passSteps[pass] : 1;
+        for (uint32_t y = start; y < image.Height; y += step, row++)
+        {
+            auto rowStart = row * image.Width;
+            if (rowStart >= decoded)
+            {
+                // The rest of the image is missing
+                return;
+            }
+            auto canvasY = image.Top + y;
+            if (canvasY >= rect.Bottom)
+            {
+                continue;
+            }
+            auto count = std::min<size_t>(visibleWidth, decoded - rowStart);
+            auto source = m_indices.data() + rowStart;
+            auto destination = m_pixels.data() + canvasY * canvasWidth + rect.Left;
+            if (transparentIndex < 0)
+            {
+                for (size_t x = 0; x < count; x++)
+                {
+                    destination[x] = m_palette[source[x]];
+                }
+            }
+            else
+            {
+                for (size_t x = 0; x < count; x++)
+                {
+                    if (source[x] != transparentIndex)
+                    {
+                        destination[x] = m_palette[source[x]];
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool GifFrameComposer::TryGetNextFrame(FrameRect& dirtyRect)
+{
+    if (m_nextFrame >= m_file.Frames.size())
+    {
+        return false;
+    }
+
+    FrameRect dirty = {};
+    if (m_nextFrame == 0)
+    {
+        dirty = FrameRect{ 0, 0, m_file.Width, m_file.Height };
+    }
+    else
+    {
+        auto&& previous = m_file.Frames[m_nextFrame - 1];
+        if (previous.Disposal == GifDisposal::RestoreToBackground ||
+            previous.Disposal == GifDisposal::RestoreToPrevious)
+        {
+            dirty = GetClippedRect(previous);
+        }
+        DisposePreviousFrame();
+    }
+
+    auto&& image = m_file.Frames[m_nextFrame];
+    auto rect = GetClippedRect(image);
+    // Nothing is disposed of after the last frame, so there's no need to
+    // save what it covers
+    auto isLastFrame = m_nextFrame + 1 == m_file.Frames.size();
+    if (image.Disposal == GifDisposal::RestoreToPrevious && !isLastFrame)
+    {
+        m_savedPixels.resize(static_cast<size_t>(rect.Width()) * rect.Height());
+        for (auto y = rect.Top; y < rect.Bottom; y++)
+        {
+            std::copy_n(
+                m_pixels.data() + static_cast<size_t>(y) * m_file.Width + rect.Left,
+                rect.Width(),
+                m_savedPixels.data() + static_cast<size_t>(y - rect.Top) * rect.Width());
+        }
+    }
+    if (!rect.IsEmpty())
+    {
+        DrawFrame(image, rect);
+    }
+
+    dirtyRect = UnionRects(dirty, rect);
+    m_nextFrame++;
+    return true;
+}
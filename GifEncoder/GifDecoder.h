@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "FrameRect.h"
+#include "GifWriter.h"
+#include "LzwDecoder.h"
+
+// Where a frame's image lives in the file, along with everything from its
+// graphic control extension.
+struct GifImage
+{
+    uint16_t Left = 0;
+    uint16_t Top = 0;
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+    // In 10ms units
+    uint16_t Delay = 0;
+    // -1 means the frame has no transparent color
+    int TransparentColorIndex = -1;
+    GifDisposal Disposal = GifDisposal::Unspecified;
+    bool Interlaced = false;
+    // Empty when the frame uses the global palette
+    std::vector<uint32_t> Palette;
+    uint32_t LzwMinCodeSize = 0;
+    // The first sub-block of the image data
+    size_t ImageDataOffset = 0;
+};
+
+struct GifFile
+{
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+    // Opaque 0xAARRGGBB colors
+    std::vector<uint32_t> GlobalPalette;
+    std::vector<GifImage> Frames;
+};
+
+// Indexes a GIF87a or GIF89a file without decoding any image data.
+// Unknown extensions are skipped, and a truncated file keeps the frames
+// that were found before the data ran out.
+std::unique_ptr<GifFile> ParseGifFile(uint8_t const* data, size_t size);
+
+// Decodes the frames of a GIF file in order onto a canvas the size of the
+// logical screen, following each frame's disposal method. Transparent
+// pixels leave the canvas as it was. The canvas starts out transparent.
+class GifFrameComposer
+{
+public:
+    // The data must be the same bytes the file was parsed from.
+    GifFrameComposer(GifFile const& file, uint8_t const* data, size_t size);
+
+    // Disposes of the previous frame and draws the next one. The dirty rect
+    // covers every pixel that may have changed, and is the whole canvas for
+    // the first frame. Returns false once every frame has been read.
+    bool TryGetNextFrame(FrameRect& dirtyRect);
+
+    // Straight alpha BGRA. Every pixel is either opaque or fully transparent.
+    std::vector<uint32_t> const& Pixels() const { return m_pixels; }
+
+private:
+    FrameRect GetClippedRect(GifImage const& image) const;
+    void DisposePreviousFrame();
+    void DrawFrame(GifImage const& image, FrameRect const& rect);
+
+    GifFile const& m_file;
+    uint8_t const* m_data = nullptr;
+    size_t m_size = 0;
+    LzwDecoder m_decoder;
+    size_t m_nextFrame = 0;
+    std::vector<uint32_t> m_pixels;
+    std::vector<uint8_t> m_indices;
+    // Palettes are padded to 256 colors so that any index can be looked up
+    std::vector<uint32_t> m_palette;
+    // What was under the previous frame, if it is restored to previous
+    std::vector<uint32_t> m_savedPixels;
+};
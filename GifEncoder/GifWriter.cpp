@@ -0,0 +1,202 @@
+#include "pch.h"
+#include "GifWriter.h"
+
+namespace
+{
+    inline void PushUInt16(std::vector<uint8_t>& buffer, uint16_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+        buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+    }
+
+    void PushColorTable(std::vector<uint8_t>& buffer, std::vector<uint32_t> const& palette, uint32_t colorTableBits)
+    {
+        auto numEntries = static_cast<size_t>(1) << colorTableBits;
+        for (size_t i = 0; i < numEntries; i++)
+        {
+            uint32_t color = i < palette.size() ? palette[i] : 0;
+            buffer.push_back(static_cast<uint8_t>((color >> 16) & 0xFF));
+            buffer.push_back(static_cast<uint8_t>((color >> 8) & 0xFF));
+            buffer.push_back(static_cast<uint8_t>(color & 0xFF));
+        }
+    }
+}
+
+void CompressGifImageData(
+    LzwEncoder& encoder,
+    uint8_t const* indices,
+    size_t count,
+    size_t paletteSize,
+    std::vector<uint8_t>& output,
+    LzwClearMode clearMode)
+{
+    auto colorTableBits = ComputeColorTableBits(paletteSize);
+    encoder.Encode(indices, count, ComputeLzwMinCodeSize(colorTableBits), output, clearMode);
+}
+
+GifWriter::GifWriter(std::ostream& stream, uint16_t width, uint16_t height, uint16_t loopCount) : m_stream(stream)
+{
+    m_width = width;
+    m_height = height;
+    m_loopCount = loopCount;
+}
+
+void GifWriter::SetGlobalPalette(std::vector<uint32_t> const& palette)
+{
+    if (m_headerWritten)
+    {
+        throw std::logic_error("The global palette must be set before any frames are written.");
+    }
+    if (palette.empty() || palette.size() > 256)
+    {
+        throw std::invalid_argument("Palettes must have between 1 and 256 colors.");
+    }
+    m_globalPalette = palette;
+}
+
+void GifWriter::WriteHeader()
+{
+    // Header
+    const char signature[] = "GIF89a";
+    m_buffer.insert(m_buffer.end(), signature, signature + 6);
+
+    // Logical screen descriptor. We always advertise 8 bits of color resolution.
+    PushUInt16(m_buffer, m_width);
+    PushUInt16(m_buffer, m_height);
+    uint32_t globalColorTableBits = 0;
+    uint8_t packed = 0x70;
+    if (!m_globalPalette.empty())
+    {
+        globalColorTableBits = ComputeColorTableBits(m_globalPalette.size());
+        packed |= static_cast<uint8_t>(0x80 | (globalColorTableBits - 1));
+    }
+    m_buffer.push_back(packed);
+    // Background color index
+    m_buffer.push_back(0);
+    // Pixel aspect ratio
+    m_buffer.push_back(0);
+
+    if (!m_globalPalette.empty())
+    {
+        PushColorTable(m_buffer, m_globalPalette, globalColorTableBits);
+    }
+
+    // Application block
+    // http://www.vurdalakov.net/misc/gif/netscape-looping-application-extension
+    {
+        m_buffer.push_back(0x21);
+        m_buffer.push_back(0xFF);
+        m_buffer.push_back(11);
+        const char application[] = "NETSCAPE2.0";
+        m_buffer.insert(m_buffer.end(), application, application + 11);
+        // The size of the sub-block, which is the fixed value 3.
+        m_buffer.push_back(3);
+        // The looping extension, which is the fixed value 1.
+        m_buffer.push_back(1);
+        PushUInt16(m_buffer, m_loopCount);
+        // Block terminator
+        m_buffer.push_back(0);
+    }
+    m_headerWritten = true;
+}
+
+void GifWriter::WriteFrameHeader(GifFrameDesc const& desc, std::vector<uint32_t> const& palette)
+{
+    if (m_finished)
+    {
+        throw std::logic_error("Cannot write a frame after the trailer.");
+    }
+    if (desc.Width == 0 || desc.Height == 0 ||
+        static_cast<uint32_t>(desc.Left) + desc.Width > m_width ||
+        static_cast<uint32_t>(desc.Top) + desc.Height > m_height)
+    {
+        throw std::invalid_argument("Frame rect is outside of the logical screen.");
+    }
+    if (palette.empty() || palette.size() > 256)
+    {
+        throw std::invalid_argument("Palettes must have between 1 and 256 colors.");
+    }
+    if (!m_headerWritten)
+    {
+        WriteHeader();
+    }
+
+    // Graphic control extension
+    {
+        m_buffer.push_back(0x21);
+        m_buffer.push_back(0xF9);
+        m_buffer.push_back(4);
+        uint8_t packed = static_cast<uint8_t>(desc.Disposal) << 2;
+        if (desc.TransparentColorIndex >= 0)
+        {
+            packed |= 1;
+        }
+        m_buffer.push_back(packed);
+        PushUInt16(m_buffer, desc.Delay);
+        m_buffer.push_back(desc.TransparentColorIndex >= 0 ? static_cast<uint8_t>(desc.TransparentColorIndex) : 0);
+        // Block terminator
+        m_buffer.push_back(0);
+    }
+
+    // Image descriptor
+    auto useGlobalPalette = IsGlobalPalette(palette);
+    auto colorTableBits = ComputeColorTableBits(palette.size());
+    {
+        m_buffer.push_back(0x2C);
+        PushUInt16(m_buffer, desc.Left);
+        PushUInt16(m_buffer, desc.Top);
+        PushUInt16(m_buffer, desc.Width);
+        PushUInt16(m_buffer, desc.Height);
+        // Local color table flag and size, not interlaced
+        m_buffer.push_back(useGlobalPalette ? 0 : static_cast<uint8_t>(0x80 | (colorTableBits - 1)));
+    }
+
+    if (!useGlobalPalette)
+    {
+        PushColorTable(m_buffer, palette, colorTableBits);
+    }
+}
+
+void GifWriter::WriteFrame(
+    GifFrameDesc const& desc,
+    std::vector<uint32_t> const& palette,
+    uint8_t const* indices)
+{
+    WriteFrameHeader(desc, palette);
+    auto count = static_cast<size_t>(desc.Width) * desc.Height;
+    CompressGifImageData(m_encoder, indices, count, palette.size(), m_buffer, m_clearMode);
+    Flush();
+}
+
+void GifWriter::WriteCompressedFrame(
+    GifFrameDesc const& desc,
+    std::vector<uint32_t> const& palette,
+    std::vector<uint8_t> const& imageData)
+{
+    WriteFrameHeader(desc, palette);
+    Flush();
+    m_stream.write(reinterpret_cast<const char*>(imageData.data()), imageData.size());
+    m_bytesWritten += imageData.size();
+}
+
+void GifWriter::Finish()
+{
+    if (!m_finished)
+    {
+        if (!m_headerWritten)
+        {
+            WriteHeader();
+        }
+        m_buffer.push_back(0x3B);
+        Flush();
+        m_stream.flush();
+        m_finished = true;
+    }
+}
+
+void GifWriter::Flush()
+{
+    m_stream.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size());
+    m_bytesWritten += m_buffer.size();
+    m_buffer.clear();
+}
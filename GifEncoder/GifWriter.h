@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "LzwEncoder.h"
+
+enum class GifDisposal : uint8_t
+{
+    Unspecified = 0,
+    DoNotDispose = 1,
+    RestoreToBackground = 2,
+    RestoreToPrevious = 3,
+};
+
+struct GifFrameDesc
+{
+    uint16_t Left = 0;
+    uint16_t Top = 0;
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+    // In 10ms units
+    uint16_t Delay = 0;
+    // -1 means the frame has no transparent color
+    int TransparentColorIndex = -1;
+    GifDisposal Disposal = GifDisposal::Unspecified;
+};
+
+// Writes a GIF89a stream. Palettes are lists of colors in the same
+// 0xAARRGGBB layout that WICColor uses. Frames whose palette matches the
+// global palette don't get a local color table.
+class GifWriter
+{
+public:
+    // A loop count of 0 loops forever. The header is written along with
+    // the first frame.
+    GifWriter(std::ostream& stream, uint16_t width, uint16_t height, uint16_t loopCount = 0);
+
+    // Must be called before the first frame is written.
+    void SetGlobalPalette(std::vector<uint32_t> const& palette);
+    // Frames with this palette are written without a local color table
+    bool IsGlobalPalette(std::vector<uint32_t> const& palette) const { return !m_globalPalette.empty() && palette == m_globalPalette; }
+
+    // How frames are compressed, including frames compressed for this
+    // writer by a ParallelGifWriter. Defaults to LzwClearMode::WhenFull.
+    void SetClearMode(LzwClearMode clearMode) { m_clearMode = clearMode; }
+    LzwClearMode ClearMode() const { return m_clearMode; }
+
+    // Compresses and writes a frame. The indices must contain Width * Height
+    // entries from the frame description.
+    void WriteFrame(
+        GifFrameDesc const& desc,
+        std::vector<uint32_t> const& palette,
+        uint8_t const* indices);
+
+    // Writes a frame whose image data was already produced by
+    // CompressGifImageData.
+    void WriteCompressedFrame(
+        GifFrameDesc const& desc,
+        std::vector<uint32_t> const& palette,
+        std::vector<uint8_t> const& imageData);
+
+    // Writes the trailer. No frames can be written afterwards.
+    void Finish();
+
+    uint64_t BytesWritten() const { return m_bytesWritten; }
+
+private:
+    void WriteHeader();
+    void WriteFrameHeader(GifFrameDesc const& desc, std::vector<uint32_t> const& palette);
+    void Flush();
+
+    std::ostream& m_stream;
+    uint16_t m_width = 0;
+    uint16_t m_height = 0;
+    uint16_t m_loopCount = 0;
+    std::vector<uint32_t> m_globalPalette;
+    bool m_headerWritten = false;
+    bool m_finished = false;
+    uint64_t m_bytesWritten = 0;
+    LzwClearMode m_clearMode = LzwClearMode::WhenFull;
+    LzwEncoder m_encoder;
+    std::vector<uint8_t> m_buffer;
+};
+
+// Produces the image data (minimum code size, sub-blocks and terminator)
+// for a frame that uses the given palette.
+void CompressGifImageData(
+    LzwEncoder& encoder,
+    uint8_t const* indices,
+    size_t count,
+    size_t paletteSize,
+    std::vector<uint8_t>& output,
+    LzwClearMode clearMode = LzwClearMode::WhenFull);
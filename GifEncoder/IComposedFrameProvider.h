@@ -1,22 +1,72 @@
 #pragma once
+#include "FrameRect.h"
 
 struct ComposedFrame
 {
-    winrt::com_ptr<ID3D11Texture2D> Texture;
+    // Tightly packed BGRA owned by the reader. Only valid until the next
+    // frame is read.
+    uint32_t const* Pixels = nullptr;
     winrt::Windows::Foundation::TimeSpan Delay;
+    // Covers every pixel that differs from the previous frame. Empty when
+    // nothing changed, and unset when the reader doesn't know.
+    std::optional<FrameRect> DirtyRect;
 };
 
+// Composes frames one at a time as they are asked for. Frame textures are
+// recycled, so a texture is only valid until the reader has produced
+// another ComposedFrameRing::DefaultSize frames. Every frame has its
+// pixels on the CPU, which are handed out without being copied.
+struct IComposedFrameReader
+{
+    virtual ~IComposedFrameReader() = 0;
+
+    // Returns false once every frame has been read.
+    virtual bool TryGetNextFrame(ComposedFrame& frame) = 0;
+    // The texture of the last frame that was read. Only set when the frame
+    // was composed on the GPU, or when the reader was asked for frame
+    // textures. Frames composed on the CPU are uploaded here, the first
+    // time it is called for them, so frames that are dropped before the
+    // diff never reach the GPU.
+    virtual winrt::com_ptr<ID3D11Texture2D> GetFrameTexture() = 0;
+};
+inline IComposedFrameReader::~IComposedFrameReader() {}
+
 struct IComposedFrameProvider
 {
     virtual ~IComposedFrameProvider() = 0;
 
     virtual uint32_t Width() = 0;
     virtual uint32_t Height() = 0;
-    virtual std::vector<ComposedFrame> GetFrames(
+    virtual uint32_t FrameCount() = 0;
+    // Each reader starts at the first frame.
+    virtual std::unique_ptr<IComposedFrameReader> CreateFrameReader(
         winrt::com_ptr<ID3D11Device> const& d3dDevice,
         winrt::com_ptr<ID2D1DeviceContext> const& d2dContext) = 0;
+    // Reports anything the provider tracked while composing frames.
+    virtual void PrintStatistics() {}
 };
 inline IComposedFrameProvider::~IComposedFrameProvider() {}
 
+enum class ComposeBackend
+{
+    // Direct2D
+    Gpu,
+    // Layers are decoded and blended on a pool of worker threads
+    Cpu,
+    // Layers are blended on the CPU, one frame at a time, and only where
+    // they changed since the previous frame
+    CpuIncremental,
+};
+
+struct ComposeOptions
+{
+    // Only .rani projects have a CPU compositor
+    ComposeBackend Backend = ComposeBackend::Gpu;
+    uint32_t NumThreads = 1;
+    // Whether frames composed on the CPU are also uploaded to a texture
+    bool FrameTextures = true;
+};
+
 std::future<std::unique_ptr<IComposedFrameProvider>> LoadComposedFrameProviderFromFileAsync(
-    winrt::Windows::Storage::StorageFile const& file);
\ No newline at end of file
+    winrt::Windows::Storage::StorageFile const& file,
+    ComposeOptions const& options = {});
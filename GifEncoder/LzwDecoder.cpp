@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "LzwDecoder.h"
+
+namespace
+{
+    // Reads variable width codes LSB first out of GIF data sub-blocks
+    class SubBlockReader
+    {
+    public:
+        SubBlockReader(uint8_t const* data, size_t size)
+        {
+            m_data = data;
+            m_size = size;
+        }
+
+        // Returns false once the codes run out
+        bool ReadCode(uint32_t codeSize, uint32_t& code)
+        {
+            if (m_bitCount < codeSize)
+            {
+                Refill();
+                if (m_bitCount < codeSize)
+                {
+                    return false;
+                }
+            }
+            code = static_cast<uint32_t>(m_bitBuffer) & ((1u << codeSize) - 1);
+            m_bitBuffer >>= codeSize;
+            m_bitCount -= codeSize;
+            return true;
+        }
+
+    private:
+        // Fills the bit buffer with as many whole bytes as it can hold
+        void Refill()
+        {
+            while (m_bitCount <= 56)
+            {
+                if (m_blockRemaining == 0)
+                {
+                    // A zero length block terminates the image data
+                    if (m_position >= m_size || m_data[m_position] == 0)
+                    {
+                        return;
+                    }
+                    m_blockRemaining = m_data[m_position++];
+                }
+                auto count = std::min<size_t>({ m_blockRemaining, (64 - m_bitCount) / 8, m_size - m_position });
+                if (count == 0)
+                {
+                    return;
+                }
+                for (size_t i = 0; i < count; i++)
+                {
+                    m_bitBuffer |= static_cast<uint64_t>(m_data[m_position++]) << m_bitCount;
+                    m_bitCount += 8;
+                }
+                m_blockRemaining -= static_cast<uint32_t>(count);
+            }
+        }
+
+        uint8_t const* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_position = 0;
+        uint32_t m_blockRemaining = 0;
+        uint64_t m_bitBuffer = 0;
+        uint32_t m_bitCount = 0;
+    };
+}
+
+LzwDecoder::LzwDecoder()
+{
+    m_prefixes.resize(MaxCodes, 0);
+    m_firsts.resize(MaxCodes, 0);
+    m_lasts.resize(MaxCodes, 0);
+    m_lengths.resize(MaxCodes, 0);
+}
+
+size_t LzwDecoder::Decode(
+    uint8_t const* data,
+    size_t size,
+    uint32_t minCodeSize,
+    uint8_t* indices,
+    size_t count)
+{
+    // The spec allows 2 to 8 bits, but some encoders use 1 bit for two
+    // color images and others go past 8
+    if (!IsValidLzwMinCodeSize(minCodeSize))
+    {
+        throw std::invalid_argument("Invalid LZW minimum code size.");
+    }
+
+    auto prefixes = m_prefixes.data();
+    auto firsts = m_firsts.data();
+    auto lasts = m_lasts.data();
+    auto lengths = m_lengths.data();
+
+    const uint32_t clearCode = 1u << minCodeSize;
+    const uint32_t endCode = clearCode + 1;
+    for (uint32_t i = 0; i < clearCode; i++)
+    {
+        firsts[i] = static_cast<uint8_t>(i);
+        lasts[i] = static_cast<uint8_t>(i);
+        lengths[i] = 1;
+    }
+
+    SubBlockReader reader(data, size);
+    auto codeSize = minCodeSize + 1;
+    auto nextCode = clearCode + 2;
+    // No previous code right after a clear code
+    uint32_t previousCode = MaxCodes;
+    size_t written = 0;
+    uint32_t code = 0;
+    while (written < count && reader.ReadCode(codeSize, code))
+    {
+        if (code == clearCode)
+        {
+            codeSize = minCodeSize + 1;
+            nextCode = clearCode + 2;
+            previousCode = MaxCodes;
+            continue;
+        }
+        if (code == endCode || code > nextCode)
+        {
+            break;
+        }
+
+        if (previousCode == MaxCodes)
+        {
+            if (code >= clearCode)
+            {
+                break;
+            }
+            indices[written++] = static_cast<uint8_t>(code);
+            previousCode = code;
+            // Only a 1 bit minimum code size starts out with a full table
+            if (nextCode >= (1u << codeSize))
+            {
+                codeSize++;
+            }
+            continue;
+        }
+        if (code == nextCode && nextCode == MaxCodes)
+        {
+            // The table is full, so there is no entry to refer to
+            break;
+        }
+
+        // The new entry is the previous string followed by the first index
+        // of the current one. When the current code is the entry being
+        // added, that is the previous string's own first index.
+        if (nextCode < MaxCodes)
+        {
+            prefixes[nextCode] = static_cast<uint16_t>(previousCode);
+            firsts[nextCode] = firsts[previousCode];
+            lasts[nextCode] = code == nextCode ? firsts[previousCode] : firsts[code];
+            lengths[nextCode] = static_cast<uint16_t>(lengths[previousCode] + 1);
+            nextCode++;
+            // Encoders switch to the wider code once the table reaches it
+            if (nextCode >= (1u << codeSize) && codeSize < MaxCodeSize)
+            {
+                codeSize++;
+            }
+        }
+
+        // Write the string back to front, dropping anything past the end
+        size_t length = lengths[code];
+        auto current = code;
+        auto end = written + length;
+        if (end > count)
+        {
+            for (auto i = end; i > count; i--)
+            {
+                current = prefixes[current];
+            }
+            end = count;
+        }
+        for (auto position = end; position > written + 1; position--)
+        {
+            indices[position - 1] = lasts[current];
+            current = prefixes[current];
+        }
+        indices[written] = firsts[code];
+        written = end;
+        previousCode = code;
+    }
+    return written;
+}
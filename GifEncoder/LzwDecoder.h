@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// A GIF LZW decompressor. Each dictionary entry remembers its prefix, its
+// first and last index and its length, so a code is expanded by writing
+// its string back to front straight into the output. A decoder instance
+// can be reused across frames to avoid reallocating its tables.
+class LzwDecoder
+{
+public:
+    static const uint32_t MaxCodeSize = 12;
+    static const uint32_t MaxCodes = 1 << MaxCodeSize;
+
+    LzwDecoder();
+
+    // Decodes GIF image data sub-blocks, starting at the first length byte
+    // after the LZW minimum code size, into at most count indices. Decoding
+    // stops at the end code, the block terminator or the end of the data,
+    // and at the first invalid code. Returns the number of indices written.
+    // Throws if the minimum code size isn't valid.
+    size_t Decode(
+        uint8_t const* data,
+        size_t size,
+        uint32_t minCodeSize,
+        uint8_t* indices,
+        size_t count);
+
+    static bool IsValidLzwMinCodeSize(uint32_t minCodeSize)
+    {
+        return minCodeSize >= 1 && minCodeSize < MaxCodeSize;
+    }
+
+private:
+    std::vector<uint16_t> m_prefixes;
+    std::vector<uint8_t> m_firsts;
+    std::vector<uint8_t> m_lasts;
+    std::vector<uint16_t> m_lengths;
+};
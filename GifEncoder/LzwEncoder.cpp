@@ -0,0 +1,298 @@
+#include "pch.h"
+#include "LzwEncoder.h"
+
+namespace
+{
+    // Packs variable width codes LSB first and splits the result into
+    // GIF data sub-blocks (a length byte followed by up to 255 bytes).
+    class SubBlockWriter
+    {
+    public:
+        SubBlockWriter(std::vector<uint8_t>& output) : m_output(output)
+        {
+            m_lengthPosition = m_output.size();
+            m_output.push_back(0);
+        }
+
+        void WriteCode(uint32_t code, uint32_t codeSize)
+        {
+            m_bitBuffer |= code << m_bitCount;
+            m_bitCount += codeSize;
+            m_bitsWritten += codeSize;
+            while (m_bitCount >= 8)
+            {
+                PutByte(static_cast<uint8_t>(m_bitBuffer & 0xFF));
+                m_bitBuffer >>= 8;
+                m_bitCount -= 8;
+            }
+        }
+
+        void Finish()
+        {
+            if (m_bitCount > 0)
+            {
+                PutByte(static_cast<uint8_t>(m_bitBuffer & 0xFF));
+                m_bitBuffer = 0;
+                m_bitCount = 0;
+            }
+
+            auto length = m_output.size() - m_lengthPosition - 1;
+            if (length == 0)
+            {
+                m_output.pop_back();
+            }
+            else
+            {
+                m_output[m_lengthPosition] = static_cast<uint8_t>(length);
+            }
+            // Block terminator
+            m_output.push_back(0);
+        }
+
+        uint64_t BitsWritten() const { return m_bitsWritten; }
+
+    private:
+        void PutByte(uint8_t value)
+        {
+            if (m_output.size() - m_lengthPosition == 256)
+            {
+                m_output[m_lengthPosition] = 255;
+                m_lengthPosition = m_output.size();
+                m_output.push_back(0);
+            }
+            m_output.push_back(value);
+        }
+
+        std::vector<uint8_t>& m_output;
+        size_t m_lengthPosition = 0;
+        uint32_t m_bitBuffer = 0;
+        uint32_t m_bitCount = 0;
+        uint64_t m_bitsWritten = 0;
+    };
+
+    inline uint32_t HashKey(uint32_t key, uint32_t bits)
+    {
+        return (key * 2654435761u) >> (32 - bits);
+    }
+}
+
+wchar_t const* LzwClearModeToString(LzwClearMode mode)
+{
+    switch (mode)
+    {
+    case LzwClearMode::WhenFull:
+        return L"full";
+    case LzwClearMode::Adaptive:
+        return L"adaptive";
+    default:
+        throw std::runtime_error("Unknown LzwClearMode value!");
+    }
+}
+
+LzwEncoder::LzwEncoder()
+{
+    m_keys.resize(HashTableSize, 0);
+    m_codes.resize(HashTableSize, 0);
+    for (auto&& runCodes : m_runCodes)
+    {
+        runCodes.reserve(MaxCodes);
+    }
+}
+
+size_t LzwEncoder::MaxEncodedSize(size_t count)
+{
+    // At most one code per index, plus the clear codes between full
+    // dictionaries and the end code. Each code is at most 12 bits.
+    auto numCodes = count + count / (MaxCodes / 4) + 4;
+    auto dataBytes = (numCodes * MaxCodeSize + 7) / 8;
+    // The minimum code size, a length byte per sub-block and the terminator
+    return 1 + dataBytes + (dataBytes + 254) / 255 + 1;
+}
+
+void LzwEncoder::ResetTable()
+{
+    std::fill(m_keys.begin(), m_keys.end(), 0);
+    // Every index starts out as a run of one. Indices past the clear code
+    // are invalid, but get one too so that a run of them can't loop.
+    for (uint32_t index = 0; index < m_runCodes.size(); index++)
+    {
+        m_runCodes[index].clear();
+        m_runCodes[index].push_back(static_cast<uint16_t>(index));
+    }
+}
+
+void LzwEncoder::Encode(
+    uint8_t const* indices,
+    size_t count,
+    uint32_t minCodeSize,
+    std::vector<uint8_t>& output,
+    LzwClearMode clearMode)
+{
+    const uint32_t clearCode = 1u << minCodeSize;
+    const uint32_t endCode = clearCode + 1;
+    uint32_t nextCode = endCode + 1;
+    uint32_t codeSize = minCodeSize + 1;
+
+    output.reserve(output.size() + MaxEncodedSize(count));
+    output.push_back(static_cast<uint8_t>(minCodeSize));
+    SubBlockWriter writer(output);
+
+    ResetTable();
+    writer.WriteCode(clearCode, codeSize);
+    if (count == 0)
+    {
+        writer.WriteCode(endCode, codeSize);
+        writer.Finish();
+        return;
+    }
+
+    // Once the dictionary is full in adaptive mode, the bits written are
+    // measured over windows of at least ClearCheckpointIndices indices.
+    // Each window has to do about as well as the best rate so far, which
+    // starts out as the rate while the dictionary was filling up.
+    size_t checkpointPosition = 0;
+    uint64_t checkpointBits = writer.BitsWritten();
+    size_t bestWindowIndices = 0;
+    uint64_t bestWindowBits = 0;
+    auto shouldClear = [&](size_t position)
+    {
+        if (clearMode == LzwClearMode::WhenFull)
+        {
+            return true;
+        }
+        auto windowIndices = position - checkpointPosition;
+        if (windowIndices < ClearCheckpointIndices)
+        {
+            return false;
+        }
+        auto windowBits = writer.BitsWritten() - checkpointBits;
+        checkpointPosition = position;
+        checkpointBits = writer.BitsWritten();
+        if (windowBits * bestWindowIndices < bestWindowBits * windowIndices)
+        {
+            bestWindowIndices = windowIndices;
+            bestWindowBits = windowBits;
+            return false;
+        }
+        // Allow an eighth more than the best rate before starting over,
+        // so that a noisy stretch doesn't throw away a good dictionary
+        return windowBits * bestWindowIndices * 8 > bestWindowBits * windowIndices * 9;
+    };
+
+    // Writes the code for the current string, which ends before position,
+    // and makes room for that string followed by the next index. Returns
+    // the code the longer string gets, or 0 when the dictionary is full.
+    auto writeString = [&](uint32_t code, size_t position) -> uint32_t
+    {
+        writer.WriteCode(code, codeSize);
+        if (nextCode < MaxCodes)
+        {
+            auto newCode = nextCode;
+            // The decoder needs one more bit as soon as the code we
+            // just added no longer fits.
+            if (nextCode == (1u << codeSize))
+            {
+                codeSize++;
+            }
+            nextCode++;
+            if (nextCode == MaxCodes)
+            {
+                bestWindowIndices = position - checkpointPosition;
+                bestWindowBits = writer.BitsWritten() - checkpointBits;
+                checkpointPosition = position;
+                checkpointBits = writer.BitsWritten();
+            }
+            return newCode;
+        }
+        if (shouldClear(position))
+        {
+            writer.WriteCode(clearCode, codeSize);
+            ResetTable();
+            nextCode = endCode + 1;
+            codeSize = minCodeSize + 1;
+            checkpointPosition = position;
+            checkpointBits = writer.BitsWritten();
+        }
+        return 0;
+    };
+
+    auto keys = m_keys.data();
+    auto codes = m_codes.data();
+    uint32_t prefix = indices[0];
+    // While the current string is one index repeated, that index and the
+    // number of times. runLength is 0 for any other string.
+    uint32_t runIndex = prefix;
+    size_t runLength = 1;
+    for (size_t i = 1; i < count; i++)
+    {
+        uint32_t index = indices[i];
+        if (runLength > 0 && index == runIndex)
+        {
+            // The string would grow through every longer run we have a
+            // code for, so take the whole run at once. The longest known
+            // run is written and one index longer is added, until what
+            // is left of the run has a code.
+            auto end = i + 1;
+            while (end < count && indices[end] == index)
+            {
+                end++;
+            }
+            auto&& runCodes = m_runCodes[index];
+            auto remaining = runLength + (end - i);
+            while (remaining > runCodes.size())
+            {
+                auto longest = runCodes.size();
+                auto newCode = writeString(runCodes[longest - 1], end - remaining + longest);
+                if (newCode != 0)
+                {
+                    runCodes.push_back(static_cast<uint16_t>(newCode));
+                }
+                remaining -= longest;
+            }
+            prefix = runCodes[remaining - 1];
+            runLength = remaining;
+            i = end - 1;
+            continue;
+        }
+
+        uint32_t key = ((prefix << 8) | index) + 1;
+
+        // Look for the string in the dictionary
+        auto slot = HashKey(key, HashTableBits);
+        bool found = false;
+        while (keys[slot] != 0)
+        {
+            if (keys[slot] == key)
+            {
+                found = true;
+                break;
+            }
+            slot = (slot + 1) & (HashTableSize - 1);
+        }
+        if (found)
+        {
+            prefix = codes[slot];
+            runLength = 0;
+            continue;
+        }
+
+        if (auto newCode = writeString(prefix, i))
+        {
+            keys[slot] = key;
+            codes[slot] = static_cast<uint16_t>(newCode);
+        }
+        prefix = index;
+        runIndex = index;
+        runLength = 1;
+    }
+    writer.WriteCode(prefix, codeSize);
+
+    // The decoder adds an entry when it reads the last code, so it may
+    // expect a wider end code than the one we last wrote.
+    if (nextCode < MaxCodes && nextCode == (1u << codeSize))
+    {
+        codeSize++;
+    }
+    writer.WriteCode(endCode, codeSize);
+    writer.Finish();
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// When the compressor starts over with an empty dictionary
+enum class LzwClearMode
+{
+    // As soon as the dictionary is full, like most encoders do
+    WhenFull,
+    // A full dictionary is kept while it compresses as well as it did
+    // when it filled up, and cleared once the output rate gets worse. GIF
+    // decoders have to handle a full dictionary without a clear code, but
+    // some very old ones don't.
+    Adaptive,
+};
+
+wchar_t const* LzwClearModeToString(LzwClearMode mode);
+
+// A table-driven GIF LZW compressor. The dictionary is an open addressed
+// hash table keyed on (prefix code, next index), which keeps lookups to a
+// couple of probes without needing a 4096x256 child table. Runs of one
+// index skip the hash table: the codes for strings of a single repeated
+// index are kept per index, so a run costs one step per code written
+// rather than one per index. An encoder instance can be reused across
+// frames to avoid reallocating its tables.
+class LzwEncoder
+{
+public:
+    static const uint32_t MaxCodeSize = 12;
+    static const uint32_t MaxCodes = 1 << MaxCodeSize;
+
+    LzwEncoder();
+
+    // An upper bound on what Encode appends for the given number of indices
+    static size_t MaxEncodedSize(size_t count);
+
+    // Appends GIF image data to the output: the LZW minimum code size byte,
+    // followed by the compressed data sub-blocks and the block terminator.
+    void Encode(
+        uint8_t const* indices,
+        size_t count,
+        uint32_t minCodeSize,
+        std::vector<uint8_t>& output,
+        LzwClearMode clearMode = LzwClearMode::WhenFull);
+
+private:
+    static const uint32_t HashTableBits = 13;
+    static const uint32_t HashTableSize = 1 << HashTableBits;
+    // With LzwClearMode::Adaptive, a full dictionary is judged by the bits
+    // written for every this many indices
+    static const uint32_t ClearCheckpointIndices = 4096;
+
+    void ResetTable();
+
+    // Keys are stored with an offset of one so that zero means empty
+    std::vector<uint32_t> m_keys;
+    std::vector<uint16_t> m_codes;
+    // m_runCodes[index][n - 1] is the code for index repeated n times.
+    // These strings aren't in the hash table.
+    std::array<std::vector<uint16_t>, 256> m_runCodes;
+};
+
+// Returns the number of bits needed for a GIF color table that can hold
+// the given number of colors. GIF color tables hold between 2 and 256 entries.
+inline uint32_t ComputeColorTableBits(size_t numColors)
+{
+    uint32_t bits = 1;
+    while (bits < 8 && (static_cast<size_t>(1) << bits) < numColors)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+// The minimum code size must be at least 2, even for 1-bit color tables.
+inline uint32_t ComputeLzwMinCodeSize(uint32_t colorTableBits)
+{
+    return colorTableBits < 2 ? 2 : colorTableBits;
+}
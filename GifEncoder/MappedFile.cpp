@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(std::filesystem::path const& path)
+{
+    auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Failed to open file.");
+    }
+    m_file = file;
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(file, &size) || static_cast<uint64_t>(size.QuadPart) > SIZE_MAX)
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to get the file size.");
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+
+    // Empty files can't be mapped
+    if (m_size > 0)
+    {
+        m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping == nullptr)
+        {
+            CloseHandle(file);
+            throw std::runtime_error("Failed to map file.");
+        }
+        m_data = static_cast<uint8_t const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data == nullptr)
+        {
+            CloseHandle(m_mapping);
+            CloseHandle(file);
+            throw std::runtime_error("Failed to map file.");
+        }
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+    }
+    CloseHandle(m_file);
+}
+#else
+MappedFile::MappedFile(std::filesystem::path const& path)
+{
+    m_file = open(path.c_str(), O_RDONLY);
+    if (m_file < 0)
+    {
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    struct stat info = {};
+    if (fstat(m_file, &info) != 0)
+    {
+        close(m_file);
+        throw std::runtime_error("Failed to get the file size.");
+    }
+    m_size = static_cast<size_t>(info.st_size);
+
+    // Empty files can't be mapped
+    if (m_size > 0)
+    {
+        auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+        if (data == MAP_FAILED)
+        {
+            close(m_file);
+            throw std::runtime_error("Failed to map file.");
+        }
+        m_data = static_cast<uint8_t const*>(data);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+    close(m_file);
+}
+#endif
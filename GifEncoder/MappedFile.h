@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// A read-only view of a whole file. Pages are only read in as they are
+// touched, so opening large files is cheap.
+class MappedFile
+{
+public:
+    explicit MappedFile(std::filesystem::path const& path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    uint8_t const* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    uint8_t const* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+};
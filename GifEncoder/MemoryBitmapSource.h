@@ -0,0 +1,89 @@
+#pragma once
+
+// Exposes BGRA pixels that are already in memory to WIC without copying
+// them the way CreateBitmapFromMemory does. The pixels must outlive the
+// source.
+struct MemoryBitmapSource : winrt::implements<MemoryBitmapSource, IWICBitmapSource>
+{
+	MemoryBitmapSource(uint8_t const* pixels, uint32_t width, uint32_t height, uint32_t stride)
+	{
+		m_pixels = pixels;
+		m_width = width;
+		m_height = height;
+		m_stride = stride;
+	}
+
+	HRESULT __stdcall GetSize(UINT* width, UINT* height) noexcept override
+	{
+		if (width == nullptr || height == nullptr)
+		{
+			return E_INVALIDARG;
+		}
+		*width = m_width;
+		*height = m_height;
+		return S_OK;
+	}
+
+	HRESULT __stdcall GetPixelFormat(WICPixelFormatGUID* pixelFormat) noexcept override
+	{
+		if (pixelFormat == nullptr)
+		{
+			return E_INVALIDARG;
+		}
+		*pixelFormat = GUID_WICPixelFormat32bppBGRA;
+		return S_OK;
+	}
+
+	HRESULT __stdcall GetResolution(double* dpiX, double* dpiY) noexcept override
+	{
+		if (dpiX == nullptr || dpiY == nullptr)
+		{
+			return E_INVALIDARG;
+		}
+		*dpiX = 96.0;
+		*dpiY = 96.0;
+		return S_OK;
+	}
+
+	HRESULT __stdcall CopyPalette(IWICPalette*) noexcept override
+	{
+		return WINCODEC_ERR_PALETTEUNAVAILABLE;
+	}
+
+	HRESULT __stdcall CopyPixels(WICRect const* rect, UINT stride, UINT bufferSize, BYTE* buffer) noexcept override
+	{
+		WICRect fullRect = { 0, 0, static_cast<INT>(m_width), static_cast<INT>(m_height) };
+		if (rect == nullptr)
+		{
+			rect = &fullRect;
+		}
+		if (buffer == nullptr || rect->X < 0 || rect->Y < 0 || rect->Width < 0 || rect->Height < 0 ||
+			static_cast<uint32_t>(rect->X + rect->Width) > m_width ||
+			static_cast<uint32_t>(rect->Y + rect->Height) > m_height)
+		{
+			return E_INVALIDARG;
+		}
+		if (rect->Width == 0 || rect->Height == 0)
+		{
+			return S_OK;
+		}
+
+		auto rowBytes = static_cast<size_t>(rect->Width) * 4;
+		if (stride < rowBytes || static_cast<size_t>(stride) * (rect->Height - 1) + rowBytes > bufferSize)
+		{
+			return WINCODEC_ERR_INSUFFICIENTBUFFER;
+		}
+		for (INT y = 0; y < rect->Height; y++)
+		{
+			auto source = m_pixels + static_cast<size_t>(rect->Y + y) * m_stride + static_cast<size_t>(rect->X) * 4;
+			memcpy(buffer + static_cast<size_t>(y) * stride, source, rowBytes);
+		}
+		return S_OK;
+	}
+
+private:
+	uint8_t const* m_pixels = nullptr;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	uint32_t m_stride = 0;
+};
@@ -0,0 +1,334 @@
+#include "pch.h"
+#include "PaletteMapper.h"
+#include "Color.h"
+#include "CpuFeatures.h"
+
+namespace
+{
+    uint8_t FindNearestColor(std::vector<uint32_t> const& palette, uint32_t color)
+    {
+        size_t nearest = 0;
+        auto nearestDistance = UINT32_MAX;
+        for (size_t i = 0; i < palette.size(); i++)
+        {
+            if (IsTransparentPixel(palette[i]))
+            {
+                continue;
+            }
+            auto distance = ColorDistanceSquared(palette[i], color);
+            if (distance < nearestDistance)
+            {
+                nearest = i;
+                nearestDistance = distance;
+            }
+        }
+        return static_cast<uint8_t>(nearest);
+    }
+}
+
+int FindTransparentColorIndex(std::vector<uint32_t> const& palette)
+{
+    for (size_t i = 0; i < palette.size(); i++)
+    {
+        if (palette[i] == 0)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void MapPixelsToIndices(
+    uint32_t const* pixels,
+    size_t count,
+    std::vector<uint32_t> const& palette,
+    uint8_t* indices)
+{
+    auto transparentColorIndex = FindTransparentColorIndex(palette);
+
+    // Neighboring pixels are often the same color, so remember the last lookup
+    uint32_t lastColor = 0;
+    uint8_t lastIndex = 0;
+    bool hasLast = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto pixel = pixels[i];
+        if (IsTransparentPixel(pixel) && transparentColorIndex >= 0)
+        {
+            indices[i] = static_cast<uint8_t>(transparentColorIndex);
+            continue;
+        }
+
+        pixel |= 0xFF000000;
+        if (!hasLast || pixel != lastColor)
+        {
+            lastColor = pixel;
+            lastIndex = FindNearestColor(palette, pixel);
+            hasLast = true;
+        }
+        indices[i] = lastIndex;
+    }
+}
+
+namespace
+{
+    inline uint32_t ColorToCellKey(uint32_t color)
+    {
+        return ((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F);
+    }
+
+    // Transparent pixels get their own cell past the end of the color cube
+    const uint32_t TransparentKey = 1 << 16;
+
+    // When mapTransparent is false, transparent pixels are keyed by color.
+    void ComputeCellKeys(uint32_t const* pixels, size_t count, bool mapTransparent, uint32_t* keys)
+    {
+        size_t i = 0;
+#if defined(GIFENCODER_X86)
+        const auto redMask = _mm_set1_epi32(0xF800);
+        const auto greenMask = _mm_set1_epi32(0x07E0);
+        const auto blueMask = _mm_set1_epi32(0x001F);
+        const auto transparentKey = _mm_set1_epi32(static_cast<int>(TransparentKey));
+        const auto threshold = _mm_set1_epi32(static_cast<int>(TransparentAlphaThreshold));
+        const auto transparentEnabled = _mm_set1_epi32(mapTransparent ? -1 : 0);
+        for (; i + 4 <= count; i += 4)
+        {
+            auto color = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pixels + i));
+            auto key = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_and_si128(_mm_srli_epi32(color, 8), redMask),
+                    _mm_and_si128(_mm_srli_epi32(color, 5), greenMask)),
+                _mm_and_si128(_mm_srli_epi32(color, 3), blueMask));
+            auto opaque = _mm_cmpgt_epi32(_mm_srli_epi32(color, 24), threshold);
+            auto transparent = _mm_andnot_si128(opaque, transparentEnabled);
+            key = _mm_or_si128(_mm_andnot_si128(transparent, key), _mm_and_si128(transparent, transparentKey));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(keys + i), key);
+        }
+#elif defined(GIFENCODER_NEON)
+        const auto threshold = vdupq_n_u32(TransparentAlphaThreshold);
+        const auto transparentEnabled = vdupq_n_u32(mapTransparent ? 0xFFFFFFFF : 0);
+        for (; i + 4 <= count; i += 4)
+        {
+            auto color = vld1q_u32(pixels + i);
+            auto key = vorrq_u32(
+                vorrq_u32(
+                    vandq_u32(vshrq_n_u32(color, 8), vdupq_n_u32(0xF800)),
+                    vandq_u32(vshrq_n_u32(color, 5), vdupq_n_u32(0x07E0))),
+                vandq_u32(vshrq_n_u32(color, 3), vdupq_n_u32(0x001F)));
+            auto transparent = vandq_u32(vcleq_u32(vshrq_n_u32(color, 24), threshold), transparentEnabled);
+            key = vbslq_u32(transparent, vdupq_n_u32(TransparentKey), key);
+            vst1q_u32(keys + i, key);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            auto pixel = pixels[i];
+            keys[i] = (mapTransparent && IsTransparentPixel(pixel)) ? TransparentKey : ColorToCellKey(pixel);
+        }
+    }
+
+    // The 8x8 Bayer matrix, 0 to 63
+    uint32_t GetBayerValue(uint32_t x, uint32_t y)
+    {
+        uint32_t value = 0;
+        for (uint32_t bit = 0; bit < 3; bit++)
+        {
+            value = (value << 2) | ((((x ^ y) >> bit) & 1) << 1) | ((y >> bit) & 1);
+        }
+        return value;
+    }
+
+    // Adds the offsets of the row to pixels that start at column x,
+    // saturating every channel. The offsets leave alpha alone, so
+    // transparent pixels stay transparent.
+    void AddOrderedOffsets(uint32_t const* pixels, size_t count, size_t x, uint32_t const* add, uint32_t const* subtract, uint32_t* dithered)
+    {
+        size_t i = 0;
+#if defined(GIFENCODER_X86)
+        for (; i + 4 <= count; i += 4)
+        {
+            auto column = (x + i) & 7;
+            auto color = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pixels + i));
+            auto addOffsets = _mm_loadu_si128(reinterpret_cast<__m128i const*>(add + column));
+            auto subtractOffsets = _mm_loadu_si128(reinterpret_cast<__m128i const*>(subtract + column));
+            color = _mm_subs_epu8(_mm_adds_epu8(color, addOffsets), subtractOffsets);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dithered + i), color);
+        }
+#elif defined(GIFENCODER_NEON)
+        for (; i + 4 <= count; i += 4)
+        {
+            auto column = (x + i) & 7;
+            auto color = vreinterpretq_u8_u32(vld1q_u32(pixels + i));
+            auto addOffsets = vreinterpretq_u8_u32(vld1q_u32(add + column));
+            auto subtractOffsets = vreinterpretq_u8_u32(vld1q_u32(subtract + column));
+            color = vqsubq_u8(vqaddq_u8(color, addOffsets), subtractOffsets);
+            vst1q_u32(dithered + i, vreinterpretq_u32_u8(color));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            auto column = (x + i) & 7;
+            auto pixel = pixels[i];
+            uint32_t result = 0;
+            for (uint32_t shift = 0; shift < 32; shift += 8)
+            {
+                auto value = static_cast<int32_t>((pixel >> shift) & 0xFF) +
+                    static_cast<int32_t>((add[column] >> shift) & 0xFF) -
+                    static_cast<int32_t>((subtract[column] >> shift) & 0xFF);
+                result |= static_cast<uint32_t>(std::min(std::max(value, 0), 255)) << shift;
+            }
+            dithered[i] = result;
+        }
+    }
+}
+
+InverseColorMap::InverseColorMap(std::vector<uint32_t> const& palette)
+{
+    m_palette = palette;
+    m_transparentColorIndex = FindTransparentColorIndex(palette);
+    m_table = std::vector<std::atomic<uint16_t>>(TransparentKey + 1);
+    for (auto&& cell : m_table)
+    {
+        cell.store(EmptyCell, std::memory_order_relaxed);
+    }
+    if (m_transparentColorIndex >= 0)
+    {
+        m_table[TransparentKey].store(static_cast<uint16_t>(m_transparentColorIndex), std::memory_order_relaxed);
+    }
+
+    // Spread the offsets over about the distance between neighboring
+    // palette colors along a channel, as if the palette were a uniform grid
+    auto numOpaqueColors = std::max(static_cast<int>(m_palette.size()) - (m_transparentColorIndex >= 0 ? 1 : 0), 1);
+    auto spread = std::min(std::max(static_cast<int32_t>(256.0 / std::cbrt(numOpaqueColors)), 4), 64);
+    for (uint32_t y = 0; y < 8; y++)
+    {
+        for (uint32_t x = 0; x < 16; x++)
+        {
+            auto offset = ((static_cast<int32_t>(GetBayerValue(x & 7, y)) * 2 + 1) * spread) / 128 - spread / 2;
+            auto add = static_cast<uint32_t>(std::max(offset, 0));
+            auto subtract = static_cast<uint32_t>(std::max(-offset, 0));
+            m_orderedAdd[(y * 16) + x] = MakeColor(0, add, add, add);
+            m_orderedSubtract[(y * 16) + x] = MakeColor(0, subtract, subtract, subtract);
+        }
+    }
+}
+
+uint8_t InverseColorMap::FillCell(uint32_t key)
+{
+    // Use the center of the cell
+    auto red = ((key >> 11) << 3) | 4;
+    auto green = (((key >> 5) & 0x3F) << 2) | 2;
+    auto blue = ((key & 0x1F) << 3) | 4;
+    auto index = FindNearestColor(m_palette, MakeColor(255, red, green, blue));
+    m_table[key].store(index, std::memory_order_relaxed);
+    return index;
+}
+
+void InverseColorMap::LookUpCells(uint32_t const* keys, size_t count, uint8_t* indices)
+{
+    auto table = m_table.data();
+    for (size_t i = 0; i < count; i++)
+    {
+        auto key = keys[i];
+        auto value = table[key].load(std::memory_order_relaxed);
+        indices[i] = value != EmptyCell ? static_cast<uint8_t>(value) : FillCell(key);
+    }
+}
+
+void InverseColorMap::MapPixels(uint32_t const* pixels, size_t count, uint8_t* indices)
+{
+    // Compute keys a block at a time into a buffer on the stack, so that
+    // threads mapping different rows don't share any scratch memory
+    const size_t blockSize = 1024;
+    uint32_t keys[blockSize];
+    // Without a transparent entry, transparent pixels keep their color
+    auto mapTransparent = m_transparentColorIndex >= 0;
+
+    for (size_t start = 0; start < count; start += blockSize)
+    {
+        auto blockCount = std::min(blockSize, count - start);
+        ComputeCellKeys(pixels + start, blockCount, mapTransparent, keys);
+        LookUpCells(keys, blockCount, indices + start);
+    }
+}
+
+void InverseColorMap::MapPixelsOrdered(uint32_t const* pixels, size_t count, uint32_t x, uint32_t y, uint8_t* indices)
+{
+    const size_t blockSize = 512;
+    uint32_t dithered[blockSize];
+    uint32_t keys[blockSize];
+    auto mapTransparent = m_transparentColorIndex >= 0;
+    auto add = m_orderedAdd.data() + ((y & 7) * 16);
+    auto subtract = m_orderedSubtract.data() + ((y & 7) * 16);
+
+    for (size_t start = 0; start < count; start += blockSize)
+    {
+        auto blockCount = std::min(blockSize, count - start);
+        AddOrderedOffsets(pixels + start, blockCount, x + start, add, subtract, dithered);
+        ComputeCellKeys(dithered, blockCount, mapTransparent, keys);
+        LookUpCells(keys, blockCount, indices + start);
+    }
+}
+
+uint8_t InverseColorMap::MapColor(uint32_t color)
+{
+    if (m_transparentColorIndex >= 0 && IsTransparentPixel(color))
+    {
+        return static_cast<uint8_t>(m_transparentColorIndex);
+    }
+    auto key = ColorToCellKey(color);
+    auto value = m_table[key].load(std::memory_order_relaxed);
+    return value != EmptyCell ? static_cast<uint8_t>(value) : FillCell(key);
+}
+
+double ComputePaletteError(ColorHistogram const& histogram, InverseColorMap& colorMap, FrameArena& arena)
+{
+    auto const& palette = colorMap.Palette();
+    auto numEntries = histogram.NumUsedBins();
+    auto entries = arena.Allocate<HistogramEntry>(numEntries);
+    histogram.GetEntries(entries);
+
+    double totalError = 0.0;
+    uint64_t totalCount = 0;
+    for (size_t i = 0; i < numEntries; i++)
+    {
+        auto&& entry = entries[i];
+        auto color = MakeColor(
+            255,
+            static_cast<uint32_t>(entry.Red + 0.5f),
+            static_cast<uint32_t>(entry.Green + 0.5f),
+            static_cast<uint32_t>(entry.Blue + 0.5f));
+        auto mapped = palette[colorMap.MapColor(color)];
+        totalError += static_cast<double>(ColorDistanceSquared(color, mapped)) * entry.Count;
+        totalCount += entry.Count;
+    }
+    return totalCount > 0 ? totalError / totalCount : 0.0;
+}
+
+InverseColorMapCache::InverseColorMapCache(size_t capacity)
+{
+    m_capacity = std::max(capacity, static_cast<size_t>(1));
+}
+
+std::shared_ptr<InverseColorMap> InverseColorMapCache::GetOrCreate(std::vector<uint32_t> const& palette)
+{
+    for (auto it = m_maps.begin(); it != m_maps.end(); it++)
+    {
+        if ((*it)->Palette() == palette)
+        {
+            // Move the node rather than reinserting so hits don't allocate
+            m_maps.splice(m_maps.begin(), m_maps, it);
+            m_hits++;
+            return m_maps.front();
+        }
+    }
+
+    m_misses++;
+    auto map = std::make_shared<InverseColorMap>(palette);
+    m_maps.push_front(map);
+    if (m_maps.size() > m_capacity)
+    {
+        m_maps.pop_back();
+    }
+    return map;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <vector>
+#include "FrameArena.h"
+#include "PaletteQuantizer.h"
+
+// Maps 0xAARRGGBB pixels to the index of the nearest palette color.
+// Nearly transparent pixels map to the transparent palette entry (a color
+// of 0x00000000), if the palette has one. This searches the whole palette
+// for every distinct color, prefer InverseColorMap for whole frames.
+void MapPixelsToIndices(
+    uint32_t const* pixels,
+    size_t count,
+    std::vector<uint32_t> const& palette,
+    uint8_t* indices);
+
+int FindTransparentColorIndex(std::vector<uint32_t> const& palette);
+
+// A 32x64x32 (5-6-5) lookup table from color to palette index. Cells are
+// filled in the first time a color lands in them, so a frame only pays
+// for the part of the color cube it uses. Once warm, mapping a pixel is a
+// table lookup. A cell always fills in with the same index, so several
+// threads can map parts of a frame at once; at worst two of them search
+// the palette for the same cell.
+class InverseColorMap
+{
+public:
+    explicit InverseColorMap(std::vector<uint32_t> const& palette);
+
+    std::vector<uint32_t> const& Palette() const { return m_palette; }
+    int TransparentColorIndex() const { return m_transparentColorIndex; }
+
+    // Same contract as MapPixelsToIndices
+    void MapPixels(uint32_t const* pixels, size_t count, uint8_t* indices);
+    // The same for count pixels of row y starting at column x, with an 8x8
+    // Bayer offset added to every pixel first. The offset only depends on
+    // where a pixel is, so a pixel that doesn't change between frames
+    // keeps its index and the pattern doesn't crawl.
+    void MapPixelsOrdered(uint32_t const* pixels, size_t count, uint32_t x, uint32_t y, uint8_t* indices);
+    uint8_t MapColor(uint32_t color);
+
+private:
+    static constexpr uint16_t EmptyCell = 0xFFFF;
+
+    uint8_t FillCell(uint32_t key);
+    void LookUpCells(uint32_t const* keys, size_t count, uint8_t* indices);
+
+    std::vector<uint32_t> m_palette;
+    int m_transparentColorIndex = -1;
+    // Relaxed atomics, which cost the same as plain loads and stores
+    std::vector<std::atomic<uint16_t>> m_table;
+    // The Bayer offsets of each channel, split by sign so they can be
+    // applied with saturating byte math. Each of the 8 rows holds its 8
+    // columns twice, so 4 pixels from any column load in one go.
+    std::array<uint32_t, 128> m_orderedAdd = {};
+    std::array<uint32_t, 128> m_orderedSubtract = {};
+};
+
+// Returns the mean squared distance, per opaque pixel, between the colors
+// in the histogram and the palette colors they map to. Used to decide
+// whether a palette is still good enough for another frame. The
+// histogram's entries are gathered in the arena.
+double ComputePaletteError(ColorHistogram const& histogram, InverseColorMap& colorMap, FrameArena& arena);
+
+// Keeps the inverse color maps of the most recently used palettes around,
+// so frames that share a palette don't rebuild their table.
+class InverseColorMapCache
+{
+public:
+    explicit InverseColorMapCache(size_t capacity = 4);
+
+    std::shared_ptr<InverseColorMap> GetOrCreate(std::vector<uint32_t> const& palette);
+
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+
+private:
+    size_t m_capacity = 0;
+    // Most recently used first
+    std::list<std::shared_ptr<InverseColorMap>> m_maps;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
@@ -0,0 +1,465 @@
+#include "pch.h"
+#include "PaletteQuantizer.h"
+#include "Color.h"
+
+namespace
+{
+    struct FloatColor
+    {
+        double Red;
+        double Green;
+        double Blue;
+    };
+
+    inline uint32_t ToOpaqueColor(double red, double green, double blue)
+    {
+        auto clamp = [](double value)
+        {
+            auto rounded = static_cast<int>(value + 0.5);
+            return static_cast<uint32_t>(std::min(std::max(rounded, 0), 255));
+        };
+        return MakeColor(255, clamp(red), clamp(green), clamp(blue));
+    }
+
+    inline double DistanceSquared(HistogramEntry const& entry, FloatColor const& color)
+    {
+        auto red = entry.Red - color.Red;
+        auto green = entry.Green - color.Green;
+        auto blue = entry.Blue - color.Blue;
+        return (red * red) + (green * green) + (blue * blue);
+    }
+
+    std::vector<FloatColor> BuildOctreePalette(std::vector<HistogramEntry> const& entries, uint32_t numColors)
+    {
+        // 5-6-5 bins don't carry more than 6 bits per channel
+        const int maxDepth = 6;
+
+        struct Node
+        {
+            int Children[8];
+            int NumChildren;
+            bool IsLeaf;
+            uint64_t Count;
+            double Red;
+            double Green;
+            double Blue;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<std::vector<int>> reducible(maxDepth);
+        auto createNode = [&](int level)
+        {
+            Node node = {};
+            std::fill(std::begin(node.Children), std::end(node.Children), -1);
+            node.IsLeaf = level == maxDepth;
+            nodes.push_back(node);
+            auto index = static_cast<int>(nodes.size() - 1);
+            if (!node.IsLeaf)
+            {
+                reducible[level].push_back(index);
+            }
+            return index;
+        };
+        createNode(0);
+
+        // Every node accumulates the pixels below it, so reducing a node
+        // is just a matter of turning it into a leaf.
+        uint32_t numLeaves = 0;
+        for (auto&& entry : entries)
+        {
+            auto red = static_cast<uint32_t>(entry.Red + 0.5f);
+            auto green = static_cast<uint32_t>(entry.Green + 0.5f);
+            auto blue = static_cast<uint32_t>(entry.Blue + 0.5f);
+            auto weight = static_cast<double>(entry.Count);
+
+            int nodeIndex = 0;
+            for (int level = 0; ; level++)
+            {
+                auto& node = nodes[nodeIndex];
+                node.Count += entry.Count;
+                node.Red += entry.Red * weight;
+                node.Green += entry.Green * weight;
+                node.Blue += entry.Blue * weight;
+                if (level == maxDepth)
+                {
+                    break;
+                }
+
+                auto shift = 7 - level;
+                auto childSlot = (((red >> shift) & 1) << 2) | (((green >> shift) & 1) << 1) | ((blue >> shift) & 1);
+                auto child = nodes[nodeIndex].Children[childSlot];
+                if (child < 0)
+                {
+                    child = createNode(level + 1);
+                    nodes[nodeIndex].Children[childSlot] = child;
+                    nodes[nodeIndex].NumChildren++;
+                    if (level + 1 == maxDepth)
+                    {
+                        numLeaves++;
+                    }
+                }
+                nodeIndex = child;
+            }
+        }
+
+        // Fold the smallest of the deepest nodes into their parents until
+        // we're under the color budget.
+        while (numLeaves > numColors)
+        {
+            int level = maxDepth - 1;
+            while (level > 0 && reducible[level].empty())
+            {
+                level--;
+            }
+            auto& candidates = reducible[level];
+            if (candidates.empty())
+            {
+                break;
+            }
+
+            size_t best = 0;
+            for (size_t i = 1; i < candidates.size(); i++)
+            {
+                if (nodes[candidates[i]].Count < nodes[candidates[best]].Count)
+                {
+                    best = i;
+                }
+            }
+            auto& node = nodes[candidates[best]];
+            node.IsLeaf = true;
+            numLeaves -= node.NumChildren - 1;
+            candidates[best] = candidates.back();
+            candidates.pop_back();
+        }
+
+        std::vector<FloatColor> colors;
+        std::vector<int> stack = { 0 };
+        while (!stack.empty())
+        {
+            auto& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.IsLeaf)
+            {
+                auto count = static_cast<double>(node.Count);
+                colors.push_back({ node.Red / count, node.Green / count, node.Blue / count });
+                continue;
+            }
+            for (auto child : node.Children)
+            {
+                if (child >= 0)
+                {
+                    stack.push_back(child);
+                }
+            }
+        }
+        return colors;
+    }
+
+    struct ColorBox
+    {
+        size_t Begin;
+        size_t End;
+        FloatColor Mean;
+        FloatColor Variance;
+        double Error;
+    };
+
+    ColorBox CreateBox(std::vector<HistogramEntry> const& entries, size_t begin, size_t end)
+    {
+        ColorBox box = {};
+        box.Begin = begin;
+        box.End = end;
+
+        double weight = 0;
+        FloatColor sum = {};
+        FloatColor sumSquares = {};
+        for (auto i = begin; i < end; i++)
+        {
+            auto&& entry = entries[i];
+            auto count = static_cast<double>(entry.Count);
+            weight += count;
+            sum.Red += entry.Red * count;
+            sum.Green += entry.Green * count;
+            sum.Blue += entry.Blue * count;
+            sumSquares.Red += entry.Red * entry.Red * count;
+            sumSquares.Green += entry.Green * entry.Green * count;
+            sumSquares.Blue += entry.Blue * entry.Blue * count;
+        }
+
+        box.Mean = { sum.Red / weight, sum.Green / weight, sum.Blue / weight };
+        box.Variance.Red = (sumSquares.Red / weight) - (box.Mean.Red * box.Mean.Red);
+        box.Variance.Green = (sumSquares.Green / weight) - (box.Mean.Green * box.Mean.Green);
+        box.Variance.Blue = (sumSquares.Blue / weight) - (box.Mean.Blue * box.Mean.Blue);
+        box.Error = (box.Variance.Red + box.Variance.Green + box.Variance.Blue) * weight;
+        return box;
+    }
+
+    std::vector<FloatColor> BuildMedianCutPalette(std::vector<HistogramEntry> entries, uint32_t numColors)
+    {
+        std::vector<ColorBox> boxes;
+        boxes.push_back(CreateBox(entries, 0, entries.size()));
+
+        // Always split the box that contributes the most squared error
+        while (boxes.size() < numColors)
+        {
+            size_t best = boxes.size();
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                auto&& box = boxes[i];
+                if (box.End - box.Begin >= 2 && box.Error > 0 &&
+                    (best == boxes.size() || box.Error > boxes[best].Error))
+                {
+                    best = i;
+                }
+            }
+            if (best == boxes.size())
+            {
+                break;
+            }
+
+            auto box = boxes[best];
+            auto first = entries.begin() + box.Begin;
+            auto last = entries.begin() + box.End;
+            if (box.Variance.Red >= box.Variance.Green && box.Variance.Red >= box.Variance.Blue)
+            {
+                std::sort(first, last, [](auto&& a, auto&& b) { return a.Red < b.Red; });
+            }
+            else if (box.Variance.Green >= box.Variance.Blue)
+            {
+                std::sort(first, last, [](auto&& a, auto&& b) { return a.Green < b.Green; });
+            }
+            else
+            {
+                std::sort(first, last, [](auto&& a, auto&& b) { return a.Blue < b.Blue; });
+            }
+
+            // Split at the weighted median, keeping both halves non-empty
+            uint64_t total = 0;
+            for (auto i = box.Begin; i < box.End; i++)
+            {
+                total += entries[i].Count;
+            }
+            uint64_t accumulated = 0;
+            auto split = box.Begin + 1;
+            for (auto i = box.Begin; i < box.End - 1; i++)
+            {
+                accumulated += entries[i].Count;
+                split = i + 1;
+                if (accumulated * 2 >= total)
+                {
+                    break;
+                }
+            }
+
+            boxes[best] = CreateBox(entries, box.Begin, split);
+            boxes.push_back(CreateBox(entries, split, box.End));
+        }
+
+        std::vector<FloatColor> colors;
+        colors.reserve(boxes.size());
+        for (auto&& box : boxes)
+        {
+            colors.push_back(box.Mean);
+        }
+        return colors;
+    }
+
+    void RefineWithKMeans(std::vector<HistogramEntry> const& entries, std::vector<FloatColor>& centroids, uint32_t iterations)
+    {
+        std::vector<FloatColor> sums(centroids.size());
+        std::vector<double> weights(centroids.size());
+        for (uint32_t iteration = 0; iteration < iterations; iteration++)
+        {
+            std::fill(sums.begin(), sums.end(), FloatColor{});
+            std::fill(weights.begin(), weights.end(), 0.0);
+
+            for (auto&& entry : entries)
+            {
+                size_t nearest = 0;
+                auto nearestDistance = DistanceSquared(entry, centroids[0]);
+                for (size_t i = 1; i < centroids.size(); i++)
+                {
+                    auto distance = DistanceSquared(entry, centroids[i]);
+                    if (distance < nearestDistance)
+                    {
+                        nearest = i;
+                        nearestDistance = distance;
+                    }
+                }
+
+                auto weight = static_cast<double>(entry.Count);
+                sums[nearest].Red += entry.Red * weight;
+                sums[nearest].Green += entry.Green * weight;
+                sums[nearest].Blue += entry.Blue * weight;
+                weights[nearest] += weight;
+            }
+
+            // Empty clusters keep their previous centroid
+            for (size_t i = 0; i < centroids.size(); i++)
+            {
+                if (weights[i] > 0)
+                {
+                    centroids[i] = { sums[i].Red / weights[i], sums[i].Green / weights[i], sums[i].Blue / weights[i] };
+                }
+            }
+        }
+    }
+}
+
+ColorHistogram::ColorHistogram()
+{
+    m_bins.resize(NumBins, Bin{});
+}
+
+void ColorHistogram::Clear()
+{
+    for (auto&& bin : m_usedBins)
+    {
+        m_bins[bin] = {};
+    }
+    m_usedBins.clear();
+    m_numPixels = 0;
+    m_numTransparentPixels = 0;
+}
+
+void ColorHistogram::AddPixels(uint32_t const* pixels, size_t count)
+{
+    auto bins = m_bins.data();
+    uint64_t numTransparentPixels = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto pixel = pixels[i];
+        if (IsTransparentPixel(pixel))
+        {
+            numTransparentPixels++;
+            continue;
+        }
+
+        auto red = GetRed(pixel);
+        auto green = GetGreen(pixel);
+        auto blue = GetBlue(pixel);
+        auto key = ((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3);
+        auto& bin = bins[key];
+        if (bin.Count == 0)
+        {
+            m_usedBins.push_back(static_cast<uint16_t>(key));
+        }
+        bin.Count++;
+        bin.Red += red;
+        bin.Green += green;
+        bin.Blue += blue;
+    }
+    m_numPixels += count;
+    m_numTransparentPixels += numTransparentPixels;
+}
+
+void ColorHistogram::Merge(ColorHistogram const& other)
+{
+    for (auto&& key : other.m_usedBins)
+    {
+        auto&& source = other.m_bins[key];
+        auto& bin = m_bins[key];
+        if (bin.Count == 0)
+        {
+            m_usedBins.push_back(key);
+        }
+        bin.Count += source.Count;
+        bin.Red += source.Red;
+        bin.Green += source.Green;
+        bin.Blue += source.Blue;
+    }
+    m_numPixels += other.m_numPixels;
+    m_numTransparentPixels += other.m_numTransparentPixels;
+}
+
+std::vector<HistogramEntry> ColorHistogram::GetEntries() const
+{
+    std::vector<HistogramEntry> entries(m_usedBins.size());
+    GetEntries(entries.data());
+    return entries;
+}
+
+void ColorHistogram::GetEntries(HistogramEntry* entries) const
+{
+    auto entry = entries;
+    for (auto&& key : m_usedBins)
+    {
+        auto&& bin = m_bins[key];
+        auto count = static_cast<float>(bin.Count);
+        *entry++ = { bin.Red / count, bin.Green / count, bin.Blue / count, bin.Count };
+    }
+    // Keep the output independent of the order pixels were added in
+    std::sort(entries, entry, [](auto&& a, auto&& b)
+    {
+        if (a.Red != b.Red) return a.Red < b.Red;
+        if (a.Green != b.Green) return a.Green < b.Green;
+        return a.Blue < b.Blue;
+    });
+}
+
+std::vector<uint32_t> BuildPalette(ColorHistogram const& histogram, QuantizerOptions const& options)
+{
+    auto numColors = std::min(std::max(options.MaxColors, 2u), 256u);
+    if (options.AddTransparentColor)
+    {
+        numColors--;
+    }
+
+    auto entries = histogram.GetEntries();
+    std::vector<FloatColor> colors;
+    if (entries.size() <= numColors)
+    {
+        // Every bin gets its own color
+        for (auto&& entry : entries)
+        {
+            colors.push_back({ entry.Red, entry.Green, entry.Blue });
+        }
+    }
+    else
+    {
+        switch (options.Algorithm)
+        {
+        case QuantizerAlgorithm::Octree:
+            colors = BuildOctreePalette(entries, numColors);
+            break;
+        case QuantizerAlgorithm::MedianCut:
+            colors = BuildMedianCutPalette(entries, numColors);
+            break;
+        case QuantizerAlgorithm::KMeans:
+            colors = BuildMedianCutPalette(entries, numColors);
+            RefineWithKMeans(entries, colors, options.KMeansIterations);
+            break;
+        }
+    }
+
+    std::vector<uint32_t> palette;
+    palette.reserve(colors.size() + 1);
+    for (auto&& color : colors)
+    {
+        palette.push_back(ToOpaqueColor(color.Red, color.Green, color.Blue));
+    }
+    if (options.AddTransparentColor)
+    {
+        palette.push_back(0);
+    }
+    else if (palette.empty())
+    {
+        palette.push_back(MakeColor(255, 0, 0, 0));
+    }
+    return palette;
+}
+
+const wchar_t* QuantizerAlgorithmToString(QuantizerAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case QuantizerAlgorithm::Octree:
+        return L"octree";
+    case QuantizerAlgorithm::MedianCut:
+        return L"mediancut";
+    case QuantizerAlgorithm::KMeans:
+        return L"kmeans";
+    default:
+        return L"unknown";
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+enum class QuantizerAlgorithm
+{
+    Octree,
+    MedianCut,
+    // Median cut followed by k-means refinement
+    KMeans,
+};
+
+struct QuantizerOptions
+{
+    QuantizerAlgorithm Algorithm = QuantizerAlgorithm::MedianCut;
+    // Includes the transparent color, if one is added
+    uint32_t MaxColors = 256;
+    // Mirrors the fAddTransparentColor parameter of IWICPalette::InitializeFromBitmap
+    bool AddTransparentColor = true;
+    uint32_t KMeansIterations = 4;
+};
+
+struct HistogramEntry
+{
+    float Red;
+    float Green;
+    float Blue;
+    uint64_t Count;
+};
+
+// Buckets pixels into 5-6-5 bins. Each bin keeps the number of pixels and
+// the sum of their channels, so palettes are built from the mean color of
+// each bin rather than its center. Building a palette then costs
+// O(pixels) to fill the histogram plus O(bins) for the algorithm.
+class ColorHistogram
+{
+public:
+    static const uint32_t NumBins = 1 << 16;
+
+    ColorHistogram();
+
+    void Clear();
+    // Pixels are 0xAARRGGBB. Nearly transparent pixels are only counted.
+    void AddPixels(uint32_t const* pixels, size_t count);
+    void Merge(ColorHistogram const& other);
+
+    uint64_t NumPixels() const { return m_numPixels; }
+    uint64_t NumTransparentPixels() const { return m_numTransparentPixels; }
+    size_t NumUsedBins() const { return m_usedBins.size(); }
+    std::vector<HistogramEntry> GetEntries() const;
+    // Writes NumUsedBins() entries, in the same order as above, without
+    // allocating.
+    void GetEntries(HistogramEntry* entries) const;
+
+private:
+    struct Bin
+    {
+        uint64_t Count;
+        uint64_t Red;
+        uint64_t Green;
+        uint64_t Blue;
+    };
+
+    std::vector<Bin> m_bins;
+    std::vector<uint16_t> m_usedBins;
+    uint64_t m_numPixels = 0;
+    uint64_t m_numTransparentPixels = 0;
+};
+
+// Returns a palette of 0xAARRGGBB colors. Opaque colors come first, and the
+// transparent color (0x00000000), if requested, is the last entry.
+std::vector<uint32_t> BuildPalette(ColorHistogram const& histogram, QuantizerOptions const& options);
+
+const wchar_t* QuantizerAlgorithmToString(QuantizerAlgorithm algorithm);
@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "ParallelGifWriter.h"
+
+ParallelGifWriter::ParallelGifWriter(GifWriter& writer, uint32_t numThreads, size_t memoryBudget) :
+    m_writer(writer),
+    m_maxFramesInFlight(static_cast<size_t>(std::max(numThreads, 1u)) * MaxFramesInFlightPerThread),
+    // Each frame in flight holds an index buffer and an output buffer
+    m_bufferPool(m_maxFramesInFlight * 2),
+    m_pool(numThreads)
+{
+    m_memoryBudget = memoryBudget;
+    m_freeFrames.reserve(m_maxFramesInFlight);
+}
+
+std::vector<uint8_t> ParallelGifWriter::AcquireIndexBuffer(size_t size)
+{
+    auto buffer = m_bufferPool.Acquire(size);
+    buffer.resize(size);
+    return buffer;
+}
+
+void ParallelGifWriter::SubmitFrame(
+    GifFrameDesc const& desc,
+    std::vector<uint32_t> const& palette,
+    std::vector<uint8_t>&& indices)
+{
+    PendingFrame* framePtr = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        WriteCompletedFrames(lock);
+        // Always let at least one frame through, even if it is larger
+        // than the whole budget.
+        auto bytes = indices.size();
+        while (!m_pendingFrames.empty() &&
+            (m_pendingBytes + bytes > m_memoryBudget || m_pendingFrames.size() >= m_maxFramesInFlight))
+        {
+            m_frameCompleted.wait(lock);
+            WriteCompletedFrames(lock);
+        }
+
+        std::unique_ptr<PendingFrame> frame;
+        if (!m_freeFrames.empty())
+        {
+            frame = std::move(m_freeFrames.back());
+            m_freeFrames.pop_back();
+        }
+        else
+        {
+            frame = std::make_unique<PendingFrame>();
+        }
+        frame->Desc = desc;
+        frame->ClearMode = m_writer.ClearMode();
+        // Recycled frames already have room for a palette
+        frame->Palette.assign(palette.begin(), palette.end());
+        frame->Indices = std::move(indices);
+        frame->Bytes = frame->Indices.size();
+        frame->Number = m_nextFrameNumber++;
+        m_pendingBytes += frame->Bytes;
+        framePtr = frame.get();
+        m_pendingFrames.push_back(std::move(frame));
+    }
+
+    m_pool.Submit([this, framePtr]() { CompressFrame(framePtr); });
+}
+
+void ParallelGifWriter::Finish()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        WriteCompletedFrames(lock);
+        while (!m_pendingFrames.empty())
+        {
+            m_frameCompleted.wait(lock);
+            WriteCompletedFrames(lock);
+        }
+    }
+    m_writer.Finish();
+}
+
+void ParallelGifWriter::CompressFrame(PendingFrame* frame)
+{
+    // Each worker keeps its own dictionary around between frames
+    thread_local LzwEncoder encoder;
+
+    auto start = std::chrono::steady_clock::now();
+    std::exception_ptr error;
+    std::vector<uint8_t> imageData;
+    try
+    {
+        // Large frames need a large buffer, which can fail like the
+        // compression itself
+        imageData = m_bufferPool.Acquire(LzwEncoder::MaxEncodedSize(frame->Indices.size()));
+        CompressGifImageData(encoder, frame->Indices.data(), frame->Indices.size(), frame->Palette.size(), imageData, frame->ClearMode);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    // The indices aren't needed anymore
+    m_bufferPool.Release(std::move(frame->Indices));
+    auto compressTime = std::chrono::steady_clock::now() - start;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        // Only account for the output from now on
+        m_pendingBytes -= frame->Bytes;
+        frame->Bytes = imageData.size();
+        m_pendingBytes += frame->Bytes;
+        frame->ImageData = std::move(imageData);
+        frame->CompressNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(compressTime).count();
+        frame->Error = error;
+        frame->Done = true;
+    }
+    m_frameCompleted.notify_all();
+}
+
+void ParallelGifWriter::WriteCompletedFrames(std::unique_lock<std::mutex>& lock)
+{
+    while (!m_pendingFrames.empty() && m_pendingFrames.front()->Done)
+    {
+        auto frame = std::move(m_pendingFrames.front());
+        m_pendingFrames.pop_front();
+        if (frame->Error)
+        {
+            m_pendingBytes -= frame->Bytes;
+            auto error = frame->Error;
+            // Hands back whatever output buffer the frame got
+            RecycleFrame(std::move(frame));
+            std::rethrow_exception(error);
+        }
+
+        // Don't hold the lock while writing so workers can keep finishing
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+        m_writer.WriteCompressedFrame(frame->Desc, frame->Palette, frame->ImageData);
+        if (m_frameWritten)
+        {
+            auto writeTime = std::chrono::steady_clock::now() - start;
+            WrittenFrameInfo info = {};
+            info.FrameNumber = frame->Number;
+            info.CompressedBytes = frame->ImageData.size();
+            info.CompressNanoseconds = frame->CompressNanoseconds;
+            info.WriteNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(writeTime).count();
+            m_frameWritten(info);
+        }
+        lock.lock();
+        m_pendingBytes -= frame->Bytes;
+        RecycleFrame(std::move(frame));
+    }
+}
+
+void ParallelGifWriter::RecycleFrame(std::unique_ptr<PendingFrame>&& frame)
+{
+    m_bufferPool.Release(std::move(frame->ImageData));
+    frame->Indices = std::vector<uint8_t>();
+    frame->ImageData = std::vector<uint8_t>();
+    frame->Bytes = 0;
+    frame->Done = false;
+    frame->Error = nullptr;
+    if (m_freeFrames.size() < m_maxFramesInFlight)
+    {
+        m_freeFrames.push_back(std::move(frame));
+    }
+}
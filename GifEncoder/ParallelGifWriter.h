@@ -0,0 +1,94 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "BufferPool.h"
+#include "GifWriter.h"
+#include "RingQueue.h"
+#include "ThreadPool.h"
+
+// Compresses frames on a pool of worker threads and hands the results to
+// a GifWriter in submission order. Frames that finish early wait in a
+// reorder buffer. Once the frames in flight (uncompressed indices plus
+// compressed output) exceed the memory budget, or there are more of them
+// than the workers can usefully queue, SubmitFrame blocks until earlier
+// frames have been written.
+//
+// Index and output buffers come from a pool and go back to it once a
+// frame has been written, and the frames themselves are recycled, so
+// encoding doesn't allocate once the frames in flight have warmed up.
+struct WrittenFrameInfo
+{
+    // Frames are numbered in submission order, starting at zero
+    size_t FrameNumber;
+    size_t CompressedBytes;
+    uint64_t CompressNanoseconds;
+    uint64_t WriteNanoseconds;
+};
+
+class ParallelGifWriter
+{
+public:
+    static const size_t DefaultMemoryBudget = 256 * 1024 * 1024;
+    static const uint32_t MaxFramesInFlightPerThread = 4;
+
+    ParallelGifWriter(GifWriter& writer, uint32_t numThreads, size_t memoryBudget = DefaultMemoryBudget);
+
+    ParallelGifWriter(ParallelGifWriter const&) = delete;
+    ParallelGifWriter& operator=(ParallelGifWriter const&) = delete;
+
+    // Returns a buffer of the given size for SubmitFrame's indices. Its
+    // contents are unspecified.
+    std::vector<uint8_t> AcquireIndexBuffer(size_t size);
+
+    void SubmitFrame(
+        GifFrameDesc const& desc,
+        std::vector<uint32_t> const& palette,
+        std::vector<uint8_t>&& indices);
+
+    // Called after each frame is written, in submission order, on the
+    // thread that submits frames.
+    void SetFrameWrittenCallback(std::function<void(WrittenFrameInfo const&)> callback) { m_frameWritten = std::move(callback); }
+
+    // Waits for every submitted frame to be written and then writes the
+    // trailer.
+    void Finish();
+
+private:
+    struct PendingFrame
+    {
+        GifFrameDesc Desc = {};
+        std::vector<uint32_t> Palette;
+        std::vector<uint8_t> Indices;
+        std::vector<uint8_t> ImageData;
+        // Taken from the writer when the frame is submitted, so the
+        // workers never read it
+        LzwClearMode ClearMode = LzwClearMode::WhenFull;
+        size_t Bytes = 0;
+        size_t Number = 0;
+        uint64_t CompressNanoseconds = 0;
+        bool Done = false;
+        std::exception_ptr Error;
+    };
+
+    void CompressFrame(PendingFrame* frame);
+    void WriteCompletedFrames(std::unique_lock<std::mutex>& lock);
+    void RecycleFrame(std::unique_ptr<PendingFrame>&& frame);
+
+    GifWriter& m_writer;
+    size_t m_memoryBudget = 0;
+    size_t m_maxFramesInFlight = 0;
+    BufferPool m_bufferPool;
+    std::mutex m_lock;
+    std::condition_variable m_frameCompleted;
+    RingQueue<std::unique_ptr<PendingFrame>> m_pendingFrames;
+    std::vector<std::unique_ptr<PendingFrame>> m_freeFrames;
+    size_t m_pendingBytes = 0;
+    size_t m_nextFrameNumber = 0;
+    std::function<void(WrittenFrameInfo const&)> m_frameWritten;
+    // Declared last so that the workers are joined before the frames
+    // they reference are destroyed.
+    ThreadPool m_pool;
+};
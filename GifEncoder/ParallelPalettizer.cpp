@@ -0,0 +1,82 @@
+#include "pch.h"
+#include "ParallelPalettizer.h"
+
+ParallelPalettizer::ParallelPalettizer(RowBandPool& pool, uint32_t width, uint32_t height, DitherMode dither) : m_pool(pool)
+{
+    m_width = width;
+    m_height = height;
+    m_dither = dither;
+    if (IsErrorDiffusion(dither))
+    {
+        m_ditherer = std::make_unique<ErrorDiffusionDitherer>(width, height, dither);
+    }
+}
+
+void ParallelPalettizer::BuildHistogram(uint32_t const* pixels, ColorHistogram& histogram)
+{
+    histogram.Clear();
+    m_threadHistograms.resize(m_pool.NumThreads() - 1);
+    for (auto&& threadHistogram : m_threadHistograms)
+    {
+        if (threadHistogram)
+        {
+            threadHistogram->Clear();
+        }
+    }
+
+    auto width = m_width;
+    m_pool.ForEachBand(0, m_height, [&](uint32_t top, uint32_t bottom, uint32_t, uint32_t thread)
+    {
+        // Each thread only ever touches its own slot
+        ColorHistogram* target = &histogram;
+        if (thread > 0)
+        {
+            auto& threadHistogram = m_threadHistograms[thread - 1];
+            if (!threadHistogram)
+            {
+                threadHistogram = std::make_unique<ColorHistogram>();
+            }
+            target = threadHistogram.get();
+        }
+        target->AddPixels(pixels + (static_cast<size_t>(top) * width), static_cast<size_t>(bottom - top) * width);
+    });
+
+    // Only the order of the used bins depends on which thread added what,
+    // and GetEntries sorts that away
+    for (auto&& threadHistogram : m_threadHistograms)
+    {
+        if (threadHistogram)
+        {
+            histogram.Merge(*threadHistogram);
+        }
+    }
+}
+
+void ParallelPalettizer::MapPixels(InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices)
+{
+    if (m_ditherer)
+    {
+        m_ditherer->MapPixels(&m_pool, colorMap, pixels, indices);
+        return;
+    }
+
+    auto width = m_width;
+    if (m_dither == DitherMode::Bayer)
+    {
+        m_pool.ForEachBand(0, m_height, [&](uint32_t top, uint32_t bottom, uint32_t, uint32_t)
+        {
+            for (auto y = top; y < bottom; y++)
+            {
+                auto offset = static_cast<size_t>(y) * width;
+                colorMap.MapPixelsOrdered(pixels + offset, width, 0, y, indices + offset);
+            }
+        });
+        return;
+    }
+
+    m_pool.ForEachBand(0, m_height, [&](uint32_t top, uint32_t bottom, uint32_t, uint32_t)
+    {
+        auto offset = static_cast<size_t>(top) * width;
+        colorMap.MapPixels(pixels + offset, static_cast<size_t>(bottom - top) * width, indices + offset);
+    });
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Dither.h"
+#include "PaletteQuantizer.h"
+#include "PaletteMapper.h"
+#include "RowBandPool.h"
+
+// Builds the histogram of a frame and maps it to palette indices in row
+// bands on a RowBandPool. The results are the same as one call to
+// ColorHistogram::AddPixels or InverseColorMap::MapPixels over the whole
+// frame: histogram bins are integer sums, so the order they are added up
+// in doesn't matter, and every row's indices only depend on its pixels.
+// Dithered mapping gives the same indices for any number of threads too:
+// Bayer offsets only depend on a pixel's position, and error diffusion
+// runs its rows as a pipeline instead of in independent bands.
+class ParallelPalettizer
+{
+public:
+    ParallelPalettizer(RowBandPool& pool, uint32_t width, uint32_t height, DitherMode dither = DitherMode::None);
+
+    // Clears the histogram and adds the whole frame to it
+    void BuildHistogram(uint32_t const* pixels, ColorHistogram& histogram);
+    void MapPixels(InverseColorMap& colorMap, uint32_t const* pixels, uint8_t* indices);
+
+private:
+    RowBandPool& m_pool;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    DitherMode m_dither = DitherMode::None;
+    std::unique_ptr<ErrorDiffusionDitherer> m_ditherer;
+    // One per thread but the calling one, which adds to the histogram it
+    // was given. Each is about 2MB, so they are only created once a thread
+    // runs a band.
+    std::vector<std::unique_ptr<ColorHistogram>> m_threadHistograms;
+};
@@ -1,37 +1,335 @@
 #pragma once
 #include "IComposedFrameProvider.h"
+#include "ComposedFrameRing.h"
 #include "RaniFormat.h"
+#include "MappedFile.h"
+#include "BufferPool.h"
+#include "RaniCompositor.h"
+#include "Color.h"
+
+// A layer image uploaded to the GPU
+struct GpuLayerBitmap
+{
+	winrt::com_ptr<ID2D1Bitmap1> Bitmap;
+	size_t Bytes = 0;
+};
+
+inline size_t GetCacheEntrySize(GpuLayerBitmap const& bitmap)
+{
+	return bitmap.Bytes;
+}
+
+typedef ContentCache<GpuLayerBitmap> GpuLayerBitmapCache;
+
+// Draws the layers of a frame into a texture that can be used as a render
+// target. Layer images are decoded from the project file the first time
+// they are drawn.
+inline void ComposeFrame(
+	RaniProject const& project,
+	RaniFrame const& frame,
+	MappedFile const& file,
+	BufferPool& bufferPool,
+	GpuLayerBitmapCache& cache,
+	winrt::com_ptr<ID3D11Texture2D> const& renderTargetTexture,
+	winrt::com_ptr<ID3D11Device> const& d3dDevice,
+	winrt::com_ptr<ID2D1DeviceContext> const& d2dContext)
+{
+	auto renderTarget = robmikh::common::uwp::CreateBitmapFromTexture(renderTargetTexture, d2dContext);
+	d2dContext->SetTarget(renderTarget.get());
+
+	auto backgroundColor = project.BackgroundColor;
+	auto clearColor = D2D1_COLOR_F{ static_cast<float>(GetRed(backgroundColor)) / 255.0f, static_cast<float>(GetGreen(backgroundColor)) / 255.0f, static_cast<float>(GetBlue(backgroundColor)) / 255.0f, static_cast<float>(GetAlpha(backgroundColor)) / 255.0f };
+	d2dContext->BeginDraw();
+	d2dContext->Clear(&clearColor);
+	for (int i = static_cast<int>(frame.Layers.size() - 1); i >= 0; i--)
+	{
+		auto&& layer = frame.Layers[i];
+
+		if (layer.Visible)
+		{
+			auto layerBitmap = cache.GetOrCreate(layer.PngDataHash, [&]()
+			{
+				PooledBuffer pngBuffer(bufferPool);
+				DecodeRaniLayerPngData(file.Data(), file.Size(), layer, pngBuffer.Get());
+				auto pngData = winrt::Windows::Security::Cryptography::CryptographicBuffer::CreateFromByteArray(pngBuffer.Get());
+				auto pngDataStream = winrt::Windows::Storage::Streams::InMemoryRandomAccessStream();
+				pngDataStream.WriteAsync(pngData).get();
+
+				auto layerTexture = robmikh::common::uwp::LoadTextureFromStreamAsync(pngDataStream, d3dDevice).get();
+				D3D11_TEXTURE2D_DESC desc = {};
+				layerTexture->GetDesc(&desc);
+				auto bitmap = std::make_shared<GpuLayerBitmap>();
+				bitmap->Bitmap = robmikh::common::uwp::CreateBitmapFromTexture(layerTexture, d2dContext);
+				bitmap->Bytes = static_cast<size_t>(desc.Width) * desc.Height * 4;
+				return std::shared_ptr<GpuLayerBitmap const>(bitmap);
+			});
+
+			auto opacity = layer.Opacity;
+			d2dContext->DrawBitmap(layerBitmap->Bitmap.get(), nullptr, opacity, D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR, nullptr, nullptr);
+		}
+	}
+	winrt::check_hresult(d2dContext->EndDraw());
+	d2dContext->SetTarget(nullptr);
+}
+
+struct RaniComposedFrameReader : IComposedFrameReader
+{
+	RaniComposedFrameReader(
+		RaniProject const& project,
+		MappedFile const& file,
+		BufferPool& bufferPool,
+		GpuLayerBitmapCache& cache,
+		winrt::com_ptr<ID3D11Device> const& d3dDevice,
+		winrt::com_ptr<ID2D1DeviceContext> const& d2dContext) :
+		m_project(project),
+		m_file(file),
+		m_bufferPool(bufferPool),
+		m_cache(cache),
+		m_ring(d3dDevice, project.Width, project.Height),
+		m_downloader(d3dDevice, project.Width, project.Height)
+	{
+		m_d3dDevice = d3dDevice;
+		m_d2dContext = d2dContext;
+	}
+	~RaniComposedFrameReader() {}
+
+	bool TryGetNextFrame(ComposedFrame& frame) override
+	{
+		if (m_frameIndex >= m_project.Frames.size())
+		{
+			return false;
+		}
+
+		m_texture = m_ring.Next();
+		ComposeFrame(m_project, m_project.Frames[m_frameIndex], m_file, m_bufferPool, m_cache, m_texture, m_d3dDevice, m_d2dContext);
+		m_downloader.Download(m_texture, m_pixels);
+		winrt::Windows::Foundation::TimeSpan frameTime = {};
+		if (m_frameIndex > 0)
+		{
+			frameTime = m_project.FrameTime;
+		}
+		frame = ComposedFrame{ m_pixels.data(), frameTime };
+		m_frameIndex++;
+		return true;
+	}
+
+	winrt::com_ptr<ID3D11Texture2D> GetFrameTexture() override { return m_texture; }
+
+private:
+	RaniProject const& m_project;
+	MappedFile const& m_file;
+	BufferPool& m_bufferPool;
+	GpuLayerBitmapCache& m_cache;
+	winrt::com_ptr<ID3D11Device> m_d3dDevice;
+	winrt::com_ptr<ID2D1DeviceContext> m_d2dContext;
+	ComposedFrameRing m_ring;
+	winrt::com_ptr<ID3D11Texture2D> m_texture;
+	FrameDownloader m_downloader;
+	std::vector<uint32_t> m_pixels;
+	size_t m_frameIndex = 0;
+};
+
+// Decodes a png file into premultiplied BGRA. Each thread gets its own
+// WIC factory.
+inline std::shared_ptr<LayerBitmap> DecodePngWithWic(uint8_t const* data, size_t size)
+{
+	thread_local auto wicFactory = winrt::create_instance<IWICImagingFactory2>(CLSID_WICImagingFactory2, CLSCTX_INPROC_SERVER);
+
+	winrt::com_ptr<IWICStream> wicStream;
+	winrt::check_hresult(wicFactory->CreateStream(wicStream.put()));
+	winrt::check_hresult(wicStream->InitializeFromMemory(const_cast<uint8_t*>(data), static_cast<DWORD>(size)));
+	winrt::com_ptr<IWICBitmapDecoder> wicDecoder;
+	winrt::check_hresult(wicFactory->CreateDecoderFromStream(wicStream.get(), nullptr, WICDecodeMetadataCacheOnDemand, wicDecoder.put()));
+	winrt::com_ptr<IWICBitmapFrameDecode> wicFrame;
+	winrt::check_hresult(wicDecoder->GetFrame(0, wicFrame.put()));
+
+	winrt::com_ptr<IWICFormatConverter> wicConverter;
+	winrt::check_hresult(wicFactory->CreateFormatConverter(wicConverter.put()));
+	winrt::check_hresult(wicConverter->Initialize(
+		wicFrame.get(),
+		GUID_WICPixelFormat32bppPBGRA,
+		WICBitmapDitherTypeNone,
+		nullptr,
+		0.0,
+		WICBitmapPaletteTypeCustom));
+
+	auto bitmap = std::make_shared<LayerBitmap>();
+	winrt::check_hresult(wicConverter->GetSize(&bitmap->Width, &bitmap->Height));
+	bitmap->Pixels.resize(static_cast<size_t>(bitmap->Width) * bitmap->Height);
+	auto stride = bitmap->Width * 4;
+	winrt::check_hresult(wicConverter->CopyPixels(
+		nullptr,
+		stride,
+		static_cast<uint32_t>(bitmap->Pixels.size() * sizeof(uint32_t)),
+		reinterpret_cast<BYTE*>(bitmap->Pixels.data())));
+	return bitmap;
+}
+
+struct RaniCpuComposedFrameReader : IComposedFrameReader
+{
+	RaniCpuComposedFrameReader(
+		RaniProject const& project,
+		MappedFile const& file,
+		LayerBitmapCache& cache,
+		uint32_t numThreads,
+		bool uploadFrames,
+		winrt::com_ptr<ID3D11Device> const& d3dDevice) :
+		m_project(project),
+		m_compositor(project, file.Data(), file.Size(), DecodePngWithWic, cache),
+		m_parallelCompositor(m_compositor, project.Frames, numThreads)
+	{
+		if (uploadFrames)
+		{
+			m_uploader.emplace(d3dDevice, project.Width, project.Height);
+		}
+	}
+	~RaniCpuComposedFrameReader() {}
+
+	bool TryGetNextFrame(ComposedFrame& frame) override
+	{
+		if (!m_parallelCompositor.TryGetNextFrame(m_pixels))
+		{
+			return false;
+		}
+
+		if (m_uploader.has_value())
+		{
+			m_uploader->SetFrame(m_pixels.data(), std::nullopt);
+		}
+		winrt::Windows::Foundation::TimeSpan frameTime = {};
+		if (m_frameIndex > 0)
+		{
+			frameTime = m_project.FrameTime;
+		}
+		frame = ComposedFrame{ m_pixels.data(), frameTime };
+		m_frameIndex++;
+		return true;
+	}
+
+	winrt::com_ptr<ID3D11Texture2D> GetFrameTexture() override
+	{
+		return m_uploader.has_value() ? m_uploader->GetTexture() : nullptr;
+	}
+
+private:
+	RaniProject const& m_project;
+	RaniCpuCompositor m_compositor;
+	ParallelRaniCompositor m_parallelCompositor;
+	std::optional<FrameUploader> m_uploader;
+	std::vector<uint32_t> m_pixels;
+	size_t m_frameIndex = 0;
+};
+
+struct RaniIncrementalComposedFrameReader : IComposedFrameReader
+{
+	RaniIncrementalComposedFrameReader(
+		RaniProject const& project,
+		MappedFile const& file,
+		LayerBitmapCache& cache,
+		bool uploadFrames,
+		winrt::com_ptr<ID3D11Device> const& d3dDevice) :
+		m_project(project),
+		m_compositor(project, file.Data(), file.Size(), DecodePngWithWic, cache),
+		m_incrementalCompositor(m_compositor, project)
+	{
+		if (uploadFrames)
+		{
+			m_uploader.emplace(d3dDevice, project.Width, project.Height);
+		}
+	}
+	~RaniIncrementalComposedFrameReader() {}
+
+	bool TryGetNextFrame(ComposedFrame& frame) override
+	{
+		FrameRect dirtyRect = {};
+		if (!m_incrementalCompositor.TryGetNextFrame(dirtyRect))
+		{
+			return false;
+		}
+
+		auto pixels = m_incrementalCompositor.Pixels().data();
+		if (m_uploader.has_value())
+		{
+			m_uploader->SetFrame(pixels, dirtyRect);
+		}
+		winrt::Windows::Foundation::TimeSpan frameTime = {};
+		if (m_frameIndex > 0)
+		{
+			frameTime = m_project.FrameTime;
+		}
+		frame = ComposedFrame{ pixels, frameTime, dirtyRect };
+		m_frameIndex++;
+		return true;
+	}
+
+	winrt::com_ptr<ID3D11Texture2D> GetFrameTexture() override
+	{
+		return m_uploader.has_value() ? m_uploader->GetTexture() : nullptr;
+	}
+
+private:
+	RaniProject const& m_project;
+	RaniCpuCompositor m_compositor;
+	IncrementalRaniCompositor m_incrementalCompositor;
+	std::optional<FrameUploader> m_uploader;
+	size_t m_frameIndex = 0;
+};
 
 struct RaniComposedFrameProvider : IComposedFrameProvider
 {
-	RaniComposedFrameProvider(std::unique_ptr<RaniProject>&& project)
+	RaniComposedFrameProvider(std::unique_ptr<MappedFile>&& file, std::unique_ptr<RaniProject>&& project, ComposeOptions const& options)
 	{
+		m_file = std::move(file);
 		m_project = std::move(project);
+		m_options = options;
 	}
 	~RaniComposedFrameProvider() {}
 
 	uint32_t Width() override { return m_project->Width; }
 	uint32_t Height() override { return m_project->Height; }
-	std::vector<ComposedFrame> GetFrames(
+	uint32_t FrameCount() override { return static_cast<uint32_t>(m_project->Frames.size()); }
+	std::unique_ptr<IComposedFrameReader> CreateFrameReader(
 		winrt::com_ptr<ID3D11Device> const& d3dDevice,
 		winrt::com_ptr<ID2D1DeviceContext> const& d2dContext) override
 	{
-		auto textures = ComposeFrames(m_project, d3dDevice, d2dContext);
-		std::vector<ComposedFrame> frames;
-		frames.reserve(textures.size());
-		for (auto i = 0; i < textures.size(); i++)
+		if (m_options.Backend == ComposeBackend::Cpu)
 		{
-			auto&& texture = textures[i];
-			winrt::Windows::Foundation::TimeSpan frameTime = {};
-			if (i > 0)
-			{
-				frameTime = m_project->FrameTime;
-			}
-			frames.push_back(ComposedFrame{ texture, frameTime });
+			return std::make_unique<RaniCpuComposedFrameReader>(*m_project, *m_file, m_cpuCache, m_options.NumThreads, m_options.FrameTextures, d3dDevice);
+		}
+		if (m_options.Backend == ComposeBackend::CpuIncremental)
+		{
+			return std::make_unique<RaniIncrementalComposedFrameReader>(*m_project, *m_file, m_cpuCache, m_options.FrameTextures, d3dDevice);
 		}
-		return frames;
+		// Cached bitmaps belong to the device context that created them
+		if (m_gpuCacheContext != d2dContext)
+		{
+			m_gpuCache.Clear();
+			m_gpuCacheContext = d2dContext;
+		}
+		return std::make_unique<RaniComposedFrameReader>(*m_project, *m_file, m_bufferPool, m_gpuCache, d3dDevice, d2dContext);
+	}
+
+	void PrintStatistics() override
+	{
+		auto stats = m_options.Backend == ComposeBackend::Gpu ? m_gpuCache.Statistics() : m_cpuCache.Statistics();
+		wprintf(L"Layer cache: %llu hits, %llu misses, %llu evictions, %zu layers (%.2f MB)\n",
+			static_cast<unsigned long long>(stats.Hits),
+			static_cast<unsigned long long>(stats.Misses),
+			static_cast<unsigned long long>(stats.Evictions),
+			stats.NumEntries,
+			stats.BytesUsed / (1024.0 * 1024.0));
 	}
 
 private:
+	// Layer images are read out of the file as frames are composed
+	std::unique_ptr<MappedFile> m_file;
 	std::unique_ptr<RaniProject> m_project;
-};
\ No newline at end of file
+	ComposeOptions m_options;
+	// Decoded png files
+	BufferPool m_bufferPool;
+	// Both caches are shared by every reader, so later passes over the
+	// frames start warm.
+	LayerBitmapCache m_cpuCache;
+	GpuLayerBitmapCache m_gpuCache;
+	winrt::com_ptr<ID2D1DeviceContext> m_gpuCacheContext;
+};
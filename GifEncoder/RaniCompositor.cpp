@@ -0,0 +1,285 @@
+#include "pch.h"
+#include "RaniCompositor.h"
+
+FrameRect GetVisibleBounds(uint32_t const* pixels, uint32_t width, uint32_t height)
+{
+    // Premultiplied pixels are only fully transparent when they're 0, and
+    // blending a 0 over anything leaves it as it was
+    auto isVisible = [](uint32_t pixel) { return pixel != 0; };
+    FrameRect bounds = {};
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = pixels + static_cast<size_t>(y) * width;
+        auto first = std::find_if(row, row + width, isVisible);
+        if (first == row + width)
+        {
+            continue;
+        }
+        auto last = std::find_if(std::make_reverse_iterator(row + width), std::make_reverse_iterator(first), isVisible);
+        auto left = static_cast<uint32_t>(first - row);
+        auto right = static_cast<uint32_t>(last.base() - row);
+        bounds = UnionRects(bounds, FrameRect{ left, y, right, y + 1 });
+    }
+    return bounds;
+}
+
+RaniCpuCompositor::RaniCpuCompositor(
+    RaniProject const& project,
+    uint8_t const* fileData,
+    size_t fileSize,
+    PngDecodeFunc decodePng,
+    LayerBitmapCache& cache,
+    SimdLevel simdLevel) : m_project(project), m_cache(cache)
+{
+    m_fileData = fileData;
+    m_fileSize = fileSize;
+    m_decodePng = std::move(decodePng);
+    m_blendRow = GetBlendRowKernel(simdLevel);
+    if (m_blendRow == nullptr)
+    {
+        m_blendRow = GetBlendRowKernel(SimdLevel::Scalar);
+    }
+    // D2D clears premultiplied targets with a premultiplied color
+    m_backgroundColor = PremultiplyColor(project.BackgroundColor);
+}
+
+std::shared_ptr<LayerBitmap const> RaniCpuCompositor::GetLayerBitmap(RaniLayer const& layer)
+{
+    return m_cache.GetOrCreate(layer.PngDataHash, [&]()
+    {
+        PooledBuffer pngData(m_bufferPool);
+        DecodeRaniLayerPngData(m_fileData, m_fileSize, layer, pngData.Get());
+        auto bitmap = m_decodePng(pngData.Get().data(), pngData.Get().size());
+        // Found once per image, not every time the layer is drawn
+        bitmap->VisibleBounds = GetVisibleBounds(bitmap->Pixels.data(), bitmap->Width, bitmap->Height);
+        return std::shared_ptr<LayerBitmap const>(bitmap);
+    });
+}
+
+FrameRect RaniCpuCompositor::GetLayerBounds(RaniLayer const& layer)
+{
+    if (!layer.Visible || OpacityToBlendWeight(layer.Opacity) == 0)
+    {
+        return FrameRect{};
+    }
+    // Layers are drawn at the origin and clipped to the frame
+    auto bitmap = GetLayerBitmap(layer);
+    auto frameRect = FrameRect{ 0, 0, static_cast<uint32_t>(m_project.Width), static_cast<uint32_t>(m_project.Height) };
+    return IntersectRects(bitmap->VisibleBounds, frameRect);
+}
+
+void RaniCpuCompositor::ComposeFrame(RaniFrame const& frame, std::vector<uint32_t>& pixels)
+{
+    auto width = static_cast<uint32_t>(m_project.Width);
+    auto height = static_cast<uint32_t>(m_project.Height);
+    pixels.resize(static_cast<size_t>(width) * height);
+    std::fill(pixels.begin(), pixels.end(), m_backgroundColor);
+    ComposeLayers(frame, 0, frame.Layers.size(), FrameRect{ 0, 0, width, height }, pixels.data());
+}
+
+void RaniCpuCompositor::ComposeLayers(
+    RaniFrame const& frame,
+    size_t firstLayer,
+    size_t lastLayer,
+    FrameRect const& clip,
+    uint32_t* pixels)
+{
+    auto width = static_cast<size_t>(m_project.Width);
+    auto frameRect = FrameRect{ 0, 0, static_cast<uint32_t>(width), static_cast<uint32_t>(m_project.Height) };
+    auto numLayers = frame.Layers.size();
+    for (auto i = firstLayer; i < lastLayer && i < numLayers; i++)
+    {
+        // Layers are stored front to back
+        auto&& layer = frame.Layers[numLayers - 1 - i];
+        auto weight = OpacityToBlendWeight(layer.Opacity);
+        if (!layer.Visible || weight == 0)
+        {
+            continue;
+        }
+
+        // Blending outside of the visible bounds wouldn't change anything
+        auto bitmap = GetLayerBitmap(layer);
+        auto rect = IntersectRects(IntersectRects(clip, bitmap->VisibleBounds), frameRect);
+        if (rect.IsEmpty())
+        {
+            continue;
+        }
+        for (auto y = rect.Top; y < rect.Bottom; y++)
+        {
+            m_blendRow(
+                pixels + y * width + rect.Left,
+                bitmap->Pixels.data() + static_cast<size_t>(y) * bitmap->Width + rect.Left,
+                rect.Width(),
+                weight);
+        }
+    }
+}
+
+IncrementalRaniCompositor::IncrementalRaniCompositor(
+    RaniCpuCompositor& compositor,
+    RaniProject const& project) : m_compositor(compositor), m_project(project)
+{
+}
+
+bool IncrementalRaniCompositor::IsSameLayer(RaniLayer const& first, RaniLayer const& second) const
+{
+    auto firstWeight = first.Visible ? OpacityToBlendWeight(first.Opacity) : 0;
+    auto secondWeight = second.Visible ? OpacityToBlendWeight(second.Opacity) : 0;
+    if (firstWeight != secondWeight)
+    {
+        return false;
+    }
+    // Hidden layers don't draw anything, whatever their image is
+    return firstWeight == 0 || first.PngDataHash == second.PngDataHash;
+}
+
+bool IncrementalRaniCompositor::TryGetNextFrame(FrameRect& dirtyRect)
+{
+    if (m_nextFrame >= m_project.Frames.size())
+    {
+        return false;
+    }
+
+    auto width = static_cast<uint32_t>(m_project.Width);
+    auto height = static_cast<uint32_t>(m_project.Height);
+    auto&& frame = m_project.Frames[m_nextFrame];
+    auto numLayers = frame.Layers.size();
+    if (m_nextFrame == 0 || m_project.Frames[m_nextFrame - 1].Layers.size() != numLayers)
+    {
+        // Nothing to build on, draw everything
+        m_compositor.ComposeFrame(frame, m_pixels);
+        m_hasBase = false;
+        dirtyRect = FrameRect{ 0, 0, width, height };
+        m_nextFrame++;
+        return true;
+    }
+
+    // Find the area covered by the layers that changed, both where they
+    // used to draw and where they draw now
+    auto&& previousFrame = m_project.Frames[m_nextFrame - 1];
+    auto lowestChangedLayer = numLayers;
+    FrameRect dirty = {};
+    for (size_t i = 0; i < numLayers; i++)
+    {
+        auto&& layer = frame.Layers[numLayers - 1 - i];
+        auto&& previousLayer = previousFrame.Layers[numLayers - 1 - i];
+        if (!IsSameLayer(layer, previousLayer))
+        {
+            lowestChangedLayer = std::min(lowestChangedLayer, i);
+            dirty = UnionRects(dirty, m_compositor.GetLayerBounds(previousLayer));
+            dirty = UnionRects(dirty, m_compositor.GetLayerBounds(layer));
+        }
+    }
+
+    if (!dirty.IsEmpty())
+    {
+        // The base only ever moves down the stack, so animations that
+        // change a few different layers settle on one base instead of
+        // rebuilding it every frame.
+        if (!m_hasBase || lowestChangedLayer < m_baseDepth)
+        {
+            m_base.resize(static_cast<size_t>(width) * height);
+            std::fill(m_base.begin(), m_base.end(), m_compositor.BackgroundColor());
+            m_compositor.ComposeLayers(frame, 0, lowestChangedLayer, FrameRect{ 0, 0, width, height }, m_base.data());
+            m_baseDepth = lowestChangedLayer;
+            m_hasBase = true;
+        }
+
+        // Blending isn't exactly associative once it's rounded, so the
+        // layers above the base are blended one at a time, but only
+        // inside the dirty rect.
+        for (auto y = dirty.Top; y < dirty.Bottom; y++)
+        {
+            auto offset = static_cast<size_t>(y) * width + dirty.Left;
+            std::copy_n(m_base.data() + offset, dirty.Width(), m_pixels.data() + offset);
+        }
+        m_compositor.ComposeLayers(frame, m_baseDepth, numLayers, dirty, m_pixels.data());
+    }
+
+    dirtyRect = dirty;
+    m_nextFrame++;
+    return true;
+}
+
+ParallelRaniCompositor::ParallelRaniCompositor(
+    RaniCpuCompositor& compositor,
+    std::vector<RaniFrame> const& frames,
+    uint32_t numThreads) : m_compositor(compositor), m_frames(frames), m_pool(numThreads)
+{
+    // Enough frames in flight to keep every worker busy while the reader
+    // is consuming one
+    m_slots.resize(static_cast<size_t>(m_pool.NumThreads()) * 2);
+    for (size_t i = 0; i < m_slots.size() && i < m_frames.size(); i++)
+    {
+        Schedule(i);
+    }
+}
+
+ParallelRaniCompositor::~ParallelRaniCompositor()
+{
+    // Frames that haven't started yet are skipped
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_cancelled = true;
+}
+
+void ParallelRaniCompositor::Schedule(size_t frameIndex)
+{
+    auto slot = &m_slots[frameIndex % m_slots.size()];
+    slot->Done = false;
+    slot->Error = nullptr;
+    m_pool.Submit([this, slot, frameIndex]()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_cancelled)
+            {
+                return;
+            }
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            m_compositor.ComposeFrame(m_frames[frameIndex], slot->Pixels);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            slot->Done = true;
+            slot->Error = error;
+        }
+        m_frameCompleted.notify_all();
+    });
+}
+
+bool ParallelRaniCompositor::TryGetNextFrame(std::vector<uint32_t>& pixels)
+{
+    if (m_nextFrame >= m_frames.size())
+    {
+        return false;
+    }
+
+    auto&& slot = m_slots[m_nextFrame % m_slots.size()];
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_frameCompleted.wait(lock, [&slot]() { return slot.Done; });
+    }
+    if (slot.Error)
+    {
+        std::rethrow_exception(slot.Error);
+    }
+    pixels.swap(slot.Pixels);
+
+    // The slot is free again, start on the frame that will use it next
+    auto frameToSchedule = m_nextFrame + m_slots.size();
+    if (frameToSchedule < m_frames.size())
+    {
+        Schedule(frameToSchedule);
+    }
+    m_nextFrame++;
+    return true;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "AlphaBlend.h"
+#include "BufferPool.h"
+#include "ContentCache.h"
+#include "FrameRect.h"
+#include "RaniFormat.h"
+#include "ThreadPool.h"
+
+// A decoded layer image in premultiplied BGRA
+struct LayerBitmap
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint32_t> Pixels;
+    // The smallest rect holding every pixel that isn't fully transparent.
+    // Blending the rest leaves the frame as it was, so layers only draw
+    // and dirty this area.
+    FrameRect VisibleBounds;
+};
+
+// Finds the visible bounds of premultiplied BGRA pixels
+FrameRect GetVisibleBounds(uint32_t const* pixels, uint32_t width, uint32_t height);
+
+inline size_t GetCacheEntrySize(LayerBitmap const& bitmap)
+{
+    return sizeof(LayerBitmap) + bitmap.Pixels.size() * sizeof(uint32_t);
+}
+
+// Decoded layers, keyed by RaniLayer::PngDataHash
+typedef ContentCache<LayerBitmap> LayerBitmapCache;
+
+// Decodes a png file. Must be safe to call from several threads at once.
+// The compositor fills in the visible bounds.
+typedef std::function<std::shared_ptr<LayerBitmap>(uint8_t const* data, size_t size)> PngDecodeFunc;
+
+// Composites .rani frames on the CPU the same way ComposeFrame does with
+// D2D: layers are drawn back to front, with their opacity, over the
+// background color. Each distinct layer image is only decoded once while
+// it stays in the cache.
+class RaniCpuCompositor
+{
+public:
+    RaniCpuCompositor(
+        RaniProject const& project,
+        uint8_t const* fileData,
+        size_t fileSize,
+        PngDecodeFunc decodePng,
+        LayerBitmapCache& cache,
+        SimdLevel simdLevel = GetBestSimdLevel());
+
+    // Safe to call from several threads at once. The pixels are resized to
+    // the size of the project and hold premultiplied BGRA.
+    void ComposeFrame(RaniFrame const& frame, std::vector<uint32_t>& pixels);
+
+    // Draws the layers of a frame, counted from the back, in the range
+    // [firstLayer, lastLayer) over the pixels, which must already be the
+    // size of the project. Nothing outside of the clip rect is touched.
+    void ComposeLayers(
+        RaniFrame const& frame,
+        size_t firstLayer,
+        size_t lastLayer,
+        FrameRect const& clip,
+        uint32_t* pixels);
+
+    // The area of the frame a layer draws to, which for most layers is a
+    // lot smaller than the frame. Hidden layers are empty.
+    FrameRect GetLayerBounds(RaniLayer const& layer);
+
+    // Premultiplied
+    uint32_t BackgroundColor() const { return m_backgroundColor; }
+
+private:
+    std::shared_ptr<LayerBitmap const> GetLayerBitmap(RaniLayer const& layer);
+
+    RaniProject const& m_project;
+    uint8_t const* m_fileData = nullptr;
+    size_t m_fileSize = 0;
+    PngDecodeFunc m_decodePng;
+    LayerBitmapCache& m_cache;
+    BlendRowKernel m_blendRow = nullptr;
+    uint32_t m_backgroundColor = 0;
+    // Base64 decoded png files
+    BufferPool m_bufferPool;
+};
+
+// Composites frames in order, redrawing only the area covered by layers
+// that differ from the ones in the previous frame. The layers below the
+// lowest changed layer are kept flattened, so only the layers above them
+// are blended again. Produces the same pixels as ComposeFrame.
+class IncrementalRaniCompositor
+{
+public:
+    IncrementalRaniCompositor(RaniCpuCompositor& compositor, RaniProject const& project);
+
+    // Composes the next frame into Pixels. The dirty rect covers every
+    // pixel that differs from the previous frame, and is the whole frame
+    // for the first one. Returns false once every frame has been read.
+    bool TryGetNextFrame(FrameRect& dirtyRect);
+
+    // Premultiplied BGRA for the last frame that was composed
+    std::vector<uint32_t> const& Pixels() const { return m_pixels; }
+
+private:
+    bool IsSameLayer(RaniLayer const& first, RaniLayer const& second) const;
+
+    RaniCpuCompositor& m_compositor;
+    RaniProject const& m_project;
+    size_t m_nextFrame = 0;
+    std::vector<uint32_t> m_pixels;
+    // The bottom m_baseDepth layers flattened over the background
+    std::vector<uint32_t> m_base;
+    size_t m_baseDepth = 0;
+    bool m_hasBase = false;
+};
+
+// Composites frames on a pool of worker threads, a few frames ahead of the
+// one being read, and hands them out in order.
+class ParallelRaniCompositor
+{
+public:
+    ParallelRaniCompositor(RaniCpuCompositor& compositor, std::vector<RaniFrame> const& frames, uint32_t numThreads);
+    ~ParallelRaniCompositor();
+
+    ParallelRaniCompositor(ParallelRaniCompositor const&) = delete;
+    ParallelRaniCompositor& operator=(ParallelRaniCompositor const&) = delete;
+
+    // Blocks until the next frame is ready and swaps it into pixels. The
+    // buffer that was passed in is reused for a later frame. Returns false
+    // once every frame has been read.
+    bool TryGetNextFrame(std::vector<uint32_t>& pixels);
+
+private:
+    struct Slot
+    {
+        std::vector<uint32_t> Pixels;
+        bool Done = false;
+        std::exception_ptr Error;
+    };
+
+    void Schedule(size_t frameIndex);
+
+    RaniCpuCompositor& m_compositor;
+    std::vector<RaniFrame> const& m_frames;
+    std::mutex m_lock;
+    std::condition_variable m_frameCompleted;
+    // Frame i is composed into slot i % m_slots.size()
+    std::vector<Slot> m_slots;
+    size_t m_nextFrame = 0;
+    bool m_cancelled = false;
+    // Declared last so that the workers are joined before the slots they
+    // reference are destroyed.
+    ThreadPool m_pool;
+};
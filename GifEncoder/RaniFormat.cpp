@@ -0,0 +1,489 @@
+#include "pch.h"
+#include "RaniFormat.h"
+#include "Base64.h"
+#include "XxHash.h"
+#include <string_view>
+
+namespace
+{
+    enum class XmlEventType
+    {
+        StartElement,
+        EndElement,
+        Text,
+        EndOfDocument,
+    };
+
+    struct XmlAttribute
+    {
+        std::string_view Name;
+        // Entities have not been expanded
+        std::string_view Value;
+    };
+
+    struct XmlEvent
+    {
+        XmlEventType Type;
+        std::string_view Name;
+        std::vector<XmlAttribute> Attributes;
+        // Raw character data, for text events
+        size_t TextOffset;
+        size_t TextLength;
+    };
+
+    // A pull parser that covers the subset of XML .rani files use. It
+    // doesn't validate the document beyond what it needs to find its way.
+    class XmlReader
+    {
+    public:
+        XmlReader(uint8_t const* data, size_t size)
+        {
+            m_data = reinterpret_cast<char const*>(data);
+            m_size = size;
+            if (size >= 2 && ((data[0] == 0xFF && data[1] == 0xFE) || (data[0] == 0xFE && data[1] == 0xFF)))
+            {
+                throw std::runtime_error("Only UTF-8 .rani files are supported.");
+            }
+            // Skip the UTF-8 byte order mark
+            if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+            {
+                m_position = 3;
+            }
+        }
+
+        void Next(XmlEvent& event)
+        {
+            event.Attributes.clear();
+            if (m_pendingEnd)
+            {
+                // The end of a self-closing element
+                m_pendingEnd = false;
+                event.Type = XmlEventType::EndElement;
+                return;
+            }
+
+            while (m_position < m_size)
+            {
+                if (m_data[m_position] != '<')
+                {
+                    auto start = m_position;
+                    auto end = Find("<", start);
+                    m_position = end;
+                    event.Type = XmlEventType::Text;
+                    event.TextOffset = start;
+                    event.TextLength = end - start;
+                    return;
+                }
+
+                if (StartsWith("<?"))
+                {
+                    m_position = Find("?>", m_position) + 2;
+                }
+                else if (StartsWith("<!--"))
+                {
+                    m_position = Find("-->", m_position) + 3;
+                }
+                else if (StartsWith("<![CDATA["))
+                {
+                    auto start = m_position + 9;
+                    auto end = Find("]]>", start);
+                    m_position = end + 3;
+                    event.Type = XmlEventType::Text;
+                    event.TextOffset = start;
+                    event.TextLength = end - start;
+                    return;
+                }
+                else if (StartsWith("<!"))
+                {
+                    m_position = Find(">", m_position) + 1;
+                }
+                else if (StartsWith("</"))
+                {
+                    m_position += 2;
+                    event.Type = XmlEventType::EndElement;
+                    event.Name = ReadName();
+                    SkipWhitespace();
+                    Expect('>');
+                    return;
+                }
+                else
+                {
+                    m_position++;
+                    event.Type = XmlEventType::StartElement;
+                    event.Name = ReadName();
+                    ReadAttributes(event.Attributes);
+                    if (StartsWith("/>"))
+                    {
+                        m_position += 2;
+                        m_pendingEnd = true;
+                    }
+                    else
+                    {
+                        Expect('>');
+                    }
+                    return;
+                }
+            }
+            event.Type = XmlEventType::EndOfDocument;
+        }
+
+    private:
+        bool StartsWith(std::string_view prefix) const
+        {
+            return std::string_view(m_data + m_position, m_size - m_position).substr(0, prefix.size()) == prefix;
+        }
+
+        size_t Find(std::string_view value, size_t start) const
+        {
+            auto position = std::string_view(m_data, m_size).find(value, start);
+            if (position == std::string_view::npos)
+            {
+                if (value == "<")
+                {
+                    return m_size;
+                }
+                throw std::runtime_error("Unexpected end of document.");
+            }
+            return position;
+        }
+
+        static bool IsWhitespace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        void SkipWhitespace()
+        {
+            while (m_position < m_size && IsWhitespace(m_data[m_position]))
+            {
+                m_position++;
+            }
+        }
+
+        void Expect(char c)
+        {
+            if (m_position >= m_size || m_data[m_position] != c)
+            {
+                throw std::runtime_error("Malformed XML.");
+            }
+            m_position++;
+        }
+
+        std::string_view ReadName()
+        {
+            auto start = m_position;
+            while (m_position < m_size)
+            {
+                auto c = m_data[m_position];
+                if (IsWhitespace(c) || c == '>' || c == '/' || c == '=')
+                {
+                    break;
+                }
+                m_position++;
+            }
+            if (m_position == start)
+            {
+                throw std::runtime_error("Malformed XML.");
+            }
+            return std::string_view(m_data + start, m_position - start);
+        }
+
+        void ReadAttributes(std::vector<XmlAttribute>& attributes)
+        {
+            while (true)
+            {
+                SkipWhitespace();
+                if (m_position >= m_size)
+                {
+                    throw std::runtime_error("Unexpected end of document.");
+                }
+                auto c = m_data[m_position];
+                if (c == '>' || c == '/')
+                {
+                    return;
+                }
+
+                XmlAttribute attribute = {};
+                attribute.Name = ReadName();
+                SkipWhitespace();
+                Expect('=');
+                SkipWhitespace();
+                if (m_position >= m_size || (m_data[m_position] != '"' && m_data[m_position] != '\''))
+                {
+                    throw std::runtime_error("Malformed XML.");
+                }
+                auto quote = m_data[m_position++];
+                auto start = m_position;
+                auto end = Find(std::string_view(&quote, 1), start);
+                attribute.Value = std::string_view(m_data + start, end - start);
+                m_position = end + 1;
+                attributes.push_back(attribute);
+            }
+        }
+
+        char const* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_position = 0;
+        bool m_pendingEnd = false;
+    };
+
+    void AppendCodePoint(std::wstring& result, uint32_t codePoint)
+    {
+        if (sizeof(wchar_t) == 2 && codePoint >= 0x10000)
+        {
+            codePoint -= 0x10000;
+            result.push_back(static_cast<wchar_t>(0xD800 + (codePoint >> 10)));
+            result.push_back(static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF)));
+        }
+        else
+        {
+            result.push_back(static_cast<wchar_t>(codePoint));
+        }
+    }
+
+    // Expands entities and converts from UTF-8
+    std::wstring DecodeAttributeValue(std::string_view value)
+    {
+        std::wstring result;
+        result.reserve(value.size());
+        size_t i = 0;
+        while (i < value.size())
+        {
+            auto c = static_cast<uint8_t>(value[i]);
+            if (c == '&')
+            {
+                auto end = value.find(';', i);
+                if (end == std::string_view::npos)
+                {
+                    throw std::runtime_error("Malformed XML entity.");
+                }
+                auto entity = value.substr(i + 1, end - i - 1);
+                if (entity == "amp") result.push_back(L'&');
+                else if (entity == "lt") result.push_back(L'<');
+                else if (entity == "gt") result.push_back(L'>');
+                else if (entity == "quot") result.push_back(L'"');
+                else if (entity == "apos") result.push_back(L'\'');
+                else if (entity.size() > 1 && entity[0] == '#')
+                {
+                    auto hex = entity[1] == 'x' || entity[1] == 'X';
+                    auto digits = std::string(entity.substr(hex ? 2 : 1));
+                    AppendCodePoint(result, static_cast<uint32_t>(std::stoul(digits, nullptr, hex ? 16 : 10)));
+                }
+                else
+                {
+                    throw std::runtime_error("Unknown XML entity.");
+                }
+                i = end + 1;
+                continue;
+            }
+
+            uint32_t codePoint = c;
+            size_t length = 1;
+            if (c >= 0xF0) { codePoint = c & 0x07; length = 4; }
+            else if (c >= 0xE0) { codePoint = c & 0x0F; length = 3; }
+            else if (c >= 0xC0) { codePoint = c & 0x1F; length = 2; }
+            if (i + length > value.size())
+            {
+                throw std::runtime_error("Invalid UTF-8.");
+            }
+            for (size_t j = 1; j < length; j++)
+            {
+                codePoint = (codePoint << 6) | (static_cast<uint8_t>(value[i + j]) & 0x3F);
+            }
+            AppendCodePoint(result, codePoint);
+            i += length;
+        }
+        return result;
+    }
+}
+
+std::unique_ptr<RaniProject> ParseRaniProject(uint8_t const* data, size_t size)
+{
+    // Where we are in the AnimatorProject/Frames/Frame/Layers/Layer/PngData
+    // hierarchy. Elements we don't know about are skipped along with their
+    // children.
+    enum class Scope
+    {
+        Document,
+        Project,
+        Frames,
+        Frame,
+        Layers,
+        Layer,
+        PngData,
+    };
+
+    std::unique_ptr<RaniProject> project;
+    std::vector<Scope> scopes = { Scope::Document };
+    size_t unknownDepth = 0;
+    RaniFrame frame = {};
+    RaniLayer layer = {};
+    size_t pngDataEnd = 0;
+
+    XmlReader reader(data, size);
+    XmlEvent event = {};
+    for (reader.Next(event); event.Type != XmlEventType::EndOfDocument; reader.Next(event))
+    {
+        if (unknownDepth > 0)
+        {
+            if (event.Type == XmlEventType::StartElement)
+            {
+                unknownDepth++;
+            }
+            else if (event.Type == XmlEventType::EndElement)
+            {
+                unknownDepth--;
+            }
+            continue;
+        }
+
+        auto scope = scopes.back();
+        if (event.Type == XmlEventType::StartElement)
+        {
+            if (scope == Scope::Document && event.Name == "AnimatorProject" && !project)
+            {
+                project = std::make_unique<RaniProject>();
+                for (auto&& attribute : event.Attributes)
+                {
+                    if (attribute.Name == "Width")
+                    {
+                        project->Width = std::stoi(std::string(attribute.Value));
+                    }
+                    else if (attribute.Name == "Height")
+                    {
+                        project->Height = std::stoi(std::string(attribute.Value));
+                    }
+                    else if (attribute.Name == "FrameTimeInMs")
+                    {
+                        project->FrameTime = std::chrono::milliseconds(std::stoi(std::string(attribute.Value)));
+                    }
+                    else if (attribute.Name == "BackgroundColor")
+                    {
+                        // Stored as RRGGBBAA
+                        auto rawColor = static_cast<uint32_t>(std::stoul(std::string(attribute.Value), nullptr, 16));
+                        project->BackgroundColor = (rawColor >> 8) | (rawColor << 24);
+                    }
+                }
+                if (project->Width == 0 || project->Height == 0)
+                {
+                    throw std::runtime_error("A width or height of 0 is invalid.");
+                }
+                scopes.push_back(Scope::Project);
+            }
+            else if (scope == Scope::Project && event.Name == "Frames")
+            {
+                scopes.push_back(Scope::Frames);
+            }
+            else if (scope == Scope::Frames && event.Name == "Frame")
+            {
+                frame = {};
+                scopes.push_back(Scope::Frame);
+            }
+            else if (scope == Scope::Frame && event.Name == "Layers")
+            {
+                scopes.push_back(Scope::Layers);
+            }
+            else if (scope == Scope::Layers && event.Name == "Layer")
+            {
+                layer = {};
+                for (auto&& attribute : event.Attributes)
+                {
+                    if (attribute.Name == "Name")
+                    {
+                        layer.Name = DecodeAttributeValue(attribute.Value);
+                    }
+                    else if (attribute.Name == "Visible")
+                    {
+                        auto value = std::string(attribute.Value);
+                        std::transform(value.begin(), value.end(), value.begin(),
+                            [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+                        layer.Visible = value == "true";
+                    }
+                    else if (attribute.Name == "Opacity")
+                    {
+                        layer.Opacity = std::stof(std::string(attribute.Value));
+                    }
+                }
+                scopes.push_back(Scope::Layer);
+            }
+            else if (scope == Scope::Layer && event.Name == "PngData")
+            {
+                layer.PngDataOffset = 0;
+                pngDataEnd = 0;
+                scopes.push_back(Scope::PngData);
+            }
+            else
+            {
+                unknownDepth = 1;
+            }
+        }
+        else if (event.Type == XmlEventType::EndElement)
+        {
+            switch (scope)
+            {
+            case Scope::Document:
+                throw std::runtime_error("Malformed XML.");
+            case Scope::Frame:
+                project->Frames.push_back(std::move(frame));
+                break;
+            case Scope::Layer:
+                if (layer.PngDataLength == 0)
+                {
+                    throw std::runtime_error("Expected png data.");
+                }
+                frame.Layers.push_back(std::move(layer));
+                break;
+            case Scope::PngData:
+                if (pngDataEnd > 0)
+                {
+                    layer.PngDataLength = pngDataEnd - layer.PngDataOffset;
+                    layer.PngDataHash = XxHash64(data + layer.PngDataOffset, static_cast<size_t>(layer.PngDataLength));
+                }
+                break;
+            default:
+                break;
+            }
+            scopes.pop_back();
+        }
+        else if (event.Type == XmlEventType::Text && scope == Scope::PngData)
+        {
+            // Only the position is kept, the text is decoded when the layer is drawn
+            auto start = event.TextOffset;
+            auto end = start + event.TextLength;
+            while (start < end && std::isspace(data[start]))
+            {
+                start++;
+            }
+            while (end > start && std::isspace(data[end - 1]))
+            {
+                end--;
+            }
+            if (start < end)
+            {
+                if (pngDataEnd == 0)
+                {
+                    layer.PngDataOffset = start;
+                }
+                pngDataEnd = end;
+            }
+        }
+    }
+
+    if (!project)
+    {
+        throw std::runtime_error("Expected AnimatorProject node as a child of the document.");
+    }
+    return project;
+}
+
+void DecodeRaniLayerPngData(uint8_t const* data, size_t size, RaniLayer const& layer, std::vector<uint8_t>& output)
+{
+    if (layer.PngDataOffset > size || layer.PngDataLength > size - layer.PngDataOffset)
+    {
+        throw std::out_of_range("The layer's png data is outside of the file.");
+    }
+    auto text = reinterpret_cast<char const*>(data + layer.PngDataOffset);
+    auto length = static_cast<size_t>(layer.PngDataLength);
+    output.resize(GetMaxDecodedBase64Size(length));
+    output.resize(DecodeBase64(text, length, output.data()));
+}
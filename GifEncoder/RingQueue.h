@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A FIFO queue over a growable ring of slots. Unlike std::deque, popping
+// never frees storage and pushing only allocates when the queue holds more
+// items than it ever has before, so a queue that cycles at a steady depth
+// stops touching the heap.
+template <typename T>
+class RingQueue
+{
+public:
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    T& front() { return m_slots[m_head]; }
+    T const& front() const { return m_slots[m_head]; }
+
+    void push_back(T&& value)
+    {
+        if (m_size == m_slots.size())
+        {
+            Grow();
+        }
+        m_slots[(m_head + m_size) % m_slots.size()] = std::move(value);
+        m_size++;
+    }
+
+    void pop_front()
+    {
+        // Release anything the item holds on to, but keep the slot
+        m_slots[m_head] = T();
+        m_head = (m_head + 1) % m_slots.size();
+        m_size--;
+    }
+
+private:
+    void Grow()
+    {
+        std::vector<T> slots(std::max<size_t>(m_slots.size() * 2, 8));
+        for (size_t i = 0; i < m_size; i++)
+        {
+            slots[i] = std::move(m_slots[(m_head + i) % m_slots.size()]);
+        }
+        m_slots = std::move(slots);
+        m_head = 0;
+    }
+
+    std::vector<T> m_slots;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "RowBandPool.h"
+
+namespace
+{
+    inline uint64_t PackRange(uint32_t front, uint32_t back)
+    {
+        return (static_cast<uint64_t>(back) << 32) | front;
+    }
+
+    inline uint32_t RangeFront(uint64_t range)
+    {
+        return static_cast<uint32_t>(range);
+    }
+
+    inline uint32_t RangeBack(uint64_t range)
+    {
+        return static_cast<uint32_t>(range >> 32);
+    }
+
+    // Band i of numBands covers rows [top + rows * i / numBands, ...)
+    inline uint32_t GetBandTop(uint32_t top, uint32_t bottom, uint32_t band, uint32_t numBands)
+    {
+        return top + static_cast<uint32_t>((static_cast<uint64_t>(bottom - top) * band) / numBands);
+    }
+}
+
+RowBandPool::RowBandPool(uint32_t numThreads, uint32_t minBandRows)
+{
+    if (numThreads == 0)
+    {
+        numThreads = 1;
+    }
+    m_minBandRows = std::max(minBandRows, 1u);
+    m_queues = std::make_unique<TaskQueue[]>(numThreads);
+    for (uint32_t i = 0; i < numThreads; i++)
+    {
+        m_queues[i].Range.store(0, std::memory_order_relaxed);
+    }
+    m_threads.reserve(numThreads - 1);
+    for (uint32_t i = 1; i < numThreads; i++)
+    {
+        m_threads.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+}
+
+RowBandPool::~RowBandPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+uint32_t RowBandPool::GetBandCount(uint32_t top, uint32_t bottom) const
+{
+    if (bottom <= top)
+    {
+        return 0;
+    }
+    auto numRows = bottom - top;
+    auto maxBands = std::max(numRows / m_minBandRows, 1u);
+    return std::min(maxBands, NumThreads() * BandsPerThread);
+}
+
+void RowBandPool::ForEachBand(uint32_t top, uint32_t bottom, BandFunction const& bandFunction)
+{
+    // Captured by one pointer so the task function fits in std::function
+    // without allocating
+    struct Bands
+    {
+        uint32_t Top;
+        uint32_t Bottom;
+        uint32_t Count;
+        BandFunction const& Function;
+    };
+    Bands bands = { top, bottom, GetBandCount(top, bottom), bandFunction };
+    ForEachTask(bands.Count, [&bands](uint32_t band, uint32_t thread)
+    {
+        bands.Function(
+            GetBandTop(bands.Top, bands.Bottom, band, bands.Count),
+            GetBandTop(bands.Top, bands.Bottom, band + 1, bands.Count),
+            band,
+            thread);
+    });
+}
+
+void RowBandPool::ForEachTask(uint32_t numTasks, TaskFunction const& taskFunction)
+{
+    if (numTasks == 0)
+    {
+        return;
+    }
+    if (numTasks == 1 || m_threads.empty())
+    {
+        for (uint32_t task = 0; task < numTasks; task++)
+        {
+            taskFunction(task, 0);
+        }
+        return;
+    }
+
+    {
+        // Workers that woke up late for the previous call may still be
+        // looking at the queues
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_workersIdle.wait(lock, [this]() { return m_numActiveWorkers == 0; });
+
+        auto numThreads = NumThreads();
+        for (uint32_t i = 0; i < numThreads; i++)
+        {
+            auto front = (numTasks * i) / numThreads;
+            auto back = (numTasks * (i + 1)) / numThreads;
+            m_queues[i].Range.store(PackRange(front, back), std::memory_order_relaxed);
+        }
+        m_taskFunction = &taskFunction;
+        m_error = nullptr;
+        m_generation++;
+    }
+    m_workAvailable.notify_all();
+
+    RunTasks(0);
+
+    // Once the queues are empty, every task left is running on a worker
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_workersIdle.wait(lock, [this]() { return m_numActiveWorkers == 0; });
+        m_taskFunction = nullptr;
+        error = m_error;
+        m_error = nullptr;
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+bool RowBandPool::TryTakeTask(uint32_t thread, uint32_t& task)
+{
+    // Our own tasks come off the front
+    auto& own = m_queues[thread].Range;
+    auto range = own.load(std::memory_order_acquire);
+    while (RangeFront(range) < RangeBack(range))
+    {
+        if (own.compare_exchange_weak(range, PackRange(RangeFront(range) + 1, RangeBack(range)), std::memory_order_acq_rel))
+        {
+            task = RangeFront(range);
+            return true;
+        }
+    }
+
+    // Other threads' tasks come off the back, away from their owner
+    auto numThreads = NumThreads();
+    for (uint32_t i = 1; i < numThreads; i++)
+    {
+        auto& victim = m_queues[(thread + i) % numThreads].Range;
+        range = victim.load(std::memory_order_acquire);
+        while (RangeFront(range) < RangeBack(range))
+        {
+            if (victim.compare_exchange_weak(range, PackRange(RangeFront(range), RangeBack(range) - 1), std::memory_order_acq_rel))
+            {
+                task = RangeBack(range) - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void RowBandPool::RunTasks(uint32_t thread)
+{
+    uint32_t task = 0;
+    while (TryTakeTask(thread, task))
+    {
+        try
+        {
+            (*m_taskFunction)(task, thread);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+        }
+    }
+}
+
+void RowBandPool::WorkerLoop(uint32_t thread)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_workAvailable.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+            if (m_stopping)
+            {
+                return;
+            }
+            generation = m_generation;
+            if (m_taskFunction == nullptr)
+            {
+                // Woke up after that call had already finished
+                continue;
+            }
+            m_numActiveWorkers++;
+        }
+
+        RunTasks(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_numActiveWorkers--;
+        }
+        m_workersIdle.notify_all();
+    }
+}
+
+void CopyRowsInBands(
+    RowBandPool* pool,
+    uint8_t* dest,
+    size_t destPitch,
+    uint8_t const* source,
+    size_t sourcePitch,
+    size_t rowBytes,
+    uint32_t numRows)
+{
+    auto copyRows = [=](uint32_t top, uint32_t bottom, uint32_t, uint32_t)
+    {
+        for (auto y = top; y < bottom; y++)
+        {
+            memcpy(dest + (y * destPitch), source + (y * sourcePitch), rowBytes);
+        }
+    };
+    if (pool != nullptr)
+    {
+        pool->ForEachBand(0, numRows, copyRows);
+    }
+    else
+    {
+        copyRows(0, numRows, 0, 0);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Splits the rows of a single frame into bands and runs them on a set of
+// worker threads, so that one large frame isn't held to a single core.
+// Every thread starts on its own contiguous share of the bands and steals
+// from the back of the other shares once its own runs out, so a band that
+// happens to be slow doesn't hold up the rest. Bands are always cut the
+// same way for the same rows and thread count, and callers keep results
+// per band (or per thread, for sums) and merge them in order, so the
+// output doesn't depend on which thread ran which band.
+class RowBandPool
+{
+public:
+    // Bands are never shorter than this by default, so small frames and
+    // dirty rects use fewer threads rather than paying for the handoff
+    static const uint32_t DefaultMinBandRows = 16;
+    // Each thread's share is cut into a few bands to leave some to steal
+    static const uint32_t BandsPerThread = 4;
+
+    // Called with the band's rows [top, bottom), its index and the index
+    // of the thread running it, which is below NumThreads().
+    typedef std::function<void(uint32_t top, uint32_t bottom, uint32_t band, uint32_t thread)> BandFunction;
+    typedef std::function<void(uint32_t task, uint32_t thread)> TaskFunction;
+
+    // The calling thread counts as one of the numThreads and always runs
+    // as thread 0, so a pool of one thread runs everything inline.
+    explicit RowBandPool(uint32_t numThreads, uint32_t minBandRows = DefaultMinBandRows);
+    ~RowBandPool();
+
+    RowBandPool(RowBandPool const&) = delete;
+    RowBandPool& operator=(RowBandPool const&) = delete;
+
+    uint32_t NumThreads() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+    // How many bands the rows [top, bottom) are cut into
+    uint32_t GetBandCount(uint32_t top, uint32_t bottom) const;
+
+    // Runs bandFunction for every band of the rows [top, bottom) and
+    // returns once all of them are done. If a band throws, the other bands
+    // still run and the first exception is rethrown here. Not reentrant.
+    void ForEachBand(uint32_t top, uint32_t bottom, BandFunction const& bandFunction);
+
+    // The same for tasks that aren't bands of rows. With NumThreads()
+    // tasks, every thread starts on a task of its own, so tasks may wait
+    // on each other's progress (e.g. a row pipeline).
+    void ForEachTask(uint32_t numTasks, TaskFunction const& taskFunction);
+
+private:
+    // The tasks a thread has left: the low half is the next task its
+    // owner takes, the high half is one past the task a thief takes next
+    struct alignas(64) TaskQueue
+    {
+        std::atomic<uint64_t> Range;
+    };
+
+    bool TryTakeTask(uint32_t thread, uint32_t& task);
+    void RunTasks(uint32_t thread);
+    void WorkerLoop(uint32_t thread);
+
+    uint32_t m_minBandRows = 0;
+    std::unique_ptr<TaskQueue[]> m_queues;
+    std::mutex m_lock;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_workersIdle;
+    uint64_t m_generation = 0;
+    uint32_t m_numActiveWorkers = 0;
+    bool m_stopping = false;
+    // Only valid while ForEachTask runs
+    TaskFunction const* m_taskFunction = nullptr;
+    std::exception_ptr m_error;
+    std::vector<std::thread> m_threads;
+};
+
+// Copies numRows rows of rowBytes bytes between buffers with different
+// pitches, in bands when a pool is given. Used for mapped GPU resources.
+void CopyRowsInBands(
+    RowBandPool* pool,
+    uint8_t* dest,
+    size_t destPitch,
+    uint8_t const* source,
+    size_t sourcePitch,
+    size_t rowBytes,
+    uint32_t numRows);
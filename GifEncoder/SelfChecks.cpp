@@ -0,0 +1,782 @@
+#include "pch.h"
+#include "SelfChecks.h"
+#include "CpuTransparencyFixer.h"
+#include "TransparencyFixer.h"
+#include "TileChangeMap.h"
+#include "PaletteQuantizer.h"
+#include "PaletteMapper.h"
+#include "ParallelPalettizer.h"
+#include "RowBandPool.h"
+#include "Dither.h"
+#include "RaniCompositor.h"
+#include "SyntheticAnimation.h"
+#include "Color.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+    using namespace robmikh::common::desktop;
+}
+
+namespace
+{
+    // How many random frame pairs each check goes through. The GPU check
+    // creates textures and a shader for every pair, so it runs fewer.
+    const uint32_t NumFramePairs = 2000;
+    const uint32_t NumGpuFramePairs = 200;
+    const uint32_t MaxFrameWidth = 70;
+    const uint32_t MaxFrameHeight = 40;
+    const uint32_t MaxImagesPerFrame = 8;
+    const uint32_t NumRaniProjects = 200;
+    const uint32_t MaxRaniFrames = 16;
+    const uint32_t MaxRaniLayers = 8;
+
+    struct FramePair
+    {
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        std::vector<uint32_t> Previous;
+        std::vector<uint32_t> Current;
+        // What palette mapping produced for the current frame. Like a real
+        // palette, no visible pixel is mapped to the transparent index.
+        std::vector<uint8_t> Indices;
+        uint8_t TransparentIndex = 0;
+    };
+
+    // Colors come from a small set so that a changed pixel sometimes gets
+    // its old color back, and alphas sit on both sides of the threshold
+    // below which a pixel counts as transparent.
+    uint32_t GenerateColor(std::mt19937& random)
+    {
+        const uint32_t alphas[] = { 0, TransparentAlphaThreshold, TransparentAlphaThreshold + 1, 128, 255 };
+        auto alpha = alphas[random() % ARRAYSIZE(alphas)];
+        return (alpha << 24) | ((random() % 4) * 0x404040);
+    }
+
+    // A non-empty rect inside the frame
+    FrameRect GenerateRect(std::mt19937& random, uint32_t width, uint32_t height)
+    {
+        auto left = static_cast<uint32_t>(random() % width);
+        auto top = static_cast<uint32_t>(random() % height);
+        auto right = left + 1 + static_cast<uint32_t>(random() % (width - left));
+        auto bottom = top + 1 + static_cast<uint32_t>(random() % (height - top));
+        return FrameRect{ left, top, right, bottom };
+    }
+
+    FramePair GenerateFramePair(std::mt19937& random)
+    {
+        FramePair pair;
+        // Sizes cross the 4, 8 and 16 pixel steps of the SIMD kernels and
+        // the shader's 8x8 thread groups
+        pair.Width = 1 + (random() % MaxFrameWidth);
+        pair.Height = 1 + (random() % MaxFrameHeight);
+        auto numPixels = static_cast<size_t>(pair.Width) * pair.Height;
+        pair.Previous.resize(numPixels);
+        for (auto&& pixel : pair.Previous)
+        {
+            pixel = GenerateColor(random);
+        }
+
+        pair.Current = pair.Previous;
+        switch (random() % 4)
+        {
+        case 0:
+            // Nothing changed
+            break;
+        case 1:
+        {
+            // A few scattered pixels
+            auto count = 1 + (random() % 8);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                pair.Current[random() % numPixels] = GenerateColor(random);
+            }
+            break;
+        }
+        case 2:
+        {
+            // One block
+            auto rect = GenerateRect(random, pair.Width, pair.Height);
+            for (auto y = rect.Top; y < rect.Bottom; y++)
+            {
+                for (auto x = rect.Left; x < rect.Right; x++)
+                {
+                    pair.Current[(static_cast<size_t>(y) * pair.Width) + x] = GenerateColor(random);
+                }
+            }
+            break;
+        }
+        default:
+            // Everything
+            for (auto&& pixel : pair.Current)
+            {
+                pixel = GenerateColor(random);
+            }
+            break;
+        }
+
+        pair.TransparentIndex = static_cast<uint8_t>(random() % 256);
+        pair.Indices.resize(numPixels);
+        for (auto&& index : pair.Indices)
+        {
+            auto value = random() % 255;
+            index = static_cast<uint8_t>(value >= pair.TransparentIndex ? value + 1 : value);
+        }
+        return pair;
+    }
+
+    // Moves every channel of every pixel by up to maxDelta steps, so that
+    // some pixels stay within a tolerance and others don't
+    std::vector<uint32_t> AddNoise(std::mt19937& random, std::vector<uint32_t> const& frame, uint32_t maxDelta)
+    {
+        auto noisy = frame;
+        for (auto&& pixel : noisy)
+        {
+            uint32_t result = 0;
+            for (uint32_t shift = 0; shift < 32; shift += 8)
+            {
+                auto delta = static_cast<int32_t>(random() % ((2 * maxDelta) + 1)) - static_cast<int32_t>(maxDelta);
+                auto channel = std::clamp(static_cast<int32_t>((pixel >> shift) & 0xFF) + delta, 0, 255);
+                result |= static_cast<uint32_t>(channel) << shift;
+            }
+            pixel = result;
+        }
+        return noisy;
+    }
+
+    // The diff one pixel at a time: a pixel that changed keeps its index
+    // unless it is nearly transparent, every other pixel gets the
+    // transparent index. The bounds cover exactly the pixels that changed.
+    // Pixels within the tolerance of the reference count as unchanged, and
+    // the reference only takes on the pixels that changed.
+    DiffInfo ComputeReferenceDiff(
+        FramePair const& pair,
+        std::vector<uint32_t> const& current,
+        std::vector<uint32_t>& reference,
+        DiffTolerance const& tolerance,
+        std::vector<uint8_t>& indices)
+    {
+        auto diffInfo = CreateInitialDiffInfo(pair.Width, pair.Height);
+        indices = pair.Indices;
+        for (uint32_t y = 0; y < pair.Height; y++)
+        {
+            for (uint32_t x = 0; x < pair.Width; x++)
+            {
+                auto i = (static_cast<size_t>(y) * pair.Width) + x;
+                auto changed = current[i] != reference[i];
+                if (changed && IsWithinTolerance(current[i], reference[i], tolerance))
+                {
+                    diffInfo.NumToleratedPixels++;
+                    changed = false;
+                }
+                if (changed)
+                {
+                    reference[i] = current[i];
+                    diffInfo.NumDifferingPixels++;
+                    diffInfo.left = std::min(diffInfo.left, x);
+                    diffInfo.top = std::min(diffInfo.top, y);
+                    diffInfo.right = std::max(diffInfo.right, x + 1);
+                    diffInfo.bottom = std::max(diffInfo.bottom, y + 1);
+                }
+                if (!changed || IsTransparentPixel(current[i]))
+                {
+                    indices[i] = pair.TransparentIndex;
+                }
+            }
+        }
+        return diffInfo;
+    }
+
+    DiffInfo ComputeReferenceDiff(FramePair const& pair, std::vector<uint8_t>& indices)
+    {
+        auto reference = pair.Previous;
+        return ComputeReferenceDiff(pair, pair.Current, reference, DiffTolerance{}, indices);
+    }
+
+    // A tolerance with a random threshold, small enough that the noise
+    // from AddNoise often goes past it
+    DiffTolerance GenerateTolerance(std::mt19937& random, DiffToleranceMode mode)
+    {
+        auto threshold = mode == DiffToleranceMode::Exact ? 0 : static_cast<uint32_t>(random() % 12);
+        return DiffTolerance{ mode, threshold };
+    }
+
+    // The frames a tolerance check diffs one after the other, starting from
+    // the pair's previous frame. The second frame is either the pair's
+    // current one or a noisy copy of the previous one; the third is a noisy
+    // copy of the second, which catches a reference that drifted.
+    std::vector<std::vector<uint32_t>> GenerateNoisyFrames(std::mt19937& random, FramePair const& pair)
+    {
+        const uint32_t maxDelta = 16;
+        std::vector<std::vector<uint32_t>> frames;
+        frames.push_back((random() % 2) == 0 ? pair.Current : AddNoise(random, pair.Previous, maxDelta));
+        frames.push_back(AddNoise(random, frames.back(), maxDelta));
+        return frames;
+    }
+
+    // Only for the ASCII names of our own enums
+    std::string ToNarrowString(wchar_t const* value)
+    {
+        std::string result;
+        for (; *value != L'\0'; value++)
+        {
+            result.push_back(static_cast<char>(*value));
+        }
+        return result;
+    }
+
+    std::string DescribeTolerance(DiffTolerance const& tolerance)
+    {
+        return ToNarrowString(DiffToleranceModeToString(tolerance.Mode)) + " " + std::to_string(tolerance.Threshold);
+    }
+
+    std::string DescribePair(FramePair const& pair, uint32_t pairIndex)
+    {
+        return "pair " + std::to_string(pairIndex) + " (" + std::to_string(pair.Width) + "x" + std::to_string(pair.Height) + ")";
+    }
+
+    std::string DescribeDiffInfo(DiffInfo const& diffInfo)
+    {
+        return std::to_string(diffInfo.NumDifferingPixels) + " pixels in [" +
+            std::to_string(diffInfo.left) + ", " + std::to_string(diffInfo.top) + ", " +
+            std::to_string(diffInfo.right) + ", " + std::to_string(diffInfo.bottom) + "), " +
+            std::to_string(diffInfo.NumToleratedPixels) + " tolerated";
+    }
+
+    void ExpectEqualDiffInfo(DiffInfo const& actual, DiffInfo const& expected, std::string const& context)
+    {
+        if (actual.NumDifferingPixels != expected.NumDifferingPixels ||
+            actual.NumToleratedPixels != expected.NumToleratedPixels ||
+            actual.left != expected.left ||
+            actual.top != expected.top ||
+            actual.right != expected.right ||
+            actual.bottom != expected.bottom)
+        {
+            throw std::runtime_error(context + ": expected " + DescribeDiffInfo(expected) + ", got " + DescribeDiffInfo(actual));
+        }
+    }
+
+    // Pixels inside rect must match the expected indices, the others must
+    // still have their original ones
+    void ExpectEqualIndices(
+        FramePair const& pair,
+        std::vector<uint8_t> const& actual,
+        std::vector<uint8_t> const& expected,
+        FrameRect const& rect,
+        std::string const& context)
+    {
+        for (uint32_t y = 0; y < pair.Height; y++)
+        {
+            for (uint32_t x = 0; x < pair.Width; x++)
+            {
+                auto i = (static_cast<size_t>(y) * pair.Width) + x;
+                auto inside = x >= rect.Left && x < rect.Right && y >= rect.Top && y < rect.Bottom;
+                auto expectedIndex = inside ? expected[i] : pair.Indices[i];
+                if (actual[i] != expectedIndex)
+                {
+                    throw std::runtime_error(context + ": index at (" + std::to_string(x) + ", " + std::to_string(y) +
+                        ") is " + std::to_string(actual[i]) + ", expected " + std::to_string(expectedIndex));
+                }
+            }
+        }
+    }
+
+    // A dirty rect somewhere around the pixels that changed
+    FrameRect GenerateDirtyRect(std::mt19937& random, FramePair const& pair, DiffInfo const& expected)
+    {
+        auto dirtyRect = GetDiffRect(expected);
+        if (dirtyRect.IsEmpty())
+        {
+            return GenerateRect(random, pair.Width, pair.Height);
+        }
+        dirtyRect.Left -= random() % (dirtyRect.Left + 1);
+        dirtyRect.Top -= random() % (dirtyRect.Top + 1);
+        dirtyRect.Right += random() % (pair.Width - dirtyRect.Right + 1);
+        dirtyRect.Bottom += random() % (pair.Height - dirtyRect.Bottom + 1);
+        return dirtyRect;
+    }
+
+    void CheckCpuDiff(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> expectedIndices;
+        std::vector<uint8_t> indices;
+        const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+        for (uint32_t pairIndex = 0; pairIndex < NumFramePairs; pairIndex++)
+        {
+            auto pair = GenerateFramePair(random);
+            auto expected = ComputeReferenceDiff(pair, expectedIndices);
+            auto dirtyRect = GenerateDirtyRect(random, pair, expected);
+
+            for (auto&& level : levels)
+            {
+                if (!IsSimdLevelSupported(level))
+                {
+                    continue;
+                }
+                for (auto useDirtyRect : { false, true })
+                {
+                    CpuTransparencyFixer fixer(pair.Width, pair.Height, level);
+                    fixer.InitPrevious(reinterpret_cast<uint8_t const*>(pair.Previous.data()));
+                    indices = pair.Indices;
+                    auto current = reinterpret_cast<uint8_t const*>(pair.Current.data());
+                    auto actual = useDirtyRect
+                        ? fixer.ProcessInput(current, pair.TransparentIndex, indices, dirtyRect)
+                        : fixer.ProcessInput(current, pair.TransparentIndex, indices);
+
+                    auto context = DescribePair(pair, pairIndex) + ", " + ToNarrowString(SimdLevelToString(level)) + (useDirtyRect ? " with dirty rect" : "");
+                    ExpectEqualDiffInfo(actual, expected, context);
+                    auto scanRect = useDirtyRect ? dirtyRect : FrameRect{ 0, 0, pair.Width, pair.Height };
+                    ExpectEqualIndices(pair, indices, expectedIndices, scanRect, context);
+                }
+            }
+        }
+    }
+
+    // Runs two frames through the tolerance kernels, so that a previous
+    // frame that follows every pixel instead of only the changed ones shows
+    // up in the second diff
+    void CheckCpuToleranceDiff(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> expectedIndices;
+        std::vector<uint8_t> indices;
+        const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon };
+        const DiffToleranceMode modes[] = { DiffToleranceMode::Channel, DiffToleranceMode::YCbCr };
+        for (uint32_t pairIndex = 0; pairIndex < NumFramePairs; pairIndex++)
+        {
+            auto pair = GenerateFramePair(random);
+            auto frames = GenerateNoisyFrames(random, pair);
+            for (auto&& mode : modes)
+            {
+                auto tolerance = GenerateTolerance(random, mode);
+                for (auto&& level : levels)
+                {
+                    if (!IsSimdLevelSupported(level))
+                    {
+                        continue;
+                    }
+                    CpuTransparencyFixer fixer(pair.Width, pair.Height, level, tolerance);
+                    fixer.InitPrevious(reinterpret_cast<uint8_t const*>(pair.Previous.data()));
+                    auto reference = pair.Previous;
+                    for (size_t frameIndex = 0; frameIndex < frames.size(); frameIndex++)
+                    {
+                        auto expected = ComputeReferenceDiff(pair, frames[frameIndex], reference, tolerance, expectedIndices);
+                        indices = pair.Indices;
+                        auto actual = fixer.ProcessInput(reinterpret_cast<uint8_t const*>(frames[frameIndex].data()), pair.TransparentIndex, indices);
+
+                        auto context = DescribePair(pair, pairIndex) + ", " + DescribeTolerance(tolerance) + ", " +
+                            ToNarrowString(SimdLevelToString(level)) + ", frame " + std::to_string(frameIndex + 1);
+                        ExpectEqualDiffInfo(actual, expected, context);
+                        ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, context);
+                    }
+                }
+            }
+        }
+    }
+
+    void ExpectEqualHistograms(ColorHistogram const& actual, ColorHistogram const& expected, std::string const& context)
+    {
+        auto actualEntries = actual.GetEntries();
+        auto expectedEntries = expected.GetEntries();
+        auto equal = actual.NumPixels() == expected.NumPixels() &&
+            actual.NumTransparentPixels() == expected.NumTransparentPixels() &&
+            std::equal(actualEntries.begin(), actualEntries.end(), expectedEntries.begin(), expectedEntries.end(), [](auto&& a, auto&& b)
+            {
+                return a.Red == b.Red && a.Green == b.Green && a.Blue == b.Blue && a.Count == b.Count;
+            });
+        if (!equal)
+        {
+            throw std::runtime_error(context + ": the histogram differs from a single threaded one");
+        }
+    }
+
+    // Runs the diff, histogram and palette mapping in row bands as short
+    // as one row, so that the tiny frames still get split between
+    // threads, and compares them against the brute-force diff and the
+    // single threaded histogram and mapping
+    void CheckRowBands(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<std::unique_ptr<RowBandPool>> pools;
+        for (auto numThreads : { 2u, 3u, 8u })
+        {
+            pools.push_back(std::make_unique<RowBandPool>(numThreads, 1));
+        }
+        std::vector<uint8_t> expectedIndices;
+        std::vector<uint8_t> indices;
+        const DiffToleranceMode modes[] = { DiffToleranceMode::Exact, DiffToleranceMode::Channel, DiffToleranceMode::YCbCr };
+        for (uint32_t pairIndex = 0; pairIndex < NumFramePairs; pairIndex++)
+        {
+            auto pair = GenerateFramePair(random);
+            auto& pool = *pools[random() % pools.size()];
+            auto pairContext = DescribePair(pair, pairIndex) + ", " + std::to_string(pool.NumThreads()) + " threads";
+
+            // An exact diff limited to a dirty rect
+            {
+                auto expected = ComputeReferenceDiff(pair, expectedIndices);
+                auto dirtyRect = GenerateDirtyRect(random, pair, expected);
+                CpuTransparencyFixer fixer(pair.Width, pair.Height);
+                fixer.SetRowBandPool(&pool);
+                fixer.InitPrevious(reinterpret_cast<uint8_t const*>(pair.Previous.data()));
+                indices = pair.Indices;
+                auto actual = fixer.ProcessInput(reinterpret_cast<uint8_t const*>(pair.Current.data()), pair.TransparentIndex, indices, dirtyRect);
+                auto context = pairContext + " with dirty rect";
+                ExpectEqualDiffInfo(actual, expected, context);
+                ExpectEqualIndices(pair, indices, expectedIndices, dirtyRect, context);
+            }
+
+            // Two frames in a row with any tolerance
+            {
+                auto tolerance = GenerateTolerance(random, modes[random() % ARRAYSIZE(modes)]);
+                auto frames = GenerateNoisyFrames(random, pair);
+                CpuTransparencyFixer fixer(pair.Width, pair.Height, GetBestSimdLevel(), tolerance);
+                fixer.SetRowBandPool(&pool);
+                fixer.InitPrevious(reinterpret_cast<uint8_t const*>(pair.Previous.data()));
+                auto reference = pair.Previous;
+                for (size_t frameIndex = 0; frameIndex < frames.size(); frameIndex++)
+                {
+                    auto expected = ComputeReferenceDiff(pair, frames[frameIndex], reference, tolerance, expectedIndices);
+                    indices = pair.Indices;
+                    auto actual = fixer.ProcessInput(reinterpret_cast<uint8_t const*>(frames[frameIndex].data()), pair.TransparentIndex, indices);
+                    auto context = pairContext + ", " + DescribeTolerance(tolerance) + ", frame " + std::to_string(frameIndex + 1);
+                    ExpectEqualDiffInfo(actual, expected, context);
+                    ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, context);
+                }
+            }
+
+            // The histogram and palette mapping of the current frame
+            {
+                ParallelPalettizer palettizer(pool, pair.Width, pair.Height);
+                ColorHistogram expectedHistogram;
+                expectedHistogram.AddPixels(pair.Current.data(), pair.Current.size());
+                ColorHistogram histogram;
+                palettizer.BuildHistogram(pair.Current.data(), histogram);
+                ExpectEqualHistograms(histogram, expectedHistogram, pairContext);
+
+                QuantizerOptions options = {};
+                options.MaxColors = 2 + static_cast<uint32_t>(random() % 15);
+                auto palette = BuildPalette(expectedHistogram, options);
+                expectedIndices.resize(pair.Current.size());
+                InverseColorMap(palette).MapPixels(pair.Current.data(), pair.Current.size(), expectedIndices.data());
+                indices.resize(pair.Current.size());
+                InverseColorMap colorMap(palette);
+                palettizer.MapPixels(colorMap, pair.Current.data(), indices.data());
+                ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, pairContext + ", palette mapping");
+
+                // Dithered mapping against the same mode on one thread
+                const DitherMode ditherModes[] = { DitherMode::Bayer, DitherMode::FloydSteinberg, DitherMode::SierraLite };
+                auto dither = ditherModes[random() % ARRAYSIZE(ditherModes)];
+                auto ditherContext = pairContext + ", " + ToNarrowString(DitherModeToString(dither));
+                InverseColorMap expectedColorMap(palette);
+                if (IsErrorDiffusion(dither))
+                {
+                    ErrorDiffusionDitherer ditherer(pair.Width, pair.Height, dither);
+                    ditherer.MapPixels(nullptr, expectedColorMap, pair.Current.data(), expectedIndices.data());
+                }
+                else
+                {
+                    for (uint32_t y = 0; y < pair.Height; y++)
+                    {
+                        auto offset = static_cast<size_t>(y) * pair.Width;
+                        expectedColorMap.MapPixelsOrdered(pair.Current.data() + offset, pair.Width, 0, y, expectedIndices.data() + offset);
+                    }
+                }
+                ParallelPalettizer ditheringPalettizer(pool, pair.Width, pair.Height, dither);
+                InverseColorMap ditherColorMap(palette);
+                ditheringPalettizer.MapPixels(ditherColorMap, pair.Current.data(), indices.data());
+                ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, ditherContext);
+
+                // Bayer offsets only depend on the position, so pixels that
+                // didn't change between the frames keep their index
+                if (dither == DitherMode::Bayer)
+                {
+                    std::vector<uint8_t> previousIndices(pair.Previous.size(), 0);
+                    ditheringPalettizer.MapPixels(ditherColorMap, pair.Previous.data(), previousIndices.data());
+                    for (size_t i = 0; i < pair.Current.size(); i++)
+                    {
+                        if (pair.Current[i] == pair.Previous[i] && indices[i] != previousIndices[i])
+                        {
+                            throw std::runtime_error(ditherContext + ": unchanged pixel " + std::to_string(i) + " changed its index");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    winrt::com_ptr<ID3D11Texture2D> CreateFrameTexture(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        uint32_t width,
+        uint32_t height,
+        std::vector<uint32_t> const& pixels)
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = pixels.data();
+        initData.SysMemPitch = width * 4;
+        winrt::com_ptr<ID3D11Texture2D> texture;
+        winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, &initData, texture.put()));
+        return texture;
+    }
+
+    void CheckGpuDiff(uint32_t seed)
+    {
+        auto d3dDevice = util::CreateD3DDevice(D3D11_CREATE_DEVICE_BGRA_SUPPORT);
+        winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+        d3dDevice->GetImmediateContext(d3dContext.put());
+
+        std::mt19937 random(seed);
+        std::vector<uint8_t> expectedIndices;
+        std::vector<uint8_t> indices;
+        const DiffToleranceMode modes[] = { DiffToleranceMode::Exact, DiffToleranceMode::Channel, DiffToleranceMode::YCbCr };
+        for (uint32_t pairIndex = 0; pairIndex < NumGpuFramePairs; pairIndex++)
+        {
+            auto pair = GenerateFramePair(random);
+            auto expected = ComputeReferenceDiff(pair, expectedIndices);
+
+            auto previousTexture = CreateFrameTexture(d3dDevice, pair.Width, pair.Height, pair.Previous);
+            auto currentTexture = CreateFrameTexture(d3dDevice, pair.Width, pair.Height, pair.Current);
+            TransparencyFixer fixer(d3dDevice, d3dContext, pair.Width, pair.Height);
+            fixer.InitPrevious(previousTexture);
+            indices = pair.Indices;
+            auto actual = fixer.ProcessInput(currentTexture, pair.TransparentIndex, indices);
+
+            auto context = DescribePair(pair, pairIndex);
+            ExpectEqualDiffInfo(actual, expected, context);
+            ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, context);
+
+            // The same two frame sequence as the CPU tolerance check, which
+            // also covers swapping the previous and reference textures
+            auto frames = GenerateNoisyFrames(random, pair);
+            for (auto&& mode : modes)
+            {
+                auto tolerance = GenerateTolerance(random, mode);
+                TransparencyFixer toleranceFixer(d3dDevice, d3dContext, pair.Width, pair.Height, tolerance);
+                toleranceFixer.InitPrevious(previousTexture);
+                auto reference = pair.Previous;
+                for (size_t frameIndex = 0; frameIndex < frames.size(); frameIndex++)
+                {
+                    expected = ComputeReferenceDiff(pair, frames[frameIndex], reference, tolerance, expectedIndices);
+                    auto frameTexture = CreateFrameTexture(d3dDevice, pair.Width, pair.Height, frames[frameIndex]);
+                    indices = pair.Indices;
+                    actual = toleranceFixer.ProcessInput(frameTexture, pair.TransparentIndex, indices);
+
+                    auto toleranceContext = context + ", " + DescribeTolerance(tolerance) + ", frame " + std::to_string(frameIndex + 1);
+                    ExpectEqualDiffInfo(actual, expected, toleranceContext);
+                    ExpectEqualIndices(pair, indices, expectedIndices, FrameRect{ 0, 0, pair.Width, pair.Height }, toleranceContext);
+                }
+            }
+        }
+    }
+
+    // Crops the diffed frame the way main does, as one image or as several
+    // found with the tile map, and draws the images over the previous frame
+    // like a viewer would. The result has to match drawing every visible
+    // pixel that changed.
+    void CheckCrop(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint8_t> indices;
+        std::vector<uint8_t> image;
+        std::vector<uint8_t> canvas;
+        std::vector<uint8_t> expectedCanvas;
+        std::vector<FrameRect> imageRects;
+        for (uint32_t pairIndex = 0; pairIndex < NumFramePairs; pairIndex++)
+        {
+            auto pair = GenerateFramePair(random);
+            auto diffInfo = ComputeReferenceDiff(pair, indices);
+            auto maxImages = 1 + (random() % MaxImagesPerFrame);
+            if (diffInfo.NumDifferingPixels == 0)
+            {
+                continue;
+            }
+            auto context = DescribePair(pair, pairIndex) + ", up to " + std::to_string(maxImages) + " images";
+
+            auto bounds = GetDiffRect(diffInfo);
+            imageRects.clear();
+            if (maxImages > 1)
+            {
+                TileChangeMap tileMap(pair.Width, pair.Height);
+                tileMap.Build(indices.data(), pair.TransparentIndex, bounds);
+                tileMap.GetChangedRects(maxImages, 0, imageRects);
+            }
+            if (imageRects.empty())
+            {
+                imageRects.push_back(bounds);
+            }
+            if (imageRects.size() > maxImages)
+            {
+                throw std::runtime_error(context + ": got " + std::to_string(imageRects.size()) + " images");
+            }
+
+            // Whatever the viewer showed before
+            canvas.resize(indices.size());
+            for (auto&& index : canvas)
+            {
+                index = static_cast<uint8_t>(random() % 256);
+            }
+            expectedCanvas = canvas;
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                if (pair.Current[i] != pair.Previous[i] && !IsTransparentPixel(pair.Current[i]))
+                {
+                    expectedCanvas[i] = pair.Indices[i];
+                }
+            }
+
+            for (auto&& rect : imageRects)
+            {
+                if (rect.IsEmpty() || rect.Right > pair.Width || rect.Bottom > pair.Height)
+                {
+                    throw std::runtime_error(context + ": image rect is empty or outside of the frame");
+                }
+                image.resize(static_cast<size_t>(rect.Width()) * rect.Height());
+                CopyRectPixels(indices.data(), pair.Width, rect, image.data());
+                for (uint32_t y = 0; y < rect.Height(); y++)
+                {
+                    for (uint32_t x = 0; x < rect.Width(); x++)
+                    {
+                        auto index = image[(static_cast<size_t>(y) * rect.Width()) + x];
+                        if (index != pair.TransparentIndex)
+                        {
+                            canvas[(static_cast<size_t>(rect.Top + y) * pair.Width) + rect.Left + x] = index;
+                        }
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < canvas.size(); i++)
+            {
+                if (canvas[i] != expectedCanvas[i])
+                {
+                    auto x = static_cast<uint32_t>(i % pair.Width);
+                    auto y = static_cast<uint32_t>(i / pair.Width);
+                    throw std::runtime_error(context + ": pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") wasn't drawn correctly");
+                }
+            }
+        }
+    }
+
+    // Composes synthetic .rani projects with the incremental compositor
+    // and compares every frame with a full compose. Pixels that changed
+    // have to be inside the dirty rect, and layer images that cover the
+    // whole canvas have to give the same dirty rects as images cropped to
+    // their sprites.
+    void CheckRaniLayers(uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<uint32_t> expected;
+        std::vector<uint32_t> previous;
+        std::vector<FrameRect> croppedDirtyRects;
+        for (uint32_t projectIndex = 0; projectIndex < NumRaniProjects; projectIndex++)
+        {
+            auto width = 1 + (random() % MaxFrameWidth);
+            auto height = 1 + (random() % MaxFrameHeight);
+            auto numFrames = 2 + (random() % (MaxRaniFrames - 1));
+            auto numLayers = 1 + (random() % MaxRaniLayers);
+            auto context = "project " + std::to_string(projectIndex) + " (" + std::to_string(width) + "x" + std::to_string(height) + ", " +
+                std::to_string(numLayers) + " layers)";
+
+            croppedDirtyRects.clear();
+            for (auto fullCanvasLayers : { false, true })
+            {
+                auto file = GenerateSyntheticRaniProject(width, height, numFrames, numLayers, fullCanvasLayers);
+                auto project = ParseRaniProject(file.data(), file.size());
+                LayerBitmapCache cache;
+                RaniCpuCompositor compositor(*project, file.data(), file.size(), DecodeSyntheticLayerImage, cache);
+                IncrementalRaniCompositor incremental(compositor, *project);
+                FrameRect dirtyRect = {};
+                for (size_t frameIndex = 0; incremental.TryGetNextFrame(dirtyRect); frameIndex++)
+                {
+                    auto frameContext = context + (fullCanvasLayers ? ", full canvas" : ", cropped") + ", frame " + std::to_string(frameIndex);
+                    compositor.ComposeFrame(project->Frames[frameIndex], expected);
+                    auto&& actual = incremental.Pixels();
+                    for (size_t i = 0; i < expected.size(); i++)
+                    {
+                        auto x = static_cast<uint32_t>(i % width);
+                        auto y = static_cast<uint32_t>(i / width);
+                        auto position = " (" + std::to_string(x) + ", " + std::to_string(y) + ")";
+                        if (actual[i] != expected[i])
+                        {
+                            throw std::runtime_error(frameContext + ": pixel" + position + " doesn't match a full compose");
+                        }
+                        auto isDirty = x >= dirtyRect.Left && x < dirtyRect.Right && y >= dirtyRect.Top && y < dirtyRect.Bottom;
+                        if (frameIndex > 0 && expected[i] != previous[i] && !isDirty)
+                        {
+                            throw std::runtime_error(frameContext + ": pixel" + position + " changed outside of the dirty rect");
+                        }
+                    }
+                    previous = expected;
+
+                    if (!fullCanvasLayers)
+                    {
+                        croppedDirtyRects.push_back(dirtyRect);
+                    }
+                    else
+                    {
+                        auto&& croppedRect = croppedDirtyRects[frameIndex];
+                        if (dirtyRect.Left != croppedRect.Left || dirtyRect.Top != croppedRect.Top ||
+                            dirtyRect.Right != croppedRect.Right || dirtyRect.Bottom != croppedRect.Bottom)
+                        {
+                            throw std::runtime_error(frameContext + ": dirty rect differs from the one with cropped layer images");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    struct SelfCheckEntry
+    {
+        const wchar_t* Name;
+        void (*Run)(uint32_t seed);
+    };
+
+    const SelfCheckEntry SelfCheckEntries[] =
+    {
+        { L"diff", CheckCpuDiff },
+        { L"diff-tolerance", CheckCpuToleranceDiff },
+        { L"diff-gpu", CheckGpuDiff },
+        { L"bands", CheckRowBands },
+        { L"crop", CheckCrop },
+        { L"rani", CheckRaniLayers },
+    };
+}
+
+bool RunSelfChecks(std::wstring const& filter, uint32_t seed)
+{
+    wprintf(L"Seed: %u\n", seed);
+    auto passed = true;
+    for (auto&& check : SelfCheckEntries)
+    {
+        if (!filter.empty() && filter != check.Name)
+        {
+            continue;
+        }
+        try
+        {
+            check.Run(seed);
+            wprintf(L"  %-16ls passed\n", check.Name);
+        }
+        catch (std::exception const& error)
+        {
+            wprintf(L"  %-16ls FAILED: %hs\n", check.Name, error.what());
+            passed = false;
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            wprintf(L"  %-16ls FAILED: %ls\n", check.Name, error.message().c_str());
+            passed = false;
+        }
+    }
+    return passed;
+}
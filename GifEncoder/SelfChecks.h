@@ -0,0 +1,9 @@
+#pragma once
+
+// Runs the built-in self checks, which compare the diff and crop stages
+// (also split into row bands) against brute-force references on random
+// frame pairs, and dithered palette mapping on several threads against
+// one, and prints the results to stdout. An empty filter runs every
+// check, otherwise only the check with a matching name is run. The same
+// seed always produces the same frames. Returns false if any check failed.
+bool RunSelfChecks(std::wstring const& filter, uint32_t seed);
@@ -0,0 +1,518 @@
+#include "pch.h"
+#include "SyntheticAnimation.h"
+#include "Base64.h"
+
+namespace
+{
+    // A cheap integer hash with good avalanche, so nearby inputs give
+    // unrelated outputs.
+    inline uint32_t Hash(uint32_t value)
+    {
+        value ^= value >> 16;
+        value *= 0x7FEB352D;
+        value ^= value >> 15;
+        value *= 0x846CA68B;
+        value ^= value >> 16;
+        return value;
+    }
+
+    // Bounces between 0 and limit
+    inline uint32_t TriangleWave(uint32_t position, uint32_t limit)
+    {
+        if (limit == 0)
+        {
+            return 0;
+        }
+        auto period = limit * 2;
+        auto phase = position % period;
+        return phase <= limit ? phase : period - phase;
+    }
+
+    const uint32_t PaperColor = 0xFFFFFFFF;
+    const uint32_t InkColor = 0xFF202020;
+    const uint32_t TitleBarColor = 0xFF2B579A;
+    const uint32_t SidebarColor = 0xFFF3F3F3;
+    const uint32_t TitleBarHeight = 32;
+    const uint32_t GlyphWidth = 8;
+    const uint32_t GlyphHeight = 12;
+    const uint32_t LineHeight = 16;
+    const uint32_t ScrollPixelsPerFrame = 3;
+    const uint32_t MaxSpriteSize = 64;
+    const uint32_t WidgetSize = 24;
+    const uint32_t WidgetMargin = 8;
+
+    uint32_t GetBlockColor(uint32_t x, uint32_t y)
+    {
+        return 0xFF000000 | (((x / 128) * 0x203040) + ((y / 128) * 0x102030));
+    }
+
+    // A ringed disc, or 0 outside of it
+    uint32_t GetSpritePixel(uint32_t x, uint32_t y, uint32_t size, uint32_t color)
+    {
+        auto center = static_cast<int32_t>(size / 2);
+        auto dx = static_cast<int32_t>(x) - center;
+        auto dy = static_cast<int32_t>(y) - center;
+        auto distanceSquared = static_cast<uint32_t>(dx * dx + dy * dy);
+        auto radius = static_cast<uint32_t>(center);
+        if (distanceSquared >= radius * radius)
+        {
+            return 0;
+        }
+        // Darken every other ring
+        auto ring = static_cast<uint32_t>(std::sqrt(static_cast<double>(distanceSquared))) / 6;
+        return (ring % 2) == 0 ? color : 0xFF000000 | ((color & 0x00FEFEFE) >> 1);
+    }
+
+    // Glyph rows are 8 pixels wide, with a blank column on each side and a
+    // blank row at the top and bottom.
+    uint8_t GetGlyphRow(uint32_t character, uint32_t row)
+    {
+        if (row == 0 || row + 1 >= GlyphHeight)
+        {
+            return 0;
+        }
+        return static_cast<uint8_t>(Hash((character % 96) * GlyphHeight + row) & 0x7E);
+    }
+
+    // Returns 0 for spaces and past the end of the line
+    uint32_t GetCharacter(uint32_t line, uint32_t column)
+    {
+        auto lineLength = 8 + Hash(line) % 72;
+        if (column >= lineLength)
+        {
+            return 0;
+        }
+        auto character = Hash((line * 1024) + column);
+        return (character % 7) == 0 ? 0 : 1 + character % 95;
+    }
+
+    void AppendUint32(std::vector<uint8_t>& data, uint32_t value)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            data.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    uint32_t ReadUint32(uint8_t const* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    const uint8_t SyntheticLayerTag[] = { 'S', 'Y', 'N', 'L' };
+
+    // The tag, the width and height, then (count, color) runs that cover
+    // the image row by row
+    std::vector<uint8_t> EncodeSyntheticLayerImage(std::vector<uint32_t> const& pixels, uint32_t width, uint32_t height)
+    {
+        std::vector<uint8_t> data(std::begin(SyntheticLayerTag), std::end(SyntheticLayerTag));
+        AppendUint32(data, width);
+        AppendUint32(data, height);
+        size_t position = 0;
+        while (position < pixels.size())
+        {
+            auto color = pixels[position];
+            auto end = position + 1;
+            while (end < pixels.size() && pixels[end] == color)
+            {
+                end++;
+            }
+            AppendUint32(data, static_cast<uint32_t>(end - position));
+            AppendUint32(data, color);
+            position = end;
+        }
+        return data;
+    }
+
+    std::string GetLayerXml(std::string const& name, float opacity, std::string const& imageData)
+    {
+        std::string xml = "<Layer Name=\"";
+        xml += name;
+        xml += "\" Visible=\"True\" Opacity=\"";
+        xml += std::to_string(opacity);
+        xml += "\">\r\n<PngData>";
+        xml += imageData;
+        xml += "</PngData>\r\n</Layer>\r\n";
+        return xml;
+    }
+}
+
+wchar_t const* SyntheticSceneToString(SyntheticScene scene)
+{
+    switch (scene)
+    {
+    case SyntheticScene::MovingSprite:
+        return L"sprite";
+    case SyntheticScene::Noise:
+        return L"noise";
+    case SyntheticScene::ScrollingText:
+        return L"scrolling-text";
+    case SyntheticScene::ScatteredWidgets:
+        return L"widgets";
+    case SyntheticScene::NoisySprite:
+        return L"noisy-sprite";
+    default:
+        throw std::runtime_error("Unknown SyntheticScene value!");
+    }
+}
+
+SyntheticAnimation::SyntheticAnimation(SyntheticScene scene, uint32_t width, uint32_t height, uint32_t numFrames)
+{
+    if (width == 0 || height == 0)
+    {
+        throw std::invalid_argument("A width or height of 0 is invalid.");
+    }
+    m_scene = scene;
+    m_width = width;
+    m_height = height;
+    m_numFrames = numFrames;
+    m_pixels.resize(static_cast<size_t>(width) * height, 0);
+
+    if (scene == SyntheticScene::MovingSprite || scene == SyntheticScene::NoisySprite)
+    {
+        m_background.resize(m_pixels.size());
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                m_background[(static_cast<size_t>(y) * width) + x] = GetBlockColor(x, y);
+            }
+        }
+    }
+    else if (scene == SyntheticScene::ScrollingText || scene == SyntheticScene::ScatteredWidgets)
+    {
+        m_background.resize(m_pixels.size());
+        auto sidebarWidth = width / 8;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                auto color = PaperColor;
+                if (y < TitleBarHeight)
+                {
+                    color = TitleBarColor;
+                }
+                else if (x < sidebarWidth)
+                {
+                    color = SidebarColor;
+                }
+                m_background[(static_cast<size_t>(y) * width) + x] = color;
+            }
+        }
+    }
+}
+
+bool SyntheticAnimation::TryGetNextFrame(FrameRect& dirtyRect)
+{
+    if (m_nextFrame >= m_numFrames)
+    {
+        return false;
+    }
+
+    auto frameIndex = m_nextFrame++;
+    switch (m_scene)
+    {
+    case SyntheticScene::MovingSprite:
+        dirtyRect = RenderMovingSprite(frameIndex);
+        break;
+    case SyntheticScene::Noise:
+        dirtyRect = RenderNoise(frameIndex);
+        break;
+    case SyntheticScene::ScrollingText:
+        dirtyRect = RenderScrollingText(frameIndex);
+        break;
+    case SyntheticScene::ScatteredWidgets:
+        dirtyRect = RenderScatteredWidgets(frameIndex);
+        break;
+    case SyntheticScene::NoisySprite:
+        dirtyRect = RenderNoisySprite(frameIndex);
+        break;
+    }
+    if (frameIndex == 0)
+    {
+        dirtyRect = FrameRect{ 0, 0, m_width, m_height };
+    }
+    return true;
+}
+
+FrameRect SyntheticAnimation::GetSpriteRect(uint32_t frameIndex) const
+{
+    auto size = std::min({ MaxSpriteSize, m_width, m_height });
+    auto left = TriangleWave(frameIndex * 7, m_width - size);
+    auto top = TriangleWave(frameIndex * 5, m_height - size);
+    return FrameRect{ left, top, left + size, top + size };
+}
+
+FrameRect SyntheticAnimation::RenderMovingSprite(uint32_t frameIndex)
+{
+    FrameRect previousRect = {};
+    if (frameIndex == 0)
+    {
+        m_pixels = m_background;
+    }
+    else
+    {
+        // Put back the background where the sprite was
+        previousRect = GetSpriteRect(frameIndex - 1);
+        for (auto y = previousRect.Top; y < previousRect.Bottom; y++)
+        {
+            auto offset = (static_cast<size_t>(y) * m_width) + previousRect.Left;
+            std::copy_n(m_background.data() + offset, previousRect.Width(), m_pixels.data() + offset);
+        }
+    }
+
+    auto rect = GetSpriteRect(frameIndex);
+    DrawSprite(rect);
+    return UnionRects(previousRect, rect);
+}
+
+void SyntheticAnimation::DrawSprite(FrameRect const& rect)
+{
+    auto size = rect.Width();
+    const uint32_t spriteColor = 0xFFE0A030;
+    for (uint32_t y = 0; y < size; y++)
+    {
+        auto row = m_pixels.data() + (static_cast<size_t>(rect.Top + y) * m_width) + rect.Left;
+        for (uint32_t x = 0; x < size; x++)
+        {
+            if (auto color = GetSpritePixel(x, y, size, spriteColor))
+            {
+                row[x] = color;
+            }
+        }
+    }
+}
+
+FrameRect SyntheticAnimation::RenderNoisySprite(uint32_t frameIndex)
+{
+    m_pixels = m_background;
+    DrawSprite(GetSpriteRect(frameIndex));
+
+    // Up to 2 steps up or down in every color channel
+    auto state = Hash(frameIndex + 1) | 1;
+    for (auto&& pixel : m_pixels)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        auto noisy = pixel & 0xFF000000;
+        for (uint32_t shift = 0; shift < 24; shift += 8)
+        {
+            auto channel = static_cast<int32_t>((pixel >> shift) & 0xFF);
+            channel += static_cast<int32_t>((state >> shift) % 5) - 2;
+            noisy |= static_cast<uint32_t>(std::clamp(channel, 0, 255)) << shift;
+        }
+        pixel = noisy;
+    }
+    return FrameRect{ 0, 0, m_width, m_height };
+}
+
+FrameRect SyntheticAnimation::RenderNoise(uint32_t frameIndex)
+{
+    // xorshift32 is fast enough that the noise doesn't dominate a benchmark
+    auto state = Hash(frameIndex + 1) | 1;
+    for (auto&& pixel : m_pixels)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        pixel = 0xFF000000 | (state & 0x00FFFFFF);
+    }
+    return FrameRect{ 0, 0, m_width, m_height };
+}
+
+FrameRect SyntheticAnimation::GetTextRect() const
+{
+    auto left = std::min(m_width / 8 + 16, m_width);
+    auto top = std::min(TitleBarHeight + 16, m_height);
+    auto right = m_width > 16 ? std::max(m_width - 16, left) : left;
+    auto bottom = m_height > 16 ? std::max(m_height - 16, top) : top;
+    return FrameRect{ left, top, right, bottom };
+}
+
+FrameRect SyntheticAnimation::RenderScrollingText(uint32_t frameIndex)
+{
+    if (frameIndex == 0)
+    {
+        m_pixels = m_background;
+    }
+
+    auto rect = GetTextRect();
+    auto scroll = frameIndex * ScrollPixelsPerFrame;
+    for (auto y = rect.Top; y < rect.Bottom; y++)
+    {
+        auto row = m_pixels.data() + (static_cast<size_t>(y) * m_width);
+        auto textY = (y - rect.Top) + scroll;
+        auto line = textY / LineHeight;
+        auto glyphRow = textY % LineHeight;
+        for (auto x = rect.Left; x < rect.Right; x += GlyphWidth)
+        {
+            auto column = (x - rect.Left) / GlyphWidth;
+            uint8_t bits = 0;
+            if (glyphRow < GlyphHeight)
+            {
+                if (auto character = GetCharacter(line, column))
+                {
+                    bits = GetGlyphRow(character, glyphRow);
+                }
+            }
+            auto end = std::min(x + GlyphWidth, rect.Right);
+            for (auto pixelX = x; pixelX < end; pixelX++)
+            {
+                row[pixelX] = (bits >> (pixelX - x)) & 1 ? InkColor : PaperColor;
+            }
+        }
+    }
+    return rect;
+}
+
+FrameRect SyntheticAnimation::RenderScatteredWidgets(uint32_t frameIndex)
+{
+    if (frameIndex == 0)
+    {
+        m_pixels = m_background;
+    }
+
+    // One widget in each corner, each redrawn with new stripes. Together
+    // they span the whole frame even though they only cover a sliver of it.
+    auto size = std::min({ WidgetSize, m_width, m_height });
+    auto right = m_width > size + WidgetMargin ? m_width - size - WidgetMargin : 0;
+    auto bottom = m_height > size + WidgetMargin ? m_height - size - WidgetMargin : 0;
+    auto left = std::min(WidgetMargin, right);
+    auto top = std::min(WidgetMargin, bottom);
+    const uint32_t positions[][2] = { { left, top }, { right, top }, { left, bottom }, { right, bottom } };
+
+    FrameRect dirtyRect = {};
+    uint32_t widget = 0;
+    for (auto&& position : positions)
+    {
+        auto rect = FrameRect{ position[0], position[1], position[0] + size, position[1] + size };
+        auto color = 0xFF000000 | (Hash((frameIndex * 4) + widget) & 0x00FFFFFF);
+        auto phase = frameIndex % size;
+        for (auto y = rect.Top; y < rect.Bottom; y++)
+        {
+            auto row = m_pixels.data() + (static_cast<size_t>(y) * m_width);
+            for (auto x = rect.Left; x < rect.Right; x++)
+            {
+                auto stripe = ((x - rect.Left) + (y - rect.Top) + phase) / 4;
+                row[x] = (stripe % 2) == 0 ? color : InkColor;
+            }
+        }
+        dirtyRect = UnionRects(dirtyRect, rect);
+        widget++;
+    }
+    return dirtyRect;
+}
+
+std::vector<uint8_t> GenerateSyntheticRaniProject(uint32_t width, uint32_t height, uint32_t numFrames, uint32_t numLayers, bool fullCanvasLayers)
+{
+    if (width == 0 || height == 0)
+    {
+        throw std::invalid_argument("A width or height of 0 is invalid.");
+    }
+    numLayers = std::max(numLayers, 1u);
+    const uint32_t numSpritePositions = 8;
+    auto spriteSize = std::min({ MaxSpriteSize, width, height });
+    auto numPixels = static_cast<size_t>(width) * height;
+
+    // Encode each distinct layer image once. Layers are counted from the
+    // bottom, layer 0 is the background.
+    std::vector<uint32_t> pixels(numPixels);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            pixels[(static_cast<size_t>(y) * width) + x] = 0xFF000000 | (((x / 32) * 0x030507) + ((y / 32) * 0x070503));
+        }
+    }
+    auto backgroundData = EncodeSyntheticLayerImage(pixels, width, height);
+    auto backgroundImage = EncodeBase64(backgroundData.data(), backgroundData.size(), 76);
+
+    // Moving sprites get an image for each position, the others only need
+    // the first one.
+    std::vector<std::vector<std::string>> spriteImages(numLayers);
+    for (uint32_t layer = 1; layer < numLayers; layer++)
+    {
+        auto numPositions = (layer % 3) == 0 ? numSpritePositions : 1;
+        auto color = 0xFF000000 | (Hash(layer) & 0x00FFFFFF);
+        for (uint32_t position = 0; position < numPositions; position++)
+        {
+            auto positionHash = Hash((layer * numSpritePositions) + position);
+            auto left = positionHash % (width - spriteSize + 1);
+            auto top = (positionHash >> 16) % (height - spriteSize + 1);
+            // Layers are drawn at the origin, so the image only needs to
+            // reach the sprite's far corner
+            auto imageWidth = fullCanvasLayers ? width : left + spriteSize;
+            auto imageHeight = fullCanvasLayers ? height : top + spriteSize;
+            std::vector<uint32_t> image(static_cast<size_t>(imageWidth) * imageHeight, 0);
+            for (uint32_t y = 0; y < spriteSize; y++)
+            {
+                auto row = image.data() + (static_cast<size_t>(top + y) * imageWidth) + left;
+                for (uint32_t x = 0; x < spriteSize; x++)
+                {
+                    row[x] = GetSpritePixel(x, y, spriteSize, color);
+                }
+            }
+            auto data = EncodeSyntheticLayerImage(image, imageWidth, imageHeight);
+            spriteImages[layer].push_back(EncodeBase64(data.data(), data.size(), 76));
+        }
+    }
+
+    std::string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n";
+    xml += "<AnimatorProject Width=\"" + std::to_string(width) + "\" Height=\"" + std::to_string(height) + "\" FrameTimeInMs=\"50\" BackgroundColor=\"FFFFFFFF\">\r\n";
+    xml += "<Frames>\r\n";
+    for (uint32_t frame = 0; frame < numFrames; frame++)
+    {
+        xml += "<Frame>\r\n<Layers>\r\n";
+        // Layers are stored front to back
+        for (auto layer = numLayers; layer-- > 0;)
+        {
+            if (layer == 0)
+            {
+                xml += GetLayerXml("Background", 1.0f, backgroundImage);
+            }
+            else
+            {
+                auto&& images = spriteImages[layer];
+                auto opacity = (layer % 2) == 0 ? 1.0f : 0.75f;
+                xml += GetLayerXml("Sprite " + std::to_string(layer), opacity, images[frame % images.size()]);
+            }
+        }
+        xml += "</Layers>\r\n</Frame>\r\n";
+    }
+    xml += "</Frames>\r\n</AnimatorProject>\r\n";
+    return std::vector<uint8_t>(xml.begin(), xml.end());
+}
+
+std::shared_ptr<LayerBitmap> DecodeSyntheticLayerImage(uint8_t const* data, size_t size)
+{
+    const size_t headerSize = sizeof(SyntheticLayerTag) + 8;
+    if (size < headerSize || !std::equal(std::begin(SyntheticLayerTag), std::end(SyntheticLayerTag), data))
+    {
+        throw std::runtime_error("Not a synthetic layer image.");
+    }
+
+    auto bitmap = std::make_shared<LayerBitmap>();
+    bitmap->Width = ReadUint32(data + 4);
+    bitmap->Height = ReadUint32(data + 8);
+    auto numPixels = static_cast<size_t>(bitmap->Width) * bitmap->Height;
+    bitmap->Pixels.resize(numPixels);
+
+    size_t position = 0;
+    for (auto run = data + headerSize; run + 8 <= data + size; run += 8)
+    {
+        auto count = ReadUint32(run);
+        auto color = ReadUint32(run + 4);
+        if (count > numPixels - position)
+        {
+            throw std::runtime_error("Synthetic layer image runs past the end of the image.");
+        }
+        std::fill_n(bitmap->Pixels.data() + position, count, color);
+        position += count;
+    }
+    if (position != numPixels)
+    {
+        throw std::runtime_error("Synthetic layer image is truncated.");
+    }
+    return bitmap;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "FrameRect.h"
+#include "RaniCompositor.h"
+
+enum class SyntheticScene
+{
+    // A static background with a sprite bouncing around on it
+    MovingSprite,
+    // Every pixel changes every frame, the worst case for every stage
+    Noise,
+    // A desktop-like screen capture where a block of text scrolls up
+    ScrollingText,
+    // The same desktop with small widgets in each corner that update every
+    // frame while the rest stays put
+    ScatteredWidgets,
+    // The moving sprite as a camera would capture it, with a little noise
+    // on every pixel of every frame
+    NoisySprite,
+};
+
+wchar_t const* SyntheticSceneToString(SyntheticScene scene);
+
+// Renders a deterministic animation of opaque 0xAARRGGBB frames. The
+// frames only depend on the scene, size and frame index, so they are the
+// same on every machine and standard library. Each frame comes with a
+// dirty rect that covers every pixel that changed since the previous one.
+class SyntheticAnimation
+{
+public:
+    SyntheticAnimation(SyntheticScene scene, uint32_t width, uint32_t height, uint32_t numFrames);
+
+    // Renders the next frame into Pixels. Returns false once every frame
+    // has been rendered.
+    bool TryGetNextFrame(FrameRect& dirtyRect);
+
+    std::vector<uint32_t> const& Pixels() const { return m_pixels; }
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+    uint32_t FrameCount() const { return m_numFrames; }
+
+private:
+    FrameRect RenderMovingSprite(uint32_t frameIndex);
+    FrameRect RenderNoise(uint32_t frameIndex);
+    FrameRect RenderScrollingText(uint32_t frameIndex);
+    FrameRect RenderScatteredWidgets(uint32_t frameIndex);
+    FrameRect RenderNoisySprite(uint32_t frameIndex);
+    void DrawSprite(FrameRect const& rect);
+    FrameRect GetSpriteRect(uint32_t frameIndex) const;
+    FrameRect GetTextRect() const;
+
+    SyntheticScene m_scene = SyntheticScene::MovingSprite;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_numFrames = 0;
+    uint32_t m_nextFrame = 0;
+    std::vector<uint32_t> m_pixels;
+    // The parts of the scene that don't move
+    std::vector<uint32_t> m_background;
+};
+
+// Writes a UTF-8 .rani project with the given number of frames and layers.
+// The bottom layer is a full frame background, the others hold a sprite
+// each; every third sprite moves from frame to frame and the rest stay
+// put. Sprite images only reach the sprite's far corner, unless
+// fullCanvasLayers is set, in which case every image covers the whole
+// canvas like the ones the editor saves. Layer images aren't PNG files but
+// run-length encoded bitmaps, so decode them with DecodeSyntheticLayerImage.
+std::vector<uint8_t> GenerateSyntheticRaniProject(uint32_t width, uint32_t height, uint32_t numFrames, uint32_t numLayers, bool fullCanvasLayers = false);
+
+// A PngDecodeFunc for projects from GenerateSyntheticRaniProject
+std::shared_ptr<LayerBitmap> DecodeSyntheticLayerImage(uint8_t const* data, size_t size);
@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t numThreads)
+{
+    if (numThreads == 0)
+    {
+        numThreads = 1;
+    }
+    m_threads.reserve(numThreads);
+    for (uint32_t i = 0; i < numThreads; i++)
+    {
+        m_threads.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_taskAvailable.notify_all();
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_tasks.push_back(std::move(task));
+    }
+    m_taskAvailable.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_taskAvailable.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty())
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "RingQueue.h"
+
+// A fixed size pool of worker threads that run tasks in submission order.
+// Tasks that are still queued when the pool is destroyed are run before
+// the workers exit.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t numThreads);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    void Submit(std::function<void()> task);
+    uint32_t NumThreads() const { return static_cast<uint32_t>(m_threads.size()); }
+
+private:
+    void WorkerLoop();
+
+    std::mutex m_lock;
+    std::condition_variable m_taskAvailable;
+    // Small tasks live inside their std::function, so a queue that has
+    // warmed up doesn't allocate
+    RingQueue<std::function<void()>> m_tasks;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+};
+
+inline uint32_t GetDefaultThreadCount()
+{
+    auto count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
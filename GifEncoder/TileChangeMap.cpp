@@ -0,0 +1,212 @@
+#include "pch.h"
+#include "TileChangeMap.h"
+
+namespace
+{
+    // Merging is quadratic in the number of rects. Frames with more runs
+    // than this are scattered enough that their bounding box is used.
+    const size_t MaxCandidateRects = 256;
+    // What an extra image costs on top of its pixels, in pixels. Besides
+    // the ~20 bytes of headers, every image restarts the LZW dictionary.
+    const uint64_t BlockCostPixels = 2048;
+    // Changed pixels usually compress to about a quarter of a byte, which
+    // is used to weigh header bytes against pixels.
+    const uint64_t PixelsPerByte = 4;
+
+    uint64_t Area(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom)
+    {
+        return static_cast<uint64_t>(right - left) * (bottom - top) * TileChangeMap::TileSize * TileChangeMap::TileSize;
+    }
+}
+
+TileChangeMap::TileChangeMap(uint32_t width, uint32_t height)
+{
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + TileSize - 1) / TileSize;
+    m_tilesY = (height + TileSize - 1) / TileSize;
+    m_tiles.resize(static_cast<size_t>(m_tilesX) * m_tilesY, 0);
+    m_rects.reserve(MaxCandidateRects + 1);
+}
+
+void TileChangeMap::Build(uint8_t const* indices, int transparentColorIndex, FrameRect const& rect)
+{
+    std::fill(m_tiles.begin(), m_tiles.end(), static_cast<uint8_t>(0));
+    auto right = std::min(rect.Right, m_width);
+    auto bottom = std::min(rect.Bottom, m_height);
+    m_bounds = { rect.Left, rect.Top, right, bottom };
+    if (m_bounds.IsEmpty())
+    {
+        return;
+    }
+    auto firstTileX = rect.Left / TileSize;
+    auto lastTileX = (right - 1) / TileSize;
+
+    if (transparentColorIndex < 0)
+    {
+        for (auto tileY = rect.Top / TileSize; tileY <= (bottom - 1) / TileSize; tileY++)
+        {
+            auto tiles = m_tiles.data() + (static_cast<size_t>(tileY) * m_tilesX);
+            std::fill(tiles + firstTileX, tiles + lastTileX + 1, static_cast<uint8_t>(1));
+        }
+        return;
+    }
+
+    auto transparent = static_cast<uint8_t>(transparentColorIndex);
+    for (auto y = rect.Top; y < bottom; y++)
+    {
+        auto row = indices + (static_cast<size_t>(y) * m_width);
+        auto tiles = m_tiles.data() + (static_cast<size_t>(y / TileSize) * m_tilesX);
+        for (auto tileX = firstTileX; tileX <= lastTileX; tileX++)
+        {
+            // One visible pixel is enough, so only unmarked tiles are read
+            if (tiles[tileX])
+            {
+                continue;
+            }
+            auto x = std::max(tileX * TileSize, rect.Left);
+            auto end = std::min((tileX + 1) * TileSize, right);
+            for (; x < end; x++)
+            {
+                if (row[x] != transparent)
+                {
+                    tiles[tileX] = 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void TileChangeMap::GetChangedRects(size_t maxRects, size_t extraBlockBytes, std::vector<FrameRect>& rects)
+{
+    rects.clear();
+    FindRuns();
+    if (m_rects.empty())
+    {
+        return;
+    }
+    MergeRects(std::max<size_t>(maxRects, 1), BlockCostPixels + (extraBlockBytes * PixelsPerByte));
+
+    std::sort(m_rects.begin(), m_rects.end(), [](TileRect const& first, TileRect const& second)
+    {
+        return first.Top != second.Top ? first.Top < second.Top : first.Left < second.Left;
+    });
+    for (auto&& rect : m_rects)
+    {
+        // Tiles on the edge of the rect are usually only partly covered
+        rects.push_back(FrameRect
+        {
+            std::max(rect.Left * TileSize, m_bounds.Left),
+            std::max(rect.Top * TileSize, m_bounds.Top),
+            std::min(rect.Right * TileSize, m_bounds.Right),
+            std::min(rect.Bottom * TileSize, m_bounds.Bottom),
+        });
+    }
+}
+
+void TileChangeMap::FindRuns()
+{
+    // Each run of changed tiles in a row either extends a rect from the
+    // row above that spans the same columns or starts a new one
+    m_rects.clear();
+    TileRect bounds = { m_tilesX, m_tilesY, 0, 0 };
+    auto tooManyRects = false;
+    for (uint32_t tileY = 0; tileY < m_tilesY; tileY++)
+    {
+        auto tiles = m_tiles.data() + (static_cast<size_t>(tileY) * m_tilesX);
+        uint32_t tileX = 0;
+        while (tileX < m_tilesX)
+        {
+            if (!tiles[tileX])
+            {
+                tileX++;
+                continue;
+            }
+            auto runStart = tileX;
+            while (tileX < m_tilesX && tiles[tileX])
+            {
+                tileX++;
+            }
+
+            bounds.Left = std::min(bounds.Left, runStart);
+            bounds.Top = std::min(bounds.Top, tileY);
+            bounds.Right = std::max(bounds.Right, tileX);
+            bounds.Bottom = tileY + 1;
+            if (tooManyRects)
+            {
+                continue;
+            }
+
+            auto extended = false;
+            for (auto&& rect : m_rects)
+            {
+                if (rect.Bottom == tileY && rect.Left == runStart && rect.Right == tileX)
+                {
+                    rect.Bottom = tileY + 1;
+                    extended = true;
+                    break;
+                }
+            }
+            if (!extended)
+            {
+                m_rects.push_back({ runStart, tileY, tileX, tileY + 1 });
+                tooManyRects = m_rects.size() > MaxCandidateRects;
+            }
+        }
+    }
+
+    if (tooManyRects)
+    {
+        m_rects.clear();
+        m_rects.push_back(bounds);
+    }
+}
+
+void TileChangeMap::MergeRects(size_t maxRects, uint64_t blockCost)
+{
+    // Greedily merge the pair whose union costs the least compared to
+    // keeping them apart, until no merge pays off and the count fits
+    while (m_rects.size() > 1)
+    {
+        size_t bestFirst = 0;
+        size_t bestSecond = 0;
+        auto bestSavings = std::numeric_limits<int64_t>::min();
+        for (size_t i = 0; i < m_rects.size(); i++)
+        {
+            auto&& first = m_rects[i];
+            auto firstCost = Area(first.Left, first.Top, first.Right, first.Bottom);
+            for (size_t j = i + 1; j < m_rects.size(); j++)
+            {
+                auto&& second = m_rects[j];
+                auto separateCost = firstCost + Area(second.Left, second.Top, second.Right, second.Bottom) + blockCost;
+                auto mergedCost = Area(
+                    std::min(first.Left, second.Left),
+                    std::min(first.Top, second.Top),
+                    std::max(first.Right, second.Right),
+                    std::max(first.Bottom, second.Bottom));
+                auto savings = static_cast<int64_t>(separateCost) - static_cast<int64_t>(mergedCost);
+                if (savings > bestSavings)
+                {
+                    bestSavings = savings;
+                    bestFirst = i;
+                    bestSecond = j;
+                }
+            }
+        }
+
+        if (bestSavings < 0 && m_rects.size() <= maxRects)
+        {
+            break;
+        }
+
+        auto&& first = m_rects[bestFirst];
+        auto&& second = m_rects[bestSecond];
+        first.Left = std::min(first.Left, second.Left);
+        first.Top = std::min(first.Top, second.Top);
+        first.Right = std::max(first.Right, second.Right);
+        first.Bottom = std::max(first.Bottom, second.Bottom);
+        m_rects[bestSecond] = m_rects.back();
+        m_rects.pop_back();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "FrameRect.h"
+
+// Records which 16x16 tiles of a diffed frame hold visible changes and
+// turns them into a few rects, so that changes in opposite corners of the
+// frame don't have to be written as one near full frame image.
+class TileChangeMap
+{
+public:
+    static const uint32_t TileSize = 16;
+
+    TileChangeMap(uint32_t width, uint32_t height);
+
+    // Marks every tile that has an index other than the transparent one
+    // inside rect. The indices cover the whole frame (width * height).
+    // With no transparent index, every tile the rect touches is marked.
+    void Build(uint8_t const* indices, int transparentColorIndex, FrameRect const& rect);
+
+    bool IsTileChanged(uint32_t tileX, uint32_t tileY) const { return m_tiles[static_cast<size_t>(tileY) * m_tilesX + tileX] != 0; }
+    uint32_t TilesX() const { return m_tilesX; }
+    uint32_t TilesY() const { return m_tilesY; }
+
+    // Covers the changed tiles with at most maxRects rects, clipped to the
+    // rect given to Build and sorted top to bottom. Neighbouring rects are
+    // merged when one larger image is expected to be cheaper than two,
+    // where every image costs a fixed header plus extraBlockBytes (e.g. a
+    // local color table). Rects can overlap. Leaves rects empty when
+    // nothing changed.
+    void GetChangedRects(size_t maxRects, size_t extraBlockBytes, std::vector<FrameRect>& rects);
+
+private:
+    // A rect in tile units
+    struct TileRect
+    {
+        uint32_t Left;
+        uint32_t Top;
+        uint32_t Right;
+        uint32_t Bottom;
+    };
+
+    void FindRuns();
+    void MergeRects(size_t maxRects, uint64_t blockCost);
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_tilesX = 0;
+    uint32_t m_tilesY = 0;
+    FrameRect m_bounds = {};
+    std::vector<uint8_t> m_tiles;
+    // Kept between frames so merging doesn't allocate
+    std::vector<TileRect> m_rects;
+};
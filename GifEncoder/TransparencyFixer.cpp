@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "TransparencyFixer.h"
 #include "FixTransparencyShader.h"
+#include "FrameCopyCounter.h"
 
 namespace util
 {
@@ -12,23 +13,23 @@ struct FrameInfo
 	uint32_t Width;
 	uint32_t Height;
 	int TransparentColorIndex;
+	uint32_t ToleranceMode;
+	uint32_t Threshold;
 };
 
-uint32_t ComputePaddedBufferSize(size_t size) 
+// Constant buffers must be a multiple of 16 bytes
+uint32_t ComputePaddedBufferSize(size_t size)
 {
-	auto paddedSize = size;
-	if (paddedSize < 16)
-	{
-		paddedSize = 16;
-	}
-	else
-	{
-		auto remainder = paddedSize % 16;
-		paddedSize = paddedSize + remainder;
-	}
+	auto paddedSize = std::max<size_t>((size + 15) & ~static_cast<size_t>(15), 16);
 	return static_cast<uint32_t>(paddedSize);
 }
 
+// Our shader uses 8x8 thread groups
+uint32_t ComputeDispatchGroupCount(uint32_t size)
+{
+	return (size + 7) / 8;
+}
+
 template <typename T>
 T ReadFromBuffer(
 	winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
@@ -54,9 +55,26 @@ TransparencyFixer::TransparencyFixer(
 	winrt::com_ptr<ID3D11Device> const& d3dDevice, 
 	winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
 	uint32_t width,
-	uint32_t height)
+	uint32_t height,
+	DiffTolerance const& tolerance)
 {
 	m_d3dContext = d3dContext;
+	m_tolerance = tolerance;
+	auto useTolerance = tolerance.Mode != DiffToleranceMode::Exact;
+	if (useTolerance)
+	{
+		if (tolerance.Threshold > 255)
+		{
+			throw winrt::hresult_invalid_argument(L"The diff threshold must be between 0 and 255.");
+		}
+		// Typed UAV stores to BGRA textures are optional on feature level 11
+		UINT formatSupport = 0;
+		winrt::check_hresult(d3dDevice->CheckFormatSupport(DXGI_FORMAT_B8G8R8A8_UNORM, &formatSupport));
+		if ((formatSupport & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW) == 0)
+		{
+			throw winrt::hresult_error(E_NOTIMPL, L"This GPU can't run the diff with a tolerance, use '-diff cpu'.");
+		}
+	}
 
 	// Create current and previous textures
 	{
@@ -70,10 +88,21 @@ TransparencyFixer::TransparencyFixer(
 		desc.Usage = D3D11_USAGE_DEFAULT;
 		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 		winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_currentTexture.put()));
+		if (useTolerance)
+		{
+			desc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+			winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_referenceTexture.put()));
+		}
 		winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, m_previousTexture.put()));
 	}
 	winrt::check_hresult(d3dDevice->CreateShaderResourceView(m_currentTexture.get(), nullptr, m_currentSrv.put()));
 	winrt::check_hresult(d3dDevice->CreateShaderResourceView(m_previousTexture.get(), nullptr, m_previousSrv.put()));
+	if (useTolerance)
+	{
+		winrt::check_hresult(d3dDevice->CreateUnorderedAccessView(m_previousTexture.get(), nullptr, m_previousUav.put()));
+		winrt::check_hresult(d3dDevice->CreateShaderResourceView(m_referenceTexture.get(), nullptr, m_referenceSrv.put()));
+		winrt::check_hresult(d3dDevice->CreateUnorderedAccessView(m_referenceTexture.get(), nullptr, m_referenceUav.put()));
+	}
 
 	// Create output and staging textures
 	{
@@ -116,14 +145,13 @@ TransparencyFixer::TransparencyFixer(
 
 	// Create diff info buffers
 	{
-		auto paddedSize = ComputePaddedBufferSize(sizeof(DiffInfo));
-		paddedSize = sizeof(DiffInfo);
+		// Structured buffers don't need the padding constant buffers do
 		D3D11_BUFFER_DESC desc = {};
-		desc.ByteWidth = paddedSize;
+		desc.ByteWidth = sizeof(DiffInfo);
 		desc.Usage = D3D11_USAGE_DEFAULT;
 		desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
 		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-		desc.StructureByteStride = paddedSize;
+		desc.StructureByteStride = sizeof(DiffInfo);
 		winrt::check_hresult(d3dDevice->CreateBuffer(&desc, nullptr, m_diffInfoBuffer.put()));
 
 		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDiff = {};
@@ -135,12 +163,7 @@ TransparencyFixer::TransparencyFixer(
 		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 		desc.MiscFlags = 0;
 		desc.StructureByteStride = 0;
-		DiffInfo initialInfo = {};
-		initialInfo.NumDifferingPixels = 0;
-		initialInfo.left = width;
-		initialInfo.top = height;
-		initialInfo.right = 0;
-		initialInfo.bottom = 0;
+		auto initialInfo = CreateInitialDiffInfo(width, height);
 		D3D11_SUBRESOURCE_DATA initData = {};
 		initData.pSysMem = reinterpret_cast<void*>(&initialInfo);
 		winrt::check_hresult(d3dDevice->CreateBuffer(&desc, &initData, m_diffInfoDefaultBuffer.put()));
@@ -174,6 +197,8 @@ DiffInfo TransparencyFixer::ProcessInput(winrt::com_ptr<ID3D11Texture2D> const&
 		info.TransparentColorIndex = transparentColorIndex;
 		info.Width = desc.Width;
 		info.Height = desc.Height;
+		info.ToleranceMode = static_cast<uint32_t>(m_tolerance.Mode);
+		info.Threshold = m_tolerance.Threshold;
 		memcpy_s(mapped.pData, sizeof(FrameInfo), reinterpret_cast<void*>(&info), sizeof(FrameInfo));
 		m_d3dContext->Unmap(m_frameInfoStagingBuffer.get(), 0);
 	}
@@ -187,33 +212,26 @@ DiffInfo TransparencyFixer::ProcessInput(winrt::com_ptr<ID3D11Texture2D> const&
 		D3D11_MAPPED_SUBRESOURCE mapped = {};
 		winrt::check_hresult(m_d3dContext->Map(m_stagingTexture.get(), 0, D3D11_MAP_WRITE, 0, &mapped));
 		auto stride = desc.Width;
-		auto dest = reinterpret_cast<byte*>(mapped.pData);
-		auto source = indexPixels.data();
-		for (auto i = 0; i < (int)desc.Height; i++)
-		{
-			memcpy(dest, source, stride);
-
-			dest += mapped.RowPitch;
-			source += stride;
-		}
+		CopyRowsInBands(m_pool, reinterpret_cast<byte*>(mapped.pData), mapped.RowPitch, indexPixels.data(), stride, stride, desc.Height);
 		m_d3dContext->Unmap(m_stagingTexture.get(), 0);
 	}
 	m_d3dContext->CopyResource(m_outputTexture.get(), m_stagingTexture.get());
+	AddFrameBytesCopied(indexPixels.size());
 
 	// Update our current texture
 	m_d3dContext->CopyResource(m_currentTexture.get(), texture.get());
 
 	// Setup our pipeline
 	m_d3dContext->CSSetShader(m_shader.get(), nullptr, 0);
-	std::vector<ID3D11ShaderResourceView*> srvs = { m_currentSrv.get(), m_previousSrv.get()};
-	m_d3dContext->CSSetShaderResources(0, static_cast<uint32_t>(srvs.size()), srvs.data());
-	std::vector<ID3D11Buffer*> constants = { m_frameInfoBuffer.get() };
-	m_d3dContext->CSSetConstantBuffers(0, static_cast<uint32_t>(constants.size()), constants.data());
-	std::vector<ID3D11UnorderedAccessView*> uavs = { m_outputUav.get(), m_diffInfoUav.get()};
-	m_d3dContext->CSSetUnorderedAccessViews(0, static_cast<uint32_t>(uavs.size()), uavs.data(), nullptr);
+	ID3D11ShaderResourceView* srvs[] = { m_currentSrv.get(), m_previousSrv.get() };
+	m_d3dContext->CSSetShaderResources(0, ARRAYSIZE(srvs), srvs);
+	ID3D11Buffer* constants[] = { m_frameInfoBuffer.get() };
+	m_d3dContext->CSSetConstantBuffers(0, ARRAYSIZE(constants), constants);
+	ID3D11UnorderedAccessView* uavs[] = { m_outputUav.get(), m_diffInfoUav.get(), m_referenceUav.get() };
+	m_d3dContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
 
 	// Run the compute shader
-	m_d3dContext->Dispatch((desc.Width / 8) + 1, (desc.Height / 8) + 1, 1);
+	m_d3dContext->Dispatch(ComputeDispatchGroupCount(desc.Width), ComputeDispatchGroupCount(desc.Height), 1);
 
 	// Copy our output to the staging texture and then to the provided buffer
 	m_d3dContext->CopyResource(m_stagingTexture.get(), m_outputTexture.get());
@@ -222,33 +240,36 @@ DiffInfo TransparencyFixer::ProcessInput(winrt::com_ptr<ID3D11Texture2D> const&
 		winrt::check_hresult(m_d3dContext->Map(m_stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
 
 		auto stride = desc.Width;
-		auto source = reinterpret_cast<byte*>(mapped.pData);
-		auto dest = indexPixels.data();
-		for (auto i = 0; i < (int)desc.Height; i++)
-		{
-			memcpy(dest, source, stride);
-
-			source += mapped.RowPitch;
-			dest += stride;
-		}
+		CopyRowsInBands(m_pool, indexPixels.data(), stride, reinterpret_cast<byte const*>(mapped.pData), mapped.RowPitch, stride, desc.Height);
 		m_d3dContext->Unmap(m_stagingTexture.get(), 0);
 	}
+	AddFrameBytesCopied(indexPixels.size());
 
 	// Copy the diff info
 	m_d3dContext->CopyResource(m_diffInfoStagingBuffer.get(), m_diffInfoBuffer.get());
 	auto diffInfo = ReadFromBuffer<DiffInfo>(m_d3dContext, m_diffInfoStagingBuffer);
 
-	// Copy current to previous
-	m_d3dContext->CopyResource(m_previousTexture.get(), m_currentTexture.get());
+	// The current frame becomes the previous one. With a tolerance, the
+	// shader already wrote the colors a viewer will show.
+	if (m_referenceTexture)
+	{
+		std::swap(m_previousTexture, m_referenceTexture);
+		std::swap(m_previousSrv, m_referenceSrv);
+		std::swap(m_previousUav, m_referenceUav);
+	}
+	else
+	{
+		m_d3dContext->CopyResource(m_previousTexture.get(), m_currentTexture.get());
+	}
 
 	// Unbind pipeline
 	m_d3dContext->CSSetShader(nullptr, nullptr, 0);
-	srvs = { nullptr, nullptr };
-	m_d3dContext->CSSetShaderResources(0, static_cast<uint32_t>(srvs.size()), srvs.data());
-	constants = { nullptr };
-	m_d3dContext->CSSetConstantBuffers(0, static_cast<uint32_t>(constants.size()), constants.data());
-	uavs = { nullptr, nullptr };
-	m_d3dContext->CSSetUnorderedAccessViews(0, static_cast<uint32_t>(uavs.size()), uavs.data(), nullptr);
+	ID3D11ShaderResourceView* nullSrvs[ARRAYSIZE(srvs)] = {};
+	m_d3dContext->CSSetShaderResources(0, ARRAYSIZE(nullSrvs), nullSrvs);
+	ID3D11Buffer* nullConstants[ARRAYSIZE(constants)] = {};
+	m_d3dContext->CSSetConstantBuffers(0, ARRAYSIZE(nullConstants), nullConstants);
+	ID3D11UnorderedAccessView* nullUavs[ARRAYSIZE(uavs)] = {};
+	m_d3dContext->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
 
 	return diffInfo;
 }
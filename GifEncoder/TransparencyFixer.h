@@ -1,13 +1,7 @@
 #pragma once
-
-struct DiffInfo
-{
-	uint32_t NumDifferingPixels;
-	uint32_t left;
-	uint32_t top;
-	uint32_t right;
-	uint32_t bottom;
-};
+#include "DiffInfo.h"
+#include "DiffKernels.h"
+#include "RowBandPool.h"
 
 class TransparencyFixer
 {
@@ -16,13 +10,20 @@ public:
 		winrt::com_ptr<ID3D11Device> const& d3dDevice,
 		winrt::com_ptr<ID3D11DeviceContext> const& d3dContext,
 		uint32_t width,
-		uint32_t height);
+		uint32_t height,
+		DiffTolerance const& tolerance = {});
+
+	// With a pool, the index rows are copied to and from the mapped
+	// staging texture in bands. The pool must outlive the fixer.
+	void SetRowBandPool(RowBandPool* pool) { m_pool = pool; }
 
 	void InitPrevious(winrt::com_ptr<ID3D11Texture2D> const& previousTexture);
 	DiffInfo ProcessInput(winrt::com_ptr<ID3D11Texture2D> const& inputTexture, int transparentColorIndex, std::vector<uint8_t>& indexPixels);
 
 private:
 	winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+	RowBandPool* m_pool = nullptr;
+	DiffTolerance m_tolerance = {};
 	winrt::com_ptr<ID3D11Texture2D> m_currentTexture;
 	winrt::com_ptr<ID3D11ShaderResourceView> m_currentSrv;
 	winrt::com_ptr<ID3D11Texture2D> m_outputTexture;
@@ -33,6 +34,12 @@ private:
 	winrt::com_ptr<ID3D11Texture2D> m_stagingTexture;
 	winrt::com_ptr<ID3D11Texture2D> m_previousTexture;
 	winrt::com_ptr<ID3D11ShaderResourceView> m_previousSrv;
+	// With a tolerance the shader writes the next previous frame here, and
+	// the two textures swap places after every frame
+	winrt::com_ptr<ID3D11UnorderedAccessView> m_previousUav;
+	winrt::com_ptr<ID3D11Texture2D> m_referenceTexture;
+	winrt::com_ptr<ID3D11ShaderResourceView> m_referenceSrv;
+	winrt::com_ptr<ID3D11UnorderedAccessView> m_referenceUav;
 	winrt::com_ptr<ID3D11Buffer> m_diffInfoBuffer;
 	winrt::com_ptr<ID3D11Buffer> m_diffInfoStagingBuffer;
 	winrt::com_ptr<ID3D11Buffer> m_diffInfoDefaultBuffer;
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "XxHash.h"
+
+namespace
+{
+    const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+    const uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64_t RotateLeft(uint64_t value, uint32_t count)
+    {
+        return (value << count) | (value >> (64 - count));
+    }
+
+    // Reads little endian values, which is what every platform we build
+    // for uses.
+    inline uint64_t Read64(uint8_t const* data)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    inline uint32_t Read32(uint8_t const* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t Round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * Prime2;
+        accumulator = RotateLeft(accumulator, 31);
+        return accumulator * Prime1;
+    }
+
+    inline uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+    {
+        accumulator ^= Round(0, value);
+        return accumulator * Prime1 + Prime4;
+    }
+}
+
+uint64_t XxHash64(void const* data, size_t length, uint64_t seed)
+{
+    auto input = static_cast<uint8_t const*>(data);
+    auto end = input + length;
+    uint64_t hash = 0;
+
+    if (length >= 32)
+    {
+        auto limit = end - 32;
+        auto v1 = seed + Prime1 + Prime2;
+        auto v2 = seed + Prime2;
+        auto v3 = seed;
+        auto v4 = seed - Prime1;
+        do
+        {
+            v1 = Round(v1, Read64(input));
+            v2 = Round(v2, Read64(input + 8));
+            v3 = Round(v3, Read64(input + 16));
+            v4 = Round(v4, Read64(input + 24));
+            input += 32;
+        } while (input <= limit);
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+    {
+        hash = seed + Prime5;
+    }
+
+    hash += static_cast<uint64_t>(length);
+
+    while (input + 8 <= end)
+    {
+        hash ^= Round(0, Read64(input));
+        hash = RotateLeft(hash, 27) * Prime1 + Prime4;
+        input += 8;
+    }
+    if (input + 4 <= end)
+    {
+        hash ^= static_cast<uint64_t>(Read32(input)) * Prime1;
+        hash = RotateLeft(hash, 23) * Prime2 + Prime3;
+        input += 4;
+    }
+    while (input < end)
+    {
+        hash ^= (*input) * Prime5;
+        hash = RotateLeft(hash, 11) * Prime1;
+        input++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
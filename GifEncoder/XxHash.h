@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), used to recognize identical
+// content without comparing it byte by byte.
+uint64_t XxHash64(void const* data, size_t length, uint64_t seed = 0);
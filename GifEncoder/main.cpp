@@ -1,7 +1,19 @@
 ﻿#include "pch.h"
 #include "TransparencyFixer.h"
+#include "PaletteQuantizer.h"
 #include "IComposedFrameProvider.h"
 #include "DebugFileWriters.h"
+#include "GifWriter.h"
+#include "ParallelGifWriter.h"
+#include "Benchmarks.h"
+#include "SelfChecks.h"
+#include "FrameCopyCounter.h"
+#include "MemoryBitmapSource.h"
+#include "AllocationCounter.h"
+#include "EncodeStats.h"
+#include "RowBandPool.h"
+#include "Dither.h"
+#include "FrameEncoder.h"
 
 namespace winrt
 {
@@ -21,11 +33,46 @@ namespace util
     using namespace robmikh::common::desktop;
 }
 
+enum class DiffBackend
+{
+    Gpu,
+    Cpu,
+};
+
+// How many frames the global palette is built from
+const size_t MaxPaletteSampleFrames = 64;
+// Allocations are only reported once this many frames have been read, by
+// which point the buffer pools and caches have warmed up.
+const uint32_t AllocationWarmupFrames = 8;
+// Used by '-tolerance' when no '-threshold' is given. Enough to hide the
+// noise of most webcams and video codecs.
+const uint32_t DefaultDiffThreshold = 4;
+
 struct Options
 {
     bool UseDebugLayer;
+    DiffBackend Diff;
+    DiffTolerance Tolerance;
+    ComposeBackend Compose;
+    // When empty, palettes are generated by WIC
+    std::optional<QuantizerAlgorithm> Quantizer;
+    PaletteMode Palette;
+    uint32_t NumThreads;
+    // Threads that share the palette, convert and diff work of each frame
+    uint32_t NumBandThreads;
+    LzwClearMode ClearMode;
+    DitherMode Dither;
+    // Changed areas of a frame are written as up to this many images
+    uint32_t MaxImagesPerFrame;
+    bool RunBenchmarks;
+    bool RunSelfChecks;
+    // Picks a single benchmark or self check
+    std::wstring BenchmarkFilter;
+    uint32_t SelfCheckSeed;
     std::wstring InputPath;
     std::wstring OutputPath;
+    // When set, stage timings and frame counters are written here
+    std::wstring StatsPath;
 };
 
 enum class CliResult
@@ -38,24 +85,34 @@ enum class CliResult
 CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options);
 void PrintHelp();
 
-winrt::IAsyncAction MainAsync(bool useDebugLayer, std::wstring inputPath, std::wstring outputPath)
+winrt::IAsyncAction MainAsync(Options options)
 {
     // Read input file
-    auto inputFile = co_await util::GetStorageFileFromPathAsync(inputPath);
-    auto inputFrameProvider = co_await LoadComposedFrameProviderFromFileAsync(inputFile);
+    auto loadStart = std::chrono::steady_clock::now();
+    auto inputFile = co_await util::GetStorageFileFromPathAsync(options.InputPath);
+    ComposeOptions composeOptions = {};
+    composeOptions.Backend = options.Compose;
+    composeOptions.NumThreads = options.NumThreads;
+    // Only the shader diff needs frames on the GPU
+    composeOptions.FrameTextures = options.Diff == DiffBackend::Gpu;
+    auto inputFrameProvider = co_await LoadComposedFrameProviderFromFileAsync(inputFile, composeOptions);
     uint32_t width = inputFrameProvider->Width();
     uint32_t height = inputFrameProvider->Height();
 
-    // Create output file
-    auto outputFile = co_await util::CreateStorageFileFromPathAsync(outputPath);
+    // Collected for every encode, but only written out when asked for
+    EncodeStats stats(width, height, inputFrameProvider->FrameCount());
+    stats.AddTime(EncodeStage::Load, NanosecondsSince(loadStart));
 
-    // Open the file for write
-    auto stream = co_await outputFile.OpenAsync(winrt::FileAccessMode::ReadWrite);
-    auto abiStream = util::CreateStreamFromRandomAccessStream(stream);
+    // Create output file
+    std::ofstream outputStream(std::filesystem::path(options.OutputPath), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!outputStream)
+    {
+        throw winrt::hresult_error(E_FAIL, L"Failed to open the output file.");
+    }
 
     // Initialize DirectX
     uint32_t d3dCreateFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-    if (useDebugLayer)
+    if (options.UseDebugLayer)
     {
         d3dCreateFlags |= D3D11_CREATE_DEVICE_DEBUG;
     }
@@ -63,7 +120,7 @@ winrt::IAsyncAction MainAsync(bool useDebugLayer, std::wstring inputPath, std::w
     winrt::com_ptr<ID3D11DeviceContext> d3dContext;
     d3dDevice->GetImmediateContext(d3dContext.put());
     auto debugLevel = D2D1_DEBUG_LEVEL_NONE;
-    if (useDebugLayer)
+    if (options.UseDebugLayer)
     {
         debugLevel = D2D1_DEBUG_LEVEL_INFORMATION;
     }
@@ -72,254 +129,199 @@ winrt::IAsyncAction MainAsync(bool useDebugLayer, std::wstring inputPath, std::w
     winrt::com_ptr<ID2D1DeviceContext> d2dContext;
     winrt::check_hresult(d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2dContext.put()));
 
-    // Create a texture for each composed layer
-    auto frames = inputFrameProvider->GetFrames(d3dDevice, d2dContext);
-
-    // Create WIC Encoder
+    // Create WIC factory
     auto wicFactory = winrt::create_instance<IWICImagingFactory2>(CLSID_WICImagingFactory2, CLSCTX_INPROC_SERVER);
-    winrt::com_ptr<IWICBitmapEncoder> wicEncoder;
-    winrt::check_hresult(wicFactory->CreateEncoder(GUID_ContainerFormatGif, nullptr, wicEncoder.put()));
-    winrt::check_hresult(wicEncoder->Initialize(abiStream.get(), WICBitmapEncoderNoCache));
-    winrt::com_ptr<IWICImageEncoder> wicImageEncoder;
-    winrt::check_hresult(wicFactory->CreateImageEncoder(d2dDevice.get(), wicImageEncoder.put()));
 
-    // Write the application block
-    // http://www.vurdalakov.net/misc/gif/netscape-looping-application-extension
+    // The header and application block are written along with the first frame
+    auto gifWriter = GifWriter(outputStream, static_cast<uint16_t>(width), static_cast<uint16_t>(height));
+    gifWriter.SetClearMode(options.ClearMode);
+    // Frames are compressed on a worker pool and written in order
+    ParallelGifWriter frameWriter(gifWriter, options.NumThreads);
+    frameWriter.SetFrameWrittenCallback([&stats](WrittenFrameInfo const& info)
     {
-        winrt::com_ptr<IWICMetadataQueryWriter> metadata;
-        winrt::check_hresult(wicEncoder->GetMetadataQueryWriter(metadata.put()));
-        {
-            PROPVARIANT value = {};
-            value.vt = VT_UI1 | VT_VECTOR;
-            value.caub.cElems = 11;
-            std::string text("NETSCAPE2.0");
-            std::vector<uint8_t> chars(text.begin(), text.end());
-            WINRT_VERIFY(chars.size() == 11);
-            value.caub.pElems = chars.data();
-            winrt::check_hresult(metadata->SetMetadataByName(L"/appext/application", &value));
-        }
-        {
-            PROPVARIANT value = {};
-            value.vt = VT_UI1 | VT_VECTOR;
-            value.caub.cElems = 5;
-            // The first value is the size of the block, which is the fixed value 3.
-            // The second value is the looping extension, which is the fixed value 1.
-            // The third and fourth values comprise an unsigned 2-byte integer (little endian).
-            //     The value of 0 means to loop infinitely.
-            // The final value is the block terminator, which is the fixed value 0.
-            std::vector<uint8_t> data({ 3, 1, 0, 0, 0 });
-            value.caub.pElems = data.data();
-            winrt::check_hresult(metadata->SetMetadataByName(L"/appext/data", &value));
-        }
+        stats.FrameWritten(info.FrameNumber, info.CompressedBytes, info.CompressNanoseconds, info.WriteNanoseconds);
+    });
+
+    // Palettes either come from WIC or from our own quantizer. Sharing
+    // palettes between frames or dithering always needs our own quantizer.
+    auto useQuantizer = options.Quantizer.has_value() || options.Palette != PaletteMode::PerFrame || options.Dither != DitherMode::None;
+    FrameEncoderOptions encoderOptions = {};
+    encoderOptions.Palette = options.Palette;
+    if (options.Quantizer.has_value())
+    {
+        encoderOptions.Quantizer.Algorithm = options.Quantizer.value();
     }
-
-    auto transparencyFixer = TransparencyFixer(d3dDevice, d3dContext, width, height);
-    std::vector<uint8_t> indexPixelBytes(width * height, 0);
-    std::vector<uint8_t> tempBuffer;
-
-    // Encode each frame
-    auto frameIndex = 0;
-    winrt::TimeSpan unusedDelay = {};
-    for (auto&& frame : frames)
-    {
-        // Create our converter
-        winrt::com_ptr<IWICFormatConverter> wicConverter;
-        winrt::check_hresult(wicFactory->CreateFormatConverter(wicConverter.put()));
-
-        auto frameTexture = frame.Texture;
-
-        // Create a WIC bitmap from our texture
-        D3D11_TEXTURE2D_DESC desc = {};
-        frameTexture->GetDesc(&desc);
-        auto bytes = util::CopyBytesFromTexture(frameTexture);
-        auto bytesPerPixel = 4;
-        winrt::com_ptr<IWICBitmap> wicBitmap;
-        winrt::check_hresult(wicFactory->CreateBitmapFromMemory(
-            desc.Width,
-            desc.Height,
-            GUID_WICPixelFormat32bppBGRA,
-            bytesPerPixel * desc.Width,
-            static_cast<uint32_t>(bytes.size()),
-            bytes.data(),
-            wicBitmap.put()));
-
-        // Create a pallette for our bitmap
-        winrt::com_ptr<IWICPalette> wicPalette;
-        winrt::check_hresult(wicFactory->CreatePalette(wicPalette.put()));
-        winrt::check_hresult(wicPalette->InitializeFromBitmap(wicBitmap.get(), 256, true));
-
-        // We need to find which color is our transparent one
-        uint32_t numColors = 0;
-        winrt::check_hresult(wicPalette->GetColorCount(&numColors));
-        std::vector<WICColor> colors(numColors, 0);
-        winrt::check_hresult(wicPalette->GetColors(numColors, colors.data(), &numColors));
-        auto transparentColorIndex = -1;
-        for (auto i = 0; i < colors.size(); i++)
-        {
-            if (colors[i] == 0)
+    encoderOptions.Dither = options.Dither;
+    encoderOptions.Tolerance = options.Tolerance;
+    encoderOptions.MaxImagesPerFrame = options.MaxImagesPerFrame;
+    encoderOptions.NumBandThreads = options.NumBandThreads;
+    // Large frames are split into row bands, so the stages that run on
+    // the frame loop's thread don't wait on a single core
+    FrameEncoder frameEncoder(gifWriter, frameWriter, stats, width, height, encoderOptions);
+    auto& bandPool = frameEncoder.BandPool();
+
+    // The diff can either run as a compute shader or on the CPU, which
+    // is the frame encoder's own. The shader asks the reader for the frame
+    // texture, so frames the encoder drops as duplicates are never uploaded.
+    std::unique_ptr<IComposedFrameReader> frameReader;
+    std::unique_ptr<TransparencyFixer> gpuTransparencyFixer;
+    if (options.Diff == DiffBackend::Gpu)
+    {
+        gpuTransparencyFixer = std::make_unique<TransparencyFixer>(d3dDevice, d3dContext, width, height, options.Tolerance);
+        gpuTransparencyFixer->SetRowBandPool(&bandPool);
+        frameEncoder.SetDiffFunctions(
+            [&]() { gpuTransparencyFixer->InitPrevious(frameReader->GetFrameTexture()); },
+            [&](int transparentColorIndex, std::vector<uint8_t>& indices, FrameRect const&)
             {
-                transparentColorIndex = i;
-                break;
-            }
-        }
+                return gpuTransparencyFixer->ProcessInput(frameReader->GetFrameTexture(), transparentColorIndex, indices);
+            });
+    }
 
-        // Convert our frame using the palette
-        winrt::check_hresult(wicConverter->Initialize(
-            wicBitmap.get(),
-            GUID_WICPixelFormat8bppIndexed,
-            WICBitmapDitherTypeNone, // ???
-            wicPalette.get(),
-            0.0,
-            WICBitmapPaletteTypeFixedWebPalette));
-        winrt::check_hresult(wicConverter->CopyPixels(nullptr, desc.Width, static_cast<uint32_t>(indexPixelBytes.size()), indexPixelBytes.data()));
-
-        std::optional<DiffInfo> diffInfoOpt = std::nullopt;
-        if (transparentColorIndex >= 0 && frameIndex > 0)
+    if (options.Palette == PaletteMode::Global && inputFrameProvider->FrameCount() > 0)
+    {
+        // Build the global palette from evenly spaced frames. This takes an
+        // extra pass over the input.
+        ScopedStageTimer timer(stats, EncodeStage::Palette);
+        auto sampleStep = std::max(inputFrameProvider->FrameCount() / static_cast<uint32_t>(MaxPaletteSampleFrames), 1u);
+        auto sampleReader = inputFrameProvider->CreateFrameReader(d3dDevice, d2dContext);
+        ColorHistogram histogram;
+        ComposedFrame frame = {};
+        for (uint32_t i = 0; sampleReader->TryGetNextFrame(frame); i++)
         {
-            auto info = transparencyFixer.ProcessInput(frameTexture, transparentColorIndex, indexPixelBytes);
-            if (info.NumDifferingPixels > 0)
-            {
-                diffInfoOpt = std::optional(std::move(info));
-            }
-            else
+            if (i % sampleStep == 0)
             {
-                unusedDelay = unusedDelay + frame.Delay;
-                continue;
+                histogram.AddPixels(frame.Pixels, static_cast<size_t>(width) * height);
             }
         }
-        else
-        {
-            transparencyFixer.InitPrevious(frameTexture);
-        }
-
-        // TEMP DEBUG
-        //{
-        //    auto debugFileName = ImageViewerFileNameFromSize("debug_indexed", desc.Width, desc.Height);
-        //    WriteIndexedPixelBytesToFileAsBgra8(debugFileName, indexPixelBytes);
-        //}
+        frameEncoder.SetGlobalPalette(BuildPalette(histogram, encoderOptions.Quantizer));
+    }
 
-        // Create a new bitmap with the fixed bytes
-        winrt::com_ptr<IWICBitmap> wicBitmapFixed;
-        if (diffInfoOpt.has_value())
+    std::vector<winrt::com_ptr<IWICFormatConverter>> wicConverters;
+    if (!useQuantizer)
+    {
+        frameEncoder.SetPaletteFunction([&](uint32_t const* pixels, std::vector<WICColor>& colors, uint8_t* indices)
         {
-            auto diffInfo = diffInfoOpt.value();
-
-            uint32_t minValue = 1;
-            uint32_t newWidth = std::max(diffInfo.right - diffInfo.left, minValue);
-            uint32_t newHeight = std::max(diffInfo.bottom - diffInfo.top, minValue);
-            tempBuffer.resize(newWidth * newHeight);
-
-            for (uint32_t i = 0; i < newHeight; i++)
+            ScopedStageTimer paletteTimer(stats, EncodeStage::Palette);
+
+            // Let WIC read the frame where it is
+            auto bytesPerPixel = 4;
+            auto wicBitmap = winrt::make_self<MemoryBitmapSource>(
+                reinterpret_cast<uint8_t const*>(pixels),
+                width,
+                height,
+                bytesPerPixel * width);
+
+            // Create a pallette for our bitmap
+            winrt::com_ptr<IWICPalette> wicPalette;
+            winrt::check_hresult(wicFactory->CreatePalette(wicPalette.put()));
+            winrt::check_hresult(wicPalette->InitializeFromBitmap(wicBitmap.get(), 256, true));
+            uint32_t numColors = 0;
+            winrt::check_hresult(wicPalette->GetColorCount(&numColors));
+            colors.resize(numColors, 0);
+            winrt::check_hresult(wicPalette->GetColors(numColors, colors.data(), &numColors));
+            paletteTimer.Stop();
+
+            // Convert our frame using the palette. Without dithering every
+            // pixel is converted on its own, so bands of rows can be
+            // converted at the same time. A converter isn't meant to be
+            // shared between threads, so every thread creates its own.
+            ScopedStageTimer convertTimer(stats, EncodeStage::Convert);
+            wicConverters.assign(bandPool.NumThreads(), nullptr);
+            bandPool.ForEachBand(0, height, [&](uint32_t top, uint32_t bottom, uint32_t, uint32_t thread)
             {
-                auto source = indexPixelBytes.data() + (((diffInfo.top + i) * width) + diffInfo.left);
-                auto dest = tempBuffer.data() + (i * newWidth);
+                auto& wicConverter = wicConverters[thread];
+                if (!wicConverter)
+                {
+                    winrt::check_hresult(wicFactory->CreateFormatConverter(wicConverter.put()));
+                    winrt::check_hresult(wicConverter->Initialize(
+                        wicBitmap.get(),
+                        GUID_WICPixelFormat8bppIndexed,
+                        // '-dither' maps with our own quantizer instead, which
+                        // keeps bands independent and the output stable
+                        WICBitmapDitherTypeNone,
+                        wicPalette.get(),
+                        0.0,
+                        WICBitmapPaletteTypeFixedWebPalette));
+                }
+                WICRect rect = { 0, static_cast<INT>(top), static_cast<INT>(width), static_cast<INT>(bottom - top) };
+                auto bandPixels = indices + (static_cast<size_t>(top) * width);
+                winrt::check_hresult(wicConverter->CopyPixels(&rect, width, (bottom - top) * width, bandPixels));
+            });
+        });
+    }
 
-                memcpy_s(dest, newWidth, source, newWidth);
-            }
+    // Frames are composed as we ask for them
+    frameReader = inputFrameProvider->CreateFrameReader(d3dDevice, d2dContext);
 
-            winrt::check_hresult(wicFactory->CreateBitmapFromMemory(
-                newWidth,
-                newHeight,
-                GUID_WICPixelFormat8bppIndexed,
-                newWidth,
-                static_cast<uint32_t>(tempBuffer.size()),
-                tempBuffer.data(),
-                wicBitmapFixed.put()));
-        }
-        else
+    // Encode each frame
+    uint32_t numFramesRead = 0;
+    uint64_t warmupAllocationCount = 0;
+    ComposedFrame frame = {};
+    while (true)
+    {
+        auto composeStart = std::chrono::steady_clock::now();
+        if (!frameReader->TryGetNextFrame(frame))
         {
-            winrt::check_hresult(wicFactory->CreateBitmapFromMemory(
-                desc.Width,
-                desc.Height,
-                GUID_WICPixelFormat8bppIndexed,
-                desc.Width,
-                static_cast<uint32_t>(indexPixelBytes.size()),
-                indexPixelBytes.data(),
-                wicBitmapFixed.put()));
+            break;
         }
-        winrt::check_hresult(wicBitmapFixed->SetPalette(wicPalette.get()));
-
-        // Setup our WIC frame
-        winrt::com_ptr<IWICBitmapFrameEncode> wicFrame;
-        winrt::check_hresult(wicEncoder->CreateNewFrame(wicFrame.put(), nullptr));
-        winrt::check_hresult(wicFrame->Initialize(nullptr));
-
-        // Compute the frame delay
-        auto delay = frame.Delay + unusedDelay;
-        unusedDelay = {};
-        auto millisconds = std::chrono::duration_cast<std::chrono::milliseconds>(delay);
-        // Use 10ms units
-        auto frameDelay = millisconds.count() / 10;
-
-        // Write frame metadata
-        winrt::com_ptr<IWICMetadataQueryWriter> metadata;
-        winrt::check_hresult(wicFrame->GetMetadataQueryWriter(metadata.put()));
-        // Delay
+        auto& frameStats = stats.BeginFrame();
+        stats.AddTime(EncodeStage::Compose, NanosecondsSince(composeStart));
+
+        if (++numFramesRead == AllocationWarmupFrames)
         {
-            PROPVARIANT delayValue = {};
-            delayValue.vt = VT_UI2;
-            delayValue.uiVal = static_cast<unsigned short>(frameDelay);
-            winrt::check_hresult(metadata->SetMetadataByName(L"/grctlext/Delay", &delayValue));
+            warmupAllocationCount = GetAllocationCount();
         }
-        // Transparency
-        if (transparentColorIndex >= 0 && frameIndex > 0)
-        {
-            {
-                PROPVARIANT transparencyValue = {};
-                transparencyValue.vt = VT_BOOL;
-                transparencyValue.boolVal = TRUE;
-                winrt::check_hresult(metadata->SetMetadataByName(L"/grctlext/TransparencyFlag", &transparencyValue));
-            }
 
-            {
-                PROPVARIANT transparencyIndex = {};
-                transparencyIndex.vt = VT_UI1;
-                transparencyIndex.bVal = static_cast<uint8_t>(transparentColorIndex);
-                winrt::check_hresult(metadata->SetMetadataByName(L"/grctlext/TransparentColorIndex", &transparencyIndex));
-            }
-        }
+        InputFrame inputFrame = {};
+        inputFrame.Pixels = frame.Pixels;
+        inputFrame.Delay = frame.Delay;
+        inputFrame.DirtyRect = frame.DirtyRect;
+        frameEncoder.EncodeFrame(inputFrame, frameStats);
+    }
+    {
+        ScopedStageTimer timer(stats, EncodeStage::Finish);
+        frameWriter.Finish();
+    }
+    auto steadyStateAllocations = GetAllocationCount() - warmupAllocationCount;
+    stats.SetOutputBytes(gifWriter.BytesWritten());
+    inputFrameProvider->PrintStatistics();
 
-        if (frameIndex > 0)
-        {
-            {
-                PROPVARIANT disposalValue = {};
-                disposalValue.vt = VT_UI1;
-                disposalValue.bVal = 1;
-                winrt::check_hresult(metadata->SetMetadataByName(L"/grctlext/Disposal", &disposalValue));
-            }
+    wprintf(L"Duplicate frames dropped: %u of %u\n", frameEncoder.NumDuplicateFrames(), numFramesRead);
+    if (options.Tolerance.Mode != DiffToleranceMode::Exact)
+    {
+        wprintf(L"Pixels within the diff tolerance: %llu\n", static_cast<unsigned long long>(frameEncoder.NumToleratedPixels()));
+    }
+    auto bytesCopied = static_cast<double>(GetFrameBytesCopied());
+    auto numFrames = std::max(inputFrameProvider->FrameCount(), 1u);
+    wprintf(L"Frame data copied: %.2f MB (%.1f KB per frame)\n", bytesCopied / (1024.0 * 1024.0), bytesCopied / 1024.0 / numFrames);
+    if (IsAllocationCountingEnabled() && numFramesRead >= AllocationWarmupFrames)
+    {
+        auto numSteadyFrames = numFramesRead - AllocationWarmupFrames + 1;
+        wprintf(L"Heap allocations after warm-up: %llu over %u frames (%.1f per frame)\n",
+            static_cast<unsigned long long>(steadyStateAllocations),
+            numSteadyFrames,
+            static_cast<double>(steadyStateAllocations) / numSteadyFrames);
+    }
 
-            // TEMP DEBUG
-            //{
-            //    auto debugFileName = ImageViewerFileNameFromSize("debug", desc.Width, desc.Height);
-            //    WriteBgra8PixelsToFile(debugFileName, bytes);
-            //}
+    if (!options.StatsPath.empty())
+    {
+        auto statsPath = std::filesystem::path(options.StatsPath);
+        std::ofstream statsStream(statsPath, std::ios::out | std::ios::trunc);
+        if (!statsStream)
+        {
+            throw winrt::hresult_error(E_FAIL, L"Failed to open the stats file.");
         }
-
-        if (diffInfoOpt.has_value())
+        auto extension = statsPath.extension().wstring();
+        if (_wcsicmp(extension.c_str(), L".csv") == 0)
         {
-            auto diffInfo = diffInfoOpt.value();
-
-            {
-                PROPVARIANT value = {};
-                value.vt = VT_UI2;
-                value.uiVal = static_cast<unsigned short>(diffInfo.left);
-                winrt::check_hresult(metadata->SetMetadataByName(L"/imgdesc/Left", &value));
-            }
-            {
-                PROPVARIANT value = {};
-                value.vt = VT_UI2;
-                value.uiVal = static_cast<unsigned short>(diffInfo.top);
-                winrt::check_hresult(metadata->SetMetadataByName(L"/imgdesc/Top", &value));
-            }
+            stats.WriteCsv(statsStream);
         }
-
-        // Write out bitmap and commit the frame
-        winrt::check_hresult(wicFrame->WriteSource(wicBitmapFixed.get(), nullptr));
-        winrt::check_hresult(wicFrame->Commit());
-
-        frameIndex++;
+        else
+        {
+            stats.WriteJson(statsStream);
+        }
+        wprintf(L"Stats written to: %ls\n", options.StatsPath.c_str());
     }
-    winrt::check_hresult(wicEncoder->Commit());
 }
 
 int __stdcall wmain(int argc, wchar_t* argv[])
@@ -341,7 +343,17 @@ int __stdcall wmain(int argc, wchar_t* argv[])
         break;
     }
 
-    MainAsync(options.UseDebugLayer, options.InputPath, options.OutputPath).get();
+    if (options.RunBenchmarks)
+    {
+        RunBenchmarks(options.BenchmarkFilter);
+        return 0;
+    }
+    if (options.RunSelfChecks)
+    {
+        return RunSelfChecks(options.BenchmarkFilter, options.SelfCheckSeed) ? 0 : 1;
+    }
+
+    MainAsync(options).get();
 
     return 0;
 }
@@ -355,6 +367,24 @@ CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options)
         PrintHelp();
         return CliResult::Help;
     }
+    if (GetFlag(args, L"-benchmark", L"/benchmark"))
+    {
+        options.RunBenchmarks = true;
+        options.BenchmarkFilter = GetFlagValue(args, L"-filter", L"/filter");
+        return CliResult::Valid;
+    }
+    if (GetFlag(args, L"-selfcheck", L"/selfcheck"))
+    {
+        options.RunSelfChecks = true;
+        options.BenchmarkFilter = GetFlagValue(args, L"-filter", L"/filter");
+        options.SelfCheckSeed = 1;
+        auto seedValue = GetFlagValue(args, L"-seed", L"/seed");
+        if (!seedValue.empty())
+        {
+            options.SelfCheckSeed = static_cast<uint32_t>(std::wcstoul(seedValue.c_str(), nullptr, 10));
+        }
+        return CliResult::Valid;
+    }
     auto inputPath = GetFlagValue(args, L"-i", L"/i");
     if (inputPath.empty())
     {
@@ -368,10 +398,192 @@ CliResult ParseOptions(std::vector<std::wstring> const& args, Options& options)
         return CliResult::Invalid;
     }
     auto useDebugLayer = GetFlag(args, L"-dxDebug", L"/dxDebug");
+    auto diffBackend = DiffBackend::Gpu;
+    auto diffValue = GetFlagValue(args, L"-diff", L"/diff");
+    if (!diffValue.empty())
+    {
+        if (diffValue == L"cpu")
+        {
+            diffBackend = DiffBackend::Cpu;
+        }
+        else if (diffValue != L"gpu")
+        {
+            wprintf(L"Invalid diff backend! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    DiffTolerance tolerance = {};
+    auto toleranceValue = GetFlagValue(args, L"-tolerance", L"/tolerance");
+    if (!toleranceValue.empty())
+    {
+        const DiffToleranceMode modes[] = { DiffToleranceMode::Exact, DiffToleranceMode::Channel, DiffToleranceMode::YCbCr };
+        auto found = false;
+        for (auto&& mode : modes)
+        {
+            if (toleranceValue == DiffToleranceModeToString(mode))
+            {
+                tolerance.Mode = mode;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            wprintf(L"Invalid diff tolerance! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        tolerance.Threshold = DefaultDiffThreshold;
+    }
+    auto thresholdValue = GetFlagValue(args, L"-threshold", L"/threshold");
+    if (!thresholdValue.empty())
+    {
+        auto value = std::wcstol(thresholdValue.c_str(), nullptr, 10);
+        if (value < 0 || value > 255)
+        {
+            wprintf(L"Invalid diff threshold! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        tolerance.Threshold = static_cast<uint32_t>(value);
+    }
+    auto composeBackend = ComposeBackend::Gpu;
+    auto composeValue = GetFlagValue(args, L"-compose", L"/compose");
+    if (!composeValue.empty())
+    {
+        if (composeValue == L"cpu")
+        {
+            composeBackend = ComposeBackend::Cpu;
+        }
+        else if (composeValue == L"incremental")
+        {
+            composeBackend = ComposeBackend::CpuIncremental;
+        }
+        else if (composeValue != L"gpu")
+        {
+            wprintf(L"Invalid compose backend! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    std::optional<QuantizerAlgorithm> quantizer;
+    auto quantizerValue = GetFlagValue(args, L"-quantizer", L"/quantizer");
+    if (!quantizerValue.empty() && quantizerValue != L"wic")
+    {
+        const QuantizerAlgorithm algorithms[] = { QuantizerAlgorithm::Octree, QuantizerAlgorithm::MedianCut, QuantizerAlgorithm::KMeans };
+        for (auto&& algorithm : algorithms)
+        {
+            if (quantizerValue == QuantizerAlgorithmToString(algorithm))
+            {
+                quantizer = algorithm;
+            }
+        }
+        if (!quantizer.has_value())
+        {
+            wprintf(L"Invalid quantizer! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    auto paletteMode = PaletteMode::PerFrame;
+    auto paletteValue = GetFlagValue(args, L"-palette", L"/palette");
+    if (!paletteValue.empty())
+    {
+        if (paletteValue == L"global")
+        {
+            paletteMode = PaletteMode::Global;
+        }
+        else if (paletteValue == L"reuse")
+        {
+            paletteMode = PaletteMode::Reuse;
+        }
+        else if (paletteValue != L"perframe")
+        {
+            wprintf(L"Invalid palette mode! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    auto numThreads = GetDefaultThreadCount();
+    auto threadsValue = GetFlagValue(args, L"-threads", L"/threads");
+    if (!threadsValue.empty())
+    {
+        auto value = std::wcstol(threadsValue.c_str(), nullptr, 10);
+        if (value <= 0)
+        {
+            wprintf(L"Invalid thread count! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        numThreads = static_cast<uint32_t>(value);
+    }
+    auto numBandThreads = numThreads;
+    auto bandsValue = GetFlagValue(args, L"-bands", L"/bands");
+    if (!bandsValue.empty())
+    {
+        auto value = std::wcstol(bandsValue.c_str(), nullptr, 10);
+        if (value <= 0)
+        {
+            wprintf(L"Invalid band thread count! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        numBandThreads = static_cast<uint32_t>(value);
+    }
+    uint32_t maxImagesPerFrame = 1;
+    auto imagesValue = GetFlagValue(args, L"-images", L"/images");
+    if (!imagesValue.empty())
+    {
+        auto value = std::wcstol(imagesValue.c_str(), nullptr, 10);
+        if (value <= 0)
+        {
+            wprintf(L"Invalid image count! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+        maxImagesPerFrame = static_cast<uint32_t>(value);
+    }
+    auto clearMode = LzwClearMode::WhenFull;
+    auto clearValue = GetFlagValue(args, L"-lzwclear", L"/lzwclear");
+    if (!clearValue.empty())
+    {
+        if (clearValue == LzwClearModeToString(LzwClearMode::Adaptive))
+        {
+            clearMode = LzwClearMode::Adaptive;
+        }
+        else if (clearValue != LzwClearModeToString(LzwClearMode::WhenFull))
+        {
+            wprintf(L"Invalid LZW clear mode! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    auto dither = DitherMode::None;
+    auto ditherValue = GetFlagValue(args, L"-dither", L"/dither");
+    if (!ditherValue.empty())
+    {
+        const DitherMode ditherModes[] = { DitherMode::None, DitherMode::Bayer, DitherMode::FloydSteinberg, DitherMode::SierraLite };
+        auto found = false;
+        for (auto&& mode : ditherModes)
+        {
+            if (ditherValue == DitherModeToString(mode))
+            {
+                dither = mode;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            wprintf(L"Invalid dither mode! Use '-help' for help.\n");
+            return CliResult::Invalid;
+        }
+    }
+    auto statsPath = GetFlagValue(args, L"-stats", L"/stats");
 
     options.UseDebugLayer = useDebugLayer;
+    options.Diff = diffBackend;
+    options.Tolerance = tolerance;
+    options.Compose = composeBackend;
+    options.Quantizer = quantizer;
+    options.Palette = paletteMode;
+    options.NumThreads = numThreads;
+    options.NumBandThreads = numBandThreads;
+    options.MaxImagesPerFrame = maxImagesPerFrame;
+    options.ClearMode = clearMode;
+    options.Dither = dither;
     options.InputPath = inputPath;
     options.OutputPath = outputPath;
+    options.StatsPath = statsPath;
     return CliResult::Valid;
 }
 
@@ -383,8 +595,59 @@ void PrintHelp()
     wprintf(L"Arguments:\n");
     wprintf(L"  -i <input path>          (required) Path to input file (*.rani, *gif).\n");
     wprintf(L"  -o <output path>         (required) Path to the output image that will be created.\n");
+    wprintf(L"  -diff <gpu|cpu>          (optional) Where to find the pixels that changed between frames.\n");
+    wprintf(L"                                      Defaults to gpu.\n");
+    wprintf(L"  -tolerance <mode>        (optional) Treat pixels that barely changed as unchanged: exact,\n");
+    wprintf(L"                                      channel (every channel within the threshold) or\n");
+    wprintf(L"                                      ycbcr (the YCbCr distance within it). Pixels are\n");
+    wprintf(L"                                      compared against what was last written, so errors\n");
+    wprintf(L"                                      don't add up. Defaults to exact.\n");
+    wprintf(L"  -threshold <0-255>       (optional) How far a pixel may drift with '-tolerance'.\n");
+    wprintf(L"                                      Defaults to %u.\n", DefaultDiffThreshold);
+    wprintf(L"  -compose <backend>       (optional) Where .rani frames are composed: gpu, cpu or\n");
+    wprintf(L"                                      incremental. The cpu compositor decodes and blends\n");
+    wprintf(L"                                      layers on -threads workers. The incremental\n");
+    wprintf(L"                                      compositor only redraws layers that changed.\n");
+    wprintf(L"                                      Defaults to gpu.\n");
+    wprintf(L"  -quantizer <name>        (optional) How palettes are generated: wic, octree, mediancut\n");
+    wprintf(L"                                      or kmeans. Defaults to wic.\n");
+    wprintf(L"  -palette <mode>          (optional) How palettes are shared between frames: perframe,\n");
+    wprintf(L"                                      global or reuse. Sharing palettes uses mediancut\n");
+    wprintf(L"                                      unless another quantizer is given. Defaults to perframe.\n");
+    wprintf(L"  -threads <count>         (optional) Number of threads used to compress frames.\n");
+    wprintf(L"                                      Defaults to the number of logical processors.\n");
+    wprintf(L"  -bands <count>           (optional) Number of threads that split the palette, convert\n");
+    wprintf(L"                                      and diff work of each frame into row bands. The\n");
+    wprintf(L"                                      output doesn't change. 1 keeps the work on one\n");
+    wprintf(L"                                      thread. Defaults to the -threads count.\n");
+    wprintf(L"  -images <count>          (optional) Write the areas of a frame that changed as up to this\n");
+    wprintf(L"                                      many images, so that changes far apart don't make\n");
+    wprintf(L"                                      one large image. Only the last image of a frame has\n");
+    wprintf(L"                                      a delay; some browsers show each of the others for\n");
+    wprintf(L"                                      100ms. Defaults to 1.\n");
+    wprintf(L"  -lzwclear <mode>         (optional) When the compressor starts over with an empty\n");
+    wprintf(L"                                      dictionary: full (as soon as it is full) or adaptive\n");
+    wprintf(L"                                      (once a full dictionary stops compressing well).\n");
+    wprintf(L"                                      Very old decoders may not read adaptive output.\n");
+    wprintf(L"                                      Defaults to full.\n");
+    wprintf(L"  -dither <mode>           (optional) How colors between palette entries are mixed: none,\n");
+    wprintf(L"                                      bayer (a fixed pattern, so pixels that don't change\n");
+    wprintf(L"                                      keep their index), floyd-steinberg or sierra-lite\n");
+    wprintf(L"                                      (error diffusion, smoother but any change ripples\n");
+    wprintf(L"                                      through the rest of the frame). Dithering uses\n");
+    wprintf(L"                                      mediancut unless another quantizer is given.\n");
+    wprintf(L"                                      Defaults to none.\n");
+    wprintf(L"  -stats <path>            (optional) Write the time spent in each stage of the encode and\n");
+    wprintf(L"                                      per-frame counters to a JSON file, or a CSV file if\n");
+    wprintf(L"                                      the path ends in .csv.\n");
     wprintf(L"\n");
     wprintf(L"Flags:\n");
     wprintf(L"  -dxDebug           (optional) Use the DirectX and DirectML debug layers.\n");
+    wprintf(L"  -benchmark         (optional) Run the built-in benchmarks instead of encoding.\n");
+    wprintf(L"                                Use '-filter <name>' to run a single benchmark.\n");
+    wprintf(L"  -selfcheck         (optional) Check the diff, crop and .rani compositing against\n");
+    wprintf(L"                                brute-force references on random frames instead of\n");
+    wprintf(L"                                encoding. Use '-filter <name>' to run a single check and\n");
+    wprintf(L"                                '-seed <number>' for other frames.\n");
     wprintf(L"\n");
 }
\ No newline at end of file
@@ -47,6 +47,11 @@
 #include <cwctype>
 #include <sstream>
 #include <fstream>
+#include <stdexcept>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <limits>
 
 // robmikh.common
 #include <robmikh.common/composition.interop.h>